@@ -0,0 +1,81 @@
+# Compares the throughput of two chip-headless builds over every ROM and
+# engine, normally the plain -O3 build against the PGO+LTO one.
+#
+#   cmake -DBASELINE=<chip-headless> -DOPTIMIZED=<chip-headless> -DROM_DIRECTORY=<roms>
+#         [-DCYCLES=N] -P PgoReport.cmake
+
+if(NOT CYCLES)
+	set(CYCLES 20000000)
+endif()
+
+file(GLOB roms ${ROM_DIRECTORY}/*.ch8)
+
+# Sets <out> to the ops/s chip-headless reports
+function(measure_throughput headless rom engine out)
+	execute_process(
+		COMMAND ${headless} ${rom} --cycles ${CYCLES} --engine ${engine}
+		OUTPUT_VARIABLE output
+		RESULT_VARIABLE result
+	)
+	if(NOT result EQUAL 0 OR NOT output MATCHES "throughput: ([0-9]+) ops/s")
+		message(FATAL_ERROR "${headless} failed on ${rom} (${engine})")
+	endif()
+	set(${out} ${CMAKE_MATCH_1} PARENT_SCOPE)
+endfunction()
+
+# Left-aligns value in a column width characters wide
+function(pad value width out)
+	string(LENGTH "${value}" length)
+	set(padded "${value}")
+	if(length LESS width)
+		math(EXPR spaces "${width} - ${length}")
+		string(REPEAT " " ${spaces} padding)
+		string(APPEND padded "${padding}")
+	endif()
+	set(${out} "${padded}" PARENT_SCOPE)
+endfunction()
+
+# Sets <out> to the change from baseline to optimized in percent, one decimal
+function(format_change baseline optimized out)
+	math(EXPR permille "(${optimized} - ${baseline}) * 1000 / ${baseline}")
+	set(sign "+")
+	if(permille LESS 0)
+		set(sign "-")
+		math(EXPR permille "-${permille}")
+	endif()
+	math(EXPR whole "${permille} / 10")
+	math(EXPR tenths "${permille} % 10")
+	set(${out} "${sign}${whole}.${tenths}%" PARENT_SCOPE)
+endfunction()
+
+pad("rom" 22 rom_column)
+pad("engine" 12 engine_column)
+pad("-O3 ops/s" 12 baseline_column)
+pad("PGO+LTO ops/s" 14 optimized_column)
+message(STATUS "${rom_column} ${engine_column} ${baseline_column} ${optimized_column} change")
+
+foreach(engine interpreter threaded jit)
+	set(baseline_total 0)
+	set(optimized_total 0)
+
+	foreach(rom ${roms})
+		get_filename_component(rom_name ${rom} NAME)
+		measure_throughput(${BASELINE} ${rom} ${engine} baseline)
+		measure_throughput(${OPTIMIZED} ${rom} ${engine} optimized)
+
+		math(EXPR baseline_total "${baseline_total} + ${baseline} / 1000")
+		math(EXPR optimized_total "${optimized_total} + ${optimized} / 1000")
+		format_change(${baseline} ${optimized} change)
+
+		pad(${rom_name} 22 rom_column)
+		pad(${engine} 12 engine_column)
+		pad(${baseline} 12 baseline_column)
+		pad(${optimized} 14 optimized_column)
+		message(STATUS "${rom_column} ${engine_column} ${baseline_column} ${optimized_column} "
+			"${change}")
+	endforeach()
+
+	format_change(${baseline_total} ${optimized_total} change)
+	message(STATUS "all ROMs ${engine}: ${change} (${baseline_total} -> ${optimized_total} "
+		"kops/s summed)")
+endforeach()
@@ -0,0 +1,53 @@
+# Training run for the PGO build, runs the instrumented chip-headless over
+# every ROM with each engine and in lockstep so the profile covers all the
+# dispatch loops.
+#
+#   cmake -DHEADLESS=<chip-headless> -DROM_DIRECTORY=<roms> -DPROFILE_DIRECTORY=<dir>
+#         [-DLLVM_PROFDATA=<llvm-profdata>] [-DCYCLES=N] -P PgoTrain.cmake
+
+if(NOT CYCLES)
+	set(CYCLES 5000000)
+endif()
+
+file(GLOB roms ${ROM_DIRECTORY}/*.ch8)
+if(NOT roms)
+	message(FATAL_ERROR "No ROMs in ${ROM_DIRECTORY}")
+endif()
+
+foreach(rom ${roms})
+	get_filename_component(rom_name ${rom} NAME)
+
+	foreach(engine interpreter threaded jit)
+		message(STATUS "Training on ${rom_name} (${engine})")
+		execute_process(
+			COMMAND ${HEADLESS} ${rom} --cycles ${CYCLES} --engine ${engine}
+			OUTPUT_QUIET
+			RESULT_VARIABLE result
+		)
+		if(NOT result EQUAL 0)
+			message(FATAL_ERROR "chip-headless failed on ${rom_name} (${engine})")
+		endif()
+	endforeach()
+
+	message(STATUS "Training on ${rom_name} (lockstep)")
+	execute_process(
+		COMMAND ${HEADLESS} ${rom} --cycles ${CYCLES} --lanes 64
+		OUTPUT_QUIET
+		RESULT_VARIABLE result
+	)
+	if(NOT result EQUAL 0)
+		message(FATAL_ERROR "chip-headless failed on ${rom_name} (lockstep)")
+	endif()
+endforeach()
+
+# Clang writes raw profiles that have to be merged first
+if(LLVM_PROFDATA)
+	file(GLOB raw_profiles ${PROFILE_DIRECTORY}/*.profraw)
+	execute_process(
+		COMMAND ${LLVM_PROFDATA} merge -output=${PROFILE_DIRECTORY}/default.profdata ${raw_profiles}
+		RESULT_VARIABLE result
+	)
+	if(NOT result EQUAL 0)
+		message(FATAL_ERROR "llvm-profdata could not merge the profiles")
+	endif()
+endif()
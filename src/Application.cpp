@@ -11,20 +11,60 @@
 #include <glm/ext/matrix_clip_space.hpp>
 #include <glm/ext/matrix_float4x4.hpp>
 #include <memory>
+#include <random>
 
 #include "Audio.h"
+#include "Keycodes.h"
 #include "Logging.h"
+#include "RomCatalog.h"
 
 namespace Chip8 {
 
 const glm::mat4 PROJECTION = glm::ortho(-1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f);
 
+static void OpenGLDebugMessageCallback(GLenum source, GLenum type, GLuint id, GLenum severity,
+                                       GLsizei length, const GLchar* message,
+                                       const void* userParam) {
+  // annoying
+  if (id == 131185) {
+    return;
+  }
+
+  switch (severity) {
+    case GL_DEBUG_SEVERITY_HIGH: {
+      LOG_ERROR("[OPENGL] {}", message);
+      break;
+    }
+    case GL_DEBUG_SEVERITY_MEDIUM: {
+      LOG_WARN("[OPENGL] {}", message);
+      break;
+    }
+    case GL_DEBUG_SEVERITY_LOW: {
+      LOG_WARN("[OPENGL] {}", message);
+      break;
+    }
+    case GL_DEBUG_SEVERITY_NOTIFICATION: {
+      LOG_TRACE("[OPENGL] {}", message);
+      break;
+    }
+    default: {
+      LOG_INFO("[OPENGL] {}", message);
+      break;
+    }
+  }
+}
+
 Application::Application(const char* rom_location)
     : m_RomLocation(rom_location), m_Interpreter(rom_location) {}
 
 Application::~Application() {}
 
 bool Application::Initialize() {
+  if (!m_Interpreter.HasRom()) {
+    LOG_ERROR("Could not load {}", m_RomLocation);
+    return false;
+  }
+
   // Init SDL
   if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO)) {
     LOG_ERROR("Failed to initialize SDL: {}", SDL_GetError());
@@ -67,7 +107,8 @@ bool Application::Initialize() {
   LOG_INFO("OpenGL context initialized successfully.");
 
   SDL_GL_MakeCurrent(m_Window, m_GLContext);
-  SDL_GL_SetSwapInterval(0);
+  // Emulation runs on its own thread, so the UI can simply follow vsync
+  SDL_GL_SetSwapInterval(1);
 
   // Init OpenGL loader (GLAD)
   if (!gladLoadGLLoader((GLADloadproc)SDL_GL_GetProcAddress)) {
@@ -82,7 +123,7 @@ bool Application::Initialize() {
   LOG_TRACE("GL_RENDERER: {}", (char*)glGetString(GL_RENDERER));
 
   glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
-  glDebugMessageCallback(Logger::OpenGLDebugMessageCallback, nullptr);
+  glDebugMessageCallback(OpenGLDebugMessageCallback, nullptr);
 
   // Init Audio
   m_AudioHandler = std::make_shared<AudioHandler>();
@@ -113,12 +154,22 @@ bool Application::Initialize() {
 
   // Init everything else
   m_Display = std::make_shared<Display>();
-  m_Interpreter.SetDisplayPointer(m_Display);
-  m_Interpreter.SetAudioPointer(m_AudioHandler);
 
-  m_Display->UpdateDisplayData();
+  m_Interpreter.SetSoundSink(m_AudioHandler);
 
-  m_TicksCount = SDL_GetTicks();
+  // A fresh seed per session, movies store the one they were recorded with
+  m_Interpreter.SetRandomSeed(std::random_device{}());
+
+  m_Display->UpdateDisplayData(m_Interpreter.GetFrameBuffer());
+
+  this->ApplyCatalogMetadata();
+
+  // From here on the interpreter belongs to the emulation thread
+  m_EmulationThread = std::make_unique<EmulationThread>(m_Interpreter, m_RomLocation);
+  m_EmulationThread->SetSchedulerMode(m_SchedulerMode);
+  m_EmulationThread->SetOpsPerSecond(m_OpsPerSecond);
+  m_EmulationThread->SetInstructionsPerFrame(m_InstructionsPerFrame);
+  m_EmulationThread->Start();
 
   return true;
 }
@@ -132,6 +183,16 @@ void Application::Run() {
 }
 
 void Application::Shutdown() {
+  if (m_EmulationThread) {
+    m_EmulationThread->Stop();
+  }
+
+  // Initialize failed before there was anything to tear down
+  if (m_Window == nullptr) {
+    SDL_Quit();
+    return;
+  }
+
   ImGui_ImplOpenGL3_Shutdown();
   ImGui_ImplSDL3_Shutdown();
   ImGui::DestroyContext();
@@ -155,26 +216,72 @@ void Application::ProcessInput() {
         LOG_INFO("Shutdown...");
         break;
       }
+      case SDL_EVENT_KEY_DOWN:
+      case SDL_EVENT_KEY_UP: {
+        // F5 saves and F9 loads the state in <rom>.c8state
+        if (event.type == SDL_EVENT_KEY_DOWN && !event.key.repeat &&
+            (event.key.scancode == SDL_SCANCODE_F5 || event.key.scancode == SDL_SCANCODE_F9)) {
+          const auto type = event.key.scancode == SDL_SCANCODE_F5 ? EmulatorCommandType::SaveState
+                                                                  : EmulatorCommandType::LoadState;
+          m_EmulationThread->PushCommand({type});
+          break;
+        }
+
+        const int key = KeyToHex(event.key.scancode, m_KeyMap);
+        if (key < 0 || event.key.repeat) {
+          break;
+        }
+
+        const auto type = event.type == SDL_EVENT_KEY_DOWN ? EmulatorCommandType::KeyDown
+                                                           : EmulatorCommandType::KeyUp;
+        if (!m_EmulationThread->PushCommand({type, key})) {
+          LOG_WARN("Emulator command queue is full, dropped key {:X}", key);
+        }
+        break;
+      }
     }
   }
 }
 
-void Application::UpdateState() {
-  const int time_cap = 1000 / m_OpsPerSecond;
+void Application::ApplyCatalogMetadata() {
+  const auto directory = std::filesystem::path(m_RomLocation).parent_path();
 
-  if (m_TicksElapsed > time_cap) {
-    if (((m_StepThrough && m_AdvanceNextStep) || !m_StepThrough)) {
-      m_Interpreter.Run();
-      m_AdvanceNextStep = false;
-    }
+  RomCatalog catalog;
+  if (!catalog.Open(directory.empty() ? "." : directory.string().c_str())) {
+    return;
+  }
+
+  const RomMetadata* metadata = catalog.FindMetadata(m_Interpreter.GetRomHash());
+  if (metadata == nullptr) {
+    return;
+  }
 
-    m_TicksElapsed = 0;
+  if (metadata->quirk_profile) {
+    m_QuirkProfile = *metadata->quirk_profile;
+    m_Interpreter.SetQuirkProfile(m_QuirkProfile);
+  }
 
-  } else {
-    m_TicksElapsed += SDL_GetTicks() - m_TicksCount;
+  if (metadata->ops_per_frame > 0) {
+    m_SchedulerMode = SchedulerMode::InstructionsPerFrame;
+    m_InstructionsPerFrame = metadata->ops_per_frame;
   }
 
-  m_TicksCount = SDL_GetTicks();
+  m_KeyMap = metadata->key_map;
+
+  LOG_INFO("Using the catalog settings for {}: {} quirks, {} op/frame", m_RomLocation,
+           GetQuirkProfileName(m_QuirkProfile), metadata->ops_per_frame);
+}
+
+void Application::UpdateState() {
+  // Hold backspace to rewind, unless a text field has the keyboard
+  const bool* keyboard = SDL_GetKeyboardState(nullptr);
+  m_EmulationThread->SetRewinding(keyboard[SDL_SCANCODE_BACKSPACE] &&
+                                  !ImGui::GetIO().WantCaptureKeyboard);
+
+  // The emulation thread runs on its own, just pick up its latest frame
+  if (m_EmulationThread->AcquireFrame()) {
+    m_Display->UpdateDisplayData(m_EmulationThread->GetFrame());
+  }
 }
 
 void Application::RenderState() {
@@ -199,17 +306,120 @@ void Application::RenderDebugUI() {
   ImGui::Begin("Settings");
 
   if (ImGui::Button("Restart")) {
-    m_Interpreter.Restart(m_RomLocation);
+    m_EmulationThread->PushCommand({EmulatorCommandType::Restart});
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Save state")) {
+    m_EmulationThread->PushCommand({EmulatorCommandType::SaveState});
+  }
+  ImGui::SetItemTooltip("F5, writes <rom>.c8state");
+  ImGui::SameLine();
+  if (ImGui::Button("Load state")) {
+    m_EmulationThread->PushCommand({EmulatorCommandType::LoadState});
+  }
+  ImGui::SetItemTooltip("F9");
+
+  const char* scheduler_modes[] = {"Ops per second", "Instructions per frame", "Turbo"};
+  int scheduler_mode = (int)m_SchedulerMode;
+  if (ImGui::Combo("Speed mode", &scheduler_mode, scheduler_modes, IM_ARRAYSIZE(scheduler_modes))) {
+    m_SchedulerMode = (SchedulerMode)scheduler_mode;
+    m_EmulationThread->SetSchedulerMode(m_SchedulerMode);
+  }
+
+  if (m_SchedulerMode == SchedulerMode::OpsPerSecond) {
+    if (ImGui::SliderInt("Speed (op/s)", &m_OpsPerSecond, 1, 1000000, "%d",
+                         ImGuiSliderFlags_Logarithmic)) {
+      m_EmulationThread->SetOpsPerSecond(m_OpsPerSecond);
+    }
+  } else if (m_SchedulerMode == SchedulerMode::InstructionsPerFrame) {
+    if (ImGui::SliderInt("Speed (op/frame)", &m_InstructionsPerFrame, 1, 10000, "%d",
+                         ImGuiSliderFlags_Logarithmic)) {
+      m_EmulationThread->SetInstructionsPerFrame(m_InstructionsPerFrame);
+    }
+  }
+
+  ImGui::Text("Running at %llu op/s",
+              (unsigned long long)m_EmulationThread->GetMeasuredOpsPerSecond());
+
+  // Resizing drops the history, so only apply it once the slider is let go
+  ImGui::SliderInt("Rewind history (s)", &m_RewindSeconds, 0, 600);
+  if (ImGui::IsItemDeactivatedAfterEdit()) {
+    m_EmulationThread->PushCommand({EmulatorCommandType::SetRewindLength, m_RewindSeconds});
+  }
+  ImGui::SetItemTooltip("Hold Backspace to rewind, except during a movie. %.1f s stored in %.1f KB",
+                        m_EmulationThread->GetRewindSeconds(),
+                        m_EmulationThread->GetRewindBytes() / 1024.0);
+
+  if (ImGui::Checkbox("Present at emulated 60 Hz", &m_PresentAt60Hz)) {
+    const auto present_mode = m_PresentAt60Hz ? PresentMode::EmulatedFrame : PresentMode::HostFrame;
+    m_EmulationThread->PushCommand({EmulatorCommandType::SetPresentMode, (int)present_mode});
+  }
+
+  if (ImGui::Checkbox("Display wait quirk", &m_DisplayWaitQuirk)) {
+    m_EmulationThread->PushCommand({EmulatorCommandType::SetDisplayWaitQuirk, m_DisplayWaitQuirk});
   }
 
-  ImGui::SliderInt("Speed (op/s)", &m_OpsPerSecond, 1, 1000);
+  if (ImGui::BeginCombo("Quirks", GetQuirkProfileName(m_QuirkProfile))) {
+    for (int index = 0; index < (int)QuirkProfile::Count; ++index) {
+      const auto profile = static_cast<QuirkProfile>(index);
 
-  if (ImGui::CollapsingHeader("Debug")) {
-    ImGui::Checkbox("Step through", &m_StepThrough);
+      if (ImGui::Selectable(GetQuirkProfileName(profile), profile == m_QuirkProfile)) {
+        m_QuirkProfile = profile;
+        m_EmulationThread->PushCommand({EmulatorCommandType::SetQuirkProfile, index});
+      }
+    }
+    ImGui::EndCombo();
+  }
+  ImGui::SetItemTooltip("default keeps this emulator's original behaviour");
+
+  const bool debug_open = ImGui::CollapsingHeader("Debug");
+  m_EmulationThread->SetSnapshotsEnabled(debug_open);
+
+  if (debug_open) {
+    if (ImGui::Checkbox("Step through", &m_StepThrough)) {
+      m_EmulationThread->SetStepThrough(m_StepThrough);
+    }
     if (ImGui::Button("Next step")) {
-      m_AdvanceNextStep = true;
+      m_EmulationThread->PushCommand({EmulatorCommandType::Step});
+    }
+
+    if (ImGui::Checkbox("Record trace", &m_RecordTrace)) {
+      m_EmulationThread->PushCommand({EmulatorCommandType::SetTraceEnabled, m_RecordTrace});
     }
-    m_Interpreter.DisplayDebugMenu();
+    ImGui::SetItemTooltip("Writes every executed instruction to <rom>.c8trace, see chip-trace");
+
+    if (ImGui::Checkbox("Record movie", &m_RecordMovie)) {
+      const auto type = m_RecordMovie ? EmulatorCommandType::RecordMovie
+                                      : EmulatorCommandType::StopMovie;
+      m_EmulationThread->PushCommand({type});
+    }
+    ImGui::SetItemTooltip("Restarts the ROM and records the input to <rom>.c8movie");
+    ImGui::SameLine();
+    if (ImGui::Button("Play movie")) {
+      m_RecordMovie = false;
+      m_EmulationThread->PushCommand({EmulatorCommandType::PlayMovie});
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Stop")) {
+      m_RecordMovie = false;
+      m_EmulationThread->PushCommand({EmulatorCommandType::StopMovie});
+    }
+
+#if CHIP8_PROFILER_ENABLED
+    if (ImGui::Button("Reset profile")) {
+      m_EmulationThread->PushCommand({EmulatorCommandType::ResetProfile});
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Export profile")) {
+      m_EmulationThread->PushCommand({EmulatorCommandType::ExportProfile});
+    }
+    ImGui::SetItemTooltip("Writes the profile counters to <rom>.profile.csv");
+#endif
+
+    m_EmulationThread->AcquireSnapshot();
+    m_EmulationThread->AcquireProfile();
+    Interpreter::DisplayDebugMenu(m_EmulationThread->GetSnapshot(),
+                                  m_EmulationThread->GetProfile());
   }
   ImGui::End();
 }
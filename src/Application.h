@@ -7,7 +7,9 @@
 
 #include "Audio.h"
 #include "Display.h"
+#include "EmulationThread.h"
 #include "Interpreter.h"
+#include "Platform.h"
 #include "Shader.h"
 
 namespace Chip8 {
@@ -31,6 +33,10 @@ private:
 
   void RenderDebugUI();
 
+  // Quirks, speed and keys chip-catalog stored for the ROM, if its
+  // directory has a catalog
+  void ApplyCatalogMetadata();
+
 private:
   SDL_Window* m_Window = nullptr;
   SDL_GLContext m_GLContext;
@@ -38,19 +44,25 @@ private:
   Interpreter m_Interpreter;
   std::shared_ptr<Display> m_Display;
   std::shared_ptr<AudioHandler> m_AudioHandler;
+  std::unique_ptr<EmulationThread> m_EmulationThread;
 
   std::unique_ptr<Shader> m_Shader;
 
   const char* m_RomLocation;
 
   bool m_StepThrough = false;
-  bool m_AdvanceNextStep = false;
+  bool m_PresentAt60Hz = false;
+  bool m_DisplayWaitQuirk = false;
+  QuirkProfile m_QuirkProfile = QuirkProfile::Default;
+  KeyMap m_KeyMap{};
+  bool m_RecordTrace = false;
+  bool m_RecordMovie = false;
 
   bool m_IsRunning = true;
 
-  unsigned int m_TicksCount = 0;
-  unsigned int m_TicksElapsed = 0;
-
+  SchedulerMode m_SchedulerMode = SchedulerMode::OpsPerSecond;
   int m_OpsPerSecond = 700;
+  int m_InstructionsPerFrame = 12;
+  int m_RewindSeconds = DEFAULT_REWIND_SECONDS;
 };
 }  // namespace Chip8
@@ -2,6 +2,8 @@
 
 #include "Logging.h"
 
+#define CHIP8_LOG_SUBSYSTEM AUDIO
+
 namespace Chip8 {
 
 static int s_CurrentSample = 0;
@@ -2,12 +2,14 @@
 
 #include <SDL3/SDL.h>
 
+#include "Platform.h"
+
 namespace Chip8 {
 
 constexpr int FREQUENCY = 440;
 constexpr int SAMPLE_RATE = 44100;
 
-class AudioHandler {
+class AudioHandler : public SoundSink {
 public:
   AudioHandler();
 
@@ -24,6 +26,11 @@ public:
 
   bool IsStreamPaused() const { return m_IsStreamPaused; }
 
+  void SetToneEnabled(bool enabled) override {
+    if (enabled && m_IsStreamPaused) this->UnpauseStream();
+    if (!enabled && !m_IsStreamPaused) this->PauseStream();
+  }
+
   static void AudioCallback(void* user_data, SDL_AudioStream* audio_stream, int additional_amount,
                             int total_amount);
 
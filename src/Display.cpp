@@ -1,126 +1,80 @@
 #include "Display.h"
 
-#include <fmt/base.h>
 #include <glad/glad.h>
 
 #include <cstdint>
-#include <vector>
 
 #include "Logging.h"
 
+#define CHIP8_LOG_SUBSYSTEM RENDER
+
 namespace Chip8 {
 
-constexpr auto PIXEL_WIDTH = 2.0 / DISPLAY_WIDTH;
-constexpr auto PIXEL_HEIGHT = 2.0 / DISPLAY_HEIGHT;
+// x, y, u, v for a quad covering the whole viewport, texture row 0 at the top
+constexpr float QUAD_VERTICES[] = {
+    -1.0f, -1.0f, 0.0f, 1.0f,  // bottom left
+    -1.0f, 1.0f,  0.0f, 0.0f,  // top left
+    1.0f,  -1.0f, 1.0f, 1.0f,  // bottom right
+    1.0f,  1.0f,  1.0f, 0.0f,  // top right
+};
+constexpr unsigned int QUAD_ELEMENTS[] = {0, 1, 2, 3, 2, 1};
 
 Display::Display() {
-  for (int x = 0; x < DISPLAY_WIDTH; ++x) {
-    for (int y = 0; y < DISPLAY_HEIGHT; ++y) {
-      m_PixelData[x][y] = false;
-    }
-  }
-
   glGenVertexArrays(1, &m_VAO);
   glBindVertexArray(m_VAO);
 
   glGenBuffers(1, &m_VBO);
   glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(QUAD_VERTICES), QUAD_VERTICES, GL_STATIC_DRAW);
+
   glGenBuffers(1, &m_EBO);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
-  glVertexAttribPointer(0, 2, GL_DOUBLE, GL_FALSE, 2 * sizeof(double), (void*)0);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(QUAD_ELEMENTS), QUAD_ELEMENTS, GL_STATIC_DRAW);
+
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
   glEnableVertexAttribArray(0);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
+  glEnableVertexAttribArray(1);
+
+  glGenTextures(1, &m_Texture);
+  glBindTexture(GL_TEXTURE_2D, m_Texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, m_DisplayData.GetWidth(), m_DisplayData.GetHeight(), 0,
+               GL_RED, GL_UNSIGNED_BYTE, m_DisplayData.GetPixels());
 }
 
-void Display::UpdateDisplayData() {
-  std::vector<Vector2<double>> positions;
-  std::vector<unsigned int> elements;
-
-  uint16_t cnt = 0;
-  for (int x = 0; x < DISPLAY_WIDTH; ++x) {
-    for (int y = 0; y < DISPLAY_HEIGHT; ++y) {
-      if (m_PixelData[x][y]) {
-        Vector2<double> bottom_left{-1.0 + x * PIXEL_WIDTH, 1.0 - (y + 1) * PIXEL_HEIGHT};
-        Vector2<double> top_left{-1.0 + x * PIXEL_WIDTH, 1.0 - y * PIXEL_HEIGHT};
-        Vector2<double> bottom_right{-1.0 + (x + 1) * PIXEL_WIDTH, 1.0 - (y + 1) * PIXEL_HEIGHT};
-        Vector2<double> top_right{-1.0 + (x + 1) * PIXEL_WIDTH, 1.0 - y * PIXEL_HEIGHT};
-
-        positions.push_back(bottom_left);
-        positions.push_back(top_left);
-        positions.push_back(bottom_right);
-        positions.push_back(top_right);
-
-        elements.push_back(0 + 4 * cnt);
-        elements.push_back(1 + 4 * cnt);
-        elements.push_back(2 + 4 * cnt);
-        elements.push_back(3 + 4 * cnt);
-        elements.push_back(2 + 4 * cnt);
-        elements.push_back(1 + 4 * cnt);
-
-        cnt += 1;
-      }
-    }
-  }
-
-  LOG_INFO("Updating display...");
-
-  m_Size = elements.size();
-
-  glBufferData(GL_ARRAY_BUFFER, sizeof(*positions.data()) * positions.size(), positions.data(),
-               GL_STATIC_DRAW);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(*elements.data()) * elements.size(), elements.data(),
-               GL_STATIC_DRAW);
+void Display::UpdateDisplayData(const FrameBuffer& frame_buffer) {
+  glBindTexture(GL_TEXTURE_2D, m_Texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  // The texture is reallocated when the resolution changes, then each run of
+  // consecutive changed rows is uploaded with one call
+  const PixelPos width = frame_buffer.GetWidth();
+  m_DisplayData.Update(
+      frame_buffer,
+      [](PixelPos width, PixelPos height) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE,
+                     nullptr);
+      },
+      [width](PixelPos first_row, PixelPos row_count, const Byte* pixels) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first_row, width, row_count, GL_RED,
+                        GL_UNSIGNED_BYTE, pixels);
+      });
+
+  LOG_TRACE("Updating display...");
 }
 
 void Display::RenderDisplay() const {
-  glBindVertexArray(m_VAO);
-  glDrawElements(GL_TRIANGLES, m_Size, GL_UNSIGNED_INT, 0);
-}
-
-void Display::ClearDisplay() {
-  for (auto x = 0; x < DISPLAY_WIDTH; ++x) {
-    for (auto y = 0; y < DISPLAY_HEIGHT; ++y) {
-      m_PixelData[x][y] = false;
-    }
-  }
-
-  this->UpdateDisplayData();
-}
-
-bool Display::LoadSprite(const PixelPos x, const PixelPos y, std::vector<Byte>& sprite) {
-  bool flag = false;
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_Texture);
 
-  const Vector2<PixelPos> starting_pos{x % DISPLAY_WIDTH, y % DISPLAY_HEIGHT};
-  const Vector2<PixelPos> end_pos{
-      (starting_pos.x + 8) >= DISPLAY_WIDTH ? DISPLAY_WIDTH : starting_pos.x + 8,
-      static_cast<PixelPos>((starting_pos.y + sprite.size()) >= DISPLAY_HEIGHT
-                                ? DISPLAY_HEIGHT
-                                : starting_pos.y + sprite.size())};
-
-  for (auto x = starting_pos.x; x < end_pos.x; ++x) {
-    for (auto y = starting_pos.y; y < end_pos.y; ++y) {
-      PixelState value = GetNthBit(sprite[y - starting_pos.y], x - starting_pos.x);
-
-      if (value) {
-        m_PixelData[x][y] = !m_PixelData[x][y];
-
-        if (!m_PixelData[x][y]) {
-          flag = true;
-        }
-      }
-    }
-  }
-
-  return flag;
-}
-
-bool Display::GetNthBit(Byte byte, int n) const {
-  Byte mask = 128 >> n;
-
-  if (byte & mask) {
-    return true;
-  }
-
-  return false;
+  glBindVertexArray(m_VAO);
+  glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 }
 
 }  // namespace Chip8
@@ -1,43 +1,33 @@
 #pragma once
 
-#include <array>
-#include <cstdint>
-#include <vector>
+#include "DisplayData.h"
+#include "FrameBuffer.h"
+#include "Platform.h"
 
 namespace Chip8 {
 
-using PixelState = bool;
-using PixelPos = unsigned int;
-using Byte = uint8_t;
 using Buffer = unsigned int;
+using Texture = unsigned int;
 
-constexpr unsigned int DISPLAY_WIDTH = 64;
-constexpr unsigned int DISPLAY_HEIGHT = 32;
-
-template <typename T>
-struct Vector2 {
-  T x, y;
-};
-
-class Display {
+// Draws the framebuffer as a single-channel texture of colour indices, 64x32
+// or 128x64, on one full-screen quad. The fragment shader maps the indices to
+// colours. Only rows that changed since the last upload are sent to the GPU.
+class Display : public FrameSink {
 public:
   Display();
 
-  void UpdateDisplayData();
-  void RenderDisplay() const;
-
-  void ClearDisplay();
+  void PresentFrame(const FrameBuffer& frame_buffer) override {
+    this->UpdateDisplayData(frame_buffer);
+  }
 
-  bool LoadSprite(const PixelPos x, const PixelPos y, std::vector<Byte>& sprite);
-
-private:
-  inline bool GetNthBit(Byte byte, int n) const;
+  void UpdateDisplayData(const FrameBuffer& frame_buffer);
+  void RenderDisplay() const;
 
 private:
-  std::array<std::array<PixelState, DISPLAY_HEIGHT>, DISPLAY_WIDTH> m_PixelData;
-
   Buffer m_VBO, m_VAO, m_EBO;
-  unsigned int m_Size;
+  Texture m_Texture;
+
+  DisplayData m_DisplayData;
 };
 
 }  // namespace Chip8
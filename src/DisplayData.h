@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+
+#include "FrameBuffer.h"
+
+namespace Chip8 {
+
+// The CPU half of the display upload, one byte per pixel for a single-channel
+// texture, holding the pixel's colour index (bit p set in plane p). Only rows
+// that changed since the last update are rebuilt, and runs of consecutive
+// changed rows are handed out together.
+class DisplayData {
+public:
+  // Calls resize(width, height) first when the resolution changed, every row
+  // is handed out again after that. Then calls upload(first_row, row_count,
+  // pixels) for every run of changed rows, pixels points at the first of
+  // them and rows are GetWidth() bytes apart.
+  template <typename Resize, typename Upload>
+  void Update(const FrameBuffer &frame_buffer, Resize &&resize, Upload &&upload) {
+    const bool resized =
+        frame_buffer.GetWidth() != m_Width || frame_buffer.GetHeight() != m_Height;
+
+    if (resized) {
+      m_Width = frame_buffer.GetWidth();
+      m_Height = frame_buffer.GetHeight();
+      resize(m_Width, m_Height);
+    }
+
+    // Nonzero for every row that differs from the texture
+    std::array<PixelWord, HIRES_HEIGHT> changed_rows;
+    if (resized) {
+      changed_rows.fill(1);
+    } else if (frame_buffer.IsHighResolution()) {
+      this->FindChangedRows<MAX_WORDS_PER_ROW>(frame_buffer, changed_rows);
+    } else {
+      this->FindChangedRows<1>(frame_buffer, changed_rows);
+    }
+
+    PixelPos y = 0;
+    while (y < m_Height) {
+      if (changed_rows[y] == 0) {
+        ++y;
+        continue;
+      }
+
+      const PixelPos first_row = y;
+      for (; y < m_Height && changed_rows[y] != 0; ++y) {
+        this->BuildRow(frame_buffer, y);
+      }
+
+      upload(first_row, y - first_row, &m_Pixels[first_row * m_Width]);
+    }
+
+    m_UploadedPlanes = frame_buffer.GetDrawnPlanes();
+  }
+
+  const Byte *GetPixels() const { return m_Pixels.data(); }
+
+  PixelPos GetWidth() const { return m_Width; }
+  PixelPos GetHeight() const { return m_Height; }
+
+private:
+  // Planes nothing was drawn into match the texture unless they were just
+  // cleared, so only the others are compared. The words are XORed as one flat
+  // run per plane, which the compiler vectorizes.
+  template <unsigned int WordsPerRow>
+  void FindChangedRows(const FrameBuffer &frame_buffer,
+                       std::array<PixelWord, HIRES_HEIGHT> &changed_rows) const {
+    const Byte planes = frame_buffer.GetDrawnPlanes() | m_UploadedPlanes | 1;
+    const size_t words = m_Height * WordsPerRow;
+
+    std::fill_n(changed_rows.data(), m_Height, 0);
+
+    for (unsigned int rest = planes; rest != 0; rest &= rest - 1) {
+      const unsigned int plane = std::countr_zero(rest);
+      const PixelWord *pixels = frame_buffer.GetRow(plane, 0);
+      const PixelWord *uploaded = m_UploadedRows[plane].data();
+
+      for (size_t word = 0; word < words; ++word) {
+        changed_rows[word / WordsPerRow] |= pixels[word] ^ uploaded[word];
+      }
+    }
+  }
+
+  // Plane 0 sets every pixel, the others only add their bit where they have
+  // anything drawn, which they usually don't
+  void BuildRow(const FrameBuffer &frame_buffer, PixelPos y) {
+    const unsigned int words = frame_buffer.GetWordsPerRow();
+    Byte *pixels = &m_Pixels[y * m_Width];
+
+    for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane) {
+      const PixelWord *row = frame_buffer.GetRow(plane, y);
+
+      for (unsigned int word = 0; word < words; ++word) {
+        const PixelWord value = row[word];
+        Byte *word_pixels = &pixels[word * PIXEL_WORD_BITS];
+        m_UploadedRows[plane][y * words + word] = value;
+
+        if (plane == 0) {
+          for (unsigned int x = 0; x < PIXEL_WORD_BITS; ++x) {
+            word_pixels[x] = (value >> (PIXEL_WORD_BITS - 1 - x)) & 1;
+          }
+        } else if (value != 0) {
+          for (unsigned int x = 0; x < PIXEL_WORD_BITS; ++x) {
+            word_pixels[x] |= ((value >> (PIXEL_WORD_BITS - 1 - x)) & 1) << plane;
+          }
+        }
+      }
+    }
+  }
+
+private:
+  PixelPos m_Width = LORES_WIDTH, m_Height = LORES_HEIGHT;
+
+  // What the texture currently holds, stored like the frame buffer's planes
+  // to find the rows that changed, and the planes that were drawn into then
+  std::array<std::array<PixelWord, HIRES_HEIGHT * MAX_WORDS_PER_ROW>, PLANE_COUNT>
+      m_UploadedRows{};
+  Byte m_UploadedPlanes = 0;
+  std::array<Byte, HIRES_WIDTH * HIRES_HEIGHT> m_Pixels{};
+};
+
+}  // namespace Chip8
@@ -0,0 +1,351 @@
+#include "EmulationThread.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+
+#include "Logging.h"
+#include "SaveState.h"
+#include "TraceRecorder.h"
+
+#define CHIP8_LOG_SUBSYSTEM CORE
+
+namespace Chip8 {
+
+EmulationThread::EmulationThread(Interpreter &interpreter, const char *rom_location)
+    : m_Interpreter(interpreter),
+      m_RomLocation(rom_location),
+      m_SaveExtendedMemory(std::make_unique<ExtendedMemory>()),
+      m_RewindBuffer(DEFAULT_REWIND_SECONDS * TIMER_FREQUENCY) {
+  m_InputSource = std::make_shared<QueuedInputSource>();
+  m_FramePublisher = std::make_shared<FramePublisher>();
+
+  m_Interpreter.SetInputSource(m_InputSource);
+  m_Interpreter.SetFrameSink(m_FramePublisher);
+
+#if CHIP8_PROFILER_ENABLED
+  m_Profiler = std::make_shared<Profiler>();
+  m_Interpreter.SetProfiler(m_Profiler);
+#endif
+}
+
+EmulationThread::~EmulationThread() { this->Stop(); }
+
+void EmulationThread::Start() {
+  if (m_Running.exchange(true)) {
+    return;
+  }
+
+  m_Thread = std::thread(&EmulationThread::ThreadMain, this);
+  LOG_INFO("Emulation thread started.");
+}
+
+void EmulationThread::Stop() {
+  m_Running.store(false);
+
+  if (m_Thread.joinable()) {
+    m_Thread.join();
+    LOG_INFO("Emulation thread stopped.");
+  }
+}
+
+// Turbo runs in chunks this big so commands are still picked up quickly
+constexpr unsigned int TURBO_BATCH_SIZE = 4096;
+
+void EmulationThread::ThreadMain() {
+  using SteadyClock = std::chrono::steady_clock;
+  constexpr auto FRAME_DURATION = std::chrono::nanoseconds(1'000'000'000 / 60);
+  constexpr auto RATE_WINDOW = std::chrono::milliseconds(500);
+
+  auto last_time = SteadyClock::now();
+  auto next_frame = last_time;
+  auto last_publish = last_time;
+  auto last_rewind_frame = last_time;
+  double pending_ops = 0.0;
+
+  auto rate_window_start = last_time;
+  uint64_t rate_window_ops = 0;
+
+  while (m_Running.load(std::memory_order_relaxed)) {
+    const unsigned int steps = this->ProcessCommands();
+    const bool step_through = m_StepThrough.load(std::memory_order_relaxed);
+    // Rewinding would put the machine out of step with the movie's input, so
+    // it is off while one records or plays
+    const bool rewinding = m_Rewinding.load(std::memory_order_relaxed) && !m_MovieActive;
+    const SchedulerMode mode = m_SchedulerMode.load(std::memory_order_relaxed);
+
+    // Timers tick on emulated cycles at the rate the ROM is meant to run at,
+    // so turbo fast-forwards them along with everything else. Movies keep
+    // the rate they were recorded at, the speed setting only paces them.
+    const unsigned int instructions_per_second =
+        m_MovieInstructionsPerSecond != 0 ? m_MovieInstructionsPerSecond
+        : mode == SchedulerMode::InstructionsPerFrame
+            ? std::max(m_InstructionsPerFrame.load(std::memory_order_relaxed), 1) * TIMER_FREQUENCY
+            : std::max(m_OpsPerSecond.load(std::memory_order_relaxed), 1);
+    m_Interpreter.SetInstructionsPerSecond(instructions_per_second);
+
+    const auto now = SteadyClock::now();
+    const double elapsed = std::chrono::duration<double>(now - last_time).count();
+    last_time = now;
+
+    unsigned int batch = 0;
+    if (rewinding) {
+      pending_ops = 0.0;
+      next_frame = now;
+    } else if (step_through) {
+      batch = steps;
+      pending_ops = 0.0;
+      next_frame = now;
+    } else {
+      switch (mode) {
+        case SchedulerMode::OpsPerSecond: {
+          // Don't try to catch up on more than 100 ms after a stall
+          const int ops_per_second = std::max(m_OpsPerSecond.load(std::memory_order_relaxed), 1);
+          pending_ops = std::min(pending_ops + elapsed * ops_per_second, ops_per_second / 10.0);
+
+          batch = static_cast<unsigned int>(pending_ops);
+          pending_ops -= batch;
+          break;
+        }
+        case SchedulerMode::InstructionsPerFrame: {
+          if (now >= next_frame) {
+            batch = std::max(m_InstructionsPerFrame.load(std::memory_order_relaxed), 1);
+
+            // Drop frames instead of bursting after a stall
+            next_frame += FRAME_DURATION;
+            if (now - next_frame > 4 * FRAME_DURATION) {
+              next_frame = now + FRAME_DURATION;
+            }
+          }
+          break;
+        }
+        case SchedulerMode::Turbo: {
+          batch = TURBO_BATCH_SIZE;
+          break;
+        }
+      }
+    }
+
+    // Turbo would otherwise publish thousands of frames a second that nobody
+    // gets to see, in EmulatedFrame mode one for every emulated 60 Hz tick
+    const bool throttled = mode == SchedulerMode::Turbo && !step_through;
+    m_Interpreter.SetEmulatedFramesOnRequest(throttled);
+
+    if (batch > 0) {
+      rate_window_ops += m_Interpreter.Execute(batch);
+    }
+
+    if (now - rate_window_start >= RATE_WINDOW) {
+      const double window = std::chrono::duration<double>(now - rate_window_start).count();
+      m_MeasuredOpsPerSecond.store(static_cast<uint64_t>(rate_window_ops / window));
+
+      rate_window_start = now;
+      rate_window_ops = 0;
+    }
+
+    // History is kept per host frame, so rewinding plays back at the speed
+    // it was seen
+    if (now - last_rewind_frame >= FRAME_DURATION) {
+      last_rewind_frame = now;
+
+      if (rewinding) {
+        if (m_RewindBuffer.StepBack(m_SaveState, *m_SaveExtendedMemory)) {
+          m_Interpreter.LoadState(m_SaveState, m_SaveExtendedMemory.get());
+          m_Interpreter.PresentFrame();
+        }
+      } else if (!step_through) {
+        m_Interpreter.SaveState(m_SaveState);
+        m_RewindBuffer.Push(m_SaveState, m_Interpreter.GetExtendedMemory());
+      }
+
+      m_RewindSnapshots.store(m_RewindBuffer.GetSnapshotCount(), std::memory_order_relaxed);
+      m_RewindBytes.store(m_RewindBuffer.GetUsedBytes(), std::memory_order_relaxed);
+    }
+
+    // At most once per host frame while throttled. EmulatedFrame frames are
+    // presented by the next timer tick after the request.
+    if (!throttled || now - last_publish >= FRAME_DURATION) {
+      last_publish = now;
+
+      if (m_Interpreter.GetPresentMode() == PresentMode::HostFrame) {
+        m_Interpreter.PresentFrame();
+      } else {
+        m_Interpreter.RequestEmulatedFrame();
+      }
+
+      if (m_SnapshotsEnabled.load(std::memory_order_relaxed)) {
+        m_Interpreter.SaveState(m_Snapshots.GetWriteBuffer());
+        m_Snapshots.Publish();
+
+        if (m_Profiler) {
+          m_Profiles.GetWriteBuffer() = m_Profiler->GetCounters();
+          m_Profiles.Publish();
+        }
+      }
+    }
+
+    if (step_through || rewinding || mode == SchedulerMode::OpsPerSecond) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    } else if (mode == SchedulerMode::InstructionsPerFrame) {
+      std::this_thread::sleep_until(next_frame);
+    }
+  }
+}
+
+unsigned int EmulationThread::ProcessCommands() {
+  unsigned int steps = 0;
+  EmulatorCommand command;
+
+  while (m_Commands.Pop(command)) {
+    switch (command.type) {
+      case EmulatorCommandType::KeyDown: {
+        m_InputSource->SetKeyPressed(command.value, true);
+        break;
+      }
+      case EmulatorCommandType::KeyUp: {
+        m_InputSource->SetKeyPressed(command.value, false);
+        break;
+      }
+      case EmulatorCommandType::Restart: {
+        m_Interpreter.Restart(m_RomLocation.c_str());
+        if (m_Profiler) {
+          m_Profiler->Reset();
+        }
+        break;
+      }
+      case EmulatorCommandType::Step: {
+        steps++;
+        break;
+      }
+      case EmulatorCommandType::SetPresentMode: {
+        m_Interpreter.SetPresentMode(static_cast<PresentMode>(command.value));
+        break;
+      }
+      case EmulatorCommandType::SetDisplayWaitQuirk: {
+        m_Interpreter.SetDisplayWaitQuirk(command.value != 0);
+        break;
+      }
+      case EmulatorCommandType::SetQuirkProfile: {
+        m_Interpreter.SetQuirkProfile(static_cast<QuirkProfile>(command.value));
+        break;
+      }
+      case EmulatorCommandType::SetTraceEnabled: {
+        // Dropping the recorder closes the file
+        std::shared_ptr<TraceRecorder> trace_recorder;
+
+        if (command.value) {
+          const auto trace_location =
+              std::filesystem::path(m_RomLocation).filename().replace_extension(".c8trace");
+
+          trace_recorder = std::make_shared<TraceRecorder>();
+          if (!trace_recorder->Open(trace_location.string().c_str())) {
+            trace_recorder.reset();
+          }
+        }
+
+        m_Interpreter.SetTraceRecorder(trace_recorder);
+        break;
+      }
+      case EmulatorCommandType::SaveState: {
+        m_Interpreter.SaveState(m_SaveState);
+        WriteStateFile(this->GetStateLocation().c_str(), m_SaveState,
+                       m_Interpreter.GetExtendedMemory());
+        break;
+      }
+      case EmulatorCommandType::LoadState: {
+        if (ReadStateFile(this->GetStateLocation().c_str(), m_SaveState,
+                          *m_SaveExtendedMemory)) {
+          m_Interpreter.LoadState(m_SaveState, m_SaveExtendedMemory.get());
+        }
+        break;
+      }
+      case EmulatorCommandType::SetRewindLength: {
+        m_RewindBuffer.SetCapacity(std::max(command.value, 0) * TIMER_FREQUENCY);
+        break;
+      }
+      case EmulatorCommandType::RecordMovie: {
+        this->StopMovie();
+        m_Interpreter.Restart(m_RomLocation.c_str());
+
+        const MovieSettings settings{m_Interpreter.GetRandomSeed(), m_Interpreter.HashMemory(),
+                                     m_Interpreter.GetInstructionsPerSecond(),
+                                     m_Interpreter.GetDisplayWaitQuirk(),
+                                     m_Interpreter.GetQuirkProfile()};
+        m_MovieRecorder = std::make_shared<MovieRecorder>(m_InputSource, settings);
+        m_MovieInstructionsPerSecond = settings.instructions_per_second;
+        m_MovieActive = true;
+        m_Interpreter.SetInputSource(m_MovieRecorder);
+
+        LOG_INFO("Recording input");
+        break;
+      }
+      case EmulatorCommandType::PlayMovie: {
+        this->StopMovie();
+
+        auto movie_player = std::make_shared<MoviePlayer>();
+        if (!movie_player->Open(this->GetMovieLocation().c_str())) {
+          break;
+        }
+
+        // The rate and quirks have to match the recording
+        const MovieSettings &settings = movie_player->GetSettings();
+        m_Interpreter.SetRandomSeed(settings.random_seed);
+        m_Interpreter.SetDisplayWaitQuirk(settings.display_wait_quirk);
+        m_Interpreter.SetQuirkProfile(settings.quirk_profile);
+        m_Interpreter.Restart(m_RomLocation.c_str());
+        m_MovieInstructionsPerSecond = settings.instructions_per_second;
+
+        if (settings.rom_hash != m_Interpreter.HashMemory()) {
+          LOG_WARN("Movie was recorded with a different ROM");
+        }
+
+        m_Interpreter.SetInputSource(movie_player);
+        m_MovieActive = true;
+        break;
+      }
+      case EmulatorCommandType::StopMovie: {
+        this->StopMovie();
+        break;
+      }
+      case EmulatorCommandType::ResetProfile: {
+        if (m_Profiler) {
+          m_Profiler->Reset();
+        }
+        break;
+      }
+      case EmulatorCommandType::ExportProfile: {
+        if (m_Profiler) {
+          WriteProfileFile(this->GetProfileLocation().c_str(), m_Profiler->GetCounters());
+        }
+        break;
+      }
+    }
+  }
+
+  return steps;
+}
+
+void EmulationThread::StopMovie() {
+  if (m_MovieRecorder) {
+    m_MovieRecorder->Save(this->GetMovieLocation().c_str());
+    m_MovieRecorder.reset();
+  }
+
+  m_Interpreter.SetInputSource(m_InputSource);
+  m_MovieInstructionsPerSecond = 0;
+  m_MovieActive = false;
+}
+
+std::string EmulationThread::GetMovieLocation() const {
+  return std::filesystem::path(m_RomLocation).filename().replace_extension(".c8movie").string();
+}
+
+std::string EmulationThread::GetProfileLocation() const {
+  return std::filesystem::path(m_RomLocation).filename().replace_extension(".profile.csv").string();
+}
+
+std::string EmulationThread::GetStateLocation() const {
+  return std::filesystem::path(m_RomLocation).filename().replace_extension(".c8state").string();
+}
+
+}  // namespace Chip8
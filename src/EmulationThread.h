@@ -0,0 +1,191 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "FrameBuffer.h"
+#include "InputMovie.h"
+#include "Interpreter.h"
+#include "Platform.h"
+#include "Profiler.h"
+#include "RewindBuffer.h"
+#include "SPSCQueue.h"
+#include "TripleBuffer.h"
+
+namespace Chip8 {
+
+enum class EmulatorCommandType : Byte {
+  KeyDown,
+  KeyUp,
+  Restart,
+  Step,
+  SetPresentMode,
+  SetDisplayWaitQuirk,
+  // value is a QuirkProfile
+  SetQuirkProfile,
+  // Records an execution trace to <rom name>.c8trace in the working directory
+  SetTraceEnabled,
+  // Save or restore the whole machine through <rom name>.c8state
+  SaveState,
+  LoadState,
+  // Seconds of rewind history to keep, 0 turns recording off. Drops the
+  // current history.
+  SetRewindLength,
+  // Restart the ROM and record the input from there to <rom name>.c8movie,
+  // or replay that file. StopMovie saves a recording and returns to live
+  // input.
+  RecordMovie,
+  PlayMovie,
+  StopMovie,
+  // Clear the profile counters, or write them to <rom name>.profile.csv
+  ResetProfile,
+  ExportProfile,
+};
+
+constexpr int DEFAULT_REWIND_SECONDS = 300;
+
+enum class SchedulerMode {
+  // A fixed number of instructions per second, spread evenly over time
+  OpsPerSecond,
+  // Exactly N instructions at the start of every 60 Hz frame
+  InstructionsPerFrame,
+  // As fast as the host allows, frames are still published at 60 Hz
+  Turbo,
+};
+
+// Sent from the UI thread to the emulation thread, value is the key for
+// KeyDown/KeyUp and the new setting for the Set* commands
+struct EmulatorCommand {
+  EmulatorCommandType type;
+  int value = 0;
+};
+
+// Keys as last reported through KeyDown/KeyUp commands, only touched by the
+// emulation thread
+class QueuedInputSource : public InputSource {
+public:
+  bool IsKeyPressed(Byte key) const override { return m_Keys[key & 0xF]; }
+
+  void SetKeyPressed(Byte key, bool pressed) { m_Keys[key & 0xF] = pressed; }
+
+private:
+  std::array<bool, 16> m_Keys{};
+};
+
+// Copies presented frames into a triple buffer for the render thread
+class FramePublisher : public FrameSink {
+public:
+  void PresentFrame(const FrameBuffer &frame_buffer) override {
+    m_Frames.GetWriteBuffer() = frame_buffer;
+    m_Frames.Publish();
+  }
+
+  TripleBuffer<FrameBuffer> &GetFrames() { return m_Frames; }
+
+private:
+  TripleBuffer<FrameBuffer> m_Frames;
+};
+
+// Runs the interpreter on its own thread. The UI thread talks to it only
+// through the command queue, the frame and snapshot triple buffers and a few
+// atomics, so neither side ever blocks on the other.
+class EmulationThread {
+public:
+  EmulationThread(Interpreter &interpreter, const char *rom_location);
+  ~EmulationThread();
+
+  void Start();
+  void Stop();
+
+  // Returns false if the queue is full and the command was dropped
+  bool PushCommand(const EmulatorCommand &command) { return m_Commands.Push(command); }
+
+  // Returns true if a new frame was published since the last call
+  bool AcquireFrame() { return m_FramePublisher->GetFrames().Acquire(); }
+  const FrameBuffer &GetFrame() { return m_FramePublisher->GetFrames().GetReadBuffer(); }
+
+  // Snapshots are only taken while requested, copying memory every batch is
+  // wasted work when the debug UI is closed
+  void SetSnapshotsEnabled(bool enabled) { m_SnapshotsEnabled.store(enabled); }
+  bool AcquireSnapshot() { return m_Snapshots.Acquire(); }
+  MachineState &GetSnapshot() { return m_Snapshots.GetReadBuffer(); }
+
+  // Profile counters, published along with the snapshots. Null when the
+  // profiler is not built in.
+  bool AcquireProfile() { return m_Profiles.Acquire(); }
+  const ProfileCounters *GetProfile() { return m_Profiler ? &m_Profiles.GetReadBuffer() : nullptr; }
+
+  void SetSchedulerMode(SchedulerMode mode) { m_SchedulerMode.store(mode); }
+  void SetOpsPerSecond(int ops_per_second) { m_OpsPerSecond.store(ops_per_second); }
+  void SetInstructionsPerFrame(int instructions) { m_InstructionsPerFrame.store(instructions); }
+  void SetStepThrough(bool enabled) { m_StepThrough.store(enabled); }
+
+  // While set, emulation pauses and steps back one recorded frame every
+  // 60 Hz frame. Ignored while a movie records or plays.
+  void SetRewinding(bool rewinding) { m_Rewinding.store(rewinding); }
+
+  // Seconds of rewind history currently stored and its compressed size
+  double GetRewindSeconds() const { return m_RewindSnapshots.load() / double(TIMER_FREQUENCY); }
+  size_t GetRewindBytes() const { return m_RewindBytes.load(); }
+
+  // Instructions actually executed per second, measured over the last half
+  // second
+  uint64_t GetMeasuredOpsPerSecond() const { return m_MeasuredOpsPerSecond.load(); }
+
+private:
+  void ThreadMain();
+
+  // Returns how many single steps were requested
+  unsigned int ProcessCommands();
+
+  std::string GetStateLocation() const;
+  std::string GetMovieLocation() const;
+  std::string GetProfileLocation() const;
+
+  void StopMovie();
+
+private:
+  Interpreter &m_Interpreter;
+  std::string m_RomLocation;
+
+  std::shared_ptr<QueuedInputSource> m_InputSource;
+  std::shared_ptr<MovieRecorder> m_MovieRecorder;
+  // Emulated rate pinned while a movie records or plays, 0 otherwise
+  unsigned int m_MovieInstructionsPerSecond = 0;
+  bool m_MovieActive = false;
+  std::shared_ptr<FramePublisher> m_FramePublisher;
+
+  SPSCQueue<EmulatorCommand, 256> m_Commands;
+  TripleBuffer<MachineState> m_Snapshots;
+
+  // Only set with CHIP8_PROFILER_ENABLED, never changes once started
+  std::shared_ptr<Profiler> m_Profiler;
+  TripleBuffer<ProfileCounters> m_Profiles;
+
+  // Scratch state for the save/load commands and rewinding, kept here so
+  // they don't put 8 KB on the stack. The extended memory is only used by
+  // XO-CHIP programs, it is allocated up front so neither path allocates.
+  MachineState m_SaveState;
+  std::unique_ptr<ExtendedMemory> m_SaveExtendedMemory;
+
+  // Only touched by the emulation thread, one snapshot per 60 Hz frame
+  RewindBuffer m_RewindBuffer;
+
+  std::atomic<bool> m_Running = false;
+  std::atomic<bool> m_SnapshotsEnabled = false;
+  std::atomic<bool> m_StepThrough = false;
+  std::atomic<bool> m_Rewinding = false;
+  std::atomic<uint32_t> m_RewindSnapshots = 0;
+  std::atomic<size_t> m_RewindBytes = 0;
+  std::atomic<SchedulerMode> m_SchedulerMode = SchedulerMode::OpsPerSecond;
+  std::atomic<int> m_OpsPerSecond = 700;
+  std::atomic<int> m_InstructionsPerFrame = 12;
+  std::atomic<uint64_t> m_MeasuredOpsPerSecond = 0;
+
+  std::thread m_Thread;
+};
+
+}  // namespace Chip8
@@ -0,0 +1,256 @@
+#include "FrameBuffer.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+
+namespace Chip8 {
+
+constexpr uint64_t FNV_OFFSET_BASIS = 0xCBF29CE484222325;
+constexpr uint64_t FNV_PRIME = 0x100000001B3;
+
+FrameBuffer::FrameBuffer() {
+  for (Plane &plane : m_Planes) {
+    plane.fill(0);
+  }
+}
+
+void FrameBuffer::Clear() {
+  const size_t words = this->GetHeight() * this->GetWordsPerRow();
+
+  for (unsigned int rest = m_PlaneMask; rest != 0; rest &= rest - 1) {
+    std::fill_n(m_Planes[std::countr_zero(rest)].data(), words, 0);
+  }
+
+  m_DrawnPlanes &= ~m_PlaneMask;
+}
+
+void FrameBuffer::SetHighResolution(bool high_resolution) {
+  m_HighResolution = high_resolution;
+  m_DrawnPlanes = 0;
+
+  for (Plane &plane : m_Planes) {
+    plane.fill(0);
+  }
+}
+
+void FrameBuffer::Sanitize() {
+  // A bool holding anything but 0 or 1 is undefined, look at the raw byte
+  Byte high_resolution;
+  std::memcpy(&high_resolution, &m_HighResolution, sizeof(high_resolution));
+  m_HighResolution = high_resolution != 0;
+
+  this->SetPlaneMask(m_PlaneMask);
+  m_DrawnPlanes &= (1 << PLANE_COUNT) - 1;
+}
+
+bool FrameBuffer::LoadSprite(const PixelPos x, const PixelPos y, std::span<const Byte> sprite) {
+  return this->DrawSprite<false>(x, y, sprite);
+}
+
+bool FrameBuffer::LoadWideSprite(const PixelPos x, const PixelPos y,
+                                 std::span<const Byte> sprite) {
+  return this->DrawSprite<true>(x, y, sprite);
+}
+
+template <bool Wide>
+bool FrameBuffer::DrawSprite(const PixelPos x, const PixelPos y, std::span<const Byte> sprite) {
+  constexpr unsigned int sprite_width = Wide ? WIDE_SPRITE_SIZE : SPRITE_WIDTH;
+  constexpr size_t bytes_per_row = sprite_width / 8;
+  constexpr size_t max_height = Wide ? WIDE_SPRITE_SIZE : MAX_SPRITE_HEIGHT;
+
+  const unsigned int planes = std::popcount(m_PlaneMask);
+  if (planes == 0) {
+    return false;
+  }
+
+  m_DrawnPlanes |= m_PlaneMask;
+
+  const Vector2<PixelPos> starting_pos{x % this->GetWidth(), y % this->GetHeight()};
+
+  // Sprites are clipped at the right and bottom edges, not wrapped
+  const size_t sprite_height = std::min(sprite.size() / (planes * bytes_per_row), max_height);
+  const size_t height = std::min<size_t>(sprite_height, this->GetHeight() - starting_pos.y);
+
+  PixelWord collision = 0;
+  const Byte *plane_sprite = sprite.data();
+
+  for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane) {
+    if (!((m_PlaneMask >> plane) & 1)) {
+      continue;
+    }
+
+    // Build every row mask first so the XOR and the collision check below
+    // are plain loops the compiler can vectorize. Rows start left-aligned
+    // in a word, bits shifted past the last word are clipped.
+    std::array<PixelWord, max_height> masks;
+    for (size_t row = 0; row < height; ++row) {
+      const PixelWord sprite_row = Wide ? (plane_sprite[row * 2] << 8) | plane_sprite[row * 2 + 1]
+                                        : plane_sprite[row];
+      masks[row] = sprite_row << (PIXEL_WORD_BITS - sprite_width);
+    }
+
+    if (!m_HighResolution) {
+      PixelWord *rows = &m_Planes[plane][starting_pos.y];
+
+      for (size_t row = 0; row < height; ++row) {
+        const PixelWord mask = masks[row] >> starting_pos.x;
+        collision |= rows[row] & mask;
+        rows[row] ^= mask;
+      }
+    } else {
+      PixelWord *rows = &m_Planes[plane][starting_pos.y * MAX_WORDS_PER_ROW];
+
+      // Straddles both words unless it starts at the left edge of one
+      const unsigned int word = starting_pos.x / PIXEL_WORD_BITS;
+      const unsigned int shift = starting_pos.x % PIXEL_WORD_BITS;
+
+      for (size_t row = 0; row < height; ++row) {
+        PixelWord *words = &rows[row * MAX_WORDS_PER_ROW];
+        const PixelWord left = masks[row] >> shift;
+        const PixelWord right =
+            word == 0 && shift != 0 ? masks[row] << (PIXEL_WORD_BITS - shift) : 0;
+
+        collision |= (words[word] & left) | (words[1] & right);
+        words[word] ^= left;
+        words[1] ^= right;
+      }
+    }
+
+    plane_sprite += sprite_height * bytes_per_row;
+  }
+
+  return collision != 0;
+}
+
+void FrameBuffer::ScrollDown(unsigned int rows) {
+  this->ScrollRows(static_cast<int>(std::min(rows, this->GetHeight())));
+}
+
+void FrameBuffer::ScrollUp(unsigned int rows) {
+  this->ScrollRows(-static_cast<int>(std::min(rows, this->GetHeight())));
+}
+
+void FrameBuffer::ScrollRows(int rows) {
+  const size_t shifted_words = std::abs(rows) * this->GetWordsPerRow();
+  const size_t kept_words = this->GetHeight() * this->GetWordsPerRow() - shifted_words;
+
+  for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane) {
+    if (!((m_PlaneMask >> plane) & 1)) {
+      continue;
+    }
+
+    PixelWord *words = m_Planes[plane].data();
+
+    if (rows > 0) {
+      std::memmove(words + shifted_words, words, kept_words * sizeof(PixelWord));
+      std::fill_n(words, shifted_words, 0);
+    } else {
+      std::memmove(words, words + shifted_words, kept_words * sizeof(PixelWord));
+      std::fill_n(words + kept_words, shifted_words, 0);
+    }
+  }
+}
+
+void FrameBuffer::ScrollRight(unsigned int pixels) {
+  if (pixels >= this->GetWidth()) {
+    this->Clear();
+    return;
+  }
+
+  for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane) {
+    if (!((m_PlaneMask >> plane) & 1) || pixels == 0) {
+      continue;
+    }
+
+    PixelWord *words = m_Planes[plane].data();
+
+    if (!m_HighResolution) {
+      for (PixelPos y = 0; y < LORES_HEIGHT; ++y) {
+        words[y] >>= pixels;
+      }
+      continue;
+    }
+
+    for (PixelPos y = 0; y < HIRES_HEIGHT; ++y) {
+      PixelWord *row = &words[y * MAX_WORDS_PER_ROW];
+
+      if (pixels >= PIXEL_WORD_BITS) {
+        row[1] = row[0] >> (pixels - PIXEL_WORD_BITS);
+        row[0] = 0;
+      } else {
+        row[1] = (row[1] >> pixels) | (row[0] << (PIXEL_WORD_BITS - pixels));
+        row[0] >>= pixels;
+      }
+    }
+  }
+}
+
+void FrameBuffer::ScrollLeft(unsigned int pixels) {
+  if (pixels >= this->GetWidth()) {
+    this->Clear();
+    return;
+  }
+
+  for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane) {
+    if (!((m_PlaneMask >> plane) & 1) || pixels == 0) {
+      continue;
+    }
+
+    PixelWord *words = m_Planes[plane].data();
+
+    if (!m_HighResolution) {
+      for (PixelPos y = 0; y < LORES_HEIGHT; ++y) {
+        words[y] <<= pixels;
+      }
+      continue;
+    }
+
+    for (PixelPos y = 0; y < HIRES_HEIGHT; ++y) {
+      PixelWord *row = &words[y * MAX_WORDS_PER_ROW];
+
+      if (pixels >= PIXEL_WORD_BITS) {
+        row[0] = row[1] << (pixels - PIXEL_WORD_BITS);
+        row[1] = 0;
+      } else {
+        row[0] = (row[0] << pixels) | (row[1] >> (PIXEL_WORD_BITS - pixels));
+        row[1] <<= pixels;
+      }
+    }
+  }
+}
+
+uint64_t FrameBuffer::Hash() const {
+  uint64_t hash = FNV_OFFSET_BASIS;
+  const size_t words = this->GetHeight() * this->GetWordsPerRow();
+
+  // One byte per 8 pixels, left to right, so the value does not depend on
+  // how the pixels happen to be stored. Planes past the first only count
+  // once something was drawn in them, so single-plane frames hash the same
+  // as before there were planes.
+  for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane) {
+    const Plane &pixels = m_Planes[plane];
+
+    if (plane > 0) {
+      if (!((m_DrawnPlanes >> plane) & 1) ||
+          std::all_of(pixels.begin(), pixels.end(), [](PixelWord word) { return word == 0; })) {
+        continue;
+      }
+
+      hash ^= plane;
+      hash *= FNV_PRIME;
+    }
+
+    for (size_t word = 0; word < words; ++word) {
+      for (int shift = PIXEL_WORD_BITS - 8; shift >= 0; shift -= 8) {
+        hash ^= (pixels[word] >> shift) & 0xFF;
+        hash *= FNV_PRIME;
+      }
+    }
+  }
+
+  return hash;
+}
+
+}  // namespace Chip8
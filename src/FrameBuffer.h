@@ -0,0 +1,133 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+
+namespace Chip8 {
+
+using PixelState = bool;
+using PixelPos = unsigned int;
+using Byte = uint8_t;
+
+// 64 pixels of a row, the leftmost pixel in the most significant bit
+using PixelWord = uint64_t;
+
+// The classic display, and the SUPER-CHIP/XO-CHIP high resolution mode
+constexpr unsigned int LORES_WIDTH = 64;
+constexpr unsigned int LORES_HEIGHT = 32;
+constexpr unsigned int HIRES_WIDTH = 128;
+constexpr unsigned int HIRES_HEIGHT = 64;
+
+constexpr unsigned int PIXEL_WORD_BITS = sizeof(PixelWord) * 8;
+constexpr unsigned int MAX_WORDS_PER_ROW = HIRES_WIDTH / PIXEL_WORD_BITS;
+static_assert(LORES_WIDTH == PIXEL_WORD_BITS);
+
+// XO-CHIP bitplanes, a pixel's colour is the bits it has set across them
+constexpr unsigned int PLANE_COUNT = 4;
+constexpr Byte DEFAULT_PLANE_MASK = 0x1;
+
+constexpr unsigned int SPRITE_WIDTH = 8;
+constexpr unsigned int MAX_SPRITE_HEIGHT = 15;
+
+// DXY0 draws 16x16 pixels, two bytes per row
+constexpr unsigned int WIDE_SPRITE_SIZE = 16;
+constexpr unsigned int WIDE_SPRITE_BYTES = WIDE_SPRITE_SIZE * 2;
+
+template <typename T>
+struct Vector2 {
+  T x, y;
+};
+
+// Every plane is stored row by row with as many words per row as the
+// resolution needs: a low resolution plane is LORES_HEIGHT consecutive
+// words, exactly the classic framebuffer, and a high resolution one has two
+// words per row. Vertical scrolls are a memmove and horizontal ones shift
+// whole words. Everything past the current resolution stays clear.
+class FrameBuffer {
+public:
+  FrameBuffer();
+
+  // Clears the selected planes
+  void Clear();
+
+  // Clears every plane, like 00FE/00FF do even without a change
+  void SetHighResolution(bool high_resolution);
+  bool IsHighResolution() const { return m_HighResolution; }
+
+  PixelPos GetWidth() const { return m_HighResolution ? HIRES_WIDTH : LORES_WIDTH; }
+  PixelPos GetHeight() const { return m_HighResolution ? HIRES_HEIGHT : LORES_HEIGHT; }
+  unsigned int GetWordsPerRow() const { return m_HighResolution ? MAX_WORDS_PER_ROW : 1; }
+
+  // Planes the sprite, clear and scroll operations apply to, bit p selects
+  // plane p
+  void SetPlaneMask(Byte plane_mask) { m_PlaneMask = plane_mask & ((1 << PLANE_COUNT) - 1); }
+  Byte GetPlaneMask() const { return m_PlaneMask; }
+
+  // Planes a sprite was drawn into since they were last cleared, every
+  // other plane is known to be clear
+  Byte GetDrawnPlanes() const { return m_DrawnPlanes; }
+
+  // Draws an 8 pixel wide sprite into every selected plane. The sprite holds
+  // the rows for each selected plane one after the other, lowest plane
+  // first. Returns whether any pixel was turned off.
+  bool LoadSprite(const PixelPos x, const PixelPos y, std::span<const Byte> sprite);
+  // The same for 16x16 sprites, WIDE_SPRITE_BYTES per plane
+  bool LoadWideSprite(const PixelPos x, const PixelPos y, std::span<const Byte> sprite);
+
+  // Scroll amounts are pixels of the current resolution, pixels that move
+  // out are lost and the ones that move in are clear
+  void ScrollDown(unsigned int rows);
+  void ScrollUp(unsigned int rows);
+  void ScrollRight(unsigned int pixels);
+  void ScrollLeft(unsigned int pixels);
+
+  PixelState GetPixel(const PixelPos x, const PixelPos y, unsigned int plane = 0) const {
+    const PixelWord word = GetWord(plane, y, x / PIXEL_WORD_BITS);
+    return (word >> (PIXEL_WORD_BITS - 1 - x % PIXEL_WORD_BITS)) & 1;
+  }
+
+  // Bit p set if the pixel is set in plane p
+  Byte GetColor(const PixelPos x, const PixelPos y) const {
+    Byte color = 0;
+    for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane) {
+      color |= GetPixel(x, y, plane) << plane;
+    }
+    return color;
+  }
+
+  // GetWordsPerRow() words, leftmost first
+  const PixelWord *GetRow(unsigned int plane, const PixelPos y) const {
+    return &m_Planes[plane][y * this->GetWordsPerRow()];
+  }
+
+  PixelWord GetWord(unsigned int plane, const PixelPos y, unsigned int word) const {
+    return word < this->GetWordsPerRow() ? this->GetRow(plane, y)[word] : 0;
+  }
+
+  // FNV-1a over the pixel data, used to compare frames without a window
+  uint64_t Hash() const;
+
+  // Brings the mode and plane fields back into range after the buffer was
+  // copied in from outside, e.g. a state file
+  void Sanitize();
+
+private:
+  template <bool Wide>
+  bool DrawSprite(const PixelPos x, const PixelPos y, std::span<const Byte> sprite);
+
+  // Shifts every selected plane's rows by whole rows, up for negative
+  // amounts
+  void ScrollRows(int rows);
+
+private:
+  using Plane = std::array<PixelWord, HIRES_HEIGHT * MAX_WORDS_PER_ROW>;
+
+  std::array<Plane, PLANE_COUNT> m_Planes;
+
+  bool m_HighResolution = false;
+  Byte m_PlaneMask = DEFAULT_PLANE_MASK;
+  Byte m_DrawnPlanes = 0;
+};
+
+}  // namespace Chip8
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Platform.h"
+
+namespace Chip8 {
+
+class NullInputSource : public InputSource {
+public:
+  bool IsKeyPressed(Byte) const override { return false; }
+};
+
+}  // namespace Chip8
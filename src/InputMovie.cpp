@@ -0,0 +1,193 @@
+#include "InputMovie.h"
+
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#include "Logging.h"
+
+#define CHIP8_LOG_SUBSYSTEM CORE
+
+namespace Chip8 {
+
+// File layout, all integers little-endian:
+//
+//   header: "C8MOVIE\0", u32 version, u64 random seed, u64 ROM hash,
+//           u32 instructions per second, u32 flags, u32 frame count
+//   frames: runs of (u16 key mask, varint frame count) until frame count
+//           frames are covered
+//
+// flags bit 0 is the display wait quirk and bits 8-15 the quirk profile,
+// movies from before profiles existed read as the default one. Keys rarely
+// change between frames, so a minute of play is usually well under a
+// kilobyte.
+constexpr char MOVIE_MAGIC[8] = {'C', '8', 'M', 'O', 'V', 'I', 'E', '\0'};
+constexpr uint32_t MOVIE_VERSION = 1;
+constexpr size_t MOVIE_HEADER_SIZE = sizeof(MOVIE_MAGIC) + 4 + 8 + 8 + 4 + 4 + 4;
+
+constexpr uint32_t MOVIE_FLAG_DISPLAY_WAIT = 1;
+constexpr int MOVIE_QUIRK_PROFILE_SHIFT = 8;
+
+// An hour of frames, so recording does not reallocate during normal play
+constexpr size_t MOVIE_RESERVED_FRAMES = 60 * 60 * 60;
+
+namespace {
+
+void PutInteger(std::vector<Byte> &out, uint64_t value, int size) {
+  for (int i = 0; i < size; ++i) {
+    out.push_back((value >> (i * 8)) & 0xFF);
+  }
+}
+
+uint64_t GetInteger(const Byte *in, int size) {
+  uint64_t value = 0;
+  for (int i = 0; i < size; ++i) {
+    value |= static_cast<uint64_t>(in[i]) << (i * 8);
+  }
+  return value;
+}
+
+}  // namespace
+
+MovieRecorder::MovieRecorder(std::shared_ptr<InputSource> live_input,
+                             const MovieSettings &settings)
+    : m_LiveInput(std::move(live_input)), m_Settings(settings) {
+  m_Frames.reserve(MOVIE_RESERVED_FRAMES);
+}
+
+void MovieRecorder::LatchFrame() {
+  m_LiveInput->LatchFrame();
+
+  uint16_t keys = 0;
+  for (Byte key = 0; key < 16; ++key) {
+    keys |= m_LiveInput->IsKeyPressed(key) << key;
+  }
+
+  m_Keys = keys;
+  m_Frames.push_back(keys);
+}
+
+bool MovieRecorder::Save(const char *movie_location) const {
+  std::vector<Byte> data;
+  data.insert(data.end(), MOVIE_MAGIC, MOVIE_MAGIC + sizeof(MOVIE_MAGIC));
+  PutInteger(data, MOVIE_VERSION, 4);
+  PutInteger(data, m_Settings.random_seed, 8);
+  PutInteger(data, m_Settings.rom_hash, 8);
+  PutInteger(data, m_Settings.instructions_per_second, 4);
+  PutInteger(data,
+             (m_Settings.display_wait_quirk ? MOVIE_FLAG_DISPLAY_WAIT : 0) |
+                 uint32_t(m_Settings.quirk_profile) << MOVIE_QUIRK_PROFILE_SHIFT,
+             4);
+  PutInteger(data, m_Frames.size(), 4);
+
+  for (size_t i = 0; i < m_Frames.size();) {
+    size_t run = 1;
+    while (i + run < m_Frames.size() && m_Frames[i + run] == m_Frames[i]) {
+      run++;
+    }
+
+    PutInteger(data, m_Frames[i], 2);
+    for (size_t value = run; value != 0; value >>= 7) {
+      data.push_back((value & 0x7F) | (value >= 0x80 ? 0x80 : 0));
+    }
+
+    i += run;
+  }
+
+  std::FILE *file = std::fopen(movie_location, "wb");
+  if (file == nullptr) {
+    LOG_ERROR("Could not open movie file {}", movie_location);
+    return false;
+  }
+
+  const bool written = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+  if (std::fclose(file) != 0 || !written) {
+    LOG_ERROR("Could not write movie file {}", movie_location);
+    return false;
+  }
+
+  LOG_INFO("Saved {} frames of input to {}", m_Frames.size(), movie_location);
+  return true;
+}
+
+bool MoviePlayer::Open(const char *movie_location) {
+  std::FILE *file = std::fopen(movie_location, "rb");
+  if (file == nullptr) {
+    LOG_ERROR("Could not open movie file {}", movie_location);
+    return false;
+  }
+
+  std::vector<Byte> data;
+  Byte buffer[4096];
+  for (size_t read; (read = std::fread(buffer, 1, sizeof(buffer), file)) > 0;) {
+    data.insert(data.end(), buffer, buffer + read);
+  }
+  std::fclose(file);
+
+  if (data.size() < MOVIE_HEADER_SIZE ||
+      std::memcmp(data.data(), MOVIE_MAGIC, sizeof(MOVIE_MAGIC)) != 0) {
+    LOG_ERROR("{} is not a movie file", movie_location);
+    return false;
+  }
+
+  const Byte *header = data.data() + sizeof(MOVIE_MAGIC);
+  if (GetInteger(header, 4) != MOVIE_VERSION) {
+    LOG_ERROR("{} was written by an incompatible version (format {})", movie_location,
+              GetInteger(header, 4));
+    return false;
+  }
+
+  m_Settings.random_seed = GetInteger(header + 4, 8);
+  m_Settings.rom_hash = GetInteger(header + 12, 8);
+  m_Settings.instructions_per_second = GetInteger(header + 20, 4);
+  const uint32_t flags = GetInteger(header + 24, 4);
+  m_Settings.display_wait_quirk = flags & MOVIE_FLAG_DISPLAY_WAIT;
+
+  const uint32_t quirk_profile = (flags >> MOVIE_QUIRK_PROFILE_SHIFT) & 0xFF;
+  if (quirk_profile >= (uint32_t)QuirkProfile::Count) {
+    LOG_ERROR("{} uses an unknown quirk profile ({})", movie_location, quirk_profile);
+    return false;
+  }
+  m_Settings.quirk_profile = static_cast<QuirkProfile>(quirk_profile);
+  const uint32_t frame_count = GetInteger(header + 28, 4);
+
+  m_Frames.clear();
+  m_Frames.reserve(frame_count);
+
+  size_t position = MOVIE_HEADER_SIZE;
+  while (m_Frames.size() < frame_count) {
+    if (position + 3 > data.size()) {
+      LOG_ERROR("{} ends after {} of {} frames", movie_location, m_Frames.size(), frame_count);
+      return false;
+    }
+
+    const uint16_t keys = GetInteger(&data[position], 2);
+    position += 2;
+
+    size_t run = 0;
+    for (int shift = 0; position < data.size() && shift < 63; shift += 7) {
+      const Byte value = data[position++];
+      run |= static_cast<size_t>(value & 0x7F) << shift;
+      if (!(value & 0x80)) break;
+    }
+
+    if (run == 0 || run > frame_count - m_Frames.size()) {
+      LOG_ERROR("Corrupt movie file {}", movie_location);
+      return false;
+    }
+    m_Frames.insert(m_Frames.end(), run, keys);
+  }
+
+  m_Keys = 0;
+  m_Frame = 0;
+
+  LOG_INFO("Playing {} frames of input from {}", frame_count, movie_location);
+  return true;
+}
+
+void MoviePlayer::LatchFrame() {
+  m_Keys = m_Frame < m_Frames.size() ? m_Frames[m_Frame] : 0;
+  m_Frame += m_Frame < m_Frames.size();
+}
+
+}  // namespace Chip8
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Platform.h"
+#include "Quirks.h"
+
+using Byte = uint8_t;
+
+namespace Chip8 {
+
+// What a movie needs to reproduce a run from power-on besides the keys
+struct MovieSettings {
+  uint64_t random_seed = 0;
+  // Interpreter::HashMemory right after loading the ROM
+  uint64_t rom_hash = 0;
+  uint32_t instructions_per_second = 0;
+  bool display_wait_quirk = false;
+  QuirkProfile quirk_profile = QuirkProfile::Default;
+};
+
+// Key states are only sampled on the emulated 60 Hz ticks and held for the
+// whole frame, both while recording and while playing back. Together with
+// the seed and the CPU rate in the header, that makes a replay execute the
+// same instructions at any host speed, turbo included.
+
+// Records the keys of another input source, one 16-bit mask per frame
+class MovieRecorder : public InputSource {
+public:
+  MovieRecorder(std::shared_ptr<InputSource> live_input, const MovieSettings &settings);
+
+  bool IsKeyPressed(Byte key) const override { return (m_Keys >> (key & 0xF)) & 1; }
+  void LatchFrame() override;
+
+  uint32_t GetFrameCount() const { return static_cast<uint32_t>(m_Frames.size()); }
+
+  bool Save(const char *movie_location) const;
+
+private:
+  std::shared_ptr<InputSource> m_LiveInput;
+  MovieSettings m_Settings;
+
+  uint16_t m_Keys = 0;
+  std::vector<uint16_t> m_Frames;
+};
+
+// Plays a recorded movie back, no keys are pressed once it ends
+class MoviePlayer : public InputSource {
+public:
+  bool Open(const char *movie_location);
+
+  bool IsKeyPressed(Byte key) const override { return (m_Keys >> (key & 0xF)) & 1; }
+  void LatchFrame() override;
+
+  const MovieSettings &GetSettings() const { return m_Settings; }
+  uint32_t GetFrameCount() const { return static_cast<uint32_t>(m_Frames.size()); }
+  bool IsFinished() const { return m_Frame >= m_Frames.size(); }
+
+private:
+  MovieSettings m_Settings;
+
+  uint16_t m_Keys = 0;
+  std::vector<uint16_t> m_Frames;
+  size_t m_Frame = 0;
+};
+
+}  // namespace Chip8
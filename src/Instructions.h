@@ -0,0 +1,602 @@
+#pragma once
+
+// What every instruction does, written once for all the engines that run
+// them one at a time: the interpreter (and through it the threaded engine
+// and the JIT fallbacks) and each lane of LockstepEngine.
+//
+// A handler only sees the machine through Machine, which provides
+//   MachineState &State()
+//   Byte &V(unsigned int r)
+//   MemoryAddress &ProgramCounter(), &IndexRegister()
+//   Byte &DelayTimer(), &SoundTimer()
+//   bool IsKeyPressed(Byte key)
+//   Byte ReadMemory(MemoryAddress address)
+//   void WriteMemory(MemoryAddress address, Byte value)
+//   const ExtendedMemory *GetExtendedMemory()
+//   void EnableExtendedMemory()
+//   void FrameChanged()
+//   bool WaitForDisplay(), true while a sprite has to wait for the next frame
+// so an engine can keep any of them outside the MachineState. The program
+// counter already points past the instruction when a handler is called.
+
+#include <cstdlib>
+
+#include "Interpreter.h"
+#include "Logging.h"
+
+namespace Chip8 {
+
+// An opcode with its operands pulled out, the handler is left to the caller
+inline Instruction DecodeOperands(Opcode opcode) {
+  Instruction decoded;
+  decoded.handler = nullptr;
+  decoded.opcode = opcode;
+  decoded.x = GET_SECOND_NIBBLE(opcode);
+  decoded.y = GET_THIRD_NIBBLE(opcode);
+  decoded.n = GET_FOURTH_NIBBLE(opcode);
+  decoded.nn = GET_LAST_TWO_NIBBLES(opcode);
+  decoded.nnn = GET_LAST_THREE_NIBBLES(opcode);
+  return decoded;
+}
+
+namespace Instructions {
+
+// Past a taken skip, see GetSkipSize
+template <typename Quirks, typename Machine>
+inline void SkipNextInstruction(Machine &machine) {
+  machine.ProgramCounter() += GetSkipSize<Quirks>(machine.State(), machine.ProgramCounter());
+}
+
+template <typename Machine>
+inline void Op_Nop(Machine &, const Instruction &) {}
+
+template <typename Machine>
+inline void Op_Unknown(Machine &, const Instruction &) {
+  LOG_WARN("Unimplemented or incorrect opcode");
+}
+
+// 00E0: Clear Screen
+template <typename Machine>
+inline void Op_00E0(Machine &machine, const Instruction &) {
+  machine.State().frame_buffer.Clear();
+  machine.FrameChanged();
+  LOG_TRACE("ClearScreen");
+}
+
+// 00EE: Return from a subroutine
+template <typename Machine>
+inline void Op_00EE(Machine &machine, const Instruction &) {
+  MachineState &state = machine.State();
+  if (state.stack_pointer == 0) {
+    LOG_ERROR("Return with an empty call stack at {:X}, ignored", machine.ProgramCounter() - 2);
+    return;
+  }
+
+  auto memory_address = state.call_stack[--state.stack_pointer];
+
+  machine.ProgramCounter() = memory_address;
+
+  LOG_TRACE("Subroutine returned, memory address set to {}", memory_address);
+}
+
+// 1NNN: Move (Jump) the program counter to memory address NNN
+template <typename Machine>
+inline void Op_1NNN(Machine &machine, const Instruction &instruction) {
+  machine.ProgramCounter() = instruction.nnn;
+
+  LOG_TRACE("Jump to: {:X}", instruction.nnn);
+}
+
+// 2NNN: Call subroutine at NNN
+template <typename Machine>
+inline void Op_2NNN(Machine &machine, const Instruction &instruction) {
+  MachineState &state = machine.State();
+
+  // On overflow the call still happens, but there is nowhere to return to
+  if (state.stack_pointer < CALL_STACK_SIZE) {
+    state.call_stack[state.stack_pointer++] = machine.ProgramCounter();
+  } else {
+    LOG_ERROR("Call stack overflow at {:X}, more than {} nested calls",
+              machine.ProgramCounter() - 2, CALL_STACK_SIZE);
+  }
+
+  machine.ProgramCounter() = instruction.nnn;
+
+  LOG_TRACE("Called subroutine at memory address {}", instruction.nnn);
+}
+
+// 3XNN: Skip the next instruction if Vx == NN
+template <typename Quirks, typename Machine>
+inline void Op_3XNN(Machine &machine, const Instruction &instruction) {
+  if (machine.V(instruction.x) == instruction.nn) {
+    SkipNextInstruction<Quirks>(machine);
+  }
+
+  LOG_TRACE("Skip if V{} == {} ({})", instruction.x, instruction.nn,
+            machine.V(instruction.x) == instruction.nn);
+}
+
+// 4XNN: Skip the next instruction if Vx != NN
+template <typename Quirks, typename Machine>
+inline void Op_4XNN(Machine &machine, const Instruction &instruction) {
+  if (machine.V(instruction.x) != instruction.nn) {
+    SkipNextInstruction<Quirks>(machine);
+  }
+
+  LOG_TRACE("Skip if V{} != {} ({})", instruction.x, instruction.nn,
+            !(machine.V(instruction.x) == instruction.nn));
+}
+
+// 5XY0: Skip the next instruction if Vx == Vy
+template <typename Quirks, typename Machine>
+inline void Op_5XY0(Machine &machine, const Instruction &instruction) {
+  if (machine.V(instruction.x) == machine.V(instruction.y)) {
+    SkipNextInstruction<Quirks>(machine);
+  }
+
+  LOG_TRACE("Skip if V{} == V{} ({})", instruction.x, instruction.y,
+            machine.V(instruction.x) == machine.V(instruction.y));
+}
+
+// 6XNN: Set the register VX to the value NN
+template <typename Machine>
+inline void Op_6XNN(Machine &machine, const Instruction &instruction) {
+  machine.V(instruction.x) = instruction.nn;
+
+  LOG_TRACE("Set register V{:X} to {:X}", instruction.x, instruction.nn);
+}
+
+// 7XNN: Add the value NN to VX
+template <typename Machine>
+inline void Op_7XNN(Machine &machine, const Instruction &instruction) {
+  machine.V(instruction.x) += instruction.nn;
+
+  LOG_TRACE("Add {:X} to register V{:X}", instruction.nn, instruction.x);
+}
+
+// 8XY0: Set
+template <typename Machine>
+inline void Op_8XY0(Machine &machine, const Instruction &instruction) {
+  machine.V(instruction.x) = machine.V(instruction.y);
+  LOG_TRACE("Set V{} to the value of V{}: {}", instruction.x, instruction.y,
+            machine.V(instruction.y));
+}
+
+// 8XY1: Binary OR
+template <typename Quirks, typename Machine>
+inline void Op_8XY1(Machine &machine, const Instruction &instruction) {
+  machine.V(instruction.x) |= machine.V(instruction.y);
+  if constexpr (Quirks::logic_resets_flag) {
+    machine.V(FLAG_REGISTER) = 0;
+  }
+  LOG_TRACE("Binary OR V{} and V{}", instruction.x, instruction.y);
+}
+
+// 8XY2: Binary AND
+template <typename Quirks, typename Machine>
+inline void Op_8XY2(Machine &machine, const Instruction &instruction) {
+  machine.V(instruction.x) &= machine.V(instruction.y);
+  if constexpr (Quirks::logic_resets_flag) {
+    machine.V(FLAG_REGISTER) = 0;
+  }
+  LOG_TRACE("Binary AND V{} and V{}", instruction.x, instruction.y);
+}
+
+// 8XY3: Logical XOR
+template <typename Quirks, typename Machine>
+inline void Op_8XY3(Machine &machine, const Instruction &instruction) {
+  machine.V(instruction.x) ^= machine.V(instruction.y);
+  if constexpr (Quirks::logic_resets_flag) {
+    machine.V(FLAG_REGISTER) = 0;
+  }
+  LOG_TRACE("Binary XOR V{} and V{}", instruction.x, instruction.y);
+}
+
+// 8XY4: Add, VF is the carry. The flag is worked out from the operands
+// and written last, so it wins when x or y is F.
+template <typename Machine>
+inline void Op_8XY4(Machine &machine, const Instruction &instruction) {
+  const unsigned int sum = machine.V(instruction.x) + machine.V(instruction.y);
+  machine.V(instruction.x) = sum & 0xFF;
+  machine.V(FLAG_REGISTER) = sum > 0xFF ? 1 : 0;
+
+  LOG_TRACE("Add V{} and V{}", instruction.x, instruction.y);
+}
+
+// 8XY5: Subtract VX - VY, VF is 1 when there is no borrow (Vx >= Vy)
+template <typename Machine>
+inline void Op_8XY5(Machine &machine, const Instruction &instruction) {
+  const Byte flag = machine.V(instruction.x) >= machine.V(instruction.y) ? 1 : 0;
+  machine.V(instruction.x) = machine.V(instruction.x) - machine.V(instruction.y);
+  machine.V(FLAG_REGISTER) = flag;
+
+  LOG_TRACE("Subtracted V{} - V{}", instruction.x, instruction.y);
+}
+
+// 8XY6: Shift right
+template <typename Quirks, typename Machine>
+inline void Op_8XY6(Machine &machine, const Instruction &instruction) {
+  const Byte source = Quirks::shift_in_place ? instruction.x : instruction.y;
+  machine.V(instruction.x) = machine.V(source);
+
+  Byte flag = GET_LAST_BIT(machine.V(instruction.x));
+
+  machine.V(instruction.x) >>= 1;
+
+  machine.V(FLAG_REGISTER) = flag;
+  LOG_TRACE("Set V{} to V{} and shifted 1 bit right", instruction.x, source);
+}
+
+// 8XY7: Subtract VY - VX, VF is 1 when there is no borrow (Vy >= Vx)
+template <typename Machine>
+inline void Op_8XY7(Machine &machine, const Instruction &instruction) {
+  const Byte flag = machine.V(instruction.y) >= machine.V(instruction.x) ? 1 : 0;
+  machine.V(instruction.x) = machine.V(instruction.y) - machine.V(instruction.x);
+  machine.V(FLAG_REGISTER) = flag;
+  LOG_TRACE("Subtracted V{} - V{}", instruction.y, instruction.x);
+}
+
+// 8XYE: Shift left
+template <typename Quirks, typename Machine>
+inline void Op_8XYE(Machine &machine, const Instruction &instruction) {
+  const Byte source = Quirks::shift_in_place ? instruction.x : instruction.y;
+  machine.V(instruction.x) = machine.V(source);
+
+  Byte flag = GET_FIRST_BIT(machine.V(instruction.x));
+
+  machine.V(instruction.x) <<= 1;
+
+  machine.V(FLAG_REGISTER) = flag;
+  LOG_TRACE("Set V{} to V{} and shifted 1 bit left", instruction.x, source);
+}
+
+// 9XY0: Skip the next instruction if Vx != Vy
+template <typename Quirks, typename Machine>
+inline void Op_9XY0(Machine &machine, const Instruction &instruction) {
+  if (machine.V(instruction.x) != machine.V(instruction.y)) {
+    SkipNextInstruction<Quirks>(machine);
+  }
+
+  LOG_TRACE("Skip if V{} != V{} ({})", instruction.x, instruction.y,
+            !(machine.V(instruction.x) == machine.V(instruction.y)));
+}
+
+// ANNN: Set Index Register to the value NNN
+template <typename Machine>
+inline void Op_ANNN(Machine &machine, const Instruction &instruction) {
+  machine.IndexRegister() = instruction.nnn;
+
+  LOG_TRACE("Set IndexRegister to {:X}", instruction.nnn);
+}
+
+// BNNN: Jump with offset
+template <typename Quirks, typename Machine>
+inline void Op_BNNN(Machine &machine, const Instruction &instruction) {
+  const Byte offset = machine.V(Quirks::jump_uses_vx ? instruction.x : 0x0);
+  machine.ProgramCounter() = instruction.nnn + offset;
+
+  LOG_TRACE("Jumped to {} with offset {}", instruction.nnn, offset);
+}
+
+// CXNN: Generate random number & NN into Vx
+template <typename Machine>
+inline void Op_CXNN(Machine &machine, const Instruction &instruction) {
+  machine.V(instruction.x) = NextRandomByte(machine.State().random_state) & instruction.nn;
+  LOG_TRACE("Generated random value {} for V{}", machine.V(instruction.x), instruction.x);
+}
+
+// DXYN: Display N-pixel tall sprite from the index register to the XY
+// location from { VX, VY } registers
+template <typename Machine>
+inline void Op_DXYN(Machine &machine, const Instruction &instruction) {
+  // Display wait quirk: only one sprite per frame, the draw is retried
+  // until the next 60 Hz tick like FX0A retries until a key is pressed
+  if (machine.WaitForDisplay()) {
+    machine.ProgramCounter() -= INSTRUCTION_SIZE;
+    return;
+  }
+
+  auto flag = DrawSprite(machine.State(), machine.GetExtendedMemory(), machine.IndexRegister(),
+                         machine.V(instruction.x), machine.V(instruction.y), instruction.n);
+  machine.FrameChanged();
+
+  machine.V(FLAG_REGISTER) = (Byte)flag;
+
+  LOG_TRACE("Draw sprite with height {:X} at {} {}", instruction.n, machine.V(instruction.x),
+            machine.V(instruction.y));
+}
+
+// EX9E: Skip if key in Vx is pressed
+template <typename Quirks, typename Machine>
+inline void Op_EX9E(Machine &machine, const Instruction &instruction) {
+  auto key = machine.V(instruction.x);
+
+  if (machine.IsKeyPressed(key)) {
+    SkipNextInstruction<Quirks>(machine);
+    LOG_TRACE("Key pressed {:X}, jump", key);
+  } else {
+    LOG_TRACE("Key not pressed {:X}", key);
+  }
+}
+
+// EXA1: Skip if key in Vx is not pressed
+template <typename Quirks, typename Machine>
+inline void Op_EXA1(Machine &machine, const Instruction &instruction) {
+  auto key = machine.V(instruction.x);
+
+  if (!machine.IsKeyPressed(key)) {
+    SkipNextInstruction<Quirks>(machine);
+    LOG_TRACE("Key not pressed {:X}, jump", key);
+  } else {
+    LOG_TRACE("Key pressed {:X}", key);
+  }
+}
+
+// FX07: Set Vx to value of delay timer
+template <typename Machine>
+inline void Op_FX07(Machine &machine, const Instruction &instruction) {
+  machine.V(instruction.x) = machine.DelayTimer();
+
+  LOG_TRACE("Set V{} to {}", instruction.x, machine.DelayTimer());
+}
+
+// FX0A: Block until key is pressed
+template <typename Machine>
+inline void Op_FX0A(Machine &machine, const Instruction &instruction) {
+  LOG_TRACE("Awaiting key press...");
+
+  bool key_pressed = false;
+  int key;
+  for (int i = 0; i <= 0xF; ++i) {
+    if (machine.IsKeyPressed(i)) {
+      key_pressed = true;
+      key = i;
+
+      LOG_TRACE("Key pressed");
+    }
+  }
+
+  if (!key_pressed) {
+    machine.ProgramCounter() -= INSTRUCTION_SIZE;
+  } else {
+    machine.V(instruction.x) = key;
+  }
+}
+
+// FX15: Set the delay timer to Vx
+template <typename Machine>
+inline void Op_FX15(Machine &machine, const Instruction &instruction) {
+  machine.DelayTimer() = machine.V(instruction.x);
+
+  LOG_TRACE("Set delay timer to V{}", instruction.x);
+}
+
+// FX18: Set the sound timer to Vx
+template <typename Machine>
+inline void Op_FX18(Machine &machine, const Instruction &instruction) {
+  machine.SoundTimer() = machine.V(instruction.x);
+
+  LOG_TRACE("Set sound timer to V{}", instruction.x);
+}
+
+// FX1E: I = I + Vx
+template <typename Machine>
+inline void Op_FX1E(Machine &machine, const Instruction &instruction) {
+  machine.IndexRegister() += machine.V(instruction.x);
+  LOG_TRACE("I += V{}", instruction.x);
+}
+
+// FX29: Font character
+template <typename Machine>
+inline void Op_FX29(Machine &machine, const Instruction &instruction) {
+  machine.IndexRegister() = FONTSET_START + 5 * machine.V(instruction.x);
+
+  LOG_TRACE("Index register set to location of character {}", machine.V(instruction.x));
+}
+
+// FX33: Binary-coded decimal conversion
+template <typename Machine>
+inline void Op_FX33(Machine &machine, const Instruction &instruction) {
+  auto number = machine.V(instruction.x);
+
+  auto digit1 = number / 100;
+  auto digit2 = (number / 10) % 10;
+  auto digit3 = number % 10;
+
+  const MemoryAddress address = machine.IndexRegister();
+  machine.WriteMemory(address, digit1);
+  machine.WriteMemory(address + 1, digit2);
+  machine.WriteMemory(address + 2, digit3);
+
+  LOG_TRACE("Converted number {} into {} {} {}", number, digit1, digit2, digit3);
+}
+
+// FX55: Store registers V0 to Vx in memory
+template <typename Quirks, typename Machine>
+inline void Op_FX55(Machine &machine, const Instruction &instruction) {
+  for (int i = 0; i <= instruction.x; ++i) {
+    machine.WriteMemory(machine.IndexRegister() + i, machine.V(i));
+  }
+
+  LOG_TRACE("Stored registers from V0 to V{:X} in memory starting at {}", instruction.x,
+            machine.IndexRegister());
+
+  if constexpr (Quirks::load_store_increments_index) {
+    machine.IndexRegister() += instruction.x + 1;
+  }
+}
+
+// FX65: Load registers V0 to Vx from memory
+template <typename Quirks, typename Machine>
+inline void Op_FX65(Machine &machine, const Instruction &instruction) {
+  for (int i = 0; i <= instruction.x; ++i) {
+    machine.V(i) = machine.ReadMemory(machine.IndexRegister() + i);
+  }
+
+  LOG_TRACE("Loaded registers from V0 to V{:X} from memory starting at {}", instruction.x,
+            machine.IndexRegister());
+
+  if constexpr (Quirks::load_store_increments_index) {
+    machine.IndexRegister() += instruction.x + 1;
+  }
+}
+
+// 00CN: Scroll the selected planes down N pixels
+template <typename Machine>
+inline void Op_00CN(Machine &machine, const Instruction &instruction) {
+  machine.State().frame_buffer.ScrollDown(instruction.n);
+  machine.FrameChanged();
+  LOG_TRACE("Scrolled down {}", instruction.n);
+}
+
+// 00DN: Scroll the selected planes up N pixels
+template <typename Machine>
+inline void Op_00DN(Machine &machine, const Instruction &instruction) {
+  machine.State().frame_buffer.ScrollUp(instruction.n);
+  machine.FrameChanged();
+  LOG_TRACE("Scrolled up {}", instruction.n);
+}
+
+// 00FB: Scroll the selected planes right 4 pixels
+template <typename Machine>
+inline void Op_00FB(Machine &machine, const Instruction &) {
+  machine.State().frame_buffer.ScrollRight(4);
+  machine.FrameChanged();
+  LOG_TRACE("Scrolled right");
+}
+
+// 00FC: Scroll the selected planes left 4 pixels
+template <typename Machine>
+inline void Op_00FC(Machine &machine, const Instruction &) {
+  machine.State().frame_buffer.ScrollLeft(4);
+  machine.FrameChanged();
+  LOG_TRACE("Scrolled left");
+}
+
+// 00FD: Exit, the program stays on this instruction from then on
+template <typename Machine>
+inline void Op_00FD(Machine &machine, const Instruction &) {
+  machine.ProgramCounter() -= INSTRUCTION_SIZE;
+  LOG_TRACE("Exit");
+}
+
+// 00FE: Low resolution, clears the screen
+template <typename Machine>
+inline void Op_00FE(Machine &machine, const Instruction &) {
+  machine.State().frame_buffer.SetHighResolution(false);
+  machine.FrameChanged();
+  LOG_TRACE("Low resolution");
+}
+
+// 00FF: High resolution, clears the screen
+template <typename Machine>
+inline void Op_00FF(Machine &machine, const Instruction &) {
+  machine.State().frame_buffer.SetHighResolution(true);
+  machine.FrameChanged();
+  LOG_TRACE("High resolution");
+}
+
+// 5XY2: Store registers Vx to Vy in memory, in descending order if x > y
+template <typename Machine>
+inline void Op_5XY2(Machine &machine, const Instruction &instruction) {
+  const int step = instruction.x <= instruction.y ? 1 : -1;
+  const int count = std::abs(instruction.y - instruction.x) + 1;
+
+  for (int i = 0; i < count; ++i) {
+    machine.WriteMemory(machine.IndexRegister() + i, machine.V(instruction.x + i * step));
+  }
+
+  LOG_TRACE("Stored registers from V{:X} to V{:X} in memory starting at {}", instruction.x,
+            instruction.y, machine.IndexRegister());
+}
+
+// 5XY3: Load registers Vx to Vy from memory, in descending order if x > y
+template <typename Machine>
+inline void Op_5XY3(Machine &machine, const Instruction &instruction) {
+  const int step = instruction.x <= instruction.y ? 1 : -1;
+  const int count = std::abs(instruction.y - instruction.x) + 1;
+
+  for (int i = 0; i < count; ++i) {
+    machine.V(instruction.x + i * step) = machine.ReadMemory(machine.IndexRegister() + i);
+  }
+
+  LOG_TRACE("Loaded registers from V{:X} to V{:X} from memory starting at {}", instruction.x,
+            instruction.y, machine.IndexRegister());
+}
+
+// F000 NNNN: Set the index register to the 16-bit address after the opcode.
+// Only the profiles with long_skip have it.
+template <typename Quirks, typename Machine>
+inline void Op_F000(Machine &machine, const Instruction &instruction) {
+  if constexpr (!Quirks::long_skip) {
+    Op_Unknown(machine, instruction);
+  } else {
+    const MachineState &state = machine.State();
+    const MemoryAddress address = machine.ProgramCounter() & MEMORY_MASK;
+    machine.IndexRegister() =
+        (state.memory[address] << 8) | state.memory[(address + 1) & MEMORY_MASK];
+    machine.ProgramCounter() += INSTRUCTION_SIZE;
+
+    // A program with 16-bit addresses expects all of memory
+    machine.EnableExtendedMemory();
+
+    LOG_TRACE("Set IndexRegister to {:X}", machine.IndexRegister());
+  }
+}
+
+// FN01: Select the planes N for drawing, clearing and scrolling
+template <typename Machine>
+inline void Op_FN01(Machine &machine, const Instruction &instruction) {
+  machine.State().frame_buffer.SetPlaneMask(instruction.x);
+  LOG_TRACE("Selected planes {:X}", instruction.x);
+}
+
+// F002: Load the 16-byte audio pattern from memory
+template <typename Machine>
+inline void Op_F002(Machine &machine, const Instruction &) {
+  MachineState &state = machine.State();
+  for (size_t i = 0; i < state.audio_pattern.size(); ++i) {
+    state.audio_pattern[i] = machine.ReadMemory(machine.IndexRegister() + i);
+  }
+
+  LOG_TRACE("Loaded audio pattern from {}", machine.IndexRegister());
+}
+
+// FX30: Big font character
+template <typename Machine>
+inline void Op_FX30(Machine &machine, const Instruction &instruction) {
+  machine.IndexRegister() = BIG_FONTSET_START + 10 * machine.V(instruction.x);
+
+  LOG_TRACE("Index register set to location of big character {}", machine.V(instruction.x));
+}
+
+// FX3A: Set the audio pitch to Vx
+template <typename Machine>
+inline void Op_FX3A(Machine &machine, const Instruction &instruction) {
+  machine.State().audio_pitch = machine.V(instruction.x);
+
+  LOG_TRACE("Set audio pitch to V{}", instruction.x);
+}
+
+// FX75: Store registers V0 to Vx in the persistent flags
+template <typename Machine>
+inline void Op_FX75(Machine &machine, const Instruction &instruction) {
+  for (int i = 0; i <= instruction.x; ++i) {
+    machine.State().flags[i] = machine.V(i);
+  }
+
+  LOG_TRACE("Stored registers from V0 to V{:X} in the flags", instruction.x);
+}
+
+// FX85: Load registers V0 to Vx from the persistent flags
+template <typename Machine>
+inline void Op_FX85(Machine &machine, const Instruction &instruction) {
+  for (int i = 0; i <= instruction.x; ++i) {
+    machine.V(i) = machine.State().flags[i];
+  }
+
+  LOG_TRACE("Loaded registers from V0 to V{:X} from the flags", instruction.x);
+}
+
+}  // namespace Instructions
+}  // namespace Chip8
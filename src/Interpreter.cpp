@@ -1,603 +1,890 @@
 #include "Interpreter.h"
 
-#include <SDL3/SDL.h>
-#include <imgui.h>
-#include <imgui_memory_editor.h>
-
+#include <algorithm>
+#include <bit>
 #include <cassert>
 #include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <ctime>
-#include <fstream>
-#include <ios>
 
-#include "Keycodes.h"
+#include "Instructions.h"
 #include "Logging.h"
+#include "Profiler.h"
+#include "RomCatalog.h"
+#include "TraceRecorder.h"
+
+#if CHIP8_JIT_ENABLED
+#include "Jit.h"
+#endif
+
+#define CHIP8_LOG_SUBSYSTEM CORE
 
 namespace Chip8 {
 
-Interpreter::Interpreter(const char *rom_location)
-    : m_IndexRegister(0), m_ProgramCounter(ROM_START) {
+Interpreter::Interpreter(const char *rom_location) {
   this->LoadFont();
   this->LoadROM(rom_location);
+  this->InvalidateInstructions();
+  this->ResetTimerSchedule();
 }
 
-void Interpreter::Run() {
-  bool increment_program_counter = true;
+Interpreter::~Interpreter() = default;
 
-  m_CurrentOpcode = (m_Memory[m_ProgramCounter] << 8) | (m_Memory[m_ProgramCounter + 1]);
+// Inline so the traced loop only calls the handler
+inline void Interpreter::RunTraced(TraceRecorder &recorder, const Instruction &instruction) {
+  // Read from memory, the instruction may not be decoded yet
+  const MemoryAddress program_counter = m_State.program_counter;
+  const Byte x = m_State.memory[program_counter & MEMORY_MASK] & 0xF;
+  const Byte x_before = m_State.registers[x];
+  const Byte flag_before = m_State.registers[FLAG_REGISTER];
 
-  auto first_nibble = GET_FIRST_NIBBLE(m_CurrentOpcode);
+  m_State.program_counter += INSTRUCTION_SIZE;
+  instruction.handler(*this, instruction);
 
-  this->DecrementTimers();
+  m_State.current_opcode = instruction.opcode;
 
-  switch (first_nibble) {
-    // DXYN: Display N-pixel tall sprite from the index register to the XY
-    // location from { VX, VY } registers
-    case 0xD: {
-      auto x = GET_SECOND_NIBBLE(m_CurrentOpcode);
-      auto y = GET_THIRD_NIBBLE(m_CurrentOpcode);
-      size_t n = GET_FOURTH_NIBBLE(m_CurrentOpcode);
+  // Only the raw values, the writer thread works out what changed
+  const uint64_t cycle = m_State.cycles - 1;
+  recorder.Record({static_cast<uint32_t>(cycle), static_cast<uint16_t>(cycle >> 32),
+                   program_counter, instruction.opcode, m_State.index_register, x_before,
+                   m_State.registers[x], flag_before, m_State.registers[FLAG_REGISTER]});
+}
 
-      std::vector<Byte> sprite(n);
+void Interpreter::Run() {
+  if (m_TraceRecorder) [[unlikely]] {
+    const Instruction &instruction = m_Instructions[m_State.program_counter & MEMORY_MASK];
+    this->AdvanceCycles(1);
+    this->RunTraced(*m_TraceRecorder, instruction);
+    return;
+  }
 
-      for (int i = m_IndexRegister; i < m_IndexRegister + n; ++i) {
-        sprite[i - m_IndexRegister] = m_Memory[i];
-      }
+  this->Step();
+}
 
-      auto flag = m_DisplayPointer->LoadSprite(m_Registers[x], m_Registers[y], sprite);
-      m_DisplayPointer->UpdateDisplayData();
+unsigned int Interpreter::ExecuteTraced(unsigned int max_instructions) {
+  TraceRecorder &recorder = *m_TraceRecorder;
 
-      m_Registers[FLAG_REGISTER] = (Byte)flag;
+  for (unsigned int i = 0; i < max_instructions; ++i) {
+    const Instruction &instruction = m_Instructions[m_State.program_counter & MEMORY_MASK];
 
-      LOG_TRACE("Draw sprite with height {:X} at {} {}", n, m_Registers[x], m_Registers[y]);
-      break;
-    }
+    this->AdvanceCycles(1);
+    this->RunTraced(recorder, instruction);
+  }
 
-    case 0x0: {
-      // 00E0: Clear Screen
-      if (m_CurrentOpcode == 0x00E0) {
-        m_DisplayPointer->ClearDisplay();
-        LOG_TRACE("ClearScreen");
-        break;
-      }
+  return max_instructions;
+}
 
-      // 00EE: Return from a subroutine
-      if (m_CurrentOpcode == 0x00EE) {
-        auto memory_address = m_CallStack.top();
-        m_CallStack.pop();
+#if CHIP8_PROFILER_ENABLED
+unsigned int Interpreter::ExecuteProfiled(unsigned int max_instructions) {
+  Profiler &profiler = *m_Profiler;
+
+  for (unsigned int i = 0; i < max_instructions; ++i) {
+    // Read from memory, the instruction may not be decoded yet
+    const MemoryAddress program_counter = m_State.program_counter & MEMORY_MASK;
+    const Opcode opcode = m_State.memory[program_counter] << 8 |
+                          m_State.memory[(program_counter + 1) & MEMORY_MASK];
+    const InstructionType type = DecodeType(opcode);
+
+    profiler.Record(program_counter, type);
+    this->Run();
+
+    // FX0A stays on itself while no key is pressed, FX07 reads the timer as
+    // ticked before it ran
+    if (type == InstructionType::Op_FX0A && m_State.program_counter == program_counter) {
+      profiler.RecordKeyWait();
+    } else if (type == InstructionType::Op_FX07) {
+      profiler.RecordDelayPoll(program_counter, m_State.cycles, m_State.delay_timer);
+    }
+  }
 
-        m_ProgramCounter = memory_address;
+  return max_instructions;
+}
+#endif
 
-        LOG_TRACE("Subroutine returned, memory address set to {}", memory_address);
-        break;
-      }
-      break;
-    }
+unsigned int Interpreter::Execute(unsigned int max_instructions) {
+#if CHIP8_PROFILER_ENABLED
+  if (m_Profiler) {
+    return this->ExecuteProfiled(max_instructions);
+  }
+#endif
 
-    // 1NNN: Move (Jump) the program counter to memory address NNN
-    case 0x1: {
-      MemoryAddress memory_address = GET_LAST_THREE_NIBBLES(m_CurrentOpcode);
-      m_ProgramCounter = memory_address;
-      increment_program_counter = false;
+  // The engines don't record traces, so tracing always interprets
+  if (m_TraceRecorder) {
+    return this->ExecuteTraced(max_instructions);
+  }
 
-      LOG_TRACE("Jump to: {:X}", memory_address);
-      break;
+  switch (m_ExecutionEngine) {
+    case ExecutionEngine::Threaded: {
+      return (this->*m_ExecuteThreaded)(max_instructions);
     }
+    case ExecutionEngine::Jit: {
+      return this->ExecuteJit(max_instructions);
+    }
+    default: {
+      for (unsigned int i = 0; i < max_instructions; ++i) {
+        this->Step();
+      }
+      return max_instructions;
+    }
+  }
+}
 
-    // 2NNN: Call subroutine at NNN
-    case 0x2: {
-      m_CallStack.push(m_ProgramCounter);
-
-      MemoryAddress memory_address = GET_LAST_THREE_NIBBLES(m_CurrentOpcode);
-      m_ProgramCounter = memory_address;
+void Interpreter::SetExecutionEngine(ExecutionEngine engine) {
+  m_ExecutionEngine = engine;
 
-      increment_program_counter = false;
+  if (engine != ExecutionEngine::Jit) {
+    m_Jit.reset();
+    return;
+  }
 
-      LOG_TRACE("Called subroutine at memory address {}", memory_address);
-      break;
-    }
+#if CHIP8_JIT_ENABLED
+  if (!m_Jit) {
+    m_Jit = std::make_unique<Jit>(*this);
+    m_Jit->SetQuirkProfile(m_QuirkProfile);
+  }
 
-    // 3XNN: Increment program counter by 2 if Vx == NN
-    case 0x3: {
-      auto register_name = GET_SECOND_NIBBLE(m_CurrentOpcode);
-      auto value = GET_LAST_TWO_NIBBLES(m_CurrentOpcode);
+  if (m_Jit->IsAvailable()) {
+    return;
+  }
 
-      if (m_Registers[register_name] == value) {
-        m_ProgramCounter += INSTRUCTION_SIZE;
-      }
+  m_Jit.reset();
+#endif
 
-      LOG_TRACE("Skip if V{} == {} ({})", register_name, value,
-                m_Registers[register_name] == value);
+  LOG_WARN("JIT is not available in this build, using the interpreter");
+  m_ExecutionEngine = ExecutionEngine::Interpreter;
+}
 
-      break;
-    }
+unsigned int Interpreter::ExecuteJit(unsigned int max_instructions) {
+  unsigned int executed = 0;
 
-    // 4XNN: Increment program counter by 2 if Vx != NN
-    case 0x4: {
-      auto register_name = GET_SECOND_NIBBLE(m_CurrentOpcode);
-      auto value = GET_LAST_TWO_NIBBLES(m_CurrentOpcode);
+#if CHIP8_JIT_ENABLED
+  while (executed < max_instructions) {
+    if (m_State.program_counter < MEMORY_SIZE) {
+      const unsigned int ran = m_Jit->Run(max_instructions - executed);
 
-      if (m_Registers[register_name] != value) {
-        m_ProgramCounter += INSTRUCTION_SIZE;
+      if (ran > 0) {
+        executed += ran;
+        continue;
       }
-
-      LOG_TRACE("Skip if V{} != {} ({})", register_name, value,
-                !(m_Registers[register_name] == value));
-
-      break;
     }
 
-    // 5XY0: Increment program counter by 2 if Vx == Vy
-    case 0x5: {
-      auto register_name_x = GET_SECOND_NIBBLE(m_CurrentOpcode);
-      auto register_name_y = GET_THIRD_NIBBLE(m_CurrentOpcode);
+    this->Step();
+    executed++;
+  }
+#endif
 
-      if (m_Registers[register_name_x] == m_Registers[register_name_y]) {
-        m_ProgramCounter += INSTRUCTION_SIZE;
-      }
+  return executed;
+}
 
-      LOG_TRACE("Skip if V{} == V{} ({})", register_name_x, register_name_y,
-                m_Registers[register_name_x] == m_Registers[register_name_y]);
+// Computed goto is a GNU extension, other compilers call the handlers
+// through the Instruction function pointers instead
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(CHIP8_NO_COMPUTED_GOTO)
+#define CHIP8_COMPUTED_GOTO 1
+#else
+#define CHIP8_COMPUTED_GOTO 0
+#endif
+
+constexpr unsigned int MAX_THREADED_BLOCK_LENGTH = 64;
+constexpr size_t MAX_THREADED_OPS = 16 * 1024;
+
+template <typename Quirks>
+unsigned int Interpreter::ExecuteThreaded(unsigned int max_instructions) {
+#if CHIP8_COMPUTED_GOTO
+  static const void *const s_Targets[] = {
+#define CHIP8_INSTRUCTION_LABEL(name) &&op_##name,
+      CHIP8_INSTRUCTIONS(CHIP8_INSTRUCTION_LABEL, CHIP8_INSTRUCTION_LABEL)
+#undef CHIP8_INSTRUCTION_LABEL
+  };
+#else
+  static const void *const *s_Targets = nullptr;
+#endif
+
+  unsigned int executed = 0;
+
+  while (executed < max_instructions) {
+    if (m_DirtyPages) {
+      this->InvalidateDirtyBlocks();
+    }
 
-      break;
+    if (m_State.program_counter >= MEMORY_SIZE) {
+      this->Run();
+      executed++;
+      continue;
     }
 
-    // 6XNN: Set the register VX to the value NN
-    case 0x6: {
-      auto register_name = GET_SECOND_NIBBLE(m_CurrentOpcode);
-      auto value = GET_LAST_TWO_NIBBLES(m_CurrentOpcode);
+    if (m_ThreadedBlocks[m_State.program_counter].length == 0) {
+      this->CompileThreadedBlock<Quirks>(m_State.program_counter, s_Targets);
+    }
 
-      m_Registers[register_name] = value;
+    const ThreadedBlock *block = &m_ThreadedBlocks[m_State.program_counter];
 
-      LOG_TRACE("Set register V{:X} to {:X}", register_name, value);
-      break;
+    // Not enough budget left for the whole block, finish one at a time
+    if (block->length > max_instructions - executed) {
+      this->Run();
+      executed++;
+      continue;
     }
 
-    // 7XNN: Add the value NN to VX
-    case 0x7: {
-      auto register_name = GET_SECOND_NIBBLE(m_CurrentOpcode);
-      auto value = GET_LAST_TWO_NIBBLES(m_CurrentOpcode);
+    // Runs blocks back to back through their successors until one is not
+    // compiled, memory was written or the budget would run out
+    for (;;) {
+      const ThreadedOp *op = &m_ThreadedOps[block->first_op];
+      const ThreadedOp *const end = op + block->length;
+
+      executed += block->length;
+
+#if CHIP8_COMPUTED_GOTO
+#define CHIP8_DISPATCH()                       \
+  if (op == end) goto block_done;              \
+  this->AdvanceCycles(1);                      \
+  m_State.program_counter += INSTRUCTION_SIZE; \
+  goto *op->target;
+
+      CHIP8_DISPATCH();
+
+#define CHIP8_INSTRUCTION_BODY(name)      \
+  op_##name : Op_##name(op->instruction); \
+  ++op;                                   \
+  CHIP8_DISPATCH();
+#define CHIP8_QUIRK_BODY(name)                    \
+  op_##name : Op_##name<Quirks>(op->instruction); \
+  ++op;                                           \
+  CHIP8_DISPATCH();
+
+      CHIP8_INSTRUCTIONS(CHIP8_INSTRUCTION_BODY, CHIP8_QUIRK_BODY)
+
+#undef CHIP8_QUIRK_BODY
+#undef CHIP8_INSTRUCTION_BODY
+#undef CHIP8_DISPATCH
+
+    block_done:
+#else
+      for (; op != end; ++op) {
+        this->AdvanceCycles(1);
+        m_State.program_counter += INSTRUCTION_SIZE;
+        op->instruction.handler(*this, op->instruction);
+      }
+#endif
+
+      m_State.current_opcode = (end - 1)->instruction.opcode;
 
-      m_Registers[register_name] += value;
+      const ThreadedBlock *next = block->GetSuccessor(m_State.program_counter);
+      if (m_DirtyPages || !next || next->length == 0 ||
+          next->length > max_instructions - executed) {
+        break;
+      }
 
-      LOG_TRACE("Add {:X} to register V{:X}", value, register_name);
-      break;
+      block = next;
     }
+  }
 
-    // 8XYN: Logical and arithmetic instructions
-    case 0x8: {
-      auto type = GET_FOURTH_NIBBLE(m_CurrentOpcode);
-      auto register_name_x = GET_SECOND_NIBBLE(m_CurrentOpcode);
-      auto register_name_y = GET_THIRD_NIBBLE(m_CurrentOpcode);
+  return executed;
+}
 
-      switch (type) {
-        // 8XY0: Set
-        case 0x0: {
-          m_Registers[register_name_x] = m_Registers[register_name_y];
-          LOG_TRACE("Set V{} to the value of V{}: {}", register_name_x, register_name_y,
-                    m_Registers[register_name_y]);
-          break;
-        }
+template <typename Quirks>
+void Interpreter::CompileThreadedBlock(MemoryAddress address, const void *const *targets) {
+  if (m_ThreadedOps.size() + MAX_THREADED_BLOCK_LENGTH > MAX_THREADED_OPS) {
+    for (auto start : m_ThreadedBlockStarts) {
+      m_ThreadedBlocks[start] = ThreadedBlock{};
+    }
+    m_ThreadedBlockStarts.clear();
+    m_ThreadedOps.clear();
+  }
 
-        // 8XY1: Binary OR
-        case 0x1: {
-          m_Registers[register_name_x] |= m_Registers[register_name_y];
-          LOG_TRACE("Binary OR V{} and V{}", register_name_x, register_name_y);
+  // Reserved once, so ops never move while a block is running and compiling
+  // never allocates after the first block
+  m_ThreadedOps.reserve(MAX_THREADED_OPS);
+  m_ThreadedBlockStarts.reserve(MEMORY_SIZE);
 
-          break;
-        }
+  ThreadedBlock &block = m_ThreadedBlocks[address];
+  block.first_op = m_ThreadedOps.size();
 
-        // 8XY2: Binary AND
-        case 0x2: {
-          m_Registers[register_name_x] &= m_Registers[register_name_y];
-          LOG_TRACE("Binary AND V{} and V{}", register_name_x, register_name_y);
+  MemoryAddress program_counter = address;
+  bool block_ended = false;
+  bool skip_at_end = false;
 
-          break;
-        }
+  while (!block_ended && block.length < MAX_THREADED_BLOCK_LENGTH) {
+    const MemoryAddress opcode_address = program_counter & MEMORY_MASK;
+    const Opcode opcode =
+        (m_State.memory[opcode_address] << 8) | m_State.memory[(opcode_address + 1) & MEMORY_MASK];
+    const InstructionType type = DecodeType(opcode);
 
-        // 8XY3: Logical XOR
-        case 0x3: {
-          m_Registers[register_name_x] ^= m_Registers[register_name_y];
-          LOG_TRACE("Binary XOR V{} and V{}", register_name_x, register_name_y);
+    ThreadedOp op;
+    op.target = targets ? targets[(size_t)type] : nullptr;
+    op.instruction = DecodeOperands(opcode);
+    op.instruction.handler = DecodeHandler(opcode);
 
-          break;
-        }
+    m_ThreadedOps.push_back(op);
+    block.length++;
 
-        // 8XY4: Add
-        case 0x4: {
-          m_Registers[register_name_x] += m_Registers[register_name_y];
-          if ((int)(m_Registers[register_name_x] + m_Registers[register_name_y]) > 255) {
-            m_Registers[FLAG_REGISTER] = 1;
-          } else {
-            m_Registers[FLAG_REGISTER] = 0;
-          }
+    block.pages |= 1ull << (opcode_address >> MEMORY_PAGE_SHIFT);
+    block.pages |= 1ull << (((opcode_address + 1) & MEMORY_MASK) >> MEMORY_PAGE_SHIFT);
 
-          LOG_TRACE("Add V{} and V{}", register_name_x, register_name_y);
+    program_counter += INSTRUCTION_SIZE;
 
-          break;
-        }
+    switch (type) {
+      // The ops after a jump or call are the ones at its target
+      case InstructionType::Op_1NNN:
+      case InstructionType::Op_2NNN: {
+        program_counter = op.instruction.nnn;
+        break;
+      }
+      case InstructionType::Op_3XNN:
+      case InstructionType::Op_4XNN:
+      case InstructionType::Op_5XY0:
+      case InstructionType::Op_9XY0:
+      case InstructionType::Op_EX9E:
+      case InstructionType::Op_EXA1: {
+        skip_at_end = true;
+        block_ended = true;
+        break;
+      }
+      // Anything else that moves the program counter other than forward,
+      // and the memory writes, so a block never runs past code it may have
+      // modified
+      case InstructionType::Op_00EE:
+      case InstructionType::Op_BNNN:
+      case InstructionType::Op_DXYN:
+      case InstructionType::Op_FX0A:
+      case InstructionType::Op_FX33:
+      case InstructionType::Op_FX55:
+      case InstructionType::Op_00FD:
+      case InstructionType::Op_5XY2:
+      case InstructionType::Op_F000: {
+        block_ended = true;
+        break;
+      }
+      default: {
+        break;
+      }
+    }
 
-        // 8XY5: Subtract VX - VY
-        case 0x5: {
-          m_Registers[FLAG_REGISTER] =
-              (m_Registers[register_name_x] > m_Registers[register_name_y]) ? 1 : 0;
-          m_Registers[register_name_x] =
-              m_Registers[register_name_x] - m_Registers[register_name_y];
+    if (program_counter >= MEMORY_SIZE) {
+      block_ended = true;
+    }
+  }
 
-          LOG_TRACE("Subtracted V{} - V{}", register_name_x, register_name_y);
+  // Only a guess for blocks ending in 00EE or BNNN, ExecuteThreaded checks the
+  // program counter against it anyway
+  const MemoryAddress skip_size = skip_at_end ? GetSkipSize<Quirks>(m_State, program_counter) : 0;
+  block.successor_addresses = {program_counter, MemoryAddress(program_counter + skip_size)};
+  for (size_t i = 0; i < block.successors.size(); ++i) {
+    const MemoryAddress successor = block.successor_addresses[i];
+    block.successors[i] = successor < MEMORY_SIZE ? &m_ThreadedBlocks[successor] : nullptr;
+  }
 
-          break;
-        }
+  m_ThreadedBlockStarts.push_back(address);
+}
 
-        // 8XY6: Shift right
-        case 0x6: {
-          m_Registers[register_name_x] = m_Registers[register_name_y];
+void Interpreter::InvalidateDirtyBlocks() {
+  for (size_t i = 0; i < m_ThreadedBlockStarts.size();) {
+    ThreadedBlock &block = m_ThreadedBlocks[m_ThreadedBlockStarts[i]];
 
-          Byte flag = GET_LAST_BIT(m_Registers[register_name_x]);
+    if (block.pages & m_DirtyPages) {
+      block = ThreadedBlock{};
 
-          m_Registers[register_name_x] >>= 1;
+      m_ThreadedBlockStarts[i] = m_ThreadedBlockStarts.back();
+      m_ThreadedBlockStarts.pop_back();
+    } else {
+      ++i;
+    }
+  }
 
-          m_Registers[FLAG_REGISTER] = flag;
-          LOG_TRACE("Set V{} to V{} and shifted 1 bit right", register_name_x, register_name_y);
+  m_DirtyPages = 0;
+}
 
-          break;
-        }
+InstructionType Interpreter::DecodeType(Opcode opcode) {
+  auto first_nibble = GET_FIRST_NIBBLE(opcode);
 
-        // 8XY7: Subtract VY - VX
-        case 0x7: {
-          m_Registers[FLAG_REGISTER] = 0;
-          if (m_Registers[register_name_y] > m_Registers[register_name_x]) {
-            m_Registers[FLAG_REGISTER] = 1;
-          }
+  switch (first_nibble) {
+    case 0x0: {
+      if (opcode == 0x00E0) return InstructionType::Op_00E0;
+      if (opcode == 0x00EE) return InstructionType::Op_00EE;
+      if ((opcode & 0xFFF0) == 0x00C0) return InstructionType::Op_00CN;
+      if ((opcode & 0xFFF0) == 0x00D0) return InstructionType::Op_00DN;
+
+      switch (opcode) {
+        case 0x00FB: return InstructionType::Op_00FB;
+        case 0x00FC: return InstructionType::Op_00FC;
+        case 0x00FD: return InstructionType::Op_00FD;
+        case 0x00FE: return InstructionType::Op_00FE;
+        case 0x00FF: return InstructionType::Op_00FF;
+        default: return InstructionType::Op_Nop;
+      }
+    }
+    case 0x1: return InstructionType::Op_1NNN;
+    case 0x2: return InstructionType::Op_2NNN;
+    case 0x3: return InstructionType::Op_3XNN;
+    case 0x4: return InstructionType::Op_4XNN;
+    case 0x5: {
+      auto type = GET_FOURTH_NIBBLE(opcode);
 
-          m_Registers[register_name_x] =
-              m_Registers[register_name_y] - m_Registers[register_name_x];
-          LOG_TRACE("Subtracted V{} - V{}", register_name_y, register_name_x);
+      // Anything else keeps acting like 5XY0, as it always has
+      if (type == 0x2) return InstructionType::Op_5XY2;
+      if (type == 0x3) return InstructionType::Op_5XY3;
 
-          break;
-        }
+      return InstructionType::Op_5XY0;
+    }
+    case 0x6: return InstructionType::Op_6XNN;
+    case 0x7: return InstructionType::Op_7XNN;
+    case 0x8: {
+      auto type = GET_FOURTH_NIBBLE(opcode);
 
-        // 8XYE: Shift left
-        case 0xE: {
-          m_Registers[register_name_x] = m_Registers[register_name_y];
+      switch (type) {
+        case 0x0: return InstructionType::Op_8XY0;
+        case 0x1: return InstructionType::Op_8XY1;
+        case 0x2: return InstructionType::Op_8XY2;
+        case 0x3: return InstructionType::Op_8XY3;
+        case 0x4: return InstructionType::Op_8XY4;
+        case 0x5: return InstructionType::Op_8XY5;
+        case 0x6: return InstructionType::Op_8XY6;
+        case 0x7: return InstructionType::Op_8XY7;
+        case 0xE: return InstructionType::Op_8XYE;
+        default: return InstructionType::Op_Nop;
+      }
+    }
+    case 0x9: return InstructionType::Op_9XY0;
+    case 0xA: return InstructionType::Op_ANNN;
+    case 0xB: return InstructionType::Op_BNNN;
+    case 0xC: return InstructionType::Op_CXNN;
+    case 0xD: return InstructionType::Op_DXYN;
+    case 0xE: {
+      auto type = GET_LAST_TWO_NIBBLES(opcode);
 
-          Byte flag = GET_FIRST_BIT(m_Registers[register_name_x]);
+      if (type == 0x9E) return InstructionType::Op_EX9E;
+      if (type == 0xA1) return InstructionType::Op_EXA1;
 
-          m_Registers[register_name_x] <<= 1;
+      return InstructionType::Op_Unknown;
+    }
+    case 0xF: {
+      auto type = GET_LAST_TWO_NIBBLES(opcode);
 
-          m_Registers[FLAG_REGISTER] = flag;
-          LOG_TRACE("Set V{} to V{} and shifted 1 bit left", register_name_x, register_name_y);
+      if (opcode == 0xF000) return InstructionType::Op_F000;
+      if (opcode == 0xF002) return InstructionType::Op_F002;
 
-          break;
-        }
+      switch (type) {
+        case 0x01: return InstructionType::Op_FN01;
+        case 0x07: return InstructionType::Op_FX07;
+        case 0x0A: return InstructionType::Op_FX0A;
+        case 0x15: return InstructionType::Op_FX15;
+        case 0x18: return InstructionType::Op_FX18;
+        case 0x1E: return InstructionType::Op_FX1E;
+        case 0x29: return InstructionType::Op_FX29;
+        case 0x33: return InstructionType::Op_FX33;
+        case 0x55: return InstructionType::Op_FX55;
+        case 0x65: return InstructionType::Op_FX65;
+        case 0x30: return InstructionType::Op_FX30;
+        case 0x3A: return InstructionType::Op_FX3A;
+        case 0x75: return InstructionType::Op_FX75;
+        case 0x85: return InstructionType::Op_FX85;
+        default: return InstructionType::Op_Unknown;
       }
-      break;
     }
+  }
 
-    // 9XY0: Increment program counter by 2 if Vx != Vy
-    case 0x9: {
-      auto register_name_x = GET_SECOND_NIBBLE(m_CurrentOpcode);
-      auto register_name_y = GET_THIRD_NIBBLE(m_CurrentOpcode);
-
-      if (m_Registers[register_name_x] != m_Registers[register_name_y]) {
-        m_ProgramCounter += INSTRUCTION_SIZE;
-      }
+  return InstructionType::Op_Unknown;
+}
 
-      LOG_TRACE("Skip if V{} != V{} ({})", register_name_x, register_name_y,
-                !(m_Registers[register_name_x] == m_Registers[register_name_y]));
+template <typename Quirks>
+const InstructionHandler *Interpreter::GetHandlers() {
+  static const InstructionHandler s_Handlers[] = {
+#define CHIP8_INSTRUCTION_DISPATCH(name) &Dispatch<&Interpreter::Op_##name>,
+#define CHIP8_QUIRK_DISPATCH(name) &Dispatch<&Interpreter::Op_##name<Quirks>>,
+      CHIP8_INSTRUCTIONS(CHIP8_INSTRUCTION_DISPATCH, CHIP8_QUIRK_DISPATCH)
+#undef CHIP8_QUIRK_DISPATCH
+#undef CHIP8_INSTRUCTION_DISPATCH
+  };
+
+  return s_Handlers;
+}
 
-      break;
-    }
+void Interpreter::SetQuirkProfile(QuirkProfile profile) {
+  m_QuirkProfile = profile;
 
-    // ANNN: Set Index Register to the value NNN
-    case 0xA: {
-      auto value = GET_LAST_THREE_NIBBLES(m_CurrentOpcode);
-      m_IndexRegister = value;
+  WithQuirks(profile, [this](auto quirks) {
+    using Quirks = decltype(quirks);
+    m_Handlers = GetHandlers<Quirks>();
+    m_ExecuteThreaded = &Interpreter::ExecuteThreaded<Quirks>;
+  });
 
-      LOG_TRACE("Set IndexRegister to {:X}", value);
-      break;
-    }
+#if CHIP8_JIT_ENABLED
+  if (m_Jit) m_Jit->SetQuirkProfile(profile);
+#endif
 
-    // BNNN: Jump with offset
-    case 0xB: {
-      auto address = GET_LAST_THREE_NIBBLES(m_CurrentOpcode);
-      m_ProgramCounter = address + m_Registers[0x0];
-      increment_program_counter = false;
+  // Code decoded for the previous profile would keep running its handlers
+  this->InvalidateInstructions();
+}
 
-      LOG_TRACE("Jumped to {} with offset {}", address, m_Registers[0x0]);
+void Interpreter::Op_Decode(const Instruction &) {
+  const MemoryAddress address = (m_State.program_counter - INSTRUCTION_SIZE) & MEMORY_MASK;
+  const Opcode opcode =
+      (m_State.memory[address] << 8) | m_State.memory[(address + 1) & MEMORY_MASK];
 
-      break;
-    }
+  Instruction &decoded = m_Instructions[address];
+  decoded = DecodeOperands(opcode);
+  decoded.handler = DecodeHandler(opcode);
 
-    // CXNN: Generate random number & NN into Vx
-    case 0xC: {
-      auto nn = GET_LAST_TWO_NIBBLES(m_CurrentOpcode);
-      auto register_name = GET_SECOND_NIBBLE(m_CurrentOpcode);
+  decoded.handler(*this, decoded);
+}
 
-      Byte number = std::rand();
+// What the handlers in Instructions.h see of the interpreter, everything
+// lives in m_State
+struct Interpreter::Machine {
+  Interpreter &interpreter;
 
-      m_Registers[register_name] = number & nn;
-      LOG_TRACE("Generated random value {} for V{}", m_Registers[register_name], register_name);
+  MachineState &State() { return interpreter.m_State; }
+  Byte &V(unsigned int r) { return interpreter.m_State.registers[r]; }
+  MemoryAddress &ProgramCounter() { return interpreter.m_State.program_counter; }
+  MemoryAddress &IndexRegister() { return interpreter.m_State.index_register; }
+  Byte &DelayTimer() { return interpreter.m_State.delay_timer; }
+  Byte &SoundTimer() { return interpreter.m_State.sound_timer; }
 
-      break;
-    }
-    case 0xE: {
-      auto type = GET_LAST_TWO_NIBBLES(m_CurrentOpcode);
+  bool IsKeyPressed(Byte key) const { return interpreter.IsKeyPressed(key); }
 
-      auto register_name = GET_SECOND_NIBBLE(m_CurrentOpcode);
-      auto key = m_Registers[register_name];
+  Byte ReadMemory(MemoryAddress address) const { return interpreter.ReadMemory(address); }
+  void WriteMemory(MemoryAddress address, Byte value) { interpreter.WriteMemory(address, value); }
+  const ExtendedMemory *GetExtendedMemory() const { return interpreter.m_ExtendedMemory.get(); }
+  void EnableExtendedMemory() { interpreter.EnableExtendedMemory(); }
 
-      auto key_state = SDL_GetKeyboardState(nullptr);
+  void FrameChanged() { interpreter.m_FrameDirty = true; }
 
-      switch (type) {
-        // EX9E: Skip if key in Vx is pressed
-        case 0x9E: {
-          if (key_state[(int)HexToKey(key)]) {
-            m_ProgramCounter += INSTRUCTION_SIZE;
-            LOG_TRACE("Key pressed {:X}, jump", key);
-          } else {
-            LOG_TRACE("Key not pressed {:X}", key);
-          }
-          break;
-        }
-        // EXA1: Skip if key in Vx is not pressed
-        case 0xA1: {
-          if (!key_state[(int)HexToKey(key)]) {
-            m_ProgramCounter += INSTRUCTION_SIZE;
-            LOG_TRACE("Key not pressed {:X}, jump", key);
-          } else {
-            LOG_TRACE("Key pressed {:X}", key);
-          }
-          break;
-        }
-        default: {
-          LOG_WARN("Unimplemented or incorrect opcode");
-          break;
-        }
-      }
-      break;
+  // Display wait quirk: only one sprite per frame
+  bool WaitForDisplay() {
+    if (!interpreter.m_DisplayWaitQuirk) {
+      return false;
+    }
+    if (!interpreter.m_State.vblank) {
+      return true;
     }
 
-    case 0xF: {
-      auto type = GET_LAST_TWO_NIBBLES(m_CurrentOpcode);
-      auto register_name = GET_SECOND_NIBBLE(m_CurrentOpcode);
+    interpreter.m_State.vblank = false;
+    return false;
+  }
+};
 
-      switch (type) {
-        // FX07: Set Vx to value of delay timer
-        case 0x07: {
-          m_Registers[register_name] = m_DelayTimer;
-
-          LOG_TRACE("Set V{} to {}", register_name, m_DelayTimer);
-          break;
-        }
-
-        // FX0A: Block until key is pressed
-        case 0x0A: {
-          auto key_state = SDL_GetKeyboardState(nullptr);
+#define CHIP8_INSTRUCTION_HANDLER(name)                         \
+  void Interpreter::Op_##name(const Instruction &instruction) { \
+    Machine machine{*this};                                     \
+    Instructions::Op_##name(machine, instruction);              \
+  }
+#define CHIP8_QUIRK_HANDLER(name)                               \
+  template <typename Quirks>                                    \
+  void Interpreter::Op_##name(const Instruction &instruction) { \
+    Machine machine{*this};                                     \
+    Instructions::Op_##name<Quirks>(machine, instruction);      \
+  }
+CHIP8_INSTRUCTIONS(CHIP8_INSTRUCTION_HANDLER, CHIP8_QUIRK_HANDLER)
+#undef CHIP8_QUIRK_HANDLER
+#undef CHIP8_INSTRUCTION_HANDLER
+
+bool DrawSprite(MachineState &state, const ExtendedMemory *extended, MemoryAddress address,
+                Byte x, Byte y, Byte n) {
+  FrameBuffer &frame_buffer = state.frame_buffer;
+  const size_t size =
+      (n == 0 ? WIDE_SPRITE_BYTES : n) * std::popcount(frame_buffer.GetPlaneMask());
+
+  address &= state.address_mask;
+
+  // Read the sprite in place, only copying when it runs off the end of
+  // memory and has to wrap around, or runs on into the extended memory
+  std::array<Byte, WIDE_SPRITE_BYTES * PLANE_COUNT> wrapped_sprite;
+  std::span<const Byte> sprite;
+
+  if (address < MEMORY_SIZE && address + size <= MEMORY_SIZE) {
+    sprite = std::span<const Byte>(&state.memory[address], size);
+  } else if (address >= MEMORY_SIZE && address + size <= EXTENDED_MEMORY_SIZE) {
+    sprite = std::span<const Byte>(&(*extended)[address - MEMORY_SIZE], size);
+  } else {
+    for (size_t i = 0; i < size; ++i) {
+      wrapped_sprite[i] = ReadMemoryByte(state, extended, MemoryAddress(address + i));
+    }
+    sprite = std::span<const Byte>(wrapped_sprite.data(), size);
+  }
 
-          LOG_TRACE("Awaiting key press...");
+  if (n == 0) {
+    return frame_buffer.LoadWideSprite(x, y, sprite);
+  }
+  return frame_buffer.LoadSprite(x, y, sprite);
+}
 
-          bool key_pressed = false;
-          int key;
-          for (int i = 0; i < 0xF; ++i) {
-            if (key_state[(int)HexToKey(i)]) {
-              key_pressed = true;
-              key = i;
+void Interpreter::Restart(const char *rom_location) {
+  const unsigned int instructions_per_second = m_State.instructions_per_second;
+  m_State = MachineState{};
+  m_State.instructions_per_second = instructions_per_second;
+  m_State.random_state = SeedRandomState(m_RandomSeed);
 
-              LOG_TRACE("Key pressed");
-            }
-          }
+  this->LoadFont();
+  this->LoadROM(rom_location);
+  this->InvalidateInstructions();
 
-          if (!key_pressed) {
-            m_ProgramCounter -= INSTRUCTION_SIZE;
-          } else {
-            m_Registers[register_name] = key;
-          }
+  m_FrameDirty = true;
+  this->ResetTimerSchedule();
+}
 
-          break;
-        }
+void Interpreter::LoadFont() {
+  for (int i = 0; i < FONTSET_SIZE; ++i) {
+    m_State.memory[i + FONTSET_START] = Font[i];
+  }
 
-        // FX15: Set the delay timer to Vx
-        case 0x15: {
-          m_DelayTimer = m_Registers[register_name];
+  for (int i = 0; i < BIG_FONTSET_SIZE; ++i) {
+    m_State.memory[i + BIG_FONTSET_START] = BigFont[i];
+  }
+}
 
-          LOG_TRACE("Set delay timer to V{}", register_name);
-          break;
-        }
+void Interpreter::LoadROM(const char *rom_location) {
+  m_RomLoaded = false;
+  m_RomHash = 0;
 
-        // FX15: Set the delay timer to Vx
-        case 0x18: {
-          m_SoundTimer = m_Registers[register_name];
+  // Copied from the mapped file straight into memory
+  RomImage rom;
+  if (!rom.Open(rom_location)) {
+    return;
+  }
 
-          LOG_TRACE("Set sound timer to V{}", register_name);
-          break;
-        }
+  const std::span<const Byte> data = rom.GetData();
 
-        // FX1E: I = I + Vx
-        case 0x1E: {
-          m_IndexRegister += m_Registers[register_name];
-          LOG_TRACE("I += V{}", register_name);
-          break;
-        }
+  LOG_INFO("ROM location: {}", rom_location);
+  LOG_INFO("ROM size: {} bytes", data.size());
 
-        // FX29: Font character
-        case 0x29: {
-          m_IndexRegister = FONTSET_START + 5 * m_Registers[register_name];
+  if (data.size() > EXTENDED_MEMORY_SIZE - ROM_START) {
+    LOG_ERROR("Failed to read ROM: too big");
+    return;
+  }
 
-          LOG_TRACE("Index register set to location of character {}", m_Registers[register_name]);
-          break;
-        }
+  // Only XO-CHIP programs are bigger than the classic memory
+  const size_t classic_size = std::min<size_t>(data.size(), MEMORY_SIZE - ROM_START);
+  std::copy_n(data.begin(), classic_size, m_State.memory.begin() + ROM_START);
 
-        // FX33: Binary-coded decimal conversion
-        case 0x33: {
-          auto number = m_Registers[register_name];
+  if (data.size() > classic_size) {
+    this->EnableExtendedMemory();
+    std::copy(data.begin() + classic_size, data.end(), m_ExtendedMemory->begin());
+  }
 
-          auto digit1 = number / 100;
-          auto digit2 = (number / 10) % 10;
-          auto digit3 = number % 10;
+  m_RomHash = HashRom(data);
+  m_RomLoaded = true;
+}
 
-          m_Memory[m_IndexRegister] = digit1;
-          m_Memory[m_IndexRegister + 1] = digit2;
-          m_Memory[m_IndexRegister + 2] = digit3;
+void Interpreter::TickTimers() {
+  if (m_State.delay_timer > 0) {
+    m_State.delay_timer--;
+  }
 
-          LOG_TRACE("Converted number {} into {} {} {}", number, digit1, digit2, digit3);
+  if (m_State.sound_timer > 0) {
+    m_State.sound_timer--;
+    if (m_SoundSink) m_SoundSink->SetToneEnabled(true);
+  } else {
+    if (m_SoundSink) m_SoundSink->SetToneEnabled(false);
+  }
 
-          break;
-        }
+  m_State.vblank = true;
+  if (m_InputSource) m_InputSource->LatchFrame();
+  if (m_PresentMode == PresentMode::EmulatedFrame &&
+      (!m_EmulatedFramesOnRequest || m_EmulatedFrameRequested)) {
+    m_EmulatedFrameRequested = false;
+    this->PresentFrame();
+  }
 
-        // FX55: Store registers V0 to Vx in memory
-        case 0x55: {
-          for (int i = 0; i <= register_name; ++i) {
-            m_Memory[m_IndexRegister + i] = m_Registers[i];
-          }
+  m_State.timer_ticks++;
+  this->ScheduleNextTimerTick();
+}
 
-          LOG_TRACE("Stored registers from V0 to V{:X} in memory starting at {}", register_name,
-                    m_IndexRegister);
+void Interpreter::ScheduleNextTimerTick() {
+  // Rounding up spreads the fractional part, at 700 op/s the ticks come
+  // 12, 12, 11, 12, 12, 11... instructions apart
+  m_State.next_timer_cycle =
+      m_State.timer_base_cycle +
+      ((m_State.timer_ticks + 1) * m_State.instructions_per_second + TIMER_FREQUENCY - 1) /
+          TIMER_FREQUENCY;
+}
 
-          break;
-        }
+void Interpreter::ResetTimerSchedule() {
+  m_State.timer_base_cycle = m_State.cycles;
+  m_State.timer_ticks = 0;
+  this->ScheduleNextTimerTick();
+}
 
-        // FX65: Load registers V0 to Vx from memory
-        case 0x65: {
-          for (int i = 0; i <= register_name; ++i) {
-            m_Registers[i] = m_Memory[m_IndexRegister + i];
-          }
+void Interpreter::SetInstructionsPerSecond(unsigned int instructions_per_second) {
+  instructions_per_second = std::min(instructions_per_second, MAX_INSTRUCTIONS_PER_SECOND);
+  if (instructions_per_second == 0 || instructions_per_second == m_State.instructions_per_second) {
+    return;
+  }
 
-          LOG_TRACE("Loaded registers from V0 to V{:X} from memory starting at {}", register_name,
-                    m_IndexRegister);
+  m_State.instructions_per_second = instructions_per_second;
+  this->ResetTimerSchedule();
+}
 
-          break;
-        }
+void Interpreter::SetRandomSeed(uint64_t seed) {
+  m_RandomSeed = seed;
+  m_State.random_state = SeedRandomState(seed);
+}
 
-        default: {
-          LOG_WARN("Unimplemented or incorrect opcode");
+const char *GetInstructionName(InstructionType type) {
+  static const char *const s_Names[] = {
+#define CHIP8_INSTRUCTION_NAME(name) #name,
+      CHIP8_INSTRUCTIONS(CHIP8_INSTRUCTION_NAME, CHIP8_INSTRUCTION_NAME)
+#undef CHIP8_INSTRUCTION_NAME
+  };
 
-          break;
-        }
-      }
+  return type < InstructionType::Count ? s_Names[(size_t)type] : "?";
+}
 
-      break;
-    }
+uint64_t Interpreter::GetDecodedInstructionTypes() const {
+  const InstructionHandler decode = &Dispatch<&Interpreter::Op_Decode>;
+  uint64_t types = 0;
 
-    default: {
-      LOG_WARN("Unimplemented or incorrect opcode");
-      break;
+  for (const Instruction &instruction : m_Instructions) {
+    if (instruction.handler != decode) {
+      types |= 1ull << (size_t)DecodeType(instruction.opcode);
     }
   }
 
-  if (increment_program_counter) {
-    m_ProgramCounter += INSTRUCTION_SIZE;
-  }
-}
+  for (const MemoryAddress start : m_ThreadedBlockStarts) {
+    const ThreadedBlock &block = m_ThreadedBlocks[start];
 
-void Interpreter::Restart(const char *rom_location) {
-  for (int i = 0; i < MEMORY_SIZE; ++i) {
-    m_Memory[i] = 0;
+    for (uint32_t i = 0; i < block.length; ++i) {
+      types |= 1ull << (size_t)DecodeType(m_ThreadedOps[block.first_op + i].instruction.opcode);
+    }
   }
 
-  for (int i = 0; i < REGISTER_SIZE; ++i) {
-    m_Registers[i] = 0;
-  }
+  return types;
+}
 
-  this->LoadFont();
-  this->LoadROM(rom_location);
+uint64_t Interpreter::HashMemory() const {
+  uint64_t hash = 0xCBF29CE484222325ull;
+  const size_t size = size_t(m_State.address_mask) + 1;
 
-  m_DisplayPointer->ClearDisplay();
+  for (size_t address = 0; address < size; ++address) {
+    hash ^= this->ReadMemory(MemoryAddress(address));
+    hash *= 0x100000001B3ull;
+  }
 
-  m_IndexRegister = 0;
-  m_ProgramCounter = ROM_START;
+  return hash;
 }
 
-void Interpreter::DisplayDebugMenu() {
-  ImGuiTableFlags table_flags = ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg;
-
-  ImGui::Text("Current opcode: %04X", m_CurrentOpcode);
+void Interpreter::WriteMemory(MemoryAddress address, Byte value) {
+  address = WriteMemoryByte(m_State, m_ExtendedMemory.get(), address, value);
 
-  if (ImGui::BeginTable("Registers", REGISTER_SIZE, table_flags)) {
-    for (int row = 0; row < 2; ++row) {
-      ImGui::TableNextRow();
-      for (int register_name = 0; register_name < REGISTER_SIZE; ++register_name) {
-        ImGui::TableNextColumn();
+  // Code never runs from above the classic memory
+  if (address < MEMORY_SIZE) {
+    m_DirtyPages |= 1ull << (address >> MEMORY_PAGE_SHIFT);
+    this->InvalidateInstructions(address);
+  }
+}
 
-        if (row == 0) {
-          ImGui::Text("V%X", register_name);
-        } else {
-          ImGui::Text("%d", m_Registers[register_name]);
-        }
-      }
-    }
-    ImGui::EndTable();
+void Interpreter::InvalidateInstructions() {
+  for (auto &instruction : m_Instructions) {
+    instruction.handler = &Dispatch<&Interpreter::Op_Decode>;
   }
 
-  static MemoryEditor memory_editor;
-  memory_editor.OptShowAscii = false;
-  memory_editor.ReadOnly = true;
-  memory_editor.DrawWindow("Memory", m_Memory.data(), MEMORY_SIZE);
+  m_DirtyPages = ~0ull;
 
-  if (ImGui::Button("Go to program counter")) {
-    memory_editor.GotoAddrAndHighlight(m_ProgramCounter, m_ProgramCounter);
-  }
+#if CHIP8_JIT_ENABLED
+  if (m_Jit) m_Jit->Flush();
+#endif
+}
 
-  ImGui::Text("Index Register: %d", m_IndexRegister);
-  ImGui::Text("Program Counter: %d", m_ProgramCounter);
+void Interpreter::InvalidateInstructions(MemoryAddress address) {
+  // An instruction is two bytes, so the one starting one byte earlier covers
+  // this address too
+  m_Instructions[address].handler = &Dispatch<&Interpreter::Op_Decode>;
+  m_Instructions[(address - 1) & MEMORY_MASK].handler = &Dispatch<&Interpreter::Op_Decode>;
 
-  ImGui::Text("Delay timer: %d", m_DelayTimer);
-  ImGui::Text("Sound timer: %d", m_SoundTimer);
+#if CHIP8_JIT_ENABLED
+  if (m_Jit) m_Jit->Invalidate(address);
+#endif
 }
 
-void Interpreter::LoadFont() {
-  for (int i = 0; i < FONTSET_SIZE; ++i) {
-    m_Memory[i + FONTSET_START] = Font[i];
+void Interpreter::PresentFrame() {
+  if (m_FrameDirty && m_FrameSink) {
+    m_FrameSink->PresentFrame(m_State.frame_buffer);
+    m_FrameDirty = false;
   }
 }
 
-void Interpreter::LoadROM(const char *rom_location) {
-  std::ifstream input_file(rom_location, std::ios::binary);
+void Interpreter::EnableExtendedMemory() {
+  if (HasExtendedMemory(m_State)) {
+    return;
+  }
 
-  input_file.seekg(0, std::ios::end);
-  size_t rom_size = input_file.tellg();
-  input_file.seekg(0, std::ios::beg);
+  if (m_ExtendedMemory) {
+    m_ExtendedMemory->fill(0);
+  } else {
+    m_ExtendedMemory = std::make_unique<ExtendedMemory>();
+  }
 
-  LOG_INFO("ROM location: {}", rom_location);
-  LOG_INFO("ROM size: {} bytes", rom_size);
+  m_State.address_mask = EXTENDED_MEMORY_MASK;
+}
 
-  if (rom_size > MEMORY_SIZE - ROM_START && input_file.is_open()) {
-    LOG_ERROR("Failed to read ROM: too big");
-    exit(1);
+void Interpreter::SaveState(MachineState &state, ExtendedMemory *extended) const {
+  state = m_State;
+
+  if (extended != nullptr && HasExtendedMemory(m_State)) {
+    *extended = *m_ExtendedMemory;
   }
+}
 
-  char rom_buffer[rom_size];
-  if (input_file.is_open()) {
-    input_file.read(&rom_buffer[0], rom_size);
-    std::memcpy(&m_Memory[ROM_START], rom_buffer, rom_size);
+void Interpreter::LoadState(const MachineState &state, const ExtendedMemory *extended) {
+  // Only code in bytes that actually change has to be decoded again, going
+  // back a few frames usually touches a handful of them
+  constexpr MemoryAddress PAGE_SIZE = 1 << MEMORY_PAGE_SHIFT;
 
-    input_file.close();
-  } else {
-    LOG_ERROR("Error: Unable to find/read the input file.");
+  for (MemoryAddress page = 0; page < MEMORY_SIZE; page += PAGE_SIZE) {
+    if (std::memcmp(&m_State.memory[page], &state.memory[page], PAGE_SIZE) == 0) {
+      continue;
+    }
+
+    m_DirtyPages |= 1ull << (page >> MEMORY_PAGE_SHIFT);
+    for (MemoryAddress address = page; address < page + PAGE_SIZE; ++address) {
+      if (m_State.memory[address] != state.memory[address]) {
+        this->InvalidateInstructions(address);
+      }
+    }
   }
-}
 
-void Interpreter::DecrementTimers() {
-  if (m_TicksElapsed > TIMER_CAP) {
-    if (m_DelayTimer > 0) {
-      m_DelayTimer--;
+  if (HasExtendedMemory(state)) {
+    if (!m_ExtendedMemory) {
+      m_ExtendedMemory = std::make_unique<ExtendedMemory>();
     }
 
-    if (m_SoundTimer > 0) {
-      m_SoundTimer--;
-      if (m_AudioPoinater->IsStreamPaused()) m_AudioPoinater->UnpauseStream();
+    if (extended != nullptr) {
+      *m_ExtendedMemory = *extended;
     } else {
-      if (!m_AudioPoinater->IsStreamPaused()) m_AudioPoinater->PauseStream();
+      m_ExtendedMemory->fill(0);
     }
+  }
 
-    m_TicksElapsed = 0;
-  } else {
-    m_TicksElapsed += SDL_GetTicks() - m_TicksCount;
+  m_State = state;
+
+  // The state may come from a file, keep it from indexing out of bounds
+  m_State.stack_pointer = std::min<uint32_t>(m_State.stack_pointer, CALL_STACK_SIZE);
+  m_State.address_mask =
+      m_State.address_mask == EXTENDED_MEMORY_MASK ? EXTENDED_MEMORY_MASK : MEMORY_MASK;
+  m_State.program_counter &= MEMORY_MASK;
+  m_State.index_register &= m_State.address_mask;
+  m_State.frame_buffer.Sanitize();
+
+  // A rate of 0 schedules every timer tick on the same cycle, and a next
+  // tick behind the cycle count ticks the timers once for every cycle in
+  // between, either way stepping never returns. The rate is clamped and the
+  // next tick worked out again, from the loaded cycle count when the
+  // schedule in the state is not the one tick ahead of it a running machine
+  // always has.
+  m_State.instructions_per_second = std::clamp<uint32_t>(m_State.instructions_per_second, 1,
+                                                         MAX_INSTRUCTIONS_PER_SECOND);
+  this->ScheduleNextTimerTick();
+
+  const uint64_t tick_length =
+      (m_State.instructions_per_second + TIMER_FREQUENCY - 1) / TIMER_FREQUENCY;
+  if (m_State.next_timer_cycle <= m_State.cycles ||
+      m_State.next_timer_cycle - m_State.cycles > tick_length) {
+    this->ResetTimerSchedule();
+  }
+
+  m_FrameDirty = true;
+  if (m_SoundSink) {
+    m_SoundSink->SetToneEnabled(m_State.sound_timer > 0);
   }
-  m_TicksCount = SDL_GetTicks();
 }
 
 }  // namespace Chip8
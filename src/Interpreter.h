@@ -3,10 +3,12 @@
 #include <array>
 #include <cstdint>
 #include <memory>
-#include <stack>
+#include <type_traits>
+#include <vector>
 
-#include "Audio.h"
-#include "Display.h"
+#include "FrameBuffer.h"
+#include "Platform.h"
+#include "Quirks.h"
 
 using MemoryAddress = uint16_t;
 using Opcode = uint16_t;
@@ -14,17 +16,41 @@ using Byte = uint8_t;
 
 constexpr MemoryAddress INSTRUCTION_SIZE = 2;
 
+// Code always runs from the classic 4 KB, XO-CHIP programs reach data in
+// the rest of the 64 KB through F000 NNNN
 constexpr unsigned int MEMORY_SIZE = 4096;
+constexpr MemoryAddress MEMORY_MASK = MEMORY_SIZE - 1;
+constexpr unsigned int EXTENDED_MEMORY_SIZE = 0x10000;
+constexpr MemoryAddress EXTENDED_MEMORY_MASK = EXTENDED_MEMORY_SIZE - 1;
 constexpr unsigned int REGISTER_SIZE = 16;
 
 constexpr MemoryAddress FONTSET_START = 0x50;
 constexpr int FONTSET_SIZE = 0x50;
 
+// The SUPER-CHIP 8x10 digits for FX30, right after the small font
+constexpr MemoryAddress BIG_FONTSET_START = FONTSET_START + FONTSET_SIZE;
+constexpr int BIG_FONTSET_SIZE = 0xA0;
+
 constexpr MemoryAddress ROM_START = 0x200;
 
 constexpr unsigned int FLAG_REGISTER = 0xF;
 
-constexpr unsigned int TIMER_CAP = 1000 / 60;
+// Depth of the return stack, the COSMAC VIP had room for 12 levels and most
+// interpreters since use 16
+#ifndef CHIP8_CALL_STACK_SIZE
+#define CHIP8_CALL_STACK_SIZE 16
+#endif
+constexpr unsigned int CALL_STACK_SIZE = CHIP8_CALL_STACK_SIZE;
+
+// Delay and sound timers count down at 60 Hz of emulated time
+constexpr unsigned int TIMER_FREQUENCY = 60;
+constexpr unsigned int DEFAULT_INSTRUCTIONS_PER_SECOND = 700;
+// Far past anything a ROM is written for, loaded states are clamped to it
+constexpr unsigned int MAX_INSTRUCTIONS_PER_SECOND = 100000000;
+
+// CXNN draws from a per-interpreter generator, so a run only depends on the
+// seed and the input
+constexpr uint64_t DEFAULT_RANDOM_SEED = 0xC8;
 
 #define GET_FIRST_NIBBLE(x) x >> 12;
 #define GET_SECOND_NIBBLE(x) (x & 0x0F00) >> 8;
@@ -58,45 +84,515 @@ const Byte Font[FONTSET_SIZE] = {
     0xF0, 0x80, 0xF0, 0x80, 0x80   // F
 };
 
+// Octo's big font, which covers A-F as well
+const Byte BigFont[BIG_FONTSET_SIZE] = {
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF,  // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF,  // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF,  // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,  // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03,  // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,  // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF,  // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18,  // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF,  // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,  // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3,  // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC,  // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C,  // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC,  // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF,  // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0   // F
+};
+
+class Interpreter;
+class Jit;
+class Profiler;
+class TraceRecorder;
+struct Instruction;
+struct ProfileCounters;
+
+using InstructionHandler = void (*)(Interpreter &interpreter, const Instruction &instruction);
+
+// Every instruction the interpreter knows, used to generate the handler
+// table, the threaded-code labels and the handler declarations. CHIP-8
+// first, then the SUPER-CHIP and XO-CHIP extensions. Q marks the ones whose
+// handler is a template on the quirk policy, X all the others.
+#define CHIP8_INSTRUCTIONS(X, Q) \
+  X(Nop)                         \
+  X(Unknown)                     \
+  X(00E0)                        \
+  X(00EE)                        \
+  X(1NNN)                        \
+  X(2NNN)                        \
+  Q(3XNN)                        \
+  Q(4XNN)                        \
+  Q(5XY0)                        \
+  X(6XNN)                        \
+  X(7XNN)                        \
+  X(8XY0)                        \
+  Q(8XY1)                        \
+  Q(8XY2)                        \
+  Q(8XY3)                        \
+  X(8XY4)                        \
+  X(8XY5)                        \
+  Q(8XY6)                        \
+  X(8XY7)                        \
+  Q(8XYE)                        \
+  Q(9XY0)                        \
+  X(ANNN)                        \
+  Q(BNNN)                        \
+  X(CXNN)                        \
+  X(DXYN)                        \
+  Q(EX9E)                        \
+  Q(EXA1)                        \
+  X(FX07)                        \
+  X(FX0A)                        \
+  X(FX15)                        \
+  X(FX18)                        \
+  X(FX1E)                        \
+  X(FX29)                        \
+  X(FX33)                        \
+  Q(FX55)                        \
+  Q(FX65)                        \
+  X(00CN)                        \
+  X(00DN)                        \
+  X(00FB)                        \
+  X(00FC)                        \
+  X(00FD)                        \
+  X(00FE)                        \
+  X(00FF)                        \
+  X(5XY2)                        \
+  X(5XY3)                        \
+  Q(F000)                        \
+  X(FN01)                        \
+  X(F002)                        \
+  X(FX30)                        \
+  X(FX3A)                        \
+  X(FX75)                        \
+  X(FX85)
+
+enum class InstructionType : Byte {
+#define CHIP8_INSTRUCTION_TYPE(name) Op_##name,
+  CHIP8_INSTRUCTIONS(CHIP8_INSTRUCTION_TYPE, CHIP8_INSTRUCTION_TYPE)
+#undef CHIP8_INSTRUCTION_TYPE
+  Count,
+};
+static_assert((size_t)InstructionType::Count <= 64, "instruction type masks are 64 bits");
+
+// The opcode pattern, e.g. "DXYN"
+const char *GetInstructionName(InstructionType type);
+
+// An opcode decoded once, with its operands already pulled out. The
+// interpreter keeps one per memory address and only decodes again after the
+// memory under it is written.
+struct Instruction {
+  InstructionHandler handler;
+
+  Opcode opcode;
+  MemoryAddress nnn;
+  Byte x, y, n, nn;
+};
+
+// One step of a threaded-code block. target is the computed-goto label of the
+// handler when the compiler supports it, otherwise instruction.handler is
+// called directly.
+struct ThreadedOp {
+  const void *target;
+  Instruction instruction;
+};
+
+// A block compiled for the threaded engine, its ops live in
+// Interpreter::m_ThreadedOps. Static jumps and calls are followed into the
+// block, it ends where the next address is only known at run time.
+struct ThreadedBlock {
+  uint64_t pages = 0;
+  uint32_t first_op = 0;
+  uint16_t length = 0;
+
+  // The blocks it goes on to, looked up once at compile time: where it falls
+  // through (or jumps) to, and the taken side of a skip at its end. Null
+  // past memory. A successor reset since then has a length of 0.
+  std::array<MemoryAddress, 2> successor_addresses{};
+  std::array<const ThreadedBlock *, 2> successors{};
+
+  const ThreadedBlock *GetSuccessor(MemoryAddress program_counter) const {
+    if (program_counter == successor_addresses[0]) return successors[0];
+    if (program_counter == successor_addresses[1]) return successors[1];
+    return nullptr;
+  }
+};
+
+// Memory is tracked for self-modifying code in 64-byte pages, so the whole
+// 4 KB of code fits in one 64-bit dirty mask
+constexpr unsigned int MEMORY_PAGE_SHIFT = 6;
+static_assert((MEMORY_SIZE >> MEMORY_PAGE_SHIFT) <= 64);
+
+// SplitMix64 step, spreads any seed (including 0) into a usable xorshift
+// state
+constexpr uint64_t SeedRandomState(uint64_t seed) {
+  uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  z ^= z >> 31;
+  return z ? z : 1;
+}
+
+// xorshift64*, the top byte is the best mixed
+inline Byte NextRandomByte(uint64_t &random_state) {
+  uint64_t x = random_state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  random_state = x;
+  return (x * 0x2545F4914F6CDD1Dull) >> 56;
+}
+
+enum class ExecutionEngine {
+  // Predecoded instructions, one dispatch per instruction
+  Interpreter,
+  // Basic blocks compiled to threaded code, built on any compiler
+  Threaded,
+  // x86-64 native code, falls back to Interpreter where unavailable
+  Jit,
+};
+
+// When the framebuffer is handed to the FrameSink. Either way it happens at
+// most once per frame, no matter how many sprites were drawn.
+enum class PresentMode {
+  // Whenever the frontend calls PresentFrame, normally once per host frame
+  HostFrame,
+  // On every 60 Hz timer tick of the emulated machine
+  EmulatedFrame,
+};
+
+// The XO-CHIP memory past the classic 4 KB. It is kept next to the
+// MachineState rather than in it, so classic machines, their snapshots and
+// their save states stay small, and only allocated once a program needs it.
+using ExtendedMemory = std::array<Byte, EXTENDED_MEMORY_SIZE - MEMORY_SIZE>;
+
+// Everything that makes up the emulated machine, in one trivially copyable
+// block so saving or restoring it is a single memcpy. Decoded instructions,
+// compiled blocks and settings are not part of it, they are rebuilt or kept
+// across a load.
+struct alignas(64) MachineState {
+  std::array<Byte, MEMORY_SIZE> memory{0};
+  FrameBuffer frame_buffer;
+
+  // What I addresses through, MEMORY_MASK until the ROM is bigger than the
+  // classic 4 KB or runs F000 NNNN, so classic programs keep wrapping. With
+  // EXTENDED_MEMORY_MASK the addresses past memory go to an ExtendedMemory.
+  MemoryAddress address_mask = MEMORY_MASK;
+
+  std::array<Byte, REGISTER_SIZE> registers{0};
+  std::array<MemoryAddress, CALL_STACK_SIZE> call_stack{0};
+  uint32_t stack_pointer = 0;
+
+  MemoryAddress program_counter = ROM_START, index_register = 0;
+  Byte delay_timer = 0, sound_timer = 0;
+  bool vblank = false;
+
+  Opcode current_opcode = 0;
+
+  // Timer ticks are scheduled on the cycle count, counted from the last rate
+  // change so the fractional part never accumulates an error
+  uint32_t instructions_per_second = DEFAULT_INSTRUCTIONS_PER_SECOND;
+  uint64_t cycles = 0;
+  uint64_t timer_base_cycle = 0;
+  uint64_t timer_ticks = 0;
+  uint64_t next_timer_cycle = 0;
+
+  // xorshift64* state for CXNN, never 0
+  uint64_t random_state = SeedRandomState(DEFAULT_RANDOM_SEED);
+
+  // SUPER-CHIP persistent flags (FX75/FX85), and the XO-CHIP audio pattern
+  // (F002) and pitch (FX3A)
+  std::array<Byte, REGISTER_SIZE> flags{0};
+  std::array<Byte, 16> audio_pattern{0};
+  Byte audio_pitch = 64;
+};
+static_assert(std::is_trivially_copyable_v<MachineState>);
+
+inline bool HasExtendedMemory(const MachineState &state) {
+  return state.address_mask == EXTENDED_MEMORY_MASK;
+}
+
+// A byte I can address, extended is only touched while the state has
+// extended memory
+inline Byte ReadMemoryByte(const MachineState &state, const ExtendedMemory *extended,
+                           MemoryAddress address) {
+  address &= state.address_mask;
+  return address < MEMORY_SIZE ? state.memory[address] : (*extended)[address - MEMORY_SIZE];
+}
+
+// Returns the address written after masking
+inline MemoryAddress WriteMemoryByte(MachineState &state, ExtendedMemory *extended,
+                                     MemoryAddress address, Byte value) {
+  address &= state.address_mask;
+  if (address < MEMORY_SIZE) {
+    state.memory[address] = value;
+  } else {
+    (*extended)[address - MEMORY_SIZE] = value;
+  }
+  return address;
+}
+
+// How far a skip moves the program counter from next, the address after the
+// skip: with long_skip F000 NNNN is a four-byte instruction and is skipped
+// whole, otherwise every instruction is two bytes
+template <typename Quirks>
+inline MemoryAddress GetSkipSize(const MachineState &state, MemoryAddress next) {
+  if constexpr (!Quirks::long_skip) {
+    return INSTRUCTION_SIZE;
+  }
+
+  const MemoryAddress address = next & MEMORY_MASK;
+  const bool long_instruction =
+      state.memory[address] == 0xF0 && state.memory[(address + 1) & MEMORY_MASK] == 0x00;
+  return long_instruction ? 2 * INSTRUCTION_SIZE : INSTRUCTION_SIZE;
+}
+
+// DXYN for any engine: draws n rows (16x16 for n = 0) from address for every
+// selected plane and returns whether a pixel was turned off
+bool DrawSprite(MachineState &state, const ExtendedMemory *extended, MemoryAddress address,
+                Byte x, Byte y, Byte n);
+
 class Interpreter {
 public:
   Interpreter(const char *rom_location);
+  ~Interpreter();
+
   void Restart(const char *rom_location);
 
+  // Runs a single instruction
   void Run();
-  void DisplayDebugMenu();
 
-  void SetDisplayPointer(std::shared_ptr<Display> &display_pointer) {
-    m_DisplayPointer = display_pointer;
+  // Runs up to max_instructions instructions with the selected engine and
+  // returns how many were executed
+  unsigned int Execute(unsigned int max_instructions);
+
+  void SetExecutionEngine(ExecutionEngine engine);
+  ExecutionEngine GetExecutionEngine() const { return m_ExecutionEngine; }
+
+  // Copies the whole machine in or out, takes about a microsecond. Loading
+  // keeps the engine, sinks and settings and drops all decoded code. The
+  // extended memory is only copied while the state has it, a null one saves
+  // without it and loads it cleared.
+  void SaveState(MachineState &state, ExtendedMemory *extended = nullptr) const;
+  void LoadState(const MachineState &state, const ExtendedMemory *extended = nullptr);
+
+  // Null while the machine only has the classic memory
+  const ExtendedMemory *GetExtendedMemory() const {
+    return HasExtendedMemory(m_State) ? m_ExtendedMemory.get() : nullptr;
+  }
+
+  // profile is null when the profiler is not built in
+  static void DisplayDebugMenu(MachineState &snapshot, const ProfileCounters *profile);
+
+  void SetFrameSink(const std::shared_ptr<FrameSink> &frame_sink) { m_FrameSink = frame_sink; }
+  void SetSoundSink(const std::shared_ptr<SoundSink> &sound_sink) { m_SoundSink = sound_sink; }
+  void SetInputSource(const std::shared_ptr<InputSource> &input_source) {
+    m_InputSource = input_source;
   }
-  void SetAudioPointer(std::shared_ptr<AudioHandler> &audio_pointer) {
-    m_AudioPoinater = audio_pointer;
+
+  // Records every executed instruction while set. Recording happens in Run,
+  // so Execute uses the plain interpreter in the meantime.
+  void SetTraceRecorder(const std::shared_ptr<TraceRecorder> &trace_recorder) {
+    m_TraceRecorder = trace_recorder;
   }
 
+#if CHIP8_PROFILER_ENABLED
+  // Counts every executed instruction while set, Execute interprets in the
+  // meantime like it does for traces
+  void SetProfiler(const std::shared_ptr<Profiler> &profiler) { m_Profiler = profiler; }
+#endif
+
+  const FrameBuffer &GetFrameBuffer() const { return m_State.frame_buffer; }
+
+  // Emulated CPU speed, the timers tick once every
+  // instructions_per_second / 60 instructions. 0 is ignored and anything
+  // above MAX_INSTRUCTIONS_PER_SECOND clamped.
+  void SetInstructionsPerSecond(unsigned int instructions_per_second);
+  unsigned int GetInstructionsPerSecond() const { return m_State.instructions_per_second; }
+
+  // Instructions executed since the ROM was loaded
+  uint64_t GetCycleCount() const { return m_State.cycles; }
+
+  // Seeds CXNN now and on every Restart
+  void SetRandomSeed(uint64_t seed);
+  uint64_t GetRandomSeed() const { return m_RandomSeed; }
+
+  // FNV-1a of the memory I can reach, identifies the loaded ROM right after
+  // a Restart
+  uint64_t HashMemory() const;
+
+  // Whether the last start found the ROM and it fit, memory past the fonts
+  // is empty otherwise
+  bool HasRom() const { return m_RomLoaded; }
+  // HashRom of the file as loaded, what catalog metadata is keyed by
+  uint64_t GetRomHash() const { return m_RomHash; }
+
+  // One bit per InstructionType in the code the interpreter and threaded
+  // engines currently have decoded, which is code that ran at least once
+  // since it was last written. Blocks the JIT compiled are not included.
+  uint64_t GetDecodedInstructionTypes() const;
+
+  // Hands the framebuffer to the frame sink if it changed since last time
+  void PresentFrame();
+
+  void SetPresentMode(PresentMode present_mode) { m_PresentMode = present_mode; }
+  PresentMode GetPresentMode() const { return m_PresentMode; }
+
+  // For frontends that run the machine faster than they show it: while
+  // enabled, EmulatedFrame only presents on the first timer tick after each
+  // RequestEmulatedFrame. A skipped frame stays dirty for the next one.
+  void SetEmulatedFramesOnRequest(bool enabled) { m_EmulatedFramesOnRequest = enabled; }
+  void RequestEmulatedFrame() { m_EmulatedFrameRequested = true; }
+
+  // COSMAC VIP behaviour: DXYN waits for the next 60 Hz tick before drawing
+  void SetDisplayWaitQuirk(bool enabled) { m_DisplayWaitQuirk = enabled; }
+  bool GetDisplayWaitQuirk() const { return m_DisplayWaitQuirk; }
+
+  // Picks the handlers and engines built for the profile and drops all
+  // decoded code, normally called once right after loading the ROM. The
+  // display wait quirk stays a setting of its own.
+  void SetQuirkProfile(QuirkProfile profile);
+  QuirkProfile GetQuirkProfile() const { return m_QuirkProfile; }
+
+  // Which instruction an opcode is, Op_Nop and Op_Unknown included
+  static InstructionType DecodeType(Opcode opcode);
+
 private:
+  // Compiled code calls back into the interpreter for what it does not
+  // compile
+  friend class Jit;
+
+  unsigned int ExecuteTraced(unsigned int max_instructions);
+  void RunTraced(TraceRecorder &recorder, const Instruction &instruction);
+#if CHIP8_PROFILER_ENABLED
+  unsigned int ExecuteProfiled(unsigned int max_instructions);
+#endif
+
   void LoadROM(const char *rom_location);
   void LoadFont();
 
-  void DecrementTimers();
+  // Run without the trace check, for the interpreter loop once Execute has
+  // made it. Kept inline so that loop has no call besides the handler's.
+  void Step() {
+    this->AdvanceCycles(1);
+    this->RunInstruction();
+  }
+
+  // Step once the cycle is advanced, for the JIT which advances them in bulk
+  void RunInstruction() {
+    const Instruction &instruction = m_Instructions[m_State.program_counter & MEMORY_MASK];
+
+    m_State.program_counter += INSTRUCTION_SIZE;
+    instruction.handler(*this, instruction);
+
+    m_State.current_opcode = instruction.opcode;
+  }
+
+  // Called before every instruction (or block of them), the only timing
+  // work on the hot path is one add and one compare
+  void AdvanceCycles(unsigned int cycles) {
+    m_State.cycles += cycles;
+    while (m_State.cycles >= m_State.next_timer_cycle) {
+      this->TickTimers();
+    }
+  }
+
+  void TickTimers();
+  void ScheduleNextTimerTick();
+  void ResetTimerSchedule();
+
+  Byte ReadMemory(MemoryAddress address) const {
+    return ReadMemoryByte(m_State, m_ExtendedMemory.get(), address);
+  }
+  void WriteMemory(MemoryAddress address, Byte value);
+  // Switches I to all 64 KB, the memory past the classic 4 KB starts clear
+  void EnableExtendedMemory();
+  void InvalidateInstructions();
+  void InvalidateInstructions(MemoryAddress address);
+
+  unsigned int ExecuteJit(unsigned int max_instructions);
+  template <typename Quirks>
+  unsigned int ExecuteThreaded(unsigned int max_instructions);
+  template <typename Quirks>
+  void CompileThreadedBlock(MemoryAddress address, const void *const *targets);
+  void InvalidateDirtyBlocks();
+
+  // One handler per InstructionType, built for Quirks
+  template <typename Quirks>
+  static const InstructionHandler *GetHandlers();
+
+  InstructionHandler DecodeHandler(Opcode opcode) const {
+    return m_Handlers[(size_t)DecodeType(opcode)];
+  }
+
+  template <void (Interpreter::*Handler)(const Instruction &)>
+  static void Dispatch(Interpreter &interpreter, const Instruction &instruction) {
+    (interpreter.*Handler)(instruction);
+  }
+
+  // Instruction handlers, the program counter already points past the
+  // instruction when they are called. Apart from Op_Decode they run the
+  // shared handlers in Instructions.h on the interpreter through Machine.
+  struct Machine;
+  void Op_Decode(const Instruction &instruction);
+
+#define CHIP8_INSTRUCTION_HANDLER(name) void Op_##name(const Instruction &instruction);
+#define CHIP8_QUIRK_HANDLER(name) \
+  template <typename Quirks>      \
+  void Op_##name(const Instruction &instruction);
+  CHIP8_INSTRUCTIONS(CHIP8_INSTRUCTION_HANDLER, CHIP8_QUIRK_HANDLER)
+#undef CHIP8_QUIRK_HANDLER
+#undef CHIP8_INSTRUCTION_HANDLER
+
+  bool IsKeyPressed(Byte key) const { return m_InputSource && m_InputSource->IsKeyPressed(key); }
+
+  Byte NextRandomByte() { return Chip8::NextRandomByte(m_State.random_state); }
 
 private:
-  std::shared_ptr<Display> m_DisplayPointer;
-  std::shared_ptr<AudioHandler> m_AudioPoinater;
+  bool m_FrameDirty = true;
+
+  PresentMode m_PresentMode = PresentMode::HostFrame;
+  bool m_EmulatedFramesOnRequest = false;
+  bool m_EmulatedFrameRequested = false;
+  bool m_DisplayWaitQuirk = false;
+
+  // Chosen by SetQuirkProfile
+  QuirkProfile m_QuirkProfile = QuirkProfile::Default;
+  const InstructionHandler *m_Handlers = GetHandlers<DefaultQuirks>();
+  unsigned int (Interpreter::*m_ExecuteThreaded)(unsigned int max_instructions) =
+      &Interpreter::ExecuteThreaded<DefaultQuirks>;
+  uint64_t m_RandomSeed = DEFAULT_RANDOM_SEED;
+
+  bool m_RomLoaded = false;
+  uint64_t m_RomHash = 0;
 
-  std::array<Byte, MEMORY_SIZE> m_Memory{0};
-  std::array<Byte, REGISTER_SIZE> m_Registers{0};
+  MachineState m_State;
+  // Allocated the first time the machine gets extended memory and kept
+  // across restarts
+  std::unique_ptr<ExtendedMemory> m_ExtendedMemory;
 
-  Byte m_DelayTimer, m_SoundTimer;
+  std::shared_ptr<FrameSink> m_FrameSink;
+  std::shared_ptr<SoundSink> m_SoundSink;
+  std::shared_ptr<InputSource> m_InputSource;
+  std::shared_ptr<TraceRecorder> m_TraceRecorder;
+#if CHIP8_PROFILER_ENABLED
+  std::shared_ptr<Profiler> m_Profiler;
+#endif
 
-  MemoryAddress m_ProgramCounter = ROM_START, m_IndexRegister = 0;
-  std::stack<MemoryAddress> m_CallStack;
+  std::array<Instruction, MEMORY_SIZE> m_Instructions;
 
-  Opcode m_CurrentOpcode;
+  ExecutionEngine m_ExecutionEngine = ExecutionEngine::Interpreter;
 
-  bool m_DebugStepThrough;
+  std::array<ThreadedBlock, MEMORY_SIZE> m_ThreadedBlocks;
+  std::vector<ThreadedOp> m_ThreadedOps;
+  std::vector<MemoryAddress> m_ThreadedBlockStarts;
+  uint64_t m_DirtyPages = ~0ull;
 
-  unsigned int m_TicksCount;
-  unsigned int m_TicksElapsed;
+  std::unique_ptr<Jit> m_Jit;
 };
 
 }  // namespace Chip8
@@ -0,0 +1,228 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include <imgui.h>
+#include <imgui_memory_editor.h>
+
+#include "Interpreter.h"
+#include "Profiler.h"
+
+namespace Chip8 {
+
+#if CHIP8_PROFILER_ENABLED
+struct Heatmap {
+  const ProfileCounters *profile;
+  double log_max_count;
+};
+
+// Tints each byte by how often the instruction it belongs to ran, on a log
+// scale so a cold branch still shows next to a hot loop
+static ImU32 GetHeatmapColor(const ImU8 *memory, size_t offset, void *user_data) {
+  const auto &heatmap = *static_cast<const Heatmap *>(user_data);
+  const auto &counts = heatmap.profile->address_counts;
+
+  // Code never runs above the classic 4 KB
+  if (offset >= counts.size()) {
+    return 0;
+  }
+
+  // The second byte of an instruction takes the count of its first
+  const uint64_t count = std::max(counts[offset], offset > 0 ? counts[offset - 1] : 0);
+  if (count == 0 || heatmap.log_max_count <= 0.0) {
+    return 0;
+  }
+
+  const double heat = std::log1p(double(count)) / heatmap.log_max_count;
+  return IM_COL32(255, 96, 0, 24 + int(heat * 200));
+}
+
+// Sorts rows by the table's sort column, column 0 compares keys and every
+// other column the counts
+template <typename Row, typename Key, typename Count>
+static void SortRows(std::vector<Row> &rows, Key key, Count count) {
+  const ImGuiTableSortSpecs *sort_specs = ImGui::TableGetSortSpecs();
+  if (sort_specs == nullptr || sort_specs->SpecsCount == 0) {
+    return;
+  }
+
+  const ImGuiTableColumnSortSpecs &spec = sort_specs->Specs[0];
+  const bool ascending = spec.SortDirection == ImGuiSortDirection_Ascending;
+
+  std::sort(rows.begin(), rows.end(), [&](const Row &a, const Row &b) {
+    if (spec.ColumnIndex == 0) {
+      return ascending ? key(a) < key(b) : key(b) < key(a);
+    }
+    return ascending ? count(a) < count(b) : count(b) < count(a);
+  });
+}
+
+static void DisplayProfile(const MachineState &snapshot, const ProfileCounters &profile,
+                           MemoryEditor &memory_editor) {
+  ImGuiTableFlags table_flags = ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg |
+                                ImGuiTableFlags_Sortable | ImGuiTableFlags_ScrollY;
+  const double total = std::max<double>(profile.instructions, 1.0);
+
+  ImGui::Text("Instructions: %llu", (unsigned long long)profile.instructions);
+  ImGui::Text("Waiting for a key (FX0A): %llu cycles, %.1f%%",
+              (unsigned long long)profile.key_wait_cycles, 100.0 * profile.key_wait_cycles / total);
+  ImGui::Text("Polling the delay timer: %llu cycles, %.1f%%",
+              (unsigned long long)profile.delay_wait_cycles,
+              100.0 * profile.delay_wait_cycles / total);
+
+  static std::vector<InstructionType> types;
+  types.clear();
+  for (size_t type = 0; type < profile.type_counts.size(); ++type) {
+    if (profile.type_counts[type] != 0) {
+      types.push_back(static_cast<InstructionType>(type));
+    }
+  }
+
+  if (ImGui::BeginTable("Instruction profile", 3, table_flags, ImVec2(0, 200))) {
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("Instruction");
+    ImGui::TableSetupColumn("Executions", ImGuiTableColumnFlags_DefaultSort |
+                                              ImGuiTableColumnFlags_PreferSortDescending);
+    ImGui::TableSetupColumn("Share");
+    ImGui::TableHeadersRow();
+
+    SortRows(
+        types, [](InstructionType type) { return type; },
+        [&](InstructionType type) { return profile.type_counts[(size_t)type]; });
+
+    for (InstructionType type : types) {
+      const uint64_t count = profile.type_counts[(size_t)type];
+
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(GetInstructionName(type));
+      ImGui::TableNextColumn();
+      ImGui::Text("%llu", (unsigned long long)count);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.2f%%", 100.0 * count / total);
+    }
+    ImGui::EndTable();
+  }
+
+  static std::vector<MemoryAddress> addresses;
+  addresses.clear();
+  for (size_t address = 0; address < profile.address_counts.size(); ++address) {
+    if (profile.address_counts[address] != 0) {
+      addresses.push_back(static_cast<MemoryAddress>(address));
+    }
+  }
+
+  if (ImGui::BeginTable("Address profile", 4, table_flags, ImVec2(0, 300))) {
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("Address");
+    ImGui::TableSetupColumn("Executions", ImGuiTableColumnFlags_DefaultSort |
+                                              ImGuiTableColumnFlags_PreferSortDescending);
+    ImGui::TableSetupColumn("Share");
+    ImGui::TableSetupColumn("Opcode", ImGuiTableColumnFlags_NoSort);
+    ImGui::TableHeadersRow();
+
+    SortRows(
+        addresses, [](MemoryAddress address) { return address; },
+        [&](MemoryAddress address) { return profile.address_counts[address]; });
+
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(addresses.size()));
+    while (clipper.Step()) {
+      for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row) {
+        const MemoryAddress address = addresses[row];
+        const uint64_t count = profile.address_counts[address];
+        const Opcode opcode = snapshot.memory[address] << 8 |
+                              snapshot.memory[(address + 1) & MEMORY_MASK];
+
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+
+        char label[8];
+        std::snprintf(label, sizeof(label), "%03X", address);
+        if (ImGui::Selectable(label, false, ImGuiSelectableFlags_SpanAllColumns)) {
+          memory_editor.GotoAddrAndHighlight(address, address + INSTRUCTION_SIZE);
+        }
+
+        ImGui::TableNextColumn();
+        ImGui::Text("%llu", (unsigned long long)count);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.2f%%", 100.0 * count / total);
+        ImGui::TableNextColumn();
+        ImGui::Text("%04X %s", opcode, GetInstructionName(Interpreter::DecodeType(opcode)));
+      }
+    }
+    ImGui::EndTable();
+  }
+}
+#endif
+
+void Interpreter::DisplayDebugMenu(MachineState &snapshot,
+                                   [[maybe_unused]] const ProfileCounters *profile) {
+  ImGuiTableFlags table_flags = ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg;
+
+  ImGui::Text("Current opcode: %04X", snapshot.current_opcode);
+
+  if (ImGui::BeginTable("Registers", REGISTER_SIZE, table_flags)) {
+    for (int row = 0; row < 2; ++row) {
+      ImGui::TableNextRow();
+      for (int register_name = 0; register_name < REGISTER_SIZE; ++register_name) {
+        ImGui::TableNextColumn();
+
+        if (row == 0) {
+          ImGui::Text("V%X", register_name);
+        } else {
+          ImGui::Text("%d", snapshot.registers[register_name]);
+        }
+      }
+    }
+    ImGui::EndTable();
+  }
+
+  static MemoryEditor memory_editor;
+
+  memory_editor.OptShowAscii = false;
+  memory_editor.ReadOnly = true;
+  memory_editor.BgColorFn = nullptr;
+
+#if CHIP8_PROFILER_ENABLED
+  static bool show_heatmap = true;
+  static Heatmap heatmap;
+
+  if (profile != nullptr && show_heatmap) {
+    heatmap.profile = profile;
+    heatmap.log_max_count = std::log1p(double(
+        *std::max_element(profile->address_counts.begin(), profile->address_counts.end())));
+
+    memory_editor.BgColorFn = &GetHeatmapColor;
+    memory_editor.UserData = &heatmap;
+  }
+#endif
+
+  // The classic 4 KB, code and the fonts live there even for XO-CHIP
+  // programs. Their extended memory is not part of the snapshot.
+  memory_editor.DrawWindow("Memory", snapshot.memory.data(), snapshot.memory.size());
+
+  if (ImGui::Button("Go to program counter")) {
+    memory_editor.GotoAddrAndHighlight(snapshot.program_counter, snapshot.program_counter);
+  }
+
+  ImGui::Text("Index Register: %d", snapshot.index_register);
+  ImGui::Text("Program Counter: %d", snapshot.program_counter);
+
+  ImGui::Text("Delay timer: %d", snapshot.delay_timer);
+  ImGui::Text("Sound timer: %d", snapshot.sound_timer);
+
+  if (ImGui::CollapsingHeader("Profile")) {
+#if CHIP8_PROFILER_ENABLED
+    if (profile != nullptr) {
+      ImGui::Checkbox("Heatmap in memory view", &show_heatmap);
+      DisplayProfile(snapshot, *profile, memory_editor);
+    }
+#else
+    ImGui::TextUnformatted("Not built in, configure with -DCHIP8_ENABLE_PROFILER=ON");
+#endif
+  }
+}
+
+}  // namespace Chip8
@@ -0,0 +1,1045 @@
+#include "Jit.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+#include <numeric>
+#include <type_traits>
+
+#include "Instructions.h"
+#include "Logging.h"
+
+#define CHIP8_LOG_SUBSYSTEM CORE
+
+namespace Chip8 {
+
+constexpr size_t CODE_BUFFER_SIZE = 4 * 1024 * 1024;
+constexpr unsigned int MAX_BLOCK_LENGTH = 64;
+constexpr MemoryAddress MAX_BLOCK_BYTES = MAX_BLOCK_LENGTH * INSTRUCTION_SIZE;
+// Reserved up front so compiling and linking while the program runs do not
+// allocate. The largest block of the test ROMs is about 1.2 KB of code.
+constexpr size_t BLOCK_CODE_RESERVE = 16 * 1024;
+constexpr size_t LINK_RESERVE = MEMORY_SIZE;
+
+namespace {
+
+// x86-64 register numbers. Inside compiled code r15 points at the
+// MachineState, r14 at the JitContext, r13d is the budget left and r12w is I.
+// The V registers a block uses most live in rbx, rbp, rsi, rdi and r8-r11,
+// rax and rcx are scratch.
+constexpr Byte RAX = 0;
+constexpr Byte RCX = 1;
+constexpr Byte RBX = 3;
+constexpr Byte RSP = 4;
+constexpr Byte RBP = 5;
+constexpr Byte RSI = 6;
+constexpr Byte RDI = 7;
+constexpr Byte R8 = 8;
+constexpr Byte R9 = 9;
+constexpr Byte R10 = 10;
+constexpr Byte R11 = 11;
+constexpr Byte R12 = 12;
+constexpr Byte R13 = 13;
+constexpr Byte R14 = 14;
+constexpr Byte R15 = 15;
+constexpr Byte NO_REGISTER = 0xFF;
+
+constexpr Byte HOST_REGISTERS[] = {RBX, RBP, RSI, RDI, R8, R9, R10, R11};
+
+constexpr Byte CONDITION_BELOW = 0x2;
+constexpr Byte CONDITION_ABOVE_OR_EQUAL = 0x3;
+constexpr Byte CONDITION_EQUAL = 0x4;
+constexpr Byte CONDITION_NOT_EQUAL = 0x5;
+
+// Compiled code addresses both structs by offset
+static_assert(std::is_standard_layout_v<MachineState> && std::is_standard_layout_v<JitContext>);
+static_assert(sizeof(MemoryAddress) == 2 && sizeof(Opcode) == 2);
+static_assert(sizeof(MachineState::stack_pointer) == 4);
+
+constexpr int32_t REGISTERS_OFFSET = offsetof(MachineState, registers);
+constexpr int32_t INDEX_REGISTER_OFFSET = offsetof(MachineState, index_register);
+constexpr int32_t PROGRAM_COUNTER_OFFSET = offsetof(MachineState, program_counter);
+constexpr int32_t CURRENT_OPCODE_OFFSET = offsetof(MachineState, current_opcode);
+constexpr int32_t STACK_POINTER_OFFSET = offsetof(MachineState, stack_pointer);
+constexpr int32_t CALL_STACK_OFFSET = offsetof(MachineState, call_stack);
+
+constexpr int32_t STATE_OFFSET = offsetof(JitContext, state);
+constexpr int32_t BUDGET_OFFSET = offsetof(JitContext, budget);
+constexpr int32_t LINK_SITE_OFFSET = offsetof(JitContext, link_site);
+
+// A register, or memory at base + index * scale + displacement
+struct Operand {
+  Byte base;
+  bool memory = false;
+  Byte index = NO_REGISTER;
+  Byte scale = 1;
+  int32_t displacement = 0;
+
+  static Operand Register(Byte reg) { return Operand{reg}; }
+  static Operand Memory(Byte base, int32_t displacement) {
+    return Operand{base, true, NO_REGISTER, 1, displacement};
+  }
+  static Operand Memory(Byte base, Byte index, Byte scale, int32_t displacement) {
+    return Operand{base, true, index, scale, displacement};
+  }
+};
+
+// Operand size. Byte always gets a REX prefix, so rbp, rsi and rdi are bpl,
+// sil and dil rather than ch, dh and bh.
+enum class Width { Byte, Word, Dword, Qword };
+
+// Minimal x86-64 encoder for the handful of instructions the blocks need
+class Emitter {
+public:
+  // base is the offset in the code buffer the code will be copied to
+  Emitter(std::vector<Byte> &code, size_t base) : m_Code(code), m_Base(base) { m_Code.clear(); }
+
+  size_t GetPosition() const { return m_Code.size(); }
+  size_t GetOffset() const { return m_Base + m_Code.size(); }
+
+  void Emit8(Byte value) { m_Code.push_back(value); }
+  void Emit16(uint16_t value) {
+    Emit8(value & 0xFF);
+    Emit8(value >> 8);
+  }
+  void Emit32(uint32_t value) {
+    Emit16(value & 0xFFFF);
+    Emit16(value >> 16);
+  }
+  void Emit64(uint64_t value) {
+    Emit32(value & 0xFFFFFFFF);
+    Emit32(value >> 32);
+  }
+
+  // Prefixes, opcode and ModRM for reg (a register, or the extension of the
+  // /digit forms) and rm
+  void Encode(std::initializer_list<Byte> opcode, Width width, Byte reg, const Operand &rm) {
+    if (width == Width::Word) {
+      Emit8(0x66);
+    }
+
+    const bool indexed = rm.memory && rm.index != NO_REGISTER;
+    Byte rex = 0x40;
+    if (width == Width::Qword) rex |= 0x08;
+    if (reg & 0x8) rex |= 0x04;
+    if (indexed && (rm.index & 0x8)) rex |= 0x02;
+    if (rm.base & 0x8) rex |= 0x01;
+    if (rex != 0x40 || width == Width::Byte) {
+      Emit8(rex);
+    }
+
+    for (Byte byte : opcode) {
+      Emit8(byte);
+    }
+
+    if (!rm.memory) {
+      Emit8(0xC0 | (reg & 0x7) << 3 | (rm.base & 0x7));
+      return;
+    }
+
+    // Always with a displacement, so rbp and r13 as base need nothing special
+    const bool sib = indexed || (rm.base & 0x7) == RSP;
+    const bool short_displacement = rm.displacement >= -128 && rm.displacement <= 127;
+    Emit8((short_displacement ? 0x40 : 0x80) | (reg & 0x7) << 3 | (sib ? RSP : rm.base & 0x7));
+
+    if (sib) {
+      const Byte scale = rm.scale == 8 ? 3 : rm.scale == 4 ? 2 : rm.scale == 2 ? 1 : 0;
+      const Byte index = indexed ? rm.index : RSP;
+      Emit8(scale << 6 | (index & 0x7) << 3 | (rm.base & 0x7));
+    }
+
+    if (short_displacement) {
+      Emit8(rm.displacement & 0xFF);
+    } else {
+      Emit32(rm.displacement);
+    }
+  }
+
+  void Push(Byte reg) {
+    if (reg & 0x8) Emit8(0x41);
+    Emit8(0x50 | (reg & 0x7));
+  }
+  void Pop(Byte reg) {
+    if (reg & 0x8) Emit8(0x41);
+    Emit8(0x58 | (reg & 0x7));
+  }
+
+  // jcc rel32 to a position bound later, returns the fixup for Bind
+  size_t JumpIf(Byte condition) {
+    Emit8(0x0F);
+    Emit8(0x80 | condition);
+    Emit32(0);
+    return GetPosition() - 4;
+  }
+  void Bind(size_t fixup, size_t position) {
+    const int32_t displacement = int32_t(position) - int32_t(fixup + 4);
+    std::memcpy(&m_Code[fixup], &displacement, sizeof(displacement));
+  }
+  void Bind(size_t fixup) { Bind(fixup, GetPosition()); }
+
+  // jmp and jcc rel32 to an offset in the code buffer
+  void JumpToOffset(size_t offset) {
+    Emit8(0xE9);
+    Emit32(int32_t(offset) - int32_t(GetOffset() + 4));
+  }
+  void JumpIfToOffset(Byte condition, size_t offset) {
+    Emit8(0x0F);
+    Emit8(0x80 | condition);
+    Emit32(int32_t(offset) - int32_t(GetOffset() + 4));
+  }
+
+  // mov word [r15 + offset], imm16
+  void StoreStateWord(int32_t offset, uint16_t value) {
+    Encode({0xC7}, Width::Word, 0, Operand::Memory(R15, offset));
+    Emit16(value);
+  }
+
+private:
+  std::vector<Byte> &m_Code;
+  size_t m_Base;
+};
+
+// Emits one block: knows which host register holds each V register and how
+// every kind of exit leaves the block
+class BlockEmitter : public Emitter {
+public:
+  BlockEmitter(std::vector<Byte> &code, size_t base, MemoryAddress start, unsigned int length,
+               size_t exit_offset, size_t miss_offset, const Byte *const *entries,
+               void (*interpret)(JitContext *context))
+      : Emitter(code, base),
+        m_Start(start),
+        m_Length(length),
+        m_ExitOffset(exit_offset),
+        m_MissOffset(miss_offset),
+        m_Entries(entries),
+        m_Interpret(interpret) {
+    m_Host.fill(NO_REGISTER);
+  }
+
+  // Gives the most used V registers a host register each. written marks the
+  // ones the block writes, which every exit stores back.
+  void AllocateRegisters(const std::array<unsigned int, REGISTER_SIZE> &uses, uint16_t written) {
+    std::array<Byte, REGISTER_SIZE> order;
+    std::iota(order.begin(), order.end(), 0);
+    // Ties go to the lower register. Not stable_sort, which allocates.
+    std::sort(order.begin(), order.end(), [&](Byte a, Byte b) {
+      return uses[a] != uses[b] ? uses[a] > uses[b] : a < b;
+    });
+
+    for (size_t i = 0; i < std::size(HOST_REGISTERS) && uses[order[i]] > 0; ++i) {
+      m_Host[order[i]] = HOST_REGISTERS[i];
+    }
+    m_Written = written;
+  }
+
+  Operand V(unsigned int r) const {
+    return m_Host[r] != NO_REGISTER ? Operand::Register(m_Host[r])
+                                    : Operand::Memory(R15, REGISTERS_OFFSET + r);
+  }
+
+  // The register holding Vr, loaded into scratch when Vr lives in memory
+  Byte Source(unsigned int r, Byte scratch) {
+    if (m_Host[r] != NO_REGISTER) {
+      return m_Host[r];
+    }
+
+    Encode({0x8A}, Width::Byte, scratch, V(r));
+    return scratch;
+  }
+
+  // Leaves right away unless the budget covers the whole block, then loads
+  // the registers. A block jumping to itself goes back to after the loads.
+  void EnterBlock() {
+    this->CompareBudget();
+    m_OutOfBudget = JumpIf(CONDITION_BELOW);
+
+    for (unsigned int r = 0; r < REGISTER_SIZE; ++r) {
+      if (m_Host[r] != NO_REGISTER) {
+        Encode({0x0F, 0xB6}, Width::Byte, m_Host[r], Operand::Memory(R15, REGISTERS_OFFSET + r));
+      }
+    }
+
+    m_Body = GetPosition();
+  }
+
+  // Goes on at target. count is how many instructions ran since the block was
+  // entered, opcode the last of them.
+  void ExitToBlock(MemoryAddress target, unsigned int count, Opcode opcode) {
+    if (target == m_Start) {
+      // Back to the top while the budget lasts, with the registers still
+      // loaded
+      this->SubtractBudget(count);
+      this->CompareBudget();
+      Bind(JumpIf(CONDITION_ABOVE_OR_EQUAL), m_Body);
+
+      this->StoreRegisters();
+      StoreStateWord(CURRENT_OPCODE_OFFSET, opcode);
+      this->Leave(target);
+      return;
+    }
+
+    this->StoreRegisters();
+    this->SubtractBudget(count);
+    StoreStateWord(CURRENT_OPCODE_OFFSET, opcode);
+    this->Chain(target);
+  }
+
+  // Has the interpreter run the instruction at address, count being the
+  // instructions up to and including it, then goes on wherever that left the
+  // program counter
+  void Interpret(MemoryAddress address, unsigned int count) {
+    this->StoreRegisters();
+    this->SubtractBudget(count);
+    Encode({0x89}, Width::Dword, R13, Operand::Memory(R14, BUDGET_OFFSET));
+    Encode({0x89}, Width::Word, R12, Operand::Memory(R15, INDEX_REGISTER_OFFSET));
+    StoreStateWord(PROGRAM_COUNTER_OFFSET, address);
+
+    // mov rdi, r14; mov rax, Jit::Interpret; call rax
+    Encode({0x89}, Width::Qword, R14, Operand::Register(RDI));
+    Emit8(0x48);
+    Emit8(0xB8 | RAX);
+    Emit64(reinterpret_cast<uint64_t>(m_Interpret));
+    Encode({0xFF}, Width::Dword, 2, Operand::Register(RAX));
+
+    // movzx r12d, I; movzx eax, PC
+    Encode({0x0F, 0xB7}, Width::Dword, R12, Operand::Memory(R15, INDEX_REGISTER_OFFSET));
+    Encode({0x0F, 0xB7}, Width::Dword, RAX, Operand::Memory(R15, PROGRAM_COUNTER_OFFSET));
+
+    // Mostly it went on to the next instruction, which gets a chain jump of
+    // its own
+    const MemoryAddress next = address + INSTRUCTION_SIZE;
+    Emit8(0x3D);
+    Emit32(next);
+    const size_t elsewhere = JumpIf(CONDITION_NOT_EQUAL);
+    this->Chain(next);
+
+    Bind(elsewhere);
+    this->Dispatch();
+  }
+
+  // Goes on at the address in eax through the entry table
+  void ExitThroughTable(unsigned int count, Opcode opcode) {
+    this->StoreRegisters();
+    this->SubtractBudget(count);
+    StoreStateWord(CURRENT_OPCODE_OFFSET, opcode);
+    this->Dispatch();
+  }
+
+  // A branch taken on the way through the block, its exit is emitted after
+  // the straight path by FinishBlock
+  // to_block false has the interpreter run the instruction at target instead
+  void AddSideExit(size_t fixup, MemoryAddress target, unsigned int count, Opcode opcode,
+                   bool to_block) {
+    m_SideExits[m_SideExitCount++] = SideExit{fixup, target, count, opcode, to_block};
+  }
+
+  void FinishBlock() {
+    for (unsigned int i = 0; i < m_SideExitCount; ++i) {
+      const SideExit &exit = m_SideExits[i];
+      Bind(exit.fixup);
+
+      if (exit.to_block) {
+        this->ExitToBlock(exit.target, exit.count, exit.opcode);
+      } else {
+        this->Interpret(exit.target, exit.count);
+      }
+    }
+
+    // Nothing ran or was loaded yet
+    Bind(m_OutOfBudget);
+    this->Leave(m_Start);
+  }
+
+private:
+  struct SideExit {
+    size_t fixup;
+    MemoryAddress target;
+    unsigned int count;
+    Opcode opcode;
+    bool to_block;
+  };
+
+  // Jit::Link patches the jump to go straight to the block at target, until
+  // then it falls through to the stub asking for that
+  void Chain(MemoryAddress target) {
+    Emit8(0xE9);
+    const size_t site = GetOffset();
+    Emit32(0);
+
+    Encode({0xC7}, Width::Dword, 0, Operand::Memory(R14, LINK_SITE_OFFSET));
+    Emit32(site + 1);
+    this->Leave(target);
+  }
+
+  // Jumps to the block at the address in eax. The entry table has the miss
+  // stub for addresses without one, which also takes the ones past memory.
+  void Dispatch() {
+    // cmp eax, MEMORY_SIZE; jae miss
+    Emit8(0x3D);
+    Emit32(MEMORY_SIZE);
+    JumpIfToOffset(CONDITION_ABOVE_OR_EQUAL, m_MissOffset);
+
+    // mov rcx, entries; jmp [rcx + rax * 8]
+    Emit8(0x48);
+    Emit8(0xB8 | RCX);
+    Emit64(reinterpret_cast<uint64_t>(m_Entries));
+    Encode({0xFF}, Width::Dword, 4, Operand::Memory(RCX, RAX, 8, 0));
+  }
+
+  void StoreRegisters() {
+    for (unsigned int r = 0; r < REGISTER_SIZE; ++r) {
+      if (m_Host[r] != NO_REGISTER && (m_Written >> r) & 1) {
+        Encode({0x88}, Width::Byte, m_Host[r], Operand::Memory(R15, REGISTERS_OFFSET + r));
+      }
+    }
+  }
+
+  // cmp r13d, length
+  void CompareBudget() {
+    Encode({0x81}, Width::Dword, 7, Operand::Register(R13));
+    Emit32(m_Length);
+  }
+
+  // sub r13d, count
+  void SubtractBudget(unsigned int count) {
+    Encode({0x81}, Width::Dword, 5, Operand::Register(R13));
+    Emit32(count);
+  }
+
+  void Leave(MemoryAddress program_counter) {
+    StoreStateWord(PROGRAM_COUNTER_OFFSET, program_counter);
+    JumpToOffset(m_ExitOffset);
+  }
+
+  MemoryAddress m_Start;
+  unsigned int m_Length;
+  size_t m_ExitOffset, m_MissOffset;
+  const Byte *const *m_Entries;
+  void (*m_Interpret)(JitContext *context);
+
+  std::array<Byte, REGISTER_SIZE> m_Host;
+  uint16_t m_Written = 0;
+
+  size_t m_OutOfBudget = 0;
+  size_t m_Body = 0;
+
+  std::array<SideExit, MAX_BLOCK_LENGTH> m_SideExits;
+  unsigned int m_SideExitCount = 0;
+};
+
+// Whether compiled code runs the instruction itself. The display, input,
+// timers, RNG and memory access go through the interpreter.
+bool IsCompiled(InstructionType type) {
+  switch (type) {
+    case InstructionType::Op_Nop:
+    case InstructionType::Op_00EE:
+    case InstructionType::Op_1NNN:
+    case InstructionType::Op_2NNN:
+    case InstructionType::Op_3XNN:
+    case InstructionType::Op_4XNN:
+    case InstructionType::Op_5XY0:
+    case InstructionType::Op_6XNN:
+    case InstructionType::Op_7XNN:
+    case InstructionType::Op_8XY0:
+    case InstructionType::Op_8XY1:
+    case InstructionType::Op_8XY2:
+    case InstructionType::Op_8XY3:
+    case InstructionType::Op_8XY4:
+    case InstructionType::Op_8XY5:
+    case InstructionType::Op_8XY6:
+    case InstructionType::Op_8XY7:
+    case InstructionType::Op_8XYE:
+    case InstructionType::Op_9XY0:
+    case InstructionType::Op_ANNN:
+    case InstructionType::Op_BNNN:
+    case InstructionType::Op_FX1E:
+    case InstructionType::Op_FX29:
+    case InstructionType::Op_FX30: return true;
+    default: return false;
+  }
+}
+
+bool EndsBlock(InstructionType type) {
+  return type == InstructionType::Op_00EE || type == InstructionType::Op_1NNN ||
+         type == InstructionType::Op_2NNN || type == InstructionType::Op_BNNN;
+}
+
+bool IsSkip(InstructionType type) {
+  return type == InstructionType::Op_3XNN || type == InstructionType::Op_4XNN ||
+         type == InstructionType::Op_5XY0 || type == InstructionType::Op_9XY0;
+}
+
+// Counts the uses of each V register by the instruction and marks the ones
+// it writes
+template <typename Quirks>
+void CountUses(InstructionType type, const Instruction &instruction,
+               std::array<unsigned int, REGISTER_SIZE> &uses, uint16_t &written) {
+  auto read = [&](unsigned int r) { uses[r]++; };
+  auto write = [&](unsigned int r) {
+    uses[r]++;
+    written |= 1 << r;
+  };
+
+  switch (type) {
+    case InstructionType::Op_3XNN:
+    case InstructionType::Op_4XNN:
+    case InstructionType::Op_FX1E:
+    case InstructionType::Op_FX29:
+    case InstructionType::Op_FX30: {
+      read(instruction.x);
+      break;
+    }
+    case InstructionType::Op_5XY0:
+    case InstructionType::Op_9XY0: {
+      read(instruction.x);
+      read(instruction.y);
+      break;
+    }
+    case InstructionType::Op_6XNN:
+    case InstructionType::Op_7XNN: {
+      write(instruction.x);
+      break;
+    }
+    case InstructionType::Op_8XY0: {
+      read(instruction.y);
+      write(instruction.x);
+      break;
+    }
+    case InstructionType::Op_8XY1:
+    case InstructionType::Op_8XY2:
+    case InstructionType::Op_8XY3: {
+      read(instruction.y);
+      write(instruction.x);
+      if (Quirks::logic_resets_flag) write(FLAG_REGISTER);
+      break;
+    }
+    case InstructionType::Op_8XY4:
+    case InstructionType::Op_8XY5:
+    case InstructionType::Op_8XY7: {
+      read(instruction.y);
+      write(instruction.x);
+      write(FLAG_REGISTER);
+      break;
+    }
+    case InstructionType::Op_8XY6:
+    case InstructionType::Op_8XYE: {
+      read(Quirks::shift_in_place ? instruction.x : instruction.y);
+      write(instruction.x);
+      write(FLAG_REGISTER);
+      break;
+    }
+    case InstructionType::Op_BNNN: {
+      read(Quirks::jump_uses_vx ? instruction.x : 0x0);
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+}
+
+// Emits instruction, the index-th of the block, which sits at
+// instruction_address
+template <typename Quirks>
+void EmitInstruction(BlockEmitter &emitter, const Byte *memory, MemoryAddress instruction_address,
+                     unsigned int index, InstructionType type, const Instruction &instruction) {
+  const MemoryAddress next = instruction_address + INSTRUCTION_SIZE;
+  const Operand vx = emitter.V(instruction.x);
+  const Operand vy = emitter.V(instruction.y);
+  const Operand vf = emitter.V(FLAG_REGISTER);
+  const Operand shift_source = Quirks::shift_in_place ? vx : vy;
+
+  // A taken skip leaves the block, past F000 NNNN as a whole where the
+  // profile has it
+  auto skip_if = [&](Byte condition) {
+    const bool long_instruction = Quirks::long_skip && memory[next & MEMORY_MASK] == 0xF0 &&
+                                  memory[(next + 1) & MEMORY_MASK] == 0x00;
+    const MemoryAddress target = next + (long_instruction ? 2 : 1) * INSTRUCTION_SIZE;
+    emitter.AddSideExit(emitter.JumpIf(condition), target, index + 1, instruction.opcode, true);
+  };
+
+  // The interpreter runs the instruction when the compiled code can not
+  auto interpret_if = [&](Byte condition) {
+    emitter.AddSideExit(emitter.JumpIf(condition), instruction_address, index + 1, 0, false);
+  };
+
+  // <op> Vx, Vy for one of the r/m8, r8 forms
+  auto apply = [&](Byte op) {
+    emitter.Encode({op}, Width::Byte, emitter.Source(instruction.y, RAX), vx);
+  };
+
+  // For arithmetic done in al: setcc cl; mov Vx, al; mov VF, cl
+  auto store_with_flag = [&](Byte condition) {
+    emitter.Encode({0x0F, Byte(0x90 | condition)}, Width::Byte, 0, Operand::Register(RCX));
+    emitter.Encode({0x88}, Width::Byte, RAX, vx);
+    emitter.Encode({0x88}, Width::Byte, RCX, vf);
+  };
+
+  auto clear_flag = [&]() {
+    emitter.Encode({0xC6}, Width::Byte, 0, vf);
+    emitter.Emit8(0);
+  };
+
+  switch (type) {
+    case InstructionType::Op_00EE: {
+      // mov eax, [sp]; test eax, eax; jz; sub eax, 1; mov [sp], eax;
+      // movzx eax, word [call_stack + rax * 2]
+      emitter.Encode({0x8B}, Width::Dword, RAX, Operand::Memory(R15, STACK_POINTER_OFFSET));
+      emitter.Encode({0x85}, Width::Dword, RAX, Operand::Register(RAX));
+      interpret_if(CONDITION_EQUAL);
+      emitter.Encode({0x83}, Width::Dword, 5, Operand::Register(RAX));
+      emitter.Emit8(1);
+      emitter.Encode({0x89}, Width::Dword, RAX, Operand::Memory(R15, STACK_POINTER_OFFSET));
+      emitter.Encode({0x0F, 0xB7}, Width::Dword, RAX,
+                     Operand::Memory(R15, RAX, 2, CALL_STACK_OFFSET));
+      emitter.ExitThroughTable(index + 1, instruction.opcode);
+      break;
+    }
+
+    case InstructionType::Op_1NNN: {
+      emitter.ExitToBlock(instruction.nnn, index + 1, instruction.opcode);
+      break;
+    }
+
+    case InstructionType::Op_2NNN: {
+      // mov eax, [sp]; cmp eax, CALL_STACK_SIZE; jae;
+      // mov word [call_stack + rax * 2], next; add eax, 1; mov [sp], eax
+      emitter.Encode({0x8B}, Width::Dword, RAX, Operand::Memory(R15, STACK_POINTER_OFFSET));
+      emitter.Encode({0x81}, Width::Dword, 7, Operand::Register(RAX));
+      emitter.Emit32(CALL_STACK_SIZE);
+      interpret_if(CONDITION_ABOVE_OR_EQUAL);
+      emitter.Encode({0xC7}, Width::Word, 0, Operand::Memory(R15, RAX, 2, CALL_STACK_OFFSET));
+      emitter.Emit16(next);
+      emitter.Encode({0x83}, Width::Dword, 0, Operand::Register(RAX));
+      emitter.Emit8(1);
+      emitter.Encode({0x89}, Width::Dword, RAX, Operand::Memory(R15, STACK_POINTER_OFFSET));
+      emitter.ExitToBlock(instruction.nnn, index + 1, instruction.opcode);
+      break;
+    }
+
+    case InstructionType::Op_3XNN:
+    case InstructionType::Op_4XNN: {
+      emitter.Encode({0x80}, Width::Byte, 7, vx);
+      emitter.Emit8(instruction.nn);
+      skip_if(type == InstructionType::Op_3XNN ? CONDITION_EQUAL : CONDITION_NOT_EQUAL);
+      break;
+    }
+
+    case InstructionType::Op_5XY0:
+    case InstructionType::Op_9XY0: {
+      emitter.Encode({0x3A}, Width::Byte, emitter.Source(instruction.x, RAX), vy);
+      skip_if(type == InstructionType::Op_5XY0 ? CONDITION_EQUAL : CONDITION_NOT_EQUAL);
+      break;
+    }
+
+    case InstructionType::Op_6XNN: {
+      emitter.Encode({0xC6}, Width::Byte, 0, vx);
+      emitter.Emit8(instruction.nn);
+      break;
+    }
+
+    case InstructionType::Op_7XNN: {
+      emitter.Encode({0x80}, Width::Byte, 0, vx);
+      emitter.Emit8(instruction.nn);
+      break;
+    }
+
+    case InstructionType::Op_8XY0: {
+      apply(0x88);
+      break;
+    }
+
+    case InstructionType::Op_8XY1: {
+      apply(0x08);
+      if (Quirks::logic_resets_flag) clear_flag();
+      break;
+    }
+
+    case InstructionType::Op_8XY2: {
+      apply(0x20);
+      if (Quirks::logic_resets_flag) clear_flag();
+      break;
+    }
+
+    case InstructionType::Op_8XY3: {
+      apply(0x30);
+      if (Quirks::logic_resets_flag) clear_flag();
+      break;
+    }
+
+    // mov al, Vx; add al, Vy; setc cl; mov Vx, al; mov VF, cl. VF is written
+    // last, so it wins when x is F.
+    case InstructionType::Op_8XY4: {
+      emitter.Encode({0x8A}, Width::Byte, RAX, vx);
+      emitter.Encode({0x02}, Width::Byte, RAX, vy);
+      store_with_flag(CONDITION_BELOW);
+      break;
+    }
+
+    // No borrow sets VF: mov al, Vx; sub al, Vy; setae cl; mov Vx, al; mov VF, cl
+    case InstructionType::Op_8XY5: {
+      emitter.Encode({0x8A}, Width::Byte, RAX, vx);
+      emitter.Encode({0x2A}, Width::Byte, RAX, vy);
+      store_with_flag(CONDITION_ABOVE_OR_EQUAL);
+      break;
+    }
+
+    case InstructionType::Op_8XY6: {
+      // mov al, Vs; mov Vx, al; mov cl, al; and cl, 1; shr Vx, 1; mov VF, cl
+      emitter.Encode({0x8A}, Width::Byte, RAX, shift_source);
+      emitter.Encode({0x88}, Width::Byte, RAX, vx);
+      emitter.Encode({0x88}, Width::Byte, RAX, Operand::Register(RCX));
+      emitter.Encode({0x80}, Width::Byte, 4, Operand::Register(RCX));
+      emitter.Emit8(1);
+      emitter.Encode({0xD0}, Width::Byte, 5, vx);
+      emitter.Encode({0x88}, Width::Byte, RCX, vf);
+      break;
+    }
+
+    case InstructionType::Op_8XY7: {
+      emitter.Encode({0x8A}, Width::Byte, RAX, vy);
+      emitter.Encode({0x2A}, Width::Byte, RAX, vx);
+      store_with_flag(CONDITION_ABOVE_OR_EQUAL);
+      break;
+    }
+
+    case InstructionType::Op_8XYE: {
+      // mov al, Vs; mov Vx, al; shr al, 7; shl Vx, 1; mov VF, al
+      emitter.Encode({0x8A}, Width::Byte, RAX, shift_source);
+      emitter.Encode({0x88}, Width::Byte, RAX, vx);
+      emitter.Encode({0xC0}, Width::Byte, 5, Operand::Register(RAX));
+      emitter.Emit8(7);
+      emitter.Encode({0xD0}, Width::Byte, 4, vx);
+      emitter.Encode({0x88}, Width::Byte, RAX, vf);
+      break;
+    }
+
+    case InstructionType::Op_ANNN: {
+      // mov r12d, nnn
+      emitter.Encode({0xC7}, Width::Dword, 0, Operand::Register(R12));
+      emitter.Emit32(instruction.nnn);
+      break;
+    }
+
+    case InstructionType::Op_BNNN: {
+      // movzx eax, V; add eax, nnn
+      emitter.Encode({0x0F, 0xB6}, Width::Byte, RAX,
+                     emitter.V(Quirks::jump_uses_vx ? instruction.x : 0x0));
+      emitter.Emit8(0x05);
+      emitter.Emit32(instruction.nnn);
+      emitter.ExitThroughTable(index + 1, instruction.opcode);
+      break;
+    }
+
+    case InstructionType::Op_FX1E: {
+      // movzx eax, Vx; add r12w, ax
+      emitter.Encode({0x0F, 0xB6}, Width::Byte, RAX, vx);
+      emitter.Encode({0x01}, Width::Word, RAX, Operand::Register(R12));
+      break;
+    }
+
+    case InstructionType::Op_FX29: {
+      // movzx eax, Vx; lea r12d, [rax + rax * 4 + FONTSET_START]
+      emitter.Encode({0x0F, 0xB6}, Width::Byte, RAX, vx);
+      emitter.Encode({0x8D}, Width::Dword, R12, Operand::Memory(RAX, RAX, 4, FONTSET_START));
+      break;
+    }
+
+    case InstructionType::Op_FX30: {
+      // movzx eax, Vx; lea eax, [rax + rax * 4];
+      // lea r12d, [rax + rax + BIG_FONTSET_START]
+      emitter.Encode({0x0F, 0xB6}, Width::Byte, RAX, vx);
+      emitter.Encode({0x8D}, Width::Dword, RAX, Operand::Memory(RAX, RAX, 4, 0));
+      emitter.Encode({0x8D}, Width::Dword, R12,
+                     Operand::Memory(RAX, RAX, 1, BIG_FONTSET_START));
+      break;
+    }
+
+    // Nop, and unknown 8XYN opcodes do nothing in the interpreter either
+    default: {
+      break;
+    }
+  }
+}
+
+}  // namespace
+
+Jit::Jit(Interpreter &interpreter) : m_Interpreter(interpreter) {
+  void *buffer =
+      mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (buffer == MAP_FAILED) {
+    LOG_ERROR("Failed to allocate JIT code buffer");
+    return;
+  }
+
+  m_CodeBuffer = static_cast<Byte *>(buffer);
+  m_Code.reserve(BLOCK_CODE_RESERVE);
+  m_Links.reserve(LINK_RESERVE);
+
+  this->EmitRuntime();
+  this->Flush();
+}
+
+Jit::~Jit() {
+  if (m_CodeBuffer) {
+    munmap(m_CodeBuffer, CODE_BUFFER_SIZE);
+  }
+}
+
+void Jit::EmitRuntime() {
+  Emitter emitter(m_Code, 0);
+
+  // Enter: push the callee-saved registers; mov r14, rdi; mov r15, [r14];
+  // mov r13d, budget; movzx r12d, I; jmp rsi
+  for (Byte reg : {RBX, RBP, R12, R13, R14, R15}) {
+    emitter.Push(reg);
+  }
+  // sub rsp, 8 keeps the stack aligned for the calls to Jit::Interpret
+  emitter.Encode({0x83}, Width::Qword, 5, Operand::Register(RSP));
+  emitter.Emit8(8);
+  emitter.Encode({0x89}, Width::Qword, RDI, Operand::Register(R14));
+  emitter.Encode({0x8B}, Width::Qword, R15, Operand::Memory(R14, STATE_OFFSET));
+  emitter.Encode({0x8B}, Width::Dword, R13, Operand::Memory(R14, BUDGET_OFFSET));
+  emitter.Encode({0x0F, 0xB7}, Width::Dword, R12, Operand::Memory(R15, INDEX_REGISTER_OFFSET));
+  emitter.Encode({0xFF}, Width::Dword, 4, Operand::Register(RSI));
+
+  // Every exit ends here with the program counter stored
+  m_ExitOffset = emitter.GetOffset();
+  emitter.Encode({0x89}, Width::Word, R12, Operand::Memory(R15, INDEX_REGISTER_OFFSET));
+  emitter.Encode({0x89}, Width::Dword, R13, Operand::Memory(R14, BUDGET_OFFSET));
+  emitter.Encode({0x83}, Width::Qword, 0, Operand::Register(RSP));
+  emitter.Emit8(8);
+  for (Byte reg : {R15, R14, R13, R12, RBP, RBX}) {
+    emitter.Pop(reg);
+  }
+  emitter.Emit8(0xC3);
+
+  // Entry table miss: nothing is compiled at the address in eax yet, or it is
+  // outside memory
+  m_MissOffset = emitter.GetOffset();
+  emitter.Encode({0x89}, Width::Word, RAX, Operand::Memory(R15, PROGRAM_COUNTER_OFFSET));
+  emitter.JumpToOffset(m_ExitOffset);
+
+  m_CodeSize = 0;
+  this->CommitCode();
+  m_RuntimeSize = m_CodeSize;
+  m_Enter = reinterpret_cast<JitEnter>(m_CodeBuffer);
+}
+
+unsigned int Jit::Enter(MachineState &state, unsigned int budget, const JitBlock &block) {
+  JitContext context;
+  context.state = &state;
+  context.interpreter = &m_Interpreter;
+  context.budget = budget;
+  context.synced = budget;
+  m_Enter(&context, block.entry);
+
+  // Compiled code leaves the timers alone, they catch up at every
+  // instruction the interpreter runs and here
+  m_Interpreter.AdvanceCycles(context.synced - context.budget);
+
+  if (context.link_site != 0) {
+    this->Link(context.link_site - 1, state.program_counter, state.memory.data());
+  }
+
+  return budget - context.budget;
+}
+
+void Jit::Interpret(JitContext *context) {
+  Interpreter &interpreter = *context->interpreter;
+
+  // The cycles of the compiled instructions before it and its own
+  interpreter.AdvanceCycles(context->synced - context->budget);
+  interpreter.RunInstruction();
+  context->synced = context->budget;
+}
+
+void Jit::Link(uint32_t site, MemoryAddress target, const Byte *memory) {
+  if (target >= MEMORY_SIZE) {
+    return;
+  }
+
+  // Compiling the target can flush the block the site is in
+  const uint64_t generation = m_Generation;
+  const JitBlock &block = this->GetBlock(target, memory);
+
+  if (generation != m_Generation || !block.entry) {
+    return;
+  }
+
+  this->Patch(site, block.entry);
+  m_Links.push_back(JitLink{site, target});
+}
+
+void Jit::Patch(uint32_t site, const Byte *destination) {
+  // A displacement of 0 falls through to the stub right after the jump
+  const int32_t displacement =
+      destination ? int32_t(destination - (m_CodeBuffer + site + sizeof(int32_t))) : 0;
+
+  this->Protect(site, sizeof(displacement), true);
+  std::memcpy(m_CodeBuffer + site, &displacement, sizeof(displacement));
+  this->Protect(site, sizeof(displacement), false);
+}
+
+void Jit::Invalidate(MemoryAddress address) {
+  // A block that ends in a skip also depends on the instruction after it
+  constexpr MemoryAddress reach = MAX_BLOCK_BYTES + INSTRUCTION_SIZE;
+  const int first = address >= reach ? address - reach : 0;
+
+  for (int start = first; start <= address; ++start) {
+    const JitBlock &block = m_Blocks[start];
+
+    // Even a block with no code, at the end of memory, depends on its start
+    const int end = block.end > start + INSTRUCTION_SIZE ? block.end : start + INSTRUCTION_SIZE;
+    if (block.compiled && address < end) {
+      this->Drop(start);
+    }
+  }
+}
+
+void Jit::Drop(MemoryAddress address) {
+  JitBlock &block = m_Blocks[address];
+
+  if (block.entry) {
+    m_Entries[address] = m_CodeBuffer + m_MissOffset;
+
+    // Jumps into the block go back to their stubs, the ones out of it are dead
+    // code from now on
+    for (size_t i = 0; i < m_Links.size();) {
+      const JitLink link = m_Links[i];
+      const bool inside = link.site >= block.code_start && link.site < block.code_end;
+
+      if (!inside && link.target != address) {
+        ++i;
+        continue;
+      }
+
+      if (!inside) {
+        this->Patch(link.site, nullptr);
+      }
+      m_Links[i] = m_Links.back();
+      m_Links.pop_back();
+    }
+  }
+
+  block = JitBlock{};
+}
+
+void Jit::Flush() {
+  m_Blocks.fill(JitBlock{});
+  m_Entries.fill(m_CodeBuffer + m_MissOffset);
+  m_Links.clear();
+  m_CodeSize = m_RuntimeSize;
+  m_Generation++;
+}
+
+void Jit::SetQuirkProfile(QuirkProfile profile) {
+  WithQuirks(profile, [this](auto quirks) { m_Compile = &Jit::Compile<decltype(quirks)>; });
+  this->Flush();
+}
+
+template <typename Quirks>
+void Jit::Compile(MemoryAddress address, const Byte *memory, JitBlock &block) {
+  // Decode the whole block first, the registers are allocated for all of it
+  std::array<Instruction, MAX_BLOCK_LENGTH> instructions;
+  std::array<InstructionType, MAX_BLOCK_LENGTH> types;
+  std::array<unsigned int, REGISTER_SIZE> uses{};
+  uint16_t written = 0;
+
+  MemoryAddress program_counter = address;
+  MemoryAddress end = address;
+  unsigned int length = 0;
+  bool block_ended = false;
+  bool interpreted = false;
+
+  while (!block_ended && length < MAX_BLOCK_LENGTH &&
+         program_counter <= MEMORY_SIZE - INSTRUCTION_SIZE) {
+    const Opcode opcode = (memory[program_counter] << 8) | memory[program_counter + 1];
+    const InstructionType type = Interpreter::DecodeType(opcode);
+
+    // The interpreter runs it for the block, which ends there
+    if (!IsCompiled(type)) {
+      interpreted = true;
+      end = std::max<MemoryAddress>(end, program_counter + INSTRUCTION_SIZE);
+      break;
+    }
+
+    instructions[length] = DecodeOperands(opcode);
+    types[length] = type;
+    CountUses<Quirks>(type, instructions[length], uses, written);
+    length++;
+
+    program_counter += INSTRUCTION_SIZE;
+    block_ended = EndsBlock(type);
+
+    // How far a skip goes depends on the instruction after it
+    const MemoryAddress reached = IsSkip(type) ? program_counter + INSTRUCTION_SIZE
+                                               : program_counter;
+    end = std::max(end, reached);
+  }
+
+  block.compiled = true;
+  block.end = std::max(program_counter, end);
+
+  const unsigned int block_length = length + (interpreted ? 1 : 0);
+  if (block_length == 0) {
+    return;
+  }
+
+  BlockEmitter emitter(m_Code, m_CodeSize, address, block_length, m_ExitOffset, m_MissOffset,
+                       m_Entries.data(), &Jit::Interpret);
+  emitter.AllocateRegisters(uses, written);
+  emitter.EnterBlock();
+
+  for (unsigned int i = 0; i < length; ++i) {
+    EmitInstruction<Quirks>(emitter, memory, address + i * INSTRUCTION_SIZE, i, types[i],
+                            instructions[i]);
+  }
+
+  if (interpreted) {
+    emitter.Interpret(program_counter, block_length);
+  } else if (!block_ended) {
+    emitter.ExitToBlock(program_counter, length, instructions[length - 1].opcode);
+  }
+
+  emitter.FinishBlock();
+
+  // Out of space: start over with an empty buffer. Flushing resets every
+  // block, including this one, and moves where the code goes.
+  if (m_CodeSize + m_Code.size() > CODE_BUFFER_SIZE) {
+    this->Flush();
+    this->Compile<Quirks>(address, memory, block);
+    return;
+  }
+
+  block.entry = m_CodeBuffer + m_CodeSize;
+  block.code_start = m_CodeSize;
+  block.length = block_length;
+  this->CommitCode();
+  block.code_end = m_CodeSize;
+
+  m_Entries[address] = block.entry;
+}
+
+void Jit::CommitCode() {
+  this->Protect(m_CodeSize, m_Code.size(), true);
+  std::memcpy(m_CodeBuffer + m_CodeSize, m_Code.data(), m_Code.size());
+  this->Protect(m_CodeSize, m_Code.size(), false);
+
+  m_CodeSize += m_Code.size();
+}
+
+void Jit::Protect(size_t offset, size_t size, bool writable) {
+  static const size_t s_PageSize = sysconf(_SC_PAGESIZE);
+
+  const size_t begin = offset & ~(s_PageSize - 1);
+  const size_t end = (offset + size + s_PageSize - 1) & ~(s_PageSize - 1);
+  mprotect(m_CodeBuffer + begin, end - begin,
+           writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC);
+}
+
+}  // namespace Chip8
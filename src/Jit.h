@@ -0,0 +1,145 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Interpreter.h"
+
+namespace Chip8 {
+
+// What compiled code gets from Jit::Run and hands back when it returns
+struct JitContext {
+  MachineState *state = nullptr;
+  Interpreter *interpreter = nullptr;
+  // Instructions the code may still run, counted down as it goes
+  uint32_t budget = 0;
+  // The budget when the cycles were last advanced, by the interpreter
+  // running an instruction for the code
+  uint32_t synced = 0;
+  // Code buffer offset + 1 of the chain jump the code left through, for Jit
+  // to patch to the block it was heading for. 0 for any other exit.
+  uint32_t link_site = 0;
+};
+
+// Saves the callee-saved registers, loads the context and jumps to code
+using JitEnter = void (*)(JitContext *context, const void *code);
+
+struct JitBlock {
+  // nullptr if nothing could be compiled, at the end of memory
+  const Byte *entry = nullptr;
+  // Where the code sits in the code buffer, links that start in it go with
+  // the block
+  uint32_t code_start = 0, code_end = 0;
+
+  // First address past the code the block depends on, which includes the
+  // instruction after a skip
+  MemoryAddress end = 0;
+  // Instructions on the longest path through the block, the budget it
+  // needs to be entered
+  unsigned int length = 0;
+
+  bool compiled = false;
+};
+
+// A chain jump patched to go straight to the block at target
+struct JitLink {
+  uint32_t site;
+  MemoryAddress target;
+};
+
+// Translates CHIP-8 code into x86-64 superblocks: straight-line code with a
+// side exit at every skip, ending at a jump, call or return. Inside a block
+// the most used V registers and I live in host registers. Exits to other
+// blocks are patched into direct jumps once both sides exist, 00EE and BNNN
+// go through a table, and a block jumping to itself loops without leaving
+// native code. What it does not compile (the display, input, timers, RNG and
+// memory) ends the block with a call to the interpreter for that one
+// instruction, so code only returns when the budget runs out.
+class Jit {
+public:
+  explicit Jit(Interpreter &interpreter);
+  ~Jit();
+
+  Jit(const Jit &) = delete;
+  Jit &operator=(const Jit &) = delete;
+
+  bool IsAvailable() const { return m_CodeBuffer != nullptr; }
+
+  // Runs compiled code from the program counter, which has to be inside
+  // memory, for at most budget instructions and advances the cycles. Returns
+  // how many ran, 0 when the block there needs more than the budget.
+  unsigned int Run(unsigned int budget) {
+    MachineState &state = m_Interpreter.m_State;
+    const JitBlock &block = this->GetBlock(state.program_counter, state.memory.data());
+
+    if (!block.entry || block.length > budget) {
+      return 0;
+    }
+
+    return this->Enter(state, budget, block);
+  }
+
+  // Drops every block that was compiled from the byte at address
+  void Invalidate(MemoryAddress address);
+  void Flush();
+
+  // Blocks are compiled for one quirk profile, changing it flushes them
+  void SetQuirkProfile(QuirkProfile profile);
+
+private:
+  const JitBlock &GetBlock(MemoryAddress address, const Byte *memory) {
+    JitBlock &block = m_Blocks[address];
+
+    if (!block.compiled) {
+      (this->*m_Compile)(address, memory, block);
+    }
+
+    return block;
+  }
+
+  template <typename Quirks>
+  void Compile(MemoryAddress address, const Byte *memory, JitBlock &block);
+  unsigned int Enter(MachineState &state, unsigned int budget, const JitBlock &block);
+  void EmitRuntime();
+  // Called by compiled code to run the instruction at the program counter
+  static void Interpret(JitContext *context);
+  void CommitCode();
+
+  void Link(uint32_t site, MemoryAddress target, const Byte *memory);
+  // Points the chain jump at site to destination, or back at its exit stub
+  // for nullptr
+  void Patch(uint32_t site, const Byte *destination);
+  void Drop(MemoryAddress address);
+
+  // Makes the pages under [offset, offset + size) writable or executable
+  void Protect(size_t offset, size_t size, bool writable);
+
+private:
+  Interpreter &m_Interpreter;
+
+  std::array<JitBlock, MEMORY_SIZE> m_Blocks;
+  // Where 00EE and BNNN jump, the entry of every compiled block and the
+  // miss stub for the rest
+  std::array<const Byte *, MEMORY_SIZE> m_Entries;
+  std::vector<JitLink> m_Links;
+
+  Byte *m_CodeBuffer = nullptr;
+  size_t m_CodeSize = 0;
+  // The entry trampoline and the shared exits, kept across a flush
+  size_t m_RuntimeSize = 0;
+  size_t m_ExitOffset = 0;
+  size_t m_MissOffset = 0;
+  JitEnter m_Enter = nullptr;
+  // Bumped by every flush, links found before one are stale
+  uint64_t m_Generation = 0;
+
+  // Scratch for the block being compiled
+  std::vector<Byte> m_Code;
+
+  void (Jit::*m_Compile)(MemoryAddress address, const Byte *memory, JitBlock &block) =
+      &Jit::Compile<DefaultQuirks>;
+};
+
+}  // namespace Chip8
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "Platform.h"
+
 namespace Chip8 {
 
 enum class Keycode {
@@ -104,4 +106,48 @@ inline Keycode HexToKey(int hex_val) {
   }
 }
 
+// Inverse of HexToKey, returns -1 for keys that aren't on the keypad
+inline int KeyToHex(int keycode) {
+  for (int hex_val = 0x0; hex_val <= 0xF; ++hex_val) {
+    if ((int)HexToKey(hex_val) == keycode) {
+      return hex_val;
+    }
+  }
+
+  return -1;
+}
+
+// Keycode of a KeyMap entry, '0'-'9' or 'A'-'Z', -1 for anything else
+inline int CharToKey(char key) {
+  if (key >= 'A' && key <= 'Z') {
+    return (int)Keycode::A + (key - 'A');
+  }
+  if (key >= '1' && key <= '9') {
+    return (int)Keycode::One + (key - '1');
+  }
+  if (key == '0') {
+    return (int)Keycode::One + 9;
+  }
+
+  return -1;
+}
+
+// KeyToHex with a ROM's key map, its keys take precedence over the default
+// layout and keys it leaves at 0 keep their default
+inline int KeyToHex(int keycode, const KeyMap &key_map) {
+  for (int hex_val = 0x0; hex_val <= 0xF; ++hex_val) {
+    if (key_map[hex_val] != 0 && CharToKey(key_map[hex_val]) == keycode) {
+      return hex_val;
+    }
+  }
+
+  for (int hex_val = 0x0; hex_val <= 0xF; ++hex_val) {
+    if (key_map[hex_val] == 0 && (int)HexToKey(hex_val) == keycode) {
+      return hex_val;
+    }
+  }
+
+  return -1;
+}
+
 }  // namespace Chip8
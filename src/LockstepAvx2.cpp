@@ -0,0 +1,29 @@
+// The lockstep block step again, built with AVX2 enabled. LockstepEngine
+// only calls into it after checking the CPU supports AVX2.
+
+#if !defined(__AVX2__)
+#error "LockstepAvx2.cpp must be built with AVX2 enabled"
+#endif
+
+#define CHIP8_LOG_SUBSYSTEM CORE
+
+#include "LockstepKernels.h"
+
+namespace Chip8 {
+
+template <typename Quirks>
+void LockstepEngine::RunBlockAvx2(LaneBlock &block, MachineState *lanes,
+                                  std::unique_ptr<ExtendedMemory> *extended, unsigned int steps,
+                                  LockstepCounters &counters) {
+  RunBlockSteps<Quirks>(block, lanes, extended, steps, counters);
+}
+
+// LockstepEngine.cpp cannot see the definition, so every profile is built here
+#define CHIP8_QUIRK_PROFILE_RUN_BLOCK(name, policy, option)                           \
+  template void LockstepEngine::RunBlockAvx2<policy>(LaneBlock &, MachineState *,    \
+                                                     std::unique_ptr<ExtendedMemory> *, \
+                                                     unsigned int, LockstepCounters &);
+CHIP8_QUIRK_PROFILES(CHIP8_QUIRK_PROFILE_RUN_BLOCK)
+#undef CHIP8_QUIRK_PROFILE_RUN_BLOCK
+
+}  // namespace Chip8
@@ -0,0 +1,182 @@
+#include "LockstepEngine.h"
+
+#include <algorithm>
+
+#define CHIP8_LOG_SUBSYSTEM CORE
+
+#include "LockstepKernels.h"
+
+namespace Chip8 {
+
+LockstepEngine::LockstepEngine(const char *rom_location, uint32_t lane_count)
+    : m_LaneCount(std::max(lane_count, 1u)) {
+  const uint32_t block_count = (m_LaneCount + LOCKSTEP_BLOCK_LANES - 1) / LOCKSTEP_BLOCK_LANES;
+
+  // Every lane starts from the machine a fresh interpreter loads
+  auto interpreter = std::make_unique<Interpreter>(rom_location);
+  m_HasRom = interpreter->HasRom();
+
+  auto initial = std::make_unique<MachineState>();
+  interpreter->SaveState(*initial);
+
+  const uint32_t lane_slots = block_count * LOCKSTEP_BLOCK_LANES;
+  m_Lanes.reset(new MachineState[lane_slots]);
+  std::fill_n(m_Lanes.get(), lane_slots, *initial);
+
+  m_ExtendedMemory.reset(new std::unique_ptr<ExtendedMemory>[lane_slots]);
+  if (const ExtendedMemory *extended = interpreter->GetExtendedMemory()) {
+    for (uint32_t lane = 0; lane < lane_slots; ++lane) {
+      m_ExtendedMemory[lane] = std::make_unique<ExtendedMemory>(*extended);
+    }
+  }
+
+  m_Blocks.resize(block_count);
+  for (uint32_t index = 0; index < block_count; ++index) {
+    LaneBlock &block = m_Blocks[index];
+
+    for (uint32_t lane = 0; lane < LOCKSTEP_BLOCK_LANES; ++lane) {
+      for (unsigned int r = 0; r < REGISTER_SIZE; ++r) {
+        block.registers[r][lane] = initial->registers[r];
+      }
+      block.program_counter[lane] = initial->program_counter;
+      block.index_register[lane] = initial->index_register;
+      block.delay_timer[lane] = initial->delay_timer;
+      block.sound_timer[lane] = initial->sound_timer;
+      block.keys[lane] = 0;
+    }
+
+    const uint32_t used = std::min(m_LaneCount - index * LOCKSTEP_BLOCK_LANES,
+                                   LOCKSTEP_BLOCK_LANES);
+    block.active_lanes = used == LOCKSTEP_BLOCK_LANES ? ~0u : (1u << used) - 1;
+  }
+
+#if defined(CHIP8_LOCKSTEP_AVX2) && (defined(__GNUC__) || defined(__clang__))
+  m_UseAvx2 = __builtin_cpu_supports("avx2");
+#endif
+  this->SetQuirkProfile(m_QuirkProfile);
+
+  LOG_INFO("Running {} lanes in lockstep with {} kernels", m_LaneCount,
+           this->IsUsingAvx2() ? "AVX2" : "portable");
+
+  this->ResetTimerSchedule();
+}
+
+LockstepEngine::~LockstepEngine() = default;
+
+void LockstepEngine::SetRandomSeed(uint32_t lane, uint64_t seed) {
+  m_Lanes[lane].random_state = SeedRandomState(seed);
+}
+
+void LockstepEngine::SetKeys(uint32_t lane, uint16_t keys) {
+  m_Blocks[lane / LOCKSTEP_BLOCK_LANES].keys[lane % LOCKSTEP_BLOCK_LANES] = keys;
+}
+
+void LockstepEngine::SetQuirkProfile(QuirkProfile profile) {
+  m_QuirkProfile = profile;
+
+  WithQuirks(profile, [this](auto quirks) {
+    using Quirks = decltype(quirks);
+    m_RunBlock = &LockstepEngine::RunBlock<Quirks>;
+#if defined(CHIP8_LOCKSTEP_AVX2)
+    if (m_UseAvx2) {
+      m_RunBlock = &LockstepEngine::RunBlockAvx2<Quirks>;
+    }
+#endif
+  });
+}
+
+void LockstepEngine::SetInstructionsPerSecond(unsigned int instructions_per_second) {
+  if (instructions_per_second == 0 || instructions_per_second == m_InstructionsPerSecond) {
+    return;
+  }
+
+  m_InstructionsPerSecond = instructions_per_second;
+  this->ResetTimerSchedule();
+}
+
+unsigned int LockstepEngine::Execute(unsigned int instructions) {
+  unsigned int executed = 0;
+
+  // The timers tick between the same instructions in every lane, so each
+  // block runs on its own up to the next tick and stays in cache meanwhile
+  while (executed < instructions) {
+    while (m_Cycles + 1 >= m_NextTimerCycle) {
+      this->TickTimers();
+    }
+
+    const unsigned int steps = static_cast<unsigned int>(
+        std::min<uint64_t>(instructions - executed, m_NextTimerCycle - m_Cycles - 1));
+
+    for (size_t index = 0; index < m_Blocks.size(); ++index) {
+      m_RunBlock(m_Blocks[index], &m_Lanes[index * LOCKSTEP_BLOCK_LANES],
+                 &m_ExtendedMemory[index * LOCKSTEP_BLOCK_LANES], steps, m_Counters);
+    }
+
+    m_Cycles += steps;
+    executed += steps;
+  }
+
+  return executed;
+}
+
+void LockstepEngine::SaveState(uint32_t lane, MachineState &state,
+                               ExtendedMemory *extended) const {
+  const LaneBlock &block = m_Blocks[lane / LOCKSTEP_BLOCK_LANES];
+  const uint32_t index = lane % LOCKSTEP_BLOCK_LANES;
+
+  state = m_Lanes[lane];
+  if (extended != nullptr && HasExtendedMemory(state)) {
+    *extended = *m_ExtendedMemory[lane];
+  }
+
+  for (unsigned int r = 0; r < REGISTER_SIZE; ++r) {
+    state.registers[r] = block.registers[r][index];
+  }
+  state.program_counter = block.program_counter[index];
+  state.index_register = block.index_register[index];
+  state.delay_timer = block.delay_timer[index];
+  state.sound_timer = block.sound_timer[index];
+  state.vblank = m_VBlank;
+  state.current_opcode = 0;
+
+  state.instructions_per_second = m_InstructionsPerSecond;
+  state.cycles = m_Cycles;
+  state.timer_base_cycle = m_TimerBaseCycle;
+  state.timer_ticks = m_TimerTicks;
+  state.next_timer_cycle = m_NextTimerCycle;
+}
+
+void LockstepEngine::TickTimers() {
+  for (LaneBlock &block : m_Blocks) {
+    for (uint32_t lane = 0; lane < LOCKSTEP_BLOCK_LANES; ++lane) {
+      block.delay_timer[lane] -= block.delay_timer[lane] > 0;
+      block.sound_timer[lane] -= block.sound_timer[lane] > 0;
+    }
+  }
+
+  m_VBlank = true;
+  m_TimerTicks++;
+  this->ScheduleNextTimerTick();
+}
+
+void LockstepEngine::ScheduleNextTimerTick() {
+  // Same schedule as Interpreter::ScheduleNextTimerTick
+  m_NextTimerCycle =
+      m_TimerBaseCycle +
+      ((m_TimerTicks + 1) * m_InstructionsPerSecond + TIMER_FREQUENCY - 1) / TIMER_FREQUENCY;
+}
+
+void LockstepEngine::ResetTimerSchedule() {
+  m_TimerBaseCycle = m_Cycles;
+  m_TimerTicks = 0;
+  this->ScheduleNextTimerTick();
+}
+
+template <typename Quirks>
+void LockstepEngine::RunBlock(LaneBlock &block, MachineState *lanes,
+                              std::unique_ptr<ExtendedMemory> *extended, unsigned int steps,
+                              LockstepCounters &counters) {
+  RunBlockSteps<Quirks>(block, lanes, extended, steps, counters);
+}
+
+}  // namespace Chip8
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "FrameBuffer.h"
+#include "Interpreter.h"
+
+namespace Chip8 {
+
+// Instances run in blocks of this many, one AVX2 register holds a byte
+// register of the whole block
+constexpr uint32_t LOCKSTEP_BLOCK_LANES = 32;
+
+// Registers, program counters, index registers, timers and keys of one block
+// of instances, laid out structure-of-arrays: registers[r][lane] is Vr of
+// that lane. Across blocks that makes V[16][N] in tiles of 32 lanes, so one
+// block's whole register file sits in 8 cache lines.
+struct alignas(64) LaneBlock {
+  Byte registers[REGISTER_SIZE][LOCKSTEP_BLOCK_LANES];
+  MemoryAddress program_counter[LOCKSTEP_BLOCK_LANES];
+  MemoryAddress index_register[LOCKSTEP_BLOCK_LANES];
+  Byte delay_timer[LOCKSTEP_BLOCK_LANES];
+  Byte sound_timer[LOCKSTEP_BLOCK_LANES];
+  uint16_t keys[LOCKSTEP_BLOCK_LANES];
+
+  // Lanes in use, only the last block can be partly empty
+  uint32_t active_lanes = 0;
+  // Memory pages any lane of the block wrote, code outside them is still
+  // the same ROM image in every lane
+  uint64_t written_pages = 0;
+};
+
+// Lane-instructions per execution path
+struct LockstepCounters {
+  uint64_t vector_instructions = 0;
+  uint64_t scalar_instructions = 0;
+};
+
+// Runs many instances of one ROM in lockstep, every lane executes one
+// instruction per step and all lanes share the cycle count and timer
+// schedule. Lanes differ by their seed and keys.
+//
+// Each step, the lanes of a block that sit on the same instruction form a
+// group that executes it once for all of them: the ALU opcodes (6XNN, 7XNN,
+// 8XY*), the skips, jumps, ANNN and the timer opcodes run as SIMD kernels
+// with the group as a mask. Everything else, and any lane left on its own,
+// runs per lane with the same semantics as Interpreter::Run. Lanes that
+// diverge just form more groups, so the engine degrades to about
+// interpreter speed rather than failing.
+//
+// Not supported: the display wait quirk, sinks and input sources. Keys are
+// set per lane with SetKeys. The kernels are built once per quirk profile
+// like the interpreter's handlers.
+class LockstepEngine {
+public:
+  LockstepEngine(const char *rom_location, uint32_t lane_count);
+  ~LockstepEngine();
+
+  uint32_t GetLaneCount() const { return m_LaneCount; }
+
+  // See Interpreter::HasRom
+  bool HasRom() const { return m_HasRom; }
+
+  // Seeds CXNN of one lane, lane i starts out seeded with DEFAULT_RANDOM_SEED
+  void SetRandomSeed(uint32_t lane, uint64_t seed);
+
+  // Bit k set means key k is held, read by EX9E, EXA1 and FX0A
+  void SetKeys(uint32_t lane, uint16_t keys);
+
+  // Applies to every lane, set before executing
+  void SetQuirkProfile(QuirkProfile profile);
+  QuirkProfile GetQuirkProfile() const { return m_QuirkProfile; }
+
+  void SetInstructionsPerSecond(unsigned int instructions_per_second);
+  unsigned int GetInstructionsPerSecond() const { return m_InstructionsPerSecond; }
+
+  // Runs instructions steps on every lane, returns the steps taken
+  unsigned int Execute(unsigned int instructions);
+
+  // Steps since the ROM was loaded, the same for every lane
+  uint64_t GetCycleCount() const { return m_Cycles; }
+
+  const FrameBuffer &GetFrameBuffer(uint32_t lane) const { return m_Lanes[lane].frame_buffer; }
+
+  // The lane as an Interpreter would hold it, current_opcode excepted. See
+  // Interpreter::SaveState for the extended memory.
+  void SaveState(uint32_t lane, MachineState &state, ExtendedMemory *extended = nullptr) const;
+
+  const LockstepCounters &GetCounters() const { return m_Counters; }
+
+  // Whether the AVX2 kernels are used, otherwise portable ones
+  bool IsUsingAvx2() const { return m_UseAvx2; }
+
+private:
+  using BlockRunner = void (*)(LaneBlock &block, MachineState *lanes,
+                               std::unique_ptr<ExtendedMemory> *extended, unsigned int steps,
+                               LockstepCounters &counters);
+
+  // Runs steps steps of one block, none of them may cross a timer tick
+  template <typename Quirks>
+  static void RunBlock(LaneBlock &block, MachineState *lanes,
+                       std::unique_ptr<ExtendedMemory> *extended, unsigned int steps,
+                       LockstepCounters &counters);
+  template <typename Quirks>
+  static void RunBlockAvx2(LaneBlock &block, MachineState *lanes,
+                           std::unique_ptr<ExtendedMemory> *extended, unsigned int steps,
+                           LockstepCounters &counters);
+
+  void TickTimers();
+  void ScheduleNextTimerTick();
+  void ResetTimerSchedule();
+
+private:
+  uint32_t m_LaneCount;
+  bool m_HasRom = false;
+  QuirkProfile m_QuirkProfile = QuirkProfile::Default;
+  bool m_UseAvx2 = false;
+  BlockRunner m_RunBlock = &LockstepEngine::RunBlock<DefaultQuirks>;
+
+  std::vector<LaneBlock> m_Blocks;
+
+  // Memory, framebuffer, call stack and random state of every lane. The
+  // fields kept in m_Blocks are stale here.
+  std::unique_ptr<MachineState[]> m_Lanes;
+  // Extended memory of every lane, null until the lane has it
+  std::unique_ptr<std::unique_ptr<ExtendedMemory>[]> m_ExtendedMemory;
+
+  unsigned int m_InstructionsPerSecond = DEFAULT_INSTRUCTIONS_PER_SECOND;
+  uint64_t m_Cycles = 0;
+  uint64_t m_TimerBaseCycle = 0;
+  uint64_t m_TimerTicks = 0;
+  uint64_t m_NextTimerCycle = 0;
+  bool m_VBlank = false;
+
+  LockstepCounters m_Counters;
+};
+
+}  // namespace Chip8
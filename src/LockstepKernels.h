@@ -0,0 +1,418 @@
+#pragma once
+
+// Block step of LockstepEngine, included once by LockstepEngine.cpp for the
+// portable kernels and once by LockstepAvx2.cpp, built with AVX2 enabled.
+// Everything is internal to the including file so the two builds never
+// get merged by the linker.
+
+#include <bit>
+#include <cstdint>
+#include <memory>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "Instructions.h"
+#include "LockstepEngine.h"
+#include "Logging.h"
+
+namespace Chip8 {
+namespace {
+
+#if defined(__AVX2__)
+
+// One byte register of every lane in a block. Comparisons give 0xFF for
+// true and 0x00 for false in each lane.
+using LaneBytes = __m256i;
+
+inline LaneBytes LoadLanes(const Byte *lanes) {
+  return _mm256_load_si256(reinterpret_cast<const __m256i *>(lanes));
+}
+inline void StoreLanes(Byte *lanes, LaneBytes value) {
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), value);
+}
+inline LaneBytes Broadcast(Byte value) { return _mm256_set1_epi8(static_cast<char>(value)); }
+
+inline LaneBytes Add(LaneBytes a, LaneBytes b) { return _mm256_add_epi8(a, b); }
+inline LaneBytes Subtract(LaneBytes a, LaneBytes b) { return _mm256_sub_epi8(a, b); }
+inline LaneBytes And(LaneBytes a, LaneBytes b) { return _mm256_and_si256(a, b); }
+inline LaneBytes Or(LaneBytes a, LaneBytes b) { return _mm256_or_si256(a, b); }
+inline LaneBytes Xor(LaneBytes a, LaneBytes b) { return _mm256_xor_si256(a, b); }
+inline LaneBytes Equal(LaneBytes a, LaneBytes b) { return _mm256_cmpeq_epi8(a, b); }
+
+// Unsigned a > b, there is no unsigned byte compare
+inline LaneBytes Greater(LaneBytes a, LaneBytes b) {
+  return Xor(Equal(_mm256_max_epu8(b, a), b), Broadcast(0xFF));
+}
+
+// No byte shifts either, shift 16-bit lanes and drop what crossed over
+inline LaneBytes ShiftRightOne(LaneBytes a) {
+  return And(_mm256_srli_epi16(a, 1), Broadcast(0x7F));
+}
+
+inline LaneBytes Select(LaneBytes mask, LaneBytes a, LaneBytes b) {
+  return _mm256_blendv_epi8(b, a, mask);
+}
+
+// Bit i of the mask to 0xFF or 0x00 in lane i
+inline LaneBytes ExpandMask(uint32_t mask) {
+  const __m256i spread = _mm256_shuffle_epi8(
+      _mm256_set1_epi32(static_cast<int>(mask)),
+      _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 3,
+                       3, 3, 3, 3, 3, 3, 3));
+  const __m256i bits = _mm256_set1_epi64x(static_cast<long long>(0x8040201008040201ull));
+  return Equal(And(spread, bits), bits);
+}
+
+inline uint32_t CompressMask(LaneBytes mask) {
+  return static_cast<uint32_t>(_mm256_movemask_epi8(mask));
+}
+
+#else
+
+// Plain loops over the lanes, which compilers turn into SSE2 or NEON
+struct LaneBytes {
+  alignas(32) Byte lanes[LOCKSTEP_BLOCK_LANES];
+};
+
+template <typename Function>
+inline LaneBytes MapLanes(Function function) {
+  LaneBytes result;
+  for (uint32_t lane = 0; lane < LOCKSTEP_BLOCK_LANES; ++lane) {
+    result.lanes[lane] = function(lane);
+  }
+  return result;
+}
+
+inline LaneBytes LoadLanes(const Byte *lanes) {
+  return MapLanes([&](uint32_t lane) { return lanes[lane]; });
+}
+inline void StoreLanes(Byte *lanes, const LaneBytes &value) {
+  for (uint32_t lane = 0; lane < LOCKSTEP_BLOCK_LANES; ++lane) {
+    lanes[lane] = value.lanes[lane];
+  }
+}
+inline LaneBytes Broadcast(Byte value) {
+  return MapLanes([&](uint32_t) { return value; });
+}
+
+inline LaneBytes Add(const LaneBytes &a, const LaneBytes &b) {
+  return MapLanes([&](uint32_t lane) { return Byte(a.lanes[lane] + b.lanes[lane]); });
+}
+inline LaneBytes Subtract(const LaneBytes &a, const LaneBytes &b) {
+  return MapLanes([&](uint32_t lane) { return Byte(a.lanes[lane] - b.lanes[lane]); });
+}
+inline LaneBytes And(const LaneBytes &a, const LaneBytes &b) {
+  return MapLanes([&](uint32_t lane) { return Byte(a.lanes[lane] & b.lanes[lane]); });
+}
+inline LaneBytes Or(const LaneBytes &a, const LaneBytes &b) {
+  return MapLanes([&](uint32_t lane) { return Byte(a.lanes[lane] | b.lanes[lane]); });
+}
+inline LaneBytes Xor(const LaneBytes &a, const LaneBytes &b) {
+  return MapLanes([&](uint32_t lane) { return Byte(a.lanes[lane] ^ b.lanes[lane]); });
+}
+inline LaneBytes Equal(const LaneBytes &a, const LaneBytes &b) {
+  return MapLanes([&](uint32_t lane) { return Byte(a.lanes[lane] == b.lanes[lane] ? 0xFF : 0); });
+}
+inline LaneBytes Greater(const LaneBytes &a, const LaneBytes &b) {
+  return MapLanes([&](uint32_t lane) { return Byte(a.lanes[lane] > b.lanes[lane] ? 0xFF : 0); });
+}
+inline LaneBytes ShiftRightOne(const LaneBytes &a) {
+  return MapLanes([&](uint32_t lane) { return Byte(a.lanes[lane] >> 1); });
+}
+inline LaneBytes Select(const LaneBytes &mask, const LaneBytes &a, const LaneBytes &b) {
+  return MapLanes([&](uint32_t lane) { return mask.lanes[lane] ? a.lanes[lane] : b.lanes[lane]; });
+}
+inline LaneBytes ExpandMask(uint32_t mask) {
+  return MapLanes([&](uint32_t lane) { return Byte((mask >> lane) & 1 ? 0xFF : 0); });
+}
+inline uint32_t CompressMask(const LaneBytes &mask) {
+  uint32_t bits = 0;
+  for (uint32_t lane = 0; lane < LOCKSTEP_BLOCK_LANES; ++lane) {
+    bits |= uint32_t(mask.lanes[lane] & 1) << lane;
+  }
+  return bits;
+}
+
+#endif
+
+inline Opcode FetchOpcode(const MachineState &lane, MemoryAddress program_counter) {
+  const MemoryAddress address = program_counter & MEMORY_MASK;
+  return (lane.memory[address] << 8) | lane.memory[(address + 1) & MEMORY_MASK];
+}
+
+// Dirty pages the two bytes of the instruction at program_counter are in
+inline uint64_t GetCodePages(MemoryAddress program_counter) {
+  const MemoryAddress address = program_counter & MEMORY_MASK;
+  return (1ull << (address >> MEMORY_PAGE_SHIFT)) |
+         (1ull << (((address + 1) & MEMORY_MASK) >> MEMORY_PAGE_SHIFT));
+}
+
+inline bool IsLaneKeyPressed(const LaneBlock &block, uint32_t lane, Byte key) {
+  return (block.keys[lane] >> (key & 0xF)) & 1;
+}
+
+inline void WriteLaneMemory(LaneBlock &block, MachineState &lane, ExtendedMemory *extended,
+                            MemoryAddress address, Byte value) {
+  address = WriteMemoryByte(lane, extended, address, value);
+
+  if (address < MEMORY_SIZE) {
+    block.written_pages |= 1ull << (address >> MEMORY_PAGE_SHIFT);
+  }
+}
+
+// Same as Interpreter::EnableExtendedMemory for one lane
+inline void EnableLaneExtendedMemory(MachineState &state,
+                                     std::unique_ptr<ExtendedMemory> &extended) {
+  if (HasExtendedMemory(state)) {
+    return;
+  }
+
+  if (extended) {
+    extended->fill(0);
+  } else {
+    extended = std::make_unique<ExtendedMemory>();
+  }
+  state.address_mask = EXTENDED_MEMORY_MASK;
+}
+
+// What the handlers in Instructions.h see of one lane: its registers, I,
+// program counter and timers live in the block, the rest in its state.
+// Lanes have no display to wait for.
+struct LaneMachine {
+  LaneBlock &block;
+  uint32_t lane;
+  MachineState &state;
+  std::unique_ptr<ExtendedMemory> &extended;
+
+  MachineState &State() { return state; }
+  Byte &V(unsigned int r) { return block.registers[r][lane]; }
+  MemoryAddress &ProgramCounter() { return block.program_counter[lane]; }
+  MemoryAddress &IndexRegister() { return block.index_register[lane]; }
+  Byte &DelayTimer() { return block.delay_timer[lane]; }
+  Byte &SoundTimer() { return block.sound_timer[lane]; }
+
+  bool IsKeyPressed(Byte key) const { return IsLaneKeyPressed(block, lane, key); }
+
+  Byte ReadMemory(MemoryAddress address) const {
+    return ReadMemoryByte(state, extended.get(), address);
+  }
+  void WriteMemory(MemoryAddress address, Byte value) {
+    WriteLaneMemory(block, state, extended.get(), address, value);
+  }
+  const ExtendedMemory *GetExtendedMemory() const { return extended.get(); }
+  void EnableExtendedMemory() { EnableLaneExtendedMemory(state, extended); }
+
+  void FrameChanged() {}
+  bool WaitForDisplay() { return false; }
+};
+
+// One instruction of one lane, the program counter already points past it
+template <typename Quirks>
+void ExecuteLane(LaneBlock &block, uint32_t lane, MachineState &state,
+                 std::unique_ptr<ExtendedMemory> &extended, InstructionType type,
+                 Opcode opcode) {
+  LaneMachine machine{block, lane, state, extended};
+  const Instruction instruction = DecodeOperands(opcode);
+
+  switch (type) {
+#define CHIP8_LANE_INSTRUCTION(name)                       \
+  case InstructionType::Op_##name:                         \
+    Instructions::Op_##name(machine, instruction);         \
+    break;
+#define CHIP8_LANE_QUIRK_INSTRUCTION(name)                 \
+  case InstructionType::Op_##name:                         \
+    Instructions::Op_##name<Quirks>(machine, instruction); \
+    break;
+    CHIP8_INSTRUCTIONS(CHIP8_LANE_INSTRUCTION, CHIP8_LANE_QUIRK_INSTRUCTION)
+#undef CHIP8_LANE_QUIRK_INSTRUCTION
+#undef CHIP8_LANE_INSTRUCTION
+    default: break;
+  }
+}
+
+// One instruction for every lane in group, which all sit at program_counter.
+// leader is the state of any lane in the group. Returns false for the
+// opcodes that only run per lane.
+template <typename Quirks>
+bool ExecuteGroup(LaneBlock &block, const MachineState &leader, uint32_t group,
+                  MemoryAddress program_counter, InstructionType type, Opcode opcode) {
+  const Byte x = (opcode >> 8) & 0xF, y = (opcode >> 4) & 0xF;
+  const Byte nn = opcode & 0xFF;
+  const MemoryAddress nnn = opcode & 0xFFF;
+
+  const LaneBytes mask = ExpandMask(group);
+  auto Read = [&](unsigned int r) { return LoadLanes(block.registers[r]); };
+  auto Write = [&](Byte *lanes, const LaneBytes &value) {
+    StoreLanes(lanes, Select(mask, value, LoadLanes(lanes)));
+  };
+  auto WriteV = [&](unsigned int r, const LaneBytes &value) { Write(block.registers[r], value); };
+  const LaneBytes one = Broadcast(1);
+  const Byte shift_source = Quirks::shift_in_place ? x : y;
+
+  // Lanes that skip the next instruction
+  uint32_t skip = 0;
+
+  switch (type) {
+    case InstructionType::Op_Nop: break;
+    case InstructionType::Op_1NNN: {
+      for (uint32_t lane = 0; lane < LOCKSTEP_BLOCK_LANES; ++lane) {
+        if ((group >> lane) & 1) block.program_counter[lane] = nnn;
+      }
+      return true;
+    }
+    case InstructionType::Op_3XNN: skip = CompressMask(Equal(Read(x), Broadcast(nn))); break;
+    case InstructionType::Op_4XNN: skip = ~CompressMask(Equal(Read(x), Broadcast(nn))); break;
+    case InstructionType::Op_5XY0: skip = CompressMask(Equal(Read(x), Read(y))); break;
+    case InstructionType::Op_9XY0: skip = ~CompressMask(Equal(Read(x), Read(y))); break;
+    case InstructionType::Op_6XNN: WriteV(x, Broadcast(nn)); break;
+    case InstructionType::Op_7XNN: WriteV(x, Add(Read(x), Broadcast(nn))); break;
+    case InstructionType::Op_8XY0: WriteV(x, Read(y)); break;
+    case InstructionType::Op_8XY1: {
+      WriteV(x, Or(Read(x), Read(y)));
+      if (Quirks::logic_resets_flag) WriteV(FLAG_REGISTER, Broadcast(0));
+      break;
+    }
+    case InstructionType::Op_8XY2: {
+      WriteV(x, And(Read(x), Read(y)));
+      if (Quirks::logic_resets_flag) WriteV(FLAG_REGISTER, Broadcast(0));
+      break;
+    }
+    case InstructionType::Op_8XY3: {
+      WriteV(x, Xor(Read(x), Read(y)));
+      if (Quirks::logic_resets_flag) WriteV(FLAG_REGISTER, Broadcast(0));
+      break;
+    }
+    case InstructionType::Op_8XY4: {
+      // The flag comes from the operands and is written last, like the
+      // interpreter, so x or y being F comes out the same
+      const LaneBytes carry = Greater(Read(x), Xor(Read(y), Broadcast(0xFF)));
+      WriteV(x, Add(Read(x), Read(y)));
+      WriteV(FLAG_REGISTER, And(carry, one));
+      break;
+    }
+    case InstructionType::Op_8XY5: {
+      const LaneBytes no_borrow = Xor(And(Greater(Read(y), Read(x)), one), one);
+      WriteV(x, Subtract(Read(x), Read(y)));
+      WriteV(FLAG_REGISTER, no_borrow);
+      break;
+    }
+    case InstructionType::Op_8XY6: {
+      WriteV(x, Read(shift_source));
+      const LaneBytes flag = And(Read(x), one);
+      WriteV(x, ShiftRightOne(Read(x)));
+      WriteV(FLAG_REGISTER, flag);
+      break;
+    }
+    case InstructionType::Op_8XY7: {
+      const LaneBytes no_borrow = Xor(And(Greater(Read(x), Read(y)), one), one);
+      WriteV(x, Subtract(Read(y), Read(x)));
+      WriteV(FLAG_REGISTER, no_borrow);
+      break;
+    }
+    case InstructionType::Op_8XYE: {
+      WriteV(x, Read(shift_source));
+      const LaneBytes flag = And(Greater(Read(x), Broadcast(0x7F)), one);
+      WriteV(x, Add(Read(x), Read(x)));
+      WriteV(FLAG_REGISTER, flag);
+      break;
+    }
+    case InstructionType::Op_ANNN: {
+      for (uint32_t lane = 0; lane < LOCKSTEP_BLOCK_LANES; ++lane) {
+        if ((group >> lane) & 1) block.index_register[lane] = nnn;
+      }
+      break;
+    }
+    case InstructionType::Op_FX07: WriteV(x, LoadLanes(block.delay_timer)); break;
+    case InstructionType::Op_FX15: Write(block.delay_timer, Read(x)); break;
+    case InstructionType::Op_FX18: Write(block.sound_timer, Read(x)); break;
+    case InstructionType::Op_FX1E: {
+      for (uint32_t lane = 0; lane < LOCKSTEP_BLOCK_LANES; ++lane) {
+        const MemoryAddress sum = block.index_register[lane] + block.registers[x][lane];
+        block.index_register[lane] = (group >> lane) & 1 ? sum : block.index_register[lane];
+      }
+      break;
+    }
+    default: return false;
+  }
+
+  const MemoryAddress next = program_counter + INSTRUCTION_SIZE;
+  MemoryAddress skip_size = INSTRUCTION_SIZE;
+
+  if (skip & group) {
+    // How far a skip goes depends on the next instruction, which the lanes
+    // only agree on while none of them wrote it
+    if (block.written_pages & GetCodePages(next)) {
+      return false;
+    }
+    skip_size = GetSkipSize<Quirks>(leader, next);
+  }
+
+  for (uint32_t lane = 0; lane < LOCKSTEP_BLOCK_LANES; ++lane) {
+    const MemoryAddress skipped = next + ((skip >> lane) & 1) * skip_size;
+    block.program_counter[lane] = (group >> lane) & 1 ? skipped : block.program_counter[lane];
+  }
+
+  return true;
+}
+
+template <typename Quirks>
+void StepBlock(LaneBlock &block, MachineState *lanes, std::unique_ptr<ExtendedMemory> *extended,
+               LockstepCounters &counters) {
+  uint32_t pending = block.active_lanes;
+
+  while (pending != 0) {
+    const uint32_t leader = std::countr_zero(pending);
+    const MemoryAddress program_counter = block.program_counter[leader];
+
+    uint32_t group = 0;
+    for (uint32_t lane = 0; lane < LOCKSTEP_BLOCK_LANES; ++lane) {
+      group |= uint32_t(block.program_counter[lane] == program_counter) << lane;
+    }
+    group &= pending;
+
+    // Only lanes that wrote the memory under the instruction can disagree on
+    // what it is
+    const Opcode opcode = FetchOpcode(lanes[leader], program_counter);
+
+    if (block.written_pages & GetCodePages(program_counter)) {
+      for (uint32_t rest = group & (group - 1); rest != 0; rest &= rest - 1) {
+        const uint32_t lane = std::countr_zero(rest);
+        if (FetchOpcode(lanes[lane], program_counter) != opcode) {
+          group &= ~(1u << lane);
+        }
+      }
+    }
+
+    pending &= ~group;
+
+    const InstructionType type = Interpreter::DecodeType(opcode);
+    const uint32_t lane_count = std::popcount(group);
+
+    if (lane_count > 1 &&
+        ExecuteGroup<Quirks>(block, lanes[leader], group, program_counter, type, opcode)) {
+      counters.vector_instructions += lane_count;
+      continue;
+    }
+
+    for (; group != 0; group &= group - 1) {
+      const uint32_t lane = std::countr_zero(group);
+      block.program_counter[lane] += INSTRUCTION_SIZE;
+      ExecuteLane<Quirks>(block, lane, lanes[lane], extended[lane], type, opcode);
+    }
+    counters.scalar_instructions += lane_count;
+  }
+}
+
+template <typename Quirks>
+void RunBlockSteps(LaneBlock &block, MachineState *lanes,
+                   std::unique_ptr<ExtendedMemory> *extended, unsigned int steps,
+                   LockstepCounters &counters) {
+  for (unsigned int step = 0; step < steps; ++step) {
+    StepBlock<Quirks>(block, lanes, extended, counters);
+  }
+}
+
+}  // namespace
+}  // namespace Chip8
@@ -1,53 +1,36 @@
 #include "Logging.h"
 
+#include <spdlog/async.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 
+#include <chrono>
 #include <memory>
 
 namespace Chip8 {
 
+// Messages waiting for the background thread. When it falls behind the
+// oldest ones are dropped, logging never blocks the emulation thread.
+constexpr size_t LOG_QUEUE_SIZE = 8192;
+
 std::shared_ptr<spdlog::logger> Logger::s_Logger;
 
 void Logger::Init() {
   spdlog::set_pattern("[%H:%M:%S] [%n] %v%$");
 
-  s_Logger = spdlog::stderr_color_mt("CHIP8");
+  spdlog::init_thread_pool(LOG_QUEUE_SIZE, 1);
+  s_Logger = spdlog::create_async_nb<spdlog::sinks::stderr_color_sink_mt>("CHIP8");
   s_Logger->set_level(spdlog::level::trace);
 
-  spdlog::flush_on(spdlog::level::trace);
+  // Errors are flushed right away, everything else at least once a second
+  s_Logger->flush_on(spdlog::level::err);
+  spdlog::flush_every(std::chrono::seconds(1));
 }
 
-void Logger::OpenGLDebugMessageCallback(GLenum source, GLenum type, GLuint id, GLenum severity,
-                                        GLsizei length, const GLchar* message,
-                                        const void* userParam) {
-  // annoying
-  if (id == 131185) {
-    return;
-  }
-
-  switch (severity) {
-    case GL_DEBUG_SEVERITY_HIGH: {
-      LOG_ERROR("[OPENGL] {}", message);
-      break;
-    }
-    case GL_DEBUG_SEVERITY_MEDIUM: {
-      LOG_WARN("[OPENGL] {}", message);
-      break;
-    }
-    case GL_DEBUG_SEVERITY_LOW: {
-      LOG_WARN("[OPENGL] {}", message);
-      break;
-    }
-    case GL_DEBUG_SEVERITY_NOTIFICATION: {
-      LOG_TRACE("[OPENGL] {}", message);
-      break;
-    }
-    default: {
-      LOG_INFO("[OPENGL] {}", message);
-      break;
-    }
-  }
+void Logger::Shutdown() {
+  // Drains the queue and joins the background thread
+  s_Logger.reset();
+  spdlog::shutdown();
 }
 
 }  // namespace Chip8
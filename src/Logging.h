@@ -1,6 +1,5 @@
 #pragma once
 
-#include <glad/glad.h>
 #include <spdlog/spdlog.h>
 
 #include <memory>
@@ -9,10 +8,10 @@ namespace Chip8 {
 
 class Logger {
 public:
+  // Messages are formatted by the caller and written out by a background
+  // thread, see Logging.cpp
   static void Init();
-  static void OpenGLDebugMessageCallback(GLenum source, GLenum type, GLuint id, GLenum severity,
-                                         GLsizei length, const GLchar* message,
-                                         const void* userParam);
+  static void Shutdown();
 
   inline static std::shared_ptr<spdlog::logger>& GetLogger() { return s_Logger; }
 
@@ -20,12 +19,54 @@ private:
   static std::shared_ptr<spdlog::logger> s_Logger;
 };
 
+// Compile-time minimum level per subsystem, using spdlog's SPDLOG_LEVEL_*
+// values. Anything below it is compiled out, so LOG_TRACE in the interpreter
+// costs nothing in release builds. Override with -DCHIP8_LOG_LEVEL_<NAME>=...
+// (the CMake cache variables of the same name do this).
+#if CHIP8_DEBUG
+#define CHIP8_LOG_DEFAULT_LEVEL SPDLOG_LEVEL_TRACE
+#else
+#define CHIP8_LOG_DEFAULT_LEVEL SPDLOG_LEVEL_INFO
+#endif
+
+#ifndef CHIP8_LOG_LEVEL_CORE
+#define CHIP8_LOG_LEVEL_CORE CHIP8_LOG_DEFAULT_LEVEL
+#endif
+
+#ifndef CHIP8_LOG_LEVEL_RENDER
+#define CHIP8_LOG_LEVEL_RENDER CHIP8_LOG_DEFAULT_LEVEL
+#endif
+
+#ifndef CHIP8_LOG_LEVEL_AUDIO
+#define CHIP8_LOG_LEVEL_AUDIO CHIP8_LOG_DEFAULT_LEVEL
+#endif
+
+#ifndef CHIP8_LOG_LEVEL_APP
+#define CHIP8_LOG_LEVEL_APP CHIP8_LOG_DEFAULT_LEVEL
+#endif
+
+// A source file picks its subsystem with e.g. `#define CHIP8_LOG_SUBSYSTEM
+// CORE`. Without one the name below is pasted together instead, which falls
+// back to APP.
+#define CHIP8_LOG_LEVEL_CHIP8_LOG_SUBSYSTEM CHIP8_LOG_LEVEL_APP
+
+#define CHIP8_LOG_CONCAT_IMPL(a, b) a##b
+#define CHIP8_LOG_CONCAT(a, b) CHIP8_LOG_CONCAT_IMPL(a, b)
+#define CHIP8_LOG_SUBSYSTEM_LEVEL CHIP8_LOG_CONCAT(CHIP8_LOG_LEVEL_, CHIP8_LOG_SUBSYSTEM)
+
 #if LOGGING_ENABLED
 
-#define LOG_TRACE(...) Chip8::Logger::GetLogger()->trace(__VA_ARGS__);
-#define LOG_INFO(...) Chip8::Logger::GetLogger()->info(__VA_ARGS__);
-#define LOG_WARN(...) Chip8::Logger::GetLogger()->warn(__VA_ARGS__);
-#define LOG_ERROR(...) Chip8::Logger::GetLogger()->critical(__VA_ARGS__);
+#define CHIP8_LOG(level, method, ...)                    \
+  do {                                                   \
+    if constexpr (CHIP8_LOG_SUBSYSTEM_LEVEL <= level) {  \
+      Chip8::Logger::GetLogger()->method(__VA_ARGS__);   \
+    }                                                    \
+  } while (0)
+
+#define LOG_TRACE(...) CHIP8_LOG(SPDLOG_LEVEL_TRACE, trace, __VA_ARGS__)
+#define LOG_INFO(...) CHIP8_LOG(SPDLOG_LEVEL_INFO, info, __VA_ARGS__)
+#define LOG_WARN(...) CHIP8_LOG(SPDLOG_LEVEL_WARN, warn, __VA_ARGS__)
+#define LOG_ERROR(...) CHIP8_LOG(SPDLOG_LEVEL_ERROR, critical, __VA_ARGS__)
 
 #else
 
@@ -1,12 +1,9 @@
 #include <cstdlib>
-#include <ctime>
 
 #include "Application.h"
 #include "Logging.h"
 
 int main(int argc, char *argv[]) {
-  srand(time(nullptr));
-
   if (argc == 1) {
     return EXIT_FAILURE;
   }
@@ -21,6 +18,7 @@ int main(int argc, char *argv[]) {
   }
 
   application.Shutdown();
+  Chip8::Logger::Shutdown();
 
   return EXIT_SUCCESS;
 }
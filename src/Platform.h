@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "FrameBuffer.h"
+
+namespace Chip8 {
+
+// Interfaces the interpreter talks to instead of SDL/OpenGL, so the core can
+// run without a window (see HeadlessPlatform.h and EmulationThread.h)
+
+class InputSource {
+public:
+  virtual ~InputSource() = default;
+
+  // key is a CHIP-8 hex key (0x0 - 0xF)
+  virtual bool IsKeyPressed(Byte key) const = 0;
+
+  // Called on every 60 Hz tick of the emulated machine, sources that only
+  // change keys on frame boundaries (movies) latch their state here
+  virtual void LatchFrame() {}
+};
+
+// Host key for each CHIP-8 key as '0'-'9' or 'A'-'Z', 0 keeps the default
+// layout (see Keycodes.h)
+using KeyMap = std::array<char, 16>;
+
+class FrameSink {
+public:
+  virtual ~FrameSink() = default;
+
+  virtual void PresentFrame(const FrameBuffer& frame_buffer) = 0;
+};
+
+class SoundSink {
+public:
+  virtual ~SoundSink() = default;
+
+  virtual void SetToneEnabled(bool enabled) = 0;
+};
+
+}  // namespace Chip8
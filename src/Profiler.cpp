@@ -0,0 +1,55 @@
+#include "Profiler.h"
+
+#include <cinttypes>
+#include <cstdio>
+
+#include "Logging.h"
+
+#define CHIP8_LOG_SUBSYSTEM CORE
+
+namespace Chip8 {
+
+void Profiler::Reset() {
+  m_Counters = ProfileCounters{};
+  m_DelayPollAddress = NO_DELAY_POLL;
+  m_DelayPollCycle = 0;
+}
+
+bool WriteProfileFile(const char *profile_location, const ProfileCounters &counters) {
+  std::FILE *file = std::fopen(profile_location, "w");
+  if (file == nullptr) {
+    LOG_ERROR("Could not open profile {}", profile_location);
+    return false;
+  }
+
+  std::fprintf(file, "section,name,count\n");
+  std::fprintf(file, "total,instructions,%" PRIu64 "\n", counters.instructions);
+
+  for (size_t type = 0; type < counters.type_counts.size(); ++type) {
+    if (counters.type_counts[type] != 0) {
+      std::fprintf(file, "instruction,%s,%" PRIu64 "\n",
+                   GetInstructionName(static_cast<InstructionType>(type)),
+                   counters.type_counts[type]);
+    }
+  }
+
+  std::fprintf(file, "wait,key,%" PRIu64 "\n", counters.key_wait_cycles);
+  std::fprintf(file, "wait,delay,%" PRIu64 "\n", counters.delay_wait_cycles);
+
+  for (size_t address = 0; address < counters.address_counts.size(); ++address) {
+    if (counters.address_counts[address] != 0) {
+      std::fprintf(file, "address,%03zX,%" PRIu64 "\n", address, counters.address_counts[address]);
+    }
+  }
+
+  const bool written = std::ferror(file) == 0;
+  if (std::fclose(file) != 0 || !written) {
+    LOG_ERROR("Could not write profile {}", profile_location);
+    return false;
+  }
+
+  LOG_INFO("Wrote profile to {}", profile_location);
+  return true;
+}
+
+}  // namespace Chip8
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "Interpreter.h"
+
+namespace Chip8 {
+
+// What the guest program spent its cycles on, as collected by a Profiler
+struct ProfileCounters {
+  uint64_t instructions = 0;
+
+  // Executions per InstructionType and per program counter
+  std::array<uint64_t, (size_t)InstructionType::Count> type_counts{0};
+  std::array<uint64_t, MEMORY_SIZE> address_counts{0};
+
+  // Cycles FX0A spent without a key pressed
+  uint64_t key_wait_cycles = 0;
+  // Cycles spent in loops that poll the delay timer with FX07 until it runs
+  // out, counted from one FX07 that read a nonzero value to the next one at
+  // the same address
+  uint64_t delay_wait_cycles = 0;
+};
+
+// Counts executed guest instructions while attached to an Interpreter. Only
+// built into the interpreter with CHIP8_ENABLE_PROFILER, and while attached
+// Execute interprets, like it does for traces.
+class Profiler {
+public:
+  void Record(MemoryAddress address, InstructionType type) {
+    m_Counters.instructions++;
+    m_Counters.type_counts[(size_t)type]++;
+    m_Counters.address_counts[address & MEMORY_MASK]++;
+  }
+
+  void RecordKeyWait() { m_Counters.key_wait_cycles++; }
+
+  // An FX07 at address ran at cycle and read delay_timer
+  void RecordDelayPoll(MemoryAddress address, uint64_t cycle, Byte delay_timer) {
+    if (address == m_DelayPollAddress) {
+      m_Counters.delay_wait_cycles += cycle - m_DelayPollCycle;
+    }
+
+    m_DelayPollAddress = delay_timer != 0 ? address : NO_DELAY_POLL;
+    m_DelayPollCycle = cycle;
+  }
+
+  void Reset();
+
+  const ProfileCounters &GetCounters() const { return m_Counters; }
+
+private:
+  static constexpr uint32_t NO_DELAY_POLL = UINT32_MAX;
+
+  ProfileCounters m_Counters;
+
+  uint32_t m_DelayPollAddress = NO_DELAY_POLL;
+  uint64_t m_DelayPollCycle = 0;
+};
+
+// Writes the counters as CSV: a "section,name,count" header, then one row
+// per instruction type, both wait counters and one row per address that ran
+bool WriteProfileFile(const char *profile_location, const ProfileCounters &counters);
+
+}  // namespace Chip8
@@ -0,0 +1,27 @@
+#include "Quirks.h"
+
+#include <cstring>
+
+namespace Chip8 {
+
+static const char *const s_QuirkProfileNames[] = {
+#define CHIP8_QUIRK_PROFILE_NAME(name, policy, option) option,
+    CHIP8_QUIRK_PROFILES(CHIP8_QUIRK_PROFILE_NAME)
+#undef CHIP8_QUIRK_PROFILE_NAME
+};
+
+const char *GetQuirkProfileName(QuirkProfile profile) {
+  return profile < QuirkProfile::Count ? s_QuirkProfileNames[(size_t)profile] : "?";
+}
+
+bool ParseQuirkProfile(const char *name, QuirkProfile &profile) {
+  for (size_t index = 0; index < (size_t)QuirkProfile::Count; ++index) {
+    if (!std::strcmp(name, s_QuirkProfileNames[index])) {
+      profile = static_cast<QuirkProfile>(index);
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace Chip8
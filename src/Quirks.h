@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+
+namespace Chip8 {
+
+// Where the CHIP-8 platforms disagree on what an opcode does. Each profile is
+// a policy type the engines are instantiated with, so picking one costs a
+// switch when it is selected and nothing per instruction.
+//
+// The default profile is what this interpreter always did: 8XY6/8XYE shift
+// VY, BNNN adds V0, FX55/FX65 leave I alone and the logic opcodes keep VF.
+// No real platform does exactly that, it stays the default so existing
+// movies and golden frames keep replaying.
+struct DefaultQuirks {
+  // 8XY1, 8XY2 and 8XY3 set VF to 0
+  static constexpr bool logic_resets_flag = false;
+  // FX55 and FX65 leave I pointing past the last register
+  static constexpr bool load_store_increments_index = false;
+  // 8XY6 and 8XYE shift VX in place instead of copying VY into it first
+  static constexpr bool shift_in_place = false;
+  // BXNN jumps to XNN + VX instead of NNN + V0
+  static constexpr bool jump_uses_vx = false;
+  // F000 NNNN loads a 16-bit I and opens up 64 KB of memory, and a skip
+  // steps over it whole. Elsewhere F000 is an unknown opcode and every skip
+  // is two bytes.
+  static constexpr bool long_skip = false;
+};
+
+struct CosmacVipQuirks : DefaultQuirks {
+  static constexpr bool logic_resets_flag = true;
+  static constexpr bool load_store_increments_index = true;
+};
+
+// SUPER-CHIP 1.1 as it ran on the HP 48
+struct SuperChipQuirks : DefaultQuirks {
+  static constexpr bool shift_in_place = true;
+  static constexpr bool jump_uses_vx = true;
+};
+
+struct XoChipQuirks : DefaultQuirks {
+  static constexpr bool load_store_increments_index = true;
+  static constexpr bool long_skip = true;
+};
+
+// Every profile as (name, policy type, command line name), used for the enum
+// and to instantiate the engines once per profile
+#define CHIP8_QUIRK_PROFILES(X)          \
+  X(Default, DefaultQuirks, "default")   \
+  X(CosmacVip, CosmacVipQuirks, "vip")   \
+  X(SuperChip, SuperChipQuirks, "schip") \
+  X(XoChip, XoChipQuirks, "xochip")
+
+enum class QuirkProfile : uint8_t {
+#define CHIP8_QUIRK_PROFILE_ENUM(name, policy, option) name,
+  CHIP8_QUIRK_PROFILES(CHIP8_QUIRK_PROFILE_ENUM)
+#undef CHIP8_QUIRK_PROFILE_ENUM
+  Count,
+};
+
+// The command line name, e.g. "schip"
+const char *GetQuirkProfileName(QuirkProfile profile);
+bool ParseQuirkProfile(const char *name, QuirkProfile &profile);
+
+// Calls function with a value of the profile's policy type, the one place a
+// runtime profile turns into a template argument
+template <typename Function>
+decltype(auto) WithQuirks(QuirkProfile profile, Function &&function) {
+  switch (profile) {
+#define CHIP8_QUIRK_PROFILE_CASE(name, policy, option) \
+  case QuirkProfile::name: return function(policy{});
+    CHIP8_QUIRK_PROFILES(CHIP8_QUIRK_PROFILE_CASE)
+#undef CHIP8_QUIRK_PROFILE_CASE
+    default: return function(DefaultQuirks{});
+  }
+}
+
+}  // namespace Chip8
@@ -0,0 +1,275 @@
+#include "RewindBuffer.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace Chip8 {
+
+// Snapshots are stored as a list of (zero run length, literal length,
+// literal bytes) tokens over the XOR of the state with its keyframe, lengths
+// as LEB128 varints. Keyframes are the same encoding against all zeroes,
+// which still squeezes out the empty memory. A literal only ends at a run of
+// at least MIN_ZERO_RUN zero bytes, so no token costs more than it saves.
+// States with extended memory have it encoded the same way right after.
+constexpr size_t STATE_SIZE = sizeof(MachineState);
+constexpr size_t EXTENDED_SIZE = sizeof(ExtendedMemory);
+constexpr size_t MIN_ZERO_RUN = 4;
+constexpr size_t MAX_ENCODED_SIZE = 2 * (STATE_SIZE + EXTENDED_SIZE) + 32;
+
+static_assert(std::endian::native == std::endian::little);
+
+namespace {
+
+const Byte s_Zeroes[std::max(STATE_SIZE, EXTENDED_SIZE)] = {};
+
+Byte *PutVarint(Byte *out, size_t value) {
+  while (value >= 0x80) {
+    *out++ = static_cast<Byte>(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = static_cast<Byte>(value);
+  return out;
+}
+
+const Byte *GetVarint(const Byte *in, size_t &value) {
+  value = 0;
+  for (int shift = 0;; shift += 7) {
+    const Byte byte = *in++;
+    value |= static_cast<size_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return in;
+    }
+  }
+}
+
+// Index of the first byte at or after position where state and reference
+// differ, compared a word at a time
+size_t SkipEqual(const Byte *state, const Byte *reference, size_t size, size_t position) {
+  while (position + sizeof(uint64_t) <= size) {
+    uint64_t a, b;
+    std::memcpy(&a, state + position, sizeof(a));
+    std::memcpy(&b, reference + position, sizeof(b));
+
+    if (a != b) {
+      return position + std::countr_zero(a ^ b) / 8;
+    }
+    position += sizeof(uint64_t);
+  }
+
+  while (position < size && state[position] == reference[position]) {
+    position++;
+  }
+  return position;
+}
+
+// Returns the end of the encoded bytes
+Byte *Encode(const Byte *state, const Byte *reference, size_t size, Byte *out) {
+  size_t position = 0;
+
+  while (position < size) {
+    const size_t literal_start = SkipEqual(state, reference, size, position);
+
+    // Extend the literal over short equal runs
+    size_t literal_end = literal_start;
+    while (literal_end < size) {
+      const size_t next_difference = SkipEqual(state, reference, size, literal_end);
+      if (next_difference - literal_end >= MIN_ZERO_RUN || next_difference == size) {
+        break;
+      }
+      literal_end = next_difference + 1;
+    }
+
+    out = PutVarint(out, literal_start - position);
+    out = PutVarint(out, literal_end - literal_start);
+
+    for (size_t i = literal_start; i < literal_end; ++i) {
+      *out++ = state[i] ^ reference[i];
+    }
+
+    position = literal_end;
+  }
+
+  return out;
+}
+
+// Returns the end of the bytes decoded
+const Byte *Decode(const Byte *in, const Byte *reference, size_t size, Byte *state) {
+  size_t position = 0;
+
+  while (position < size) {
+    size_t zero_run, literal_length;
+    in = GetVarint(in, zero_run);
+    in = GetVarint(in, literal_length);
+
+    std::memcpy(state + position, reference + position, zero_run);
+    position += zero_run;
+
+    for (size_t i = 0; i < literal_length; ++i, ++position) {
+      state[position] = *in++ ^ reference[position];
+    }
+  }
+
+  return in;
+}
+
+}  // namespace
+
+RewindBuffer::RewindBuffer(uint32_t max_snapshots, size_t budget_bytes) {
+  this->SetCapacity(max_snapshots, budget_bytes);
+}
+
+void RewindBuffer::SetCapacity(uint32_t max_snapshots, size_t budget_bytes) {
+  m_MaxSnapshots = max_snapshots;
+
+  if (max_snapshots == 0) {
+    m_Entries.reset();
+    m_Data.reset();
+    m_DataSize = 0;
+  } else {
+    // Not value-initialized, so pages are only touched once history reaches
+    // them
+    m_Entries.reset(new Entry[max_snapshots]);
+    m_DataSize = std::max(budget_bytes, 2 * MAX_ENCODED_SIZE);
+    m_Data.reset(new Byte[m_DataSize]);
+    m_KeyframeExtended.reset(new ExtendedMemory);
+  }
+
+  this->Clear();
+}
+
+void RewindBuffer::Clear() {
+  m_Head = m_Tail = 0;
+  m_WriteOffset = 0;
+  m_UsedBytes = 0;
+  m_HasKeyframe = false;
+}
+
+void RewindBuffer::Push(const MachineState &state, const ExtendedMemory *extended) {
+  if (m_MaxSnapshots == 0) {
+    return;
+  }
+
+  this->Reserve();
+
+  const uint64_t sequence = m_Head;
+  // Groups are dropped whole, keep them small in short histories
+  const uint32_t keyframe_interval =
+      std::clamp(m_MaxSnapshots / 4, uint32_t(1), REWIND_KEYFRAME_INTERVAL);
+  const bool has_extended = HasExtendedMemory(state);
+  // Deltas only hold extended memory if their keyframe does too
+  const bool keyframe = !m_HasKeyframe || m_KeyframeSequence < m_Tail ||
+                        sequence - m_KeyframeSequence >= keyframe_interval ||
+                        HasExtendedMemory(m_Keyframe) != has_extended;
+
+  Byte *const start = m_Data.get() + m_WriteOffset;
+  const auto *reference = keyframe ? s_Zeroes : reinterpret_cast<const Byte *>(&m_Keyframe);
+  Byte *end = Encode(reinterpret_cast<const Byte *>(&state), reference, STATE_SIZE, start);
+
+  if (has_extended) {
+    const Byte *extended_reference = keyframe ? s_Zeroes : m_KeyframeExtended->data();
+    end = Encode(extended->data(), extended_reference, EXTENDED_SIZE, end);
+  }
+
+  if (keyframe) {
+    m_Keyframe = state;
+    if (has_extended) {
+      *m_KeyframeExtended = *extended;
+    }
+    m_KeyframeSequence = sequence;
+    m_HasKeyframe = true;
+  }
+
+  const size_t size = end - start;
+
+  this->GetEntry(sequence) = {static_cast<uint32_t>(m_WriteOffset), static_cast<uint32_t>(size),
+                              m_KeyframeSequence};
+
+  m_WriteOffset += size;
+  m_UsedBytes += size;
+  m_Head++;
+}
+
+bool RewindBuffer::StepBack(MachineState &state, ExtendedMemory &extended) {
+  if (m_Head == m_Tail) {
+    return false;
+  }
+
+  const uint64_t sequence = m_Head - 1;
+  const Entry entry = this->GetEntry(sequence);
+
+  this->DecodeKeyframe(entry.keyframe);
+  if (entry.keyframe == sequence) {
+    state = m_Keyframe;
+    if (HasExtendedMemory(state)) {
+      extended = *m_KeyframeExtended;
+    }
+
+    // Its deltas are all gone, the next push starts a new group
+    m_HasKeyframe = false;
+  } else {
+    const Byte *in = Decode(m_Data.get() + entry.offset,
+                            reinterpret_cast<const Byte *>(&m_Keyframe), STATE_SIZE,
+                            reinterpret_cast<Byte *>(&state));
+    if (HasExtendedMemory(state)) {
+      Decode(in, m_KeyframeExtended->data(), EXTENDED_SIZE, extended.data());
+    }
+  }
+
+  // The newest snapshot is always the last one written
+  m_WriteOffset = entry.offset;
+  m_UsedBytes -= entry.size;
+  m_Head--;
+
+  return true;
+}
+
+void RewindBuffer::Reserve() {
+  if (m_Head - m_Tail == m_MaxSnapshots) {
+    this->DropOldestGroup();
+  }
+
+  if (m_WriteOffset + MAX_ENCODED_SIZE > m_DataSize) {
+    // Wrap around. Whatever is still stored past the write offset is older
+    // than anything at the start, so it has to go first.
+    while (m_Head != m_Tail && this->GetEntry(m_Tail).offset >= m_WriteOffset) {
+      this->DropOldestGroup();
+    }
+    m_WriteOffset = 0;
+  }
+
+  while (m_Head != m_Tail) {
+    const Entry &oldest = this->GetEntry(m_Tail);
+    if (oldest.offset >= m_WriteOffset + MAX_ENCODED_SIZE ||
+        oldest.offset + oldest.size <= m_WriteOffset) {
+      break;
+    }
+    this->DropOldestGroup();
+  }
+}
+
+void RewindBuffer::DropOldestGroup() {
+  // Deltas are useless without their keyframe
+  const uint64_t keyframe = this->GetEntry(m_Tail).keyframe;
+
+  while (m_Head != m_Tail && this->GetEntry(m_Tail).keyframe == keyframe) {
+    m_UsedBytes -= this->GetEntry(m_Tail).size;
+    m_Tail++;
+  }
+}
+
+void RewindBuffer::DecodeKeyframe(uint64_t keyframe) {
+  if (m_HasKeyframe && m_KeyframeSequence == keyframe) {
+    return;
+  }
+
+  const Byte *in = Decode(m_Data.get() + this->GetEntry(keyframe).offset, s_Zeroes, STATE_SIZE,
+                          reinterpret_cast<Byte *>(&m_Keyframe));
+  if (HasExtendedMemory(m_Keyframe)) {
+    Decode(in, s_Zeroes, EXTENDED_SIZE, m_KeyframeExtended->data());
+  }
+  m_KeyframeSequence = keyframe;
+  m_HasKeyframe = true;
+}
+
+}  // namespace Chip8
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "Interpreter.h"
+
+namespace Chip8 {
+
+constexpr size_t DEFAULT_REWIND_BUDGET = 16 * 1024 * 1024;
+
+// A new keyframe is stored at least this often, so restoring any snapshot
+// never decodes more than one keyframe and one delta
+constexpr uint32_t REWIND_KEYFRAME_INTERVAL = 60;
+
+// Bounded history of machine states for rewinding. Snapshots are grouped
+// behind a keyframe; every other snapshot is stored as its XOR against that
+// keyframe, run-length encoded, which is a few dozen bytes for a typical
+// frame. Everything lives in one preallocated byte ring, the oldest group is
+// dropped when either the snapshot count or the byte budget runs out, and
+// neither Push nor StepBack allocates.
+class RewindBuffer {
+public:
+  explicit RewindBuffer(uint32_t max_snapshots = 0, size_t budget_bytes = DEFAULT_REWIND_BUDGET);
+
+  // Drops all history, 0 snapshots disables recording
+  void SetCapacity(uint32_t max_snapshots, size_t budget_bytes = DEFAULT_REWIND_BUDGET);
+  void Clear();
+
+  // extended is the state's extended memory, only read if it has one
+  void Push(const MachineState &state, const ExtendedMemory *extended = nullptr);
+
+  // Removes the newest snapshot and writes it to state, and to extended if
+  // the state has extended memory. Returns false when there is no history
+  // left.
+  bool StepBack(MachineState &state, ExtendedMemory &extended);
+
+  uint32_t GetSnapshotCount() const { return static_cast<uint32_t>(m_Head - m_Tail); }
+  uint32_t GetMaxSnapshots() const { return m_MaxSnapshots; }
+  size_t GetUsedBytes() const { return m_UsedBytes; }
+
+private:
+  struct Entry {
+    uint32_t offset;
+    uint32_t size;
+    // Sequence number of the keyframe this snapshot is relative to, its own
+    // for keyframes
+    uint64_t keyframe;
+  };
+
+  Entry &GetEntry(uint64_t sequence) { return m_Entries[sequence % m_MaxSnapshots]; }
+
+  // Makes room for an encoded snapshot at m_WriteOffset
+  void Reserve();
+  void DropOldestGroup();
+
+  // Loads m_Keyframe with the given keyframe unless it already holds it
+  void DecodeKeyframe(uint64_t keyframe);
+
+private:
+  uint32_t m_MaxSnapshots = 0;
+
+  std::unique_ptr<Entry[]> m_Entries;
+  // Sequence numbers of the oldest snapshot and one past the newest
+  uint64_t m_Head = 0, m_Tail = 0;
+
+  std::unique_ptr<Byte[]> m_Data;
+  size_t m_DataSize = 0;
+  size_t m_WriteOffset = 0;
+  size_t m_UsedBytes = 0;
+
+  // Raw copy of the keyframe new snapshots are encoded against, and the one
+  // restored last when stepping back
+  MachineState m_Keyframe;
+  std::unique_ptr<ExtendedMemory> m_KeyframeExtended;
+  uint64_t m_KeyframeSequence = 0;
+  bool m_HasKeyframe = false;
+};
+
+}  // namespace Chip8
@@ -0,0 +1,435 @@
+#include "RomCatalog.h"
+
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CHIP8_ROM_MMAP 1
+#endif
+
+#include "Logging.h"
+
+#define CHIP8_LOG_SUBSYSTEM CORE
+
+namespace Chip8 {
+
+// Index layout, all integers little-endian:
+//
+//   header:   "C8CATLG\0", u32 version, i64 directory modification time,
+//             u32 ROM count, u32 metadata count
+//   ROMs:     u64 hash, u64 size, i64 modification time, u16 path length,
+//             path
+//   metadata: u64 hash, u8 quirk profile (0xFF if unset), u16 ops per
+//             frame, 16 key map bytes
+constexpr char CATALOG_MAGIC[8] = {'C', '8', 'C', 'A', 'T', 'L', 'G', '\0'};
+constexpr uint32_t CATALOG_VERSION = 1;
+constexpr size_t CATALOG_HEADER_SIZE = sizeof(CATALOG_MAGIC) + 4 + 8 + 4 + 4;
+constexpr size_t CATALOG_ROM_SIZE = 8 + 8 + 8 + 2;
+constexpr size_t CATALOG_METADATA_SIZE = 8 + 1 + 2 + sizeof(KeyMap);
+constexpr Byte CATALOG_NO_QUIRK_PROFILE = 0xFF;
+
+constexpr const char *CATALOG_FILE_NAME = ".c8catalog";
+
+// What Scan picks up, matched case-insensitively
+constexpr const char *ROM_EXTENSIONS[] = {".ch8", ".c8", ".sc8", ".xo8"};
+
+constexpr uint64_t HASH_PRIME_1 = 0x9E3779B185EBCA87;
+constexpr uint64_t HASH_PRIME_2 = 0xC2B2AE3D27D4EB4F;
+constexpr uint64_t HASH_PRIME_3 = 0x165667B19E3779F9;
+
+static_assert(std::endian::native == std::endian::little, "ROM hashes read words little-endian");
+
+namespace {
+
+void PutInteger(std::vector<Byte> &out, uint64_t value, int size) {
+  for (int i = 0; i < size; ++i) {
+    out.push_back((value >> (i * 8)) & 0xFF);
+  }
+}
+
+uint64_t GetInteger(const Byte *in, int size) {
+  uint64_t value = 0;
+  for (int i = 0; i < size; ++i) {
+    value |= uint64_t(in[i]) << (i * 8);
+  }
+  return value;
+}
+
+uint64_t MixWord(uint64_t hash, uint64_t word) {
+  word *= HASH_PRIME_2;
+  word = std::rotl(word, 31) * HASH_PRIME_1;
+  return std::rotl(hash ^ word, 27) * HASH_PRIME_1 + HASH_PRIME_3;
+}
+
+bool IsRomFile(const std::filesystem::path &path) {
+  std::string extension = path.extension().string();
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+
+  return std::any_of(std::begin(ROM_EXTENSIONS), std::end(ROM_EXTENSIONS),
+                     [&](const char *rom_extension) { return extension == rom_extension; });
+}
+
+}  // namespace
+
+RomImage::~RomImage() { this->Close(); }
+
+bool RomImage::Open(const char *rom_location) {
+  this->Close();
+
+#if CHIP8_ROM_MMAP
+  const int file = open(rom_location, O_RDONLY);
+  if (file < 0) {
+    LOG_ERROR("Could not open {}", rom_location);
+    return false;
+  }
+
+  struct stat file_stat;
+  if (fstat(file, &file_stat) != 0) {
+    close(file);
+    LOG_ERROR("Could not read {}", rom_location);
+    return false;
+  }
+
+  // Mapping nothing fails, an empty file is just empty
+  m_Size = file_stat.st_size;
+  if (m_Size == 0) {
+    close(file);
+    return true;
+  }
+
+  void *mapping = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+
+  if (mapping == MAP_FAILED) {
+    m_Size = 0;
+    LOG_ERROR("Could not map {}", rom_location);
+    return false;
+  }
+
+  m_Data = static_cast<const Byte *>(mapping);
+  m_Mapped = true;
+  return true;
+#else
+  std::FILE *file = std::fopen(rom_location, "rb");
+  if (file == nullptr) {
+    LOG_ERROR("Could not open {}", rom_location);
+    return false;
+  }
+
+  Byte buffer[4096];
+  for (size_t read; (read = std::fread(buffer, 1, sizeof(buffer), file)) > 0;) {
+    m_Buffer.insert(m_Buffer.end(), buffer, buffer + read);
+  }
+
+  const bool failed = std::ferror(file);
+  std::fclose(file);
+
+  if (failed) {
+    m_Buffer.clear();
+    LOG_ERROR("Could not read {}", rom_location);
+    return false;
+  }
+
+  m_Data = m_Buffer.data();
+  m_Size = m_Buffer.size();
+  return true;
+#endif
+}
+
+void RomImage::Close() {
+#if CHIP8_ROM_MMAP
+  if (m_Mapped) {
+    munmap(const_cast<Byte *>(m_Data), m_Size);
+  }
+#endif
+
+  m_Data = nullptr;
+  m_Size = 0;
+  m_Mapped = false;
+  m_Buffer.clear();
+}
+
+uint64_t HashRom(std::span<const Byte> data) {
+  uint64_t hash = HASH_PRIME_3 ^ (data.size() * HASH_PRIME_1);
+
+  size_t offset = 0;
+  for (; offset + sizeof(uint64_t) <= data.size(); offset += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, data.data() + offset, sizeof(word));
+    hash = MixWord(hash, word);
+  }
+
+  // The last partial word, zero padded. The length is already in the seed.
+  if (offset < data.size()) {
+    uint64_t word = 0;
+    std::memcpy(&word, data.data() + offset, data.size() - offset);
+    hash = MixWord(hash, word);
+  }
+
+  hash ^= hash >> 33;
+  hash *= HASH_PRIME_2;
+  hash ^= hash >> 29;
+  hash *= HASH_PRIME_3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+bool RomCatalog::Open(const char *directory) {
+  m_Directory = directory;
+  m_IndexLocation = (std::filesystem::path(directory) / CATALOG_FILE_NAME).string();
+
+  m_DirectoryModified = 0;
+  m_Roms.clear();
+  m_RomsByHash.clear();
+  m_Metadata.clear();
+
+  if (!std::filesystem::exists(m_IndexLocation)) {
+    LOG_INFO("{} has no ROM catalog yet", directory);
+    return false;
+  }
+
+  if (!this->ReadIndex()) {
+    m_DirectoryModified = 0;
+    m_Roms.clear();
+    m_RomsByHash.clear();
+    m_Metadata.clear();
+    return false;
+  }
+
+  LOG_INFO("Read {} ROMs from {}", m_Roms.size(), m_IndexLocation);
+  return true;
+}
+
+bool RomCatalog::ReadIndex() {
+  RomImage index;
+  if (!index.Open(m_IndexLocation.c_str())) {
+    return false;
+  }
+
+  const std::span<const Byte> data = index.GetData();
+  if (data.size() < CATALOG_HEADER_SIZE ||
+      std::memcmp(data.data(), CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) != 0) {
+    LOG_ERROR("{} is not a ROM catalog", m_IndexLocation);
+    return false;
+  }
+
+  const Byte *header = data.data() + sizeof(CATALOG_MAGIC);
+  if (GetInteger(header, 4) != CATALOG_VERSION) {
+    LOG_ERROR("{} was written by an incompatible version (format {})", m_IndexLocation,
+              GetInteger(header, 4));
+    return false;
+  }
+
+  m_DirectoryModified = GetInteger(header + 4, 8);
+  const uint32_t rom_count = GetInteger(header + 12, 4);
+  const uint32_t metadata_count = GetInteger(header + 16, 4);
+
+  size_t position = CATALOG_HEADER_SIZE;
+  m_Roms.reserve(std::min<size_t>(rom_count, data.size() / CATALOG_ROM_SIZE));
+
+  for (uint32_t index = 0; index < rom_count; ++index) {
+    if (position + CATALOG_ROM_SIZE > data.size()) {
+      LOG_ERROR("{} is truncated", m_IndexLocation);
+      return false;
+    }
+
+    const Byte *in = data.data() + position;
+    const size_t path_length = GetInteger(in + 24, 2);
+    if (position + CATALOG_ROM_SIZE + path_length > data.size()) {
+      LOG_ERROR("{} is truncated", m_IndexLocation);
+      return false;
+    }
+
+    RomEntry &entry = m_Roms.emplace_back();
+    entry.hash = GetInteger(in, 8);
+    entry.size = GetInteger(in + 8, 8);
+    entry.modified = GetInteger(in + 16, 8);
+    entry.path.assign(reinterpret_cast<const char *>(in + CATALOG_ROM_SIZE), path_length);
+
+    m_RomsByHash.try_emplace(entry.hash, m_Roms.size() - 1);
+    position += CATALOG_ROM_SIZE + path_length;
+  }
+
+  if (position + size_t(metadata_count) * CATALOG_METADATA_SIZE > data.size()) {
+    LOG_ERROR("{} is truncated", m_IndexLocation);
+    return false;
+  }
+
+  for (uint32_t index = 0; index < metadata_count; ++index) {
+    const Byte *in = data.data() + position;
+    RomMetadata metadata;
+
+    const Byte quirk_profile = in[8];
+    if (quirk_profile < (Byte)QuirkProfile::Count) {
+      metadata.quirk_profile = static_cast<QuirkProfile>(quirk_profile);
+    }
+    metadata.ops_per_frame = GetInteger(in + 9, 2);
+    std::memcpy(metadata.key_map.data(), in + 11, sizeof(KeyMap));
+
+    m_Metadata[GetInteger(in, 8)] = metadata;
+    position += CATALOG_METADATA_SIZE;
+  }
+
+  return true;
+}
+
+size_t RomCatalog::Scan() {
+  namespace fs = std::filesystem;
+
+  std::unordered_map<std::string, RomEntry> previous;
+  for (RomEntry &entry : m_Roms) {
+    previous.emplace(entry.path, std::move(entry));
+  }
+
+  m_Roms.clear();
+  m_RomsByHash.clear();
+
+  size_t hashed = 0;
+  std::error_code error;
+  RomImage image;
+
+  for (auto it = fs::recursive_directory_iterator(
+           m_Directory, fs::directory_options::skip_permission_denied, error);
+       !error && it != fs::recursive_directory_iterator(); it.increment(error)) {
+    if (!it->is_regular_file(error) || !IsRomFile(it->path())) {
+      continue;
+    }
+
+    RomEntry entry;
+    entry.path = it->path().lexically_relative(m_Directory).generic_string();
+    entry.size = it->file_size(error);
+    entry.modified = it->last_write_time(error).time_since_epoch().count();
+    if (error) {
+      LOG_WARN("Skipped {}: {}", it->path().string(), error.message());
+      error.clear();
+      continue;
+    }
+
+    // Unchanged files keep their hash, only new and edited ones are read
+    const auto known = previous.find(entry.path);
+    if (known != previous.end() && known->second.size == entry.size &&
+        known->second.modified == entry.modified) {
+      entry.hash = known->second.hash;
+    } else {
+      if (!image.Open(it->path().string().c_str())) {
+        continue;
+      }
+      entry.hash = HashRom(image.GetData());
+      hashed++;
+    }
+
+    m_Roms.push_back(std::move(entry));
+  }
+
+  if (error) {
+    LOG_ERROR("Could not scan {}: {}", m_Directory, error.message());
+  }
+
+  std::sort(m_Roms.begin(), m_Roms.end(),
+            [](const RomEntry &a, const RomEntry &b) { return a.path < b.path; });
+
+  for (size_t index = 0; index < m_Roms.size(); ++index) {
+    m_RomsByHash.try_emplace(m_Roms[index].hash, index);
+  }
+
+  m_DirectoryModified = this->GetDirectoryModified();
+
+  LOG_INFO("Scanned {} ROMs in {}, hashed {}", m_Roms.size(), m_Directory, hashed);
+  return hashed;
+}
+
+bool RomCatalog::Save() {
+  const bool up_to_date = !this->IsStale();
+
+  if (!this->WriteIndex()) {
+    return false;
+  }
+
+  // Creating the index modifies the directory too, that is not a change
+  // worth a rescan
+  if (up_to_date && this->IsStale()) {
+    m_DirectoryModified = this->GetDirectoryModified();
+    return this->WriteIndex();
+  }
+
+  return true;
+}
+
+bool RomCatalog::WriteIndex() const {
+  std::vector<Byte> data;
+  data.insert(data.end(), CATALOG_MAGIC, CATALOG_MAGIC + sizeof(CATALOG_MAGIC));
+  PutInteger(data, CATALOG_VERSION, 4);
+  PutInteger(data, m_DirectoryModified, 8);
+  PutInteger(data, m_Roms.size(), 4);
+  PutInteger(data, m_Metadata.size(), 4);
+
+  for (const RomEntry &entry : m_Roms) {
+    const size_t path_length = std::min<size_t>(entry.path.size(), UINT16_MAX);
+
+    PutInteger(data, entry.hash, 8);
+    PutInteger(data, entry.size, 8);
+    PutInteger(data, entry.modified, 8);
+    PutInteger(data, path_length, 2);
+    data.insert(data.end(), entry.path.begin(), entry.path.begin() + path_length);
+  }
+
+  for (const auto &[hash, metadata] : m_Metadata) {
+    PutInteger(data, hash, 8);
+    PutInteger(data, metadata.quirk_profile ? Byte(*metadata.quirk_profile)
+                                            : CATALOG_NO_QUIRK_PROFILE, 1);
+    PutInteger(data, metadata.ops_per_frame, 2);
+    data.insert(data.end(), metadata.key_map.begin(), metadata.key_map.end());
+  }
+
+  std::FILE *file = std::fopen(m_IndexLocation.c_str(), "wb");
+  if (file == nullptr) {
+    LOG_ERROR("Could not open {}", m_IndexLocation);
+    return false;
+  }
+
+  const bool written = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+  if (std::fclose(file) != 0 || !written) {
+    LOG_ERROR("Could not write {}", m_IndexLocation);
+    return false;
+  }
+
+  LOG_INFO("Saved {} ROMs to {}", m_Roms.size(), m_IndexLocation);
+  return true;
+}
+
+bool RomCatalog::IsStale() const { return this->GetDirectoryModified() != m_DirectoryModified; }
+
+const RomEntry *RomCatalog::FindRom(uint64_t hash) const {
+  const auto rom = m_RomsByHash.find(hash);
+  return rom != m_RomsByHash.end() ? &m_Roms[rom->second] : nullptr;
+}
+
+const RomMetadata *RomCatalog::FindMetadata(uint64_t hash) const {
+  const auto metadata = m_Metadata.find(hash);
+  return metadata != m_Metadata.end() ? &metadata->second : nullptr;
+}
+
+void RomCatalog::SetMetadata(uint64_t hash, const RomMetadata &metadata) {
+  if (metadata == RomMetadata{}) {
+    m_Metadata.erase(hash);
+  } else {
+    m_Metadata[hash] = metadata;
+  }
+}
+
+int64_t RomCatalog::GetDirectoryModified() const {
+  std::error_code error;
+  return std::filesystem::last_write_time(m_Directory, error).time_since_epoch().count();
+}
+
+}  // namespace Chip8
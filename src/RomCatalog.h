@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Platform.h"
+#include "Quirks.h"
+
+namespace Chip8 {
+
+// A ROM file mapped read-only, or read into memory where mapping is not
+// available. The data stays valid until the image is closed or destroyed.
+class RomImage {
+public:
+  RomImage() = default;
+  ~RomImage();
+
+  RomImage(const RomImage &) = delete;
+  RomImage &operator=(const RomImage &) = delete;
+
+  bool Open(const char *rom_location);
+  void Close();
+
+  std::span<const Byte> GetData() const { return {m_Data, m_Size}; }
+
+private:
+  const Byte *m_Data = nullptr;
+  size_t m_Size = 0;
+  bool m_Mapped = false;
+  std::vector<Byte> m_Buffer;
+};
+
+// 64-bit content hash of a ROM, eight bytes at a time. Stored in catalog
+// indexes, so it must not change between versions.
+uint64_t HashRom(std::span<const Byte> data);
+
+// Settings a ROM wants, whatever its file is called
+struct RomMetadata {
+  std::optional<QuirkProfile> quirk_profile;
+  // Instructions per 60 Hz frame, 0 keeps the frontend's speed setting
+  uint16_t ops_per_frame = 0;
+  KeyMap key_map{};
+
+  bool operator==(const RomMetadata &) const = default;
+};
+
+struct RomEntry {
+  // Relative to the catalog directory, '/' separated
+  std::string path;
+  uint64_t size = 0;
+  // std::filesystem::file_time_type ticks, only compared for equality
+  int64_t modified = 0;
+  uint64_t hash = 0;
+};
+
+// Every ROM under a directory by content hash, plus metadata keyed by the
+// same hash, persisted as one index file in the directory. Opening reads
+// just that file. Scan walks the directory again but only hashes files
+// whose size or modification time changed, and metadata survives renames
+// and moves since it never refers to a path.
+class RomCatalog {
+public:
+  // Reads the index of directory. Returns false if there is none or it is
+  // unreadable, the catalog is then empty but can still be scanned.
+  bool Open(const char *directory);
+
+  // Returns how many files had to be hashed
+  size_t Scan();
+  bool Save();
+
+  // Whether files were added to or removed from the directory itself since
+  // the index was written, a single stat. Subdirectories need a Scan.
+  bool IsStale() const;
+
+  const std::vector<RomEntry> &GetRoms() const { return m_Roms; }
+  const RomEntry *FindRom(uint64_t hash) const;
+
+  const RomMetadata *FindMetadata(uint64_t hash) const;
+  // Metadata equal to the default removes the entry
+  void SetMetadata(uint64_t hash, const RomMetadata &metadata);
+
+  const std::string &GetIndexLocation() const { return m_IndexLocation; }
+
+private:
+  bool ReadIndex();
+  bool WriteIndex() const;
+  int64_t GetDirectoryModified() const;
+
+private:
+  std::string m_Directory;
+  std::string m_IndexLocation;
+  int64_t m_DirectoryModified = 0;
+
+  std::vector<RomEntry> m_Roms;
+  std::unordered_map<uint64_t, size_t> m_RomsByHash;
+  std::unordered_map<uint64_t, RomMetadata> m_Metadata;
+};
+
+}  // namespace Chip8
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace Chip8 {
+
+// Bounded lock-free queue for exactly one producer and one consumer thread
+template <typename T, size_t Capacity>
+class SPSCQueue {
+  static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+  // Producer side, returns false when the queue is full
+  bool Push(const T &value) {
+    const size_t head = m_Head.load(std::memory_order_relaxed);
+
+    if (head - m_Tail.load(std::memory_order_acquire) == Capacity) {
+      return false;
+    }
+
+    m_Items[head & (Capacity - 1)] = value;
+    m_Head.store(head + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  // Consumer side, returns false when the queue is empty
+  bool Pop(T &out_value) {
+    const size_t tail = m_Tail.load(std::memory_order_relaxed);
+
+    if (tail == m_Head.load(std::memory_order_acquire)) {
+      return false;
+    }
+
+    out_value = m_Items[tail & (Capacity - 1)];
+    m_Tail.store(tail + 1, std::memory_order_release);
+
+    return true;
+  }
+
+private:
+  std::array<T, Capacity> m_Items{};
+
+  alignas(64) std::atomic<size_t> m_Head{0};
+  alignas(64) std::atomic<size_t> m_Tail{0};
+};
+
+}  // namespace Chip8
@@ -0,0 +1,150 @@
+#include "SaveState.h"
+
+#include <bit>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CHIP8_STATE_MMAP 1
+#endif
+
+#include "Logging.h"
+
+#define CHIP8_LOG_SUBSYSTEM CORE
+
+namespace Chip8 {
+
+// Bump whenever MachineState changes layout
+constexpr uint32_t STATE_VERSION = 4;
+constexpr char STATE_MAGIC[8] = {'C', '8', 'S', 'T', 'A', 'T', 'E', '\0'};
+
+// Padded to the state's alignment so the state right after it is aligned in
+// a mapped file too
+struct alignas(alignof(MachineState)) StateFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t state_size;
+};
+static_assert(sizeof(StateFileHeader) == alignof(MachineState));
+
+static_assert(std::endian::native == std::endian::little, "save states are stored little-endian");
+
+static bool IsCompatible(const StateFileHeader &header, const char *state_location) {
+  if (std::memcmp(header.magic, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0) {
+    LOG_ERROR("{} is not a save state", state_location);
+    return false;
+  }
+
+  if (header.version != STATE_VERSION || header.state_size != sizeof(MachineState)) {
+    LOG_ERROR("{} was written by an incompatible version (format {})", state_location,
+              header.version);
+    return false;
+  }
+
+  return true;
+}
+
+bool WriteStateFile(const char *state_location, const MachineState &state,
+                    const ExtendedMemory *extended) {
+  std::FILE *file = std::fopen(state_location, "wb");
+  if (file == nullptr) {
+    LOG_ERROR("Could not open save state {}", state_location);
+    return false;
+  }
+
+  StateFileHeader header{};
+  std::memcpy(header.magic, STATE_MAGIC, sizeof(STATE_MAGIC));
+  header.version = STATE_VERSION;
+  header.state_size = sizeof(MachineState);
+
+  bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                 std::fwrite(&state, sizeof(state), 1, file) == 1;
+  if (HasExtendedMemory(state)) {
+    written = written && std::fwrite(extended->data(), extended->size(), 1, file) == 1;
+  }
+
+  if (std::fclose(file) != 0 || !written) {
+    LOG_ERROR("Could not write save state {}", state_location);
+    return false;
+  }
+
+  LOG_INFO("Saved state to {}", state_location);
+  return true;
+}
+
+bool ReadStateFile(const char *state_location, MachineState &state, ExtendedMemory &extended) {
+  constexpr size_t STATE_END = sizeof(StateFileHeader) + sizeof(MachineState);
+
+#if CHIP8_STATE_MMAP
+  const int file = open(state_location, O_RDONLY);
+  if (file < 0) {
+    LOG_ERROR("Could not open save state {}", state_location);
+    return false;
+  }
+
+  struct stat file_stat;
+  if (fstat(file, &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) < STATE_END) {
+    close(file);
+    LOG_ERROR("{} is not a save state", state_location);
+    return false;
+  }
+
+  const size_t file_size = static_cast<size_t>(file_stat.st_size);
+  void *mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+
+  if (mapping == MAP_FAILED) {
+    LOG_ERROR("Could not map save state {}", state_location);
+    return false;
+  }
+
+  const auto *data = static_cast<const Byte *>(mapping);
+  bool read = IsCompatible(*reinterpret_cast<const StateFileHeader *>(data), state_location);
+
+  if (read) {
+    std::memcpy(&state, data + sizeof(StateFileHeader), sizeof(MachineState));
+
+    if (HasExtendedMemory(state)) {
+      read = file_size >= STATE_END + extended.size();
+      if (read) {
+        std::memcpy(extended.data(), data + STATE_END, extended.size());
+      } else {
+        LOG_ERROR("{} is missing its extended memory", state_location);
+      }
+    }
+  }
+
+  munmap(mapping, file_size);
+  return read;
+#else
+  std::FILE *file = std::fopen(state_location, "rb");
+  if (file == nullptr) {
+    LOG_ERROR("Could not open save state {}", state_location);
+    return false;
+  }
+
+  StateFileHeader header;
+  const bool has_header = std::fread(&header, sizeof(header), 1, file) == 1;
+  if (!has_header || !IsCompatible(header, state_location)) {
+    if (!has_header) LOG_ERROR("{} is not a save state", state_location);
+    std::fclose(file);
+    return false;
+  }
+
+  const bool read = std::fread(&state, sizeof(state), 1, file) == 1 &&
+                    (!HasExtendedMemory(state) ||
+                     std::fread(extended.data(), extended.size(), 1, file) == 1);
+  std::fclose(file);
+
+  if (!read) {
+    LOG_ERROR("{} is not a save state", state_location);
+  }
+  return read;
+#endif
+}
+
+}  // namespace Chip8
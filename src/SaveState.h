@@ -0,0 +1,17 @@
+#pragma once
+
+#include "Interpreter.h"
+
+namespace Chip8 {
+
+// Save files are a 64-byte header followed by the raw MachineState, and the
+// ExtendedMemory when the state has it, so a file is loaded by mapping it
+// and copying the structs out in one go. Files from a build with a
+// different layout (version, call stack size) are rejected rather than
+// converted.
+bool WriteStateFile(const char *state_location, const MachineState &state,
+                    const ExtendedMemory *extended);
+// extended is only written if the state has extended memory
+bool ReadStateFile(const char *state_location, MachineState &state, ExtendedMemory &extended);
+
+}  // namespace Chip8
@@ -10,6 +10,8 @@
 
 #include "Logging.h"
 
+#define CHIP8_LOG_SUBSYSTEM RENDER
+
 Shader::Shader() : m_ShaderProgram(0), m_FragmentShader(0), m_VertexShader(0) {}
 
 bool Shader::Load(const std::string &vertName, const std::string &fragName) {
@@ -1,7 +1,19 @@
 #version 330 core
 
+in vec2 vTexCoord;
+
+uniform sampler2D uDisplay;
+
 out vec4 FragColor;
 
+// Colour per index, bit p of the index is set when the pixel is on in plane p
+const vec3 Palette[16] = vec3[16](
+    vec3(0.0, 0.0, 0.0), vec3(1.0, 1.0, 1.0), vec3(0.67, 0.67, 0.67), vec3(0.33, 0.33, 0.33),
+    vec3(1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0), vec3(0.0, 0.0, 1.0), vec3(1.0, 1.0, 0.0),
+    vec3(0.53, 0.0, 0.0), vec3(0.0, 0.53, 0.0), vec3(0.0, 0.0, 0.53), vec3(0.53, 0.53, 0.0),
+    vec3(1.0, 0.0, 1.0), vec3(0.0, 1.0, 1.0), vec3(0.53, 0.0, 0.53), vec3(0.0, 0.53, 0.53));
+
 void main() {
-    FragColor = vec4(1.0, 1.0, 1.0, 1.0);
+    int index = int(texture(uDisplay, vTexCoord).r * 255.0 + 0.5) & 15;
+    FragColor = vec4(Palette[index], 1.0);
 }
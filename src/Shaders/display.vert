@@ -1,9 +1,13 @@
 #version 330 core
 
 layout(location = 0) in vec2 aPos;
+layout(location = 1) in vec2 aTexCoord;
 
 uniform mat4 uProjection;
 
+out vec2 vTexCoord;
+
 void main() {
     gl_Position = vec4(aPos.x, aPos.y, 0.0, 1.0);
+    vTexCoord = aTexCoord;
 }
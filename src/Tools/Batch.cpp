@@ -0,0 +1,356 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "HeadlessPlatform.h"
+#include "Interpreter.h"
+#include "Logging.h"
+#include "WorkStealingPool.h"
+
+// Runs every combination of ROMs and settings headless, spread over all
+// cores, and writes one report for the whole batch.
+//
+//   chip-batch <rom or directory>... [--cycles N] [--engines LIST]
+//              [--ops-per-second LIST] [--display-wait off|on|both]
+//              [--seed N] [--threads N] [--pin] [--report FILE]
+//
+// LISTs are comma separated, e.g. --engines interpreter,jit. Directories
+// contribute every *.ch8 in them. The report is CSV when FILE ends in .csv
+// and JSON otherwise, "-" writes JSON to stdout. Every job owns its
+// interpreter, so throughput scales with the core count.
+
+constexpr uint64_t DEFAULT_CYCLES = 10'000'000;
+
+struct BatchJob {
+  std::string rom_location;
+  Chip8::ExecutionEngine engine;
+  unsigned int ops_per_second;
+  bool display_wait;
+};
+
+struct BatchResult {
+  uint64_t cycles = 0;
+  double seconds = 0.0;
+  uint64_t framebuffer_hash = 0;
+  uint64_t instruction_types = 0;
+  unsigned int worker = 0;
+};
+
+static void PrintUsage(const char *program_name) {
+  std::fprintf(stderr,
+               "Usage: %s <rom or directory>... [--cycles N] [--engines LIST] "
+               "[--ops-per-second LIST] [--display-wait off|on|both] [--seed N] [--threads N] "
+               "[--pin] [--report FILE]\n",
+               program_name);
+}
+
+static const char *GetEngineName(Chip8::ExecutionEngine engine) {
+  switch (engine) {
+    case Chip8::ExecutionEngine::Interpreter: return "interpreter";
+    case Chip8::ExecutionEngine::Threaded: return "threaded";
+    case Chip8::ExecutionEngine::Jit: return "jit";
+  }
+  return "?";
+}
+
+static std::vector<std::string> SplitList(const char *list) {
+  std::vector<std::string> items;
+  std::string item;
+
+  for (const char *c = list;; ++c) {
+    if (*c == ',' || *c == '\0') {
+      if (!item.empty()) items.push_back(item);
+      item.clear();
+      if (*c == '\0') break;
+    } else {
+      item += *c;
+    }
+  }
+
+  return items;
+}
+
+static bool ParseEngines(const char *list, std::vector<Chip8::ExecutionEngine> &engines) {
+  engines.clear();
+
+  for (const std::string &name : SplitList(list)) {
+    if (name == "interpreter") {
+      engines.push_back(Chip8::ExecutionEngine::Interpreter);
+    } else if (name == "threaded") {
+      engines.push_back(Chip8::ExecutionEngine::Threaded);
+    } else if (name == "jit") {
+      engines.push_back(Chip8::ExecutionEngine::Jit);
+    } else {
+      return false;
+    }
+  }
+
+  return !engines.empty();
+}
+
+static void AddRoms(const char *location, std::vector<std::string> &roms) {
+  namespace fs = std::filesystem;
+
+  std::error_code error;
+  if (!fs::is_directory(location, error)) {
+    roms.emplace_back(location);
+    return;
+  }
+
+  std::vector<std::string> found;
+  for (const auto &entry : fs::directory_iterator(location, error)) {
+    if (entry.is_regular_file() && entry.path().extension() == ".ch8") {
+      found.push_back(entry.path().string());
+    }
+  }
+
+  std::sort(found.begin(), found.end());
+  roms.insert(roms.end(), found.begin(), found.end());
+}
+
+static std::string GetInstructionList(uint64_t instruction_types) {
+  std::string list;
+
+  for (size_t type = 0; type < (size_t)Chip8::InstructionType::Count; ++type) {
+    if (instruction_types & (1ull << type)) {
+      if (!list.empty()) list += ' ';
+      list += Chip8::GetInstructionName(static_cast<Chip8::InstructionType>(type));
+    }
+  }
+
+  return list;
+}
+
+static std::string EscapeJson(const std::string &text) {
+  std::string escaped;
+
+  for (const char c : text) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char code[8];
+      std::snprintf(code, sizeof(code), "\\u%04x", c);
+      escaped += code;
+    } else {
+      escaped += c;
+    }
+  }
+
+  return escaped;
+}
+
+static void WriteJsonReport(std::FILE *file, const std::vector<BatchJob> &jobs,
+                            const std::vector<BatchResult> &results, unsigned int threads,
+                            double wall_seconds) {
+  uint64_t total_cycles = 0;
+  for (const BatchResult &result : results) {
+    total_cycles += result.cycles;
+  }
+
+  std::fprintf(file, "{\n  \"threads\": %u,\n  \"wall_seconds\": %.6f,\n", threads, wall_seconds);
+  std::fprintf(file, "  \"total_cycles\": %llu,\n  \"cycles_per_second\": %.0f,\n",
+               static_cast<unsigned long long>(total_cycles),
+               wall_seconds > 0.0 ? total_cycles / wall_seconds : 0.0);
+  std::fprintf(file, "  \"jobs\": [\n");
+
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    const BatchJob &job = jobs[i];
+    const BatchResult &result = results[i];
+
+    std::fprintf(file,
+                 "    {\"rom\": \"%s\", \"engine\": \"%s\", \"ops_per_second\": %u, "
+                 "\"display_wait\": %s, \"cycles\": %llu, \"seconds\": %.6f, "
+                 "\"cycles_per_second\": %.0f, \"framebuffer\": \"%016llx\", "
+                 "\"instructions\": \"%s\", \"worker\": %u}%s\n",
+                 EscapeJson(job.rom_location).c_str(), GetEngineName(job.engine),
+                 job.ops_per_second, job.display_wait ? "true" : "false",
+                 static_cast<unsigned long long>(result.cycles), result.seconds,
+                 result.seconds > 0.0 ? result.cycles / result.seconds : 0.0,
+                 static_cast<unsigned long long>(result.framebuffer_hash),
+                 GetInstructionList(result.instruction_types).c_str(), result.worker,
+                 i + 1 < jobs.size() ? "," : "");
+  }
+
+  std::fprintf(file, "  ]\n}\n");
+}
+
+static void WriteCsvReport(std::FILE *file, const std::vector<BatchJob> &jobs,
+                           const std::vector<BatchResult> &results) {
+  std::fprintf(file,
+               "rom,engine,ops_per_second,display_wait,cycles,seconds,cycles_per_second,"
+               "framebuffer,instructions,worker\n");
+
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    const BatchJob &job = jobs[i];
+    const BatchResult &result = results[i];
+
+    std::fprintf(file, "\"%s\",%s,%u,%d,%llu,%.6f,%.0f,%016llx,%s,%u\n",
+                 job.rom_location.c_str(), GetEngineName(job.engine), job.ops_per_second,
+                 job.display_wait, static_cast<unsigned long long>(result.cycles),
+                 result.seconds, result.seconds > 0.0 ? result.cycles / result.seconds : 0.0,
+                 static_cast<unsigned long long>(result.framebuffer_hash),
+                 GetInstructionList(result.instruction_types).c_str(), result.worker);
+  }
+}
+
+static BatchResult RunJob(const BatchJob &job, uint64_t cycles, uint64_t random_seed) {
+  Chip8::Interpreter interpreter(job.rom_location.c_str());
+  interpreter.SetInputSource(std::make_shared<Chip8::NullInputSource>());
+  interpreter.SetRandomSeed(random_seed);
+  interpreter.SetInstructionsPerSecond(job.ops_per_second);
+  interpreter.SetExecutionEngine(job.engine);
+  interpreter.SetDisplayWaitQuirk(job.display_wait);
+
+  BatchResult result;
+  const auto start = std::chrono::steady_clock::now();
+
+  while (result.cycles < cycles) {
+    result.cycles += interpreter.Execute(std::min<uint64_t>(cycles - result.cycles, UINT32_MAX));
+  }
+
+  result.seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  result.framebuffer_hash = interpreter.GetFrameBuffer().Hash();
+  result.instruction_types = interpreter.GetDecodedInstructionTypes();
+
+  return result;
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> roms;
+  std::vector<Chip8::ExecutionEngine> engines = {Chip8::ExecutionEngine::Interpreter};
+  std::vector<unsigned int> ops_per_second_list = {DEFAULT_INSTRUCTIONS_PER_SECOND};
+  std::vector<bool> display_wait_list = {false};
+  uint64_t cycles = DEFAULT_CYCLES;
+  uint64_t random_seed = DEFAULT_RANDOM_SEED;
+  unsigned int threads = 0;
+  bool pin_threads = false;
+  const char *report_location = nullptr;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+
+    if (!std::strcmp(argv[i], "--cycles") && has_value) {
+      cycles = std::strtoull(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--engines") && has_value) {
+      if (!ParseEngines(argv[++i], engines)) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (!std::strcmp(argv[i], "--ops-per-second") && has_value) {
+      ops_per_second_list.clear();
+      for (const std::string &value : SplitList(argv[++i])) {
+        const unsigned int ops_per_second = std::strtoul(value.c_str(), nullptr, 10);
+        if (ops_per_second == 0) {
+          PrintUsage(argv[0]);
+          return EXIT_FAILURE;
+        }
+        ops_per_second_list.push_back(ops_per_second);
+      }
+    } else if (!std::strcmp(argv[i], "--display-wait") && has_value) {
+      const char *value = argv[++i];
+      if (!std::strcmp(value, "off")) {
+        display_wait_list = {false};
+      } else if (!std::strcmp(value, "on")) {
+        display_wait_list = {true};
+      } else if (!std::strcmp(value, "both")) {
+        display_wait_list = {false, true};
+      } else {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (!std::strcmp(argv[i], "--seed") && has_value) {
+      random_seed = std::strtoull(argv[++i], nullptr, 0);
+    } else if (!std::strcmp(argv[i], "--threads") && has_value) {
+      threads = std::strtoul(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--pin")) {
+      pin_threads = true;
+    } else if (!std::strcmp(argv[i], "--report") && has_value) {
+      report_location = argv[++i];
+    } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    } else {
+      AddRoms(argv[i], roms);
+    }
+  }
+
+  if (roms.empty() || ops_per_second_list.empty()) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Chip8::Logger::Init();
+  Chip8::Logger::GetLogger()->set_level(spdlog::level::err);
+
+  std::vector<BatchJob> jobs;
+  for (const std::string &rom : roms) {
+    for (const Chip8::ExecutionEngine engine : engines) {
+      for (const unsigned int ops_per_second : ops_per_second_list) {
+        for (const bool display_wait : display_wait_list) {
+          jobs.push_back({rom, engine, ops_per_second, display_wait});
+        }
+      }
+    }
+  }
+
+  // Each job writes only its own slot
+  std::vector<BatchResult> results(jobs.size());
+  Chip8::WorkStealingPool pool(threads, pin_threads);
+
+  const auto start = std::chrono::steady_clock::now();
+
+  pool.Run(jobs.size(), [&](size_t index, unsigned int worker) {
+    results[index] = RunJob(jobs[index], cycles, random_seed);
+    results[index].worker = worker;
+  });
+
+  const double wall_seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  // The summary moves out of the way when the report goes to stdout
+  const bool report_to_stdout = report_location != nullptr && !std::strcmp(report_location, "-");
+  std::FILE *summary = report_to_stdout ? stderr : stdout;
+
+  uint64_t total_cycles = 0;
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    total_cycles += results[i].cycles;
+    std::fprintf(summary, "%-40s %-11s %8u %-3s %12.0f ops/s  %016llx\n",
+                 jobs[i].rom_location.c_str(), GetEngineName(jobs[i].engine),
+                 jobs[i].ops_per_second, jobs[i].display_wait ? "on" : "off",
+                 results[i].seconds > 0.0 ? results[i].cycles / results[i].seconds : 0.0,
+                 static_cast<unsigned long long>(results[i].framebuffer_hash));
+  }
+  std::fprintf(summary, "%zu jobs on %u threads in %.3f s, %.0f ops/s total\n", jobs.size(),
+               pool.GetThreadCount(), wall_seconds,
+               wall_seconds > 0.0 ? total_cycles / wall_seconds : 0.0);
+
+  int exit_code = EXIT_SUCCESS;
+
+  if (report_location != nullptr) {
+    std::FILE *file = report_to_stdout ? stdout : std::fopen(report_location, "w");
+
+    if (file == nullptr) {
+      std::fprintf(stderr, "Could not open %s\n", report_location);
+      exit_code = EXIT_FAILURE;
+    } else {
+      if (!report_to_stdout && std::filesystem::path(report_location).extension() == ".csv") {
+        WriteCsvReport(file, jobs, results);
+      } else {
+        WriteJsonReport(file, jobs, results, pool.GetThreadCount(), wall_seconds);
+      }
+
+      if (!report_to_stdout) std::fclose(file);
+    }
+  }
+
+  Chip8::Logger::Shutdown();
+  return exit_code;
+}
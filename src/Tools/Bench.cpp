@@ -0,0 +1,354 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "DisplayData.h"
+#include "FrameBuffer.h"
+#include "Interpreter.h"
+#include "LockstepEngine.h"
+#include "Logging.h"
+
+// Microbenchmarks for the core: every opcode family through
+// Interpreter::Run, sprite drawing, the display upload staging and whole
+// ROMs on every engine.
+//
+//   chip-bench [--roms DIR] [Google Benchmark flags]
+//
+// Results go to chip-bench.json unless --benchmark_out says otherwise, so
+// two releases compare with Google Benchmark's tools/compare.py. The ROM
+// benchmarks use every *.ch8 in DIR, the repository's roms/ by default.
+
+#ifndef CHIP8_BENCH_ROM_DIRECTORY
+#define CHIP8_BENCH_ROM_DIRECTORY "roms"
+#endif
+
+constexpr const char *DEFAULT_REPORT = "chip-bench.json";
+
+// Instructions per timed Execute call
+constexpr unsigned int BATCH_INSTRUCTIONS = 4096;
+
+// Copies of the family's opcodes in the loop body, so the closing jump is
+// noise
+constexpr size_t LOOP_INSTRUCTIONS = 512;
+
+constexpr uint32_t LOCKSTEP_LANES = 256;
+
+namespace {
+
+// A loop over one opcode family. Before the loop I points at a spare data
+// area, and a subroutine at SUBROUTINE_ADDRESS returns right away.
+struct OpcodeFamily {
+  const char *name;
+  std::vector<Opcode> body;
+};
+
+constexpr MemoryAddress LOOP_START = ROM_START + INSTRUCTION_SIZE;
+constexpr MemoryAddress DATA_ADDRESS = 0x800;
+constexpr MemoryAddress SUBROUTINE_ADDRESS = 0xE00;
+
+// Skips always land on another opcode of the same family and never on the
+// closing jump
+const std::vector<OpcodeFamily> OPCODE_FAMILIES = {
+    {"00E0", {0x00E0}},
+    {"2NNN+00EE", {0x2000 | SUBROUTINE_ADDRESS}},
+    {"3XNN-9XY0", {0x5010, 0x9010, 0x4000, 0x3001}},
+    {"6XNN-7XNN", {0x6A12, 0x7B34}},
+    {"8XY*", {0x8014, 0x8125, 0x8236, 0x8347, 0x845E, 0x8561, 0x8672, 0x8783, 0x8800}},
+    {"ANNN", {0xA000 | DATA_ADDRESS}},
+    {"CXNN", {0xC0FF, 0xC10F}},
+    {"DXYN", {0xF029, 0xD015}},
+    {"EX9E-EXA1", {0xE09E, 0xE0A1, 0x6000}},
+    {"FX07-FX18", {0xF007, 0xF115, 0xF118}},
+    {"FX1E-FX29", {0xF01E, 0xF029}},
+    {"FX33", {0xA000 | DATA_ADDRESS, 0xF033}},
+    {"FX55-FX65", {0xA000 | DATA_ADDRESS, 0xF355, 0xF365}},
+};
+
+// Jumps are their own loop body, each one goes to the next
+constexpr const char *JUMP_FAMILY = "1NNN";
+
+std::filesystem::path WriteProgram(const char *name, const std::vector<Opcode> &program) {
+  std::string file_name = std::string("chip-bench-") + name + ".ch8";
+  std::replace_if(file_name.begin(), file_name.end(), [](char c) { return c == '*' || c == '+'; },
+                  '_');
+
+  const auto location = std::filesystem::temp_directory_path() / file_name;
+
+  std::vector<Byte> bytes;
+  for (const Opcode opcode : program) {
+    bytes.push_back(opcode >> 8);
+    bytes.push_back(opcode & 0xFF);
+  }
+
+  std::FILE *file = std::fopen(location.c_str(), "wb");
+  if (file == nullptr) {
+    return {};
+  }
+  std::fwrite(bytes.data(), 1, bytes.size(), file);
+  std::fclose(file);
+
+  return location;
+}
+
+std::vector<Opcode> BuildProgram(const OpcodeFamily &family) {
+  std::vector<Opcode> program = {0xA000 | DATA_ADDRESS};
+
+  while (program.size() - 1 < LOOP_INSTRUCTIONS) {
+    program.insert(program.end(), family.body.begin(), family.body.end());
+  }
+  program.push_back(0x1000 | LOOP_START);
+
+  program.resize((SUBROUTINE_ADDRESS - ROM_START) / INSTRUCTION_SIZE);
+  program.push_back(0x00EE);
+
+  return program;
+}
+
+std::vector<Opcode> BuildJumpProgram() {
+  std::vector<Opcode> program = {0xA000 | DATA_ADDRESS};
+
+  for (size_t i = 0; i < LOOP_INSTRUCTIONS; ++i) {
+    const MemoryAddress next = LOOP_START + (i + 1) * INSTRUCTION_SIZE;
+    program.push_back(0x1000 | (i + 1 < LOOP_INSTRUCTIONS ? next : LOOP_START));
+  }
+
+  return program;
+}
+
+// Time per executed instruction as a counter, a rate counter divides by the
+// elapsed seconds and kInvert flips that. Shown as e.g. 16.2ns, stored in
+// the JSON in seconds.
+void SetTimePerOp(benchmark::State &state, uint64_t instructions) {
+  state.SetItemsProcessed(instructions);
+  state.counters["time_per_op"] = benchmark::Counter(
+      instructions, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+void RunInterpreter(benchmark::State &state, const std::string &rom_location,
+                    Chip8::ExecutionEngine engine) {
+  Chip8::Interpreter interpreter(rom_location.c_str());
+  interpreter.SetExecutionEngine(engine);
+
+  // Decode, compile and draw once outside the timed loop
+  interpreter.Execute(BATCH_INSTRUCTIONS);
+
+  for (auto _ : state) {
+    interpreter.Execute(BATCH_INSTRUCTIONS);
+  }
+
+  benchmark::DoNotOptimize(interpreter.GetFrameBuffer().GetWord(0, 0, 0));
+  SetTimePerOp(state, state.iterations() * BATCH_INSTRUCTIONS);
+}
+
+void RunLockstep(benchmark::State &state, const std::string &rom_location) {
+  Chip8::LockstepEngine engine(rom_location.c_str(), LOCKSTEP_LANES);
+  for (uint32_t lane = 0; lane < LOCKSTEP_LANES; ++lane) {
+    engine.SetRandomSeed(lane, DEFAULT_RANDOM_SEED + lane);
+  }
+
+  engine.Execute(BATCH_INSTRUCTIONS);
+
+  for (auto _ : state) {
+    engine.Execute(BATCH_INSTRUCTIONS);
+  }
+
+  benchmark::DoNotOptimize(engine.GetFrameBuffer(0).GetWord(0, 0, 0));
+  SetTimePerOp(state, state.iterations() * BATCH_INSTRUCTIONS * LOCKSTEP_LANES);
+}
+
+// LoadSprite cases by start position: byte aligned, unaligned, clipped at
+// the right or bottom edge, and coordinates past the edges that wrap
+struct SpritePosition {
+  const char *name;
+  Chip8::PixelPos x, y;
+};
+
+constexpr std::array<SpritePosition, 5> SPRITE_POSITIONS = {{
+    {"aligned", 8, 4},
+    {"unaligned", 13, 4},
+    {"clip_right", 60, 4},
+    {"clip_bottom", 8, 28},
+    {"wrapped", 8 + Chip8::LORES_WIDTH, 4 + Chip8::LORES_HEIGHT},
+}};
+
+void BM_LoadSprite(benchmark::State &state) {
+  const size_t height = state.range(0);
+  const SpritePosition &position = SPRITE_POSITIONS[state.range(1)];
+
+  std::array<Byte, Chip8::MAX_SPRITE_HEIGHT> sprite;
+  for (size_t row = 0; row < sprite.size(); ++row) {
+    sprite[row] = 0xA5 ^ (row * 0x11);
+  }
+
+  Chip8::FrameBuffer frame_buffer;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        frame_buffer.LoadSprite(position.x, position.y, std::span(sprite.data(), height)));
+  }
+
+  state.SetLabel(position.name);
+  SetTimePerOp(state, state.iterations());
+}
+BENCHMARK(BM_LoadSprite)
+    ->ArgNames({"height", "position"})
+    ->ArgsProduct({{1, 5, 8, 15}, benchmark::CreateDenseRange(0, SPRITE_POSITIONS.size() - 1, 1)});
+
+// Display::UpdateDisplayData without the GL calls: frames alternate between
+// two framebuffers that differ in the given number of rows
+void BM_UpdateDisplayData(benchmark::State &state) {
+  const size_t changed_rows = state.range(0);
+
+  std::array<Chip8::FrameBuffer, 2> frames;
+  const std::array<Byte, 1> sprite = {0x81};
+  for (size_t row = 0; row < changed_rows; ++row) {
+    frames[1].LoadSprite(row * 2, row, sprite);
+  }
+
+  Chip8::DisplayData display_data;
+  uint64_t frame = 0;
+  for (auto _ : state) {
+    display_data.Update(
+        frames[frame++ & 1], [](Chip8::PixelPos, Chip8::PixelPos) {},
+        [](Chip8::PixelPos, Chip8::PixelPos, const Byte *p) { benchmark::DoNotOptimize(p); });
+  }
+
+  SetTimePerOp(state, state.iterations());
+}
+BENCHMARK(BM_UpdateDisplayData)->ArgName("changed_rows")->Arg(0)->Arg(1)->Arg(8)->Arg(16)->Arg(32);
+
+// One scroll in each direction of a high resolution frame with every plane
+// selected, vertical scrolls are a memmove and horizontal ones word shifts
+void BM_Scroll(benchmark::State &state) {
+  Chip8::FrameBuffer frame_buffer;
+  frame_buffer.SetHighResolution(true);
+  frame_buffer.SetPlaneMask(0xF);
+
+  for (auto _ : state) {
+    frame_buffer.ScrollDown(1);
+    frame_buffer.ScrollRight(4);
+    frame_buffer.ScrollUp(1);
+    frame_buffer.ScrollLeft(4);
+    benchmark::DoNotOptimize(frame_buffer.GetWord(0, 0, 0));
+  }
+
+  SetTimePerOp(state, state.iterations() * 4);
+}
+BENCHMARK(BM_Scroll);
+
+struct EngineName {
+  const char *name;
+  Chip8::ExecutionEngine engine;
+};
+
+constexpr std::array<EngineName, 3> ENGINES = {{
+    {"interpreter", Chip8::ExecutionEngine::Interpreter},
+    {"threaded", Chip8::ExecutionEngine::Threaded},
+    {"jit", Chip8::ExecutionEngine::Jit},
+}};
+
+void RegisterOpcodeBenchmarks() {
+  for (const OpcodeFamily &family : OPCODE_FAMILIES) {
+    const std::string rom_location = WriteProgram(family.name, BuildProgram(family));
+
+    benchmark::RegisterBenchmark(
+        (std::string("BM_Opcode/") + family.name).c_str(),
+        [rom_location](benchmark::State &state) {
+          RunInterpreter(state, rom_location, Chip8::ExecutionEngine::Interpreter);
+        });
+  }
+
+  const std::string rom_location = WriteProgram(JUMP_FAMILY, BuildJumpProgram());
+  benchmark::RegisterBenchmark((std::string("BM_Opcode/") + JUMP_FAMILY).c_str(),
+                               [rom_location](benchmark::State &state) {
+                                 RunInterpreter(state, rom_location,
+                                                Chip8::ExecutionEngine::Interpreter);
+                               });
+}
+
+void RegisterRomBenchmarks(const char *rom_directory) {
+  namespace fs = std::filesystem;
+
+  std::vector<fs::path> roms;
+  std::error_code error;
+  for (const auto &entry : fs::directory_iterator(rom_directory, error)) {
+    if (entry.is_regular_file() && entry.path().extension() == ".ch8") {
+      roms.push_back(entry.path());
+    }
+  }
+  std::sort(roms.begin(), roms.end());
+
+  if (roms.empty()) {
+    std::fprintf(stderr, "No ROMs in %s, skipping the ROM benchmarks\n", rom_directory);
+  }
+
+  for (const fs::path &rom : roms) {
+    const std::string rom_location = rom.string();
+    const std::string rom_name = rom.stem().string();
+
+    for (const EngineName &engine : ENGINES) {
+      benchmark::RegisterBenchmark(
+          ("BM_Rom/" + rom_name + "/" + engine.name).c_str(),
+          [rom_location, engine](benchmark::State &state) {
+            RunInterpreter(state, rom_location, engine.engine);
+          });
+    }
+
+    benchmark::RegisterBenchmark(("BM_Rom/" + rom_name + "/lockstep").c_str(),
+                                 [rom_location](benchmark::State &state) {
+                                   RunLockstep(state, rom_location);
+                                 });
+  }
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  const char *rom_directory = CHIP8_BENCH_ROM_DIRECTORY;
+  bool has_output = false;
+
+  // Our own flags are taken out, the rest goes to Google Benchmark
+  std::vector<char *> arguments = {argv[0]};
+  for (int i = 1; i < argc; ++i) {
+    if (!std::strcmp(argv[i], "--roms") && i + 1 < argc) {
+      rom_directory = argv[++i];
+      continue;
+    }
+
+    has_output |= !std::strncmp(argv[i], "--benchmark_out=", std::strlen("--benchmark_out="));
+    arguments.push_back(argv[i]);
+  }
+
+  std::string output_flag = std::string("--benchmark_out=") + DEFAULT_REPORT;
+  std::string format_flag = "--benchmark_out_format=json";
+  if (!has_output) {
+    arguments.push_back(output_flag.data());
+    arguments.push_back(format_flag.data());
+  }
+
+  Chip8::Logger::Init();
+  Chip8::Logger::GetLogger()->set_level(spdlog::level::err);
+
+  RegisterOpcodeBenchmarks();
+  RegisterRomBenchmarks(rom_directory);
+
+  int argument_count = static_cast<int>(arguments.size());
+  benchmark::Initialize(&argument_count, arguments.data());
+  if (benchmark::ReportUnrecognizedArguments(argument_count, arguments.data())) {
+    return 1;
+  }
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+
+  Chip8::Logger::Shutdown();
+  return 0;
+}
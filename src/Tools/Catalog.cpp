@@ -0,0 +1,179 @@
+#include <cctype>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "Logging.h"
+#include "RomCatalog.h"
+
+// Builds and edits the ROM catalog of a directory, the index the frontend
+// and chip-headless --catalog read instead of scanning
+//
+//   chip-catalog scan <directory>
+//   chip-catalog list <directory>
+//   chip-catalog set <directory> <rom> [--quirks default|vip|schip|xochip]
+//                    [--ops-per-frame N] [--keys MAP]
+//   chip-catalog clear <directory> <rom>
+//
+// scan walks the directory and its subdirectories again, hashing only new
+// and changed files. set attaches settings to the ROM's content hash, so
+// they follow the ROM wherever it is; the ROM does not even need to be in
+// the directory. MAP is 16 characters, the host key for CHIP-8 keys 0 to F
+// with '.' keeping a key's default, e.g. ..W.A.D.S....... to play 2/4/6/8 on
+// WASD.
+
+static void PrintUsage(const char *program_name) {
+  std::fprintf(stderr,
+               "Usage: %s scan <directory>\n"
+               "       %s list <directory>\n"
+               "       %s set <directory> <rom> [--quirks default|vip|schip|xochip] "
+               "[--ops-per-frame N] [--keys MAP]\n"
+               "       %s clear <directory> <rom>\n",
+               program_name, program_name, program_name, program_name);
+}
+
+static bool ParseKeyMap(const char *text, Chip8::KeyMap &key_map) {
+  if (std::strlen(text) != key_map.size()) {
+    return false;
+  }
+
+  for (size_t key = 0; key < key_map.size(); ++key) {
+    const char c = std::toupper(static_cast<unsigned char>(text[key]));
+
+    if (c == '.') {
+      key_map[key] = 0;
+    } else if (std::isdigit(static_cast<unsigned char>(c)) || (c >= 'A' && c <= 'Z')) {
+      key_map[key] = c;
+    } else {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static void PrintMetadata(const Chip8::RomMetadata &metadata) {
+  if (metadata.quirk_profile) {
+    std::printf(" quirks=%s", Chip8::GetQuirkProfileName(*metadata.quirk_profile));
+  }
+  if (metadata.ops_per_frame > 0) {
+    std::printf(" ops-per-frame=%u", metadata.ops_per_frame);
+  }
+  if (metadata.key_map != Chip8::KeyMap{}) {
+    std::printf(" keys=");
+    for (const char key : metadata.key_map) {
+      std::putchar(key ? key : '.');
+    }
+  }
+}
+
+static int List(const Chip8::RomCatalog &catalog) {
+  for (const Chip8::RomEntry &entry : catalog.GetRoms()) {
+    std::printf("%016" PRIx64 " %s", entry.hash, entry.path.c_str());
+
+    if (const Chip8::RomMetadata *metadata = catalog.FindMetadata(entry.hash)) {
+      PrintMetadata(*metadata);
+    }
+    std::printf("\n");
+  }
+
+  if (catalog.IsStale()) {
+    std::fprintf(stderr, "Files were added or removed since the last scan\n");
+  }
+  return EXIT_SUCCESS;
+}
+
+// Sets or clears the metadata of the ROM in argv[3], options from argv[4]
+static int Set(Chip8::RomCatalog &catalog, int argc, char *argv[], bool clear) {
+  Chip8::RomImage rom;
+  if (!rom.Open(argv[3])) {
+    return EXIT_FAILURE;
+  }
+
+  const uint64_t hash = Chip8::HashRom(rom.GetData());
+
+  Chip8::RomMetadata metadata;
+  if (const Chip8::RomMetadata *existing = catalog.FindMetadata(hash)) {
+    metadata = *existing;
+  }
+
+  for (int i = 4; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+
+    if (!std::strcmp(argv[i], "--quirks") && has_value) {
+      Chip8::QuirkProfile quirk_profile;
+      if (!Chip8::ParseQuirkProfile(argv[++i], quirk_profile)) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      metadata.quirk_profile = quirk_profile;
+    } else if (!std::strcmp(argv[i], "--ops-per-frame") && has_value) {
+      const unsigned long ops_per_frame = std::strtoul(argv[++i], nullptr, 10);
+      if (ops_per_frame > UINT16_MAX) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      metadata.ops_per_frame = static_cast<uint16_t>(ops_per_frame);
+    } else if (!std::strcmp(argv[i], "--keys") && has_value) {
+      if (!ParseKeyMap(argv[++i], metadata.key_map)) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (clear) {
+    metadata = Chip8::RomMetadata{};
+  }
+
+  catalog.SetMetadata(hash, metadata);
+  if (!catalog.Save()) {
+    return EXIT_FAILURE;
+  }
+
+  std::printf("%016" PRIx64 " %s", hash, argv[3]);
+  PrintMetadata(metadata);
+  std::printf("\n");
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Chip8::Logger::Init();
+  Chip8::Logger::GetLogger()->set_level(spdlog::level::err);
+
+  const char *command = argv[1];
+  Chip8::RomCatalog catalog;
+  catalog.Open(argv[2]);
+
+  int result = EXIT_FAILURE;
+
+  if (!std::strcmp(command, "scan") && argc == 3) {
+    const size_t hashed = catalog.Scan();
+    if (catalog.Save()) {
+      std::printf("%zu ROMs in %s, %zu hashed\n", catalog.GetRoms().size(),
+                  catalog.GetIndexLocation().c_str(), hashed);
+      result = EXIT_SUCCESS;
+    }
+  } else if (!std::strcmp(command, "list") && argc == 3) {
+    result = List(catalog);
+  } else if (!std::strcmp(command, "set") && argc >= 4) {
+    result = Set(catalog, argc, argv, false);
+  } else if (!std::strcmp(command, "clear") && argc == 4) {
+    result = Set(catalog, argc, argv, true);
+  } else {
+    PrintUsage(argv[0]);
+  }
+
+  Chip8::Logger::Shutdown();
+  return result;
+}
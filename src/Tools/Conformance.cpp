@@ -0,0 +1,479 @@
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Interpreter.h"
+#include "Logging.h"
+
+// Runs the test ROMs headless with scripted input and checks the final
+// framebuffer against checked-in golden hashes, on every engine. Also
+// measures each run's speed and can fail on slowdowns against an earlier
+// report.
+//
+//   chip-conformance [GOLDEN] [--engines LIST] [--repeat N] [--report FILE]
+//                    [--baseline FILE [--tolerance PERCENT]] [--update]
+//                    [--dump] [--verbose]
+//
+// GOLDEN defaults to roms/conformance.txt, one ROM per line:
+//
+//   <rom> <cycles> <input> <framebuffer hash> [quirk profile]
+//
+// The ROM path is relative to the golden file. input is "-" or a comma
+// separated list of KEY@FRAME or KEY@FRAME+FRAMES, hex key held from that
+// emulated frame for 1 or FRAMES frames. Runs use 700 op/s and the default
+// seed, so frames are 700/60 instructions apart. The profile is a
+// chip-headless --quirks name, default if left out, and shows as
+// rom:profile in the output.
+//
+// --repeat runs each ROM N times and keeps the fastest, every repeat must
+// give the same frame. --report writes the results as CSV, --baseline reads
+// such a report back and fails any run more than --tolerance percent (10 by
+// default) slower than it was there. --update writes the interpreter's
+// hashes back into the golden file, and writes nothing if any run differs
+// between repeats. --dump prints every final frame.
+
+#ifndef CHIP8_CONFORMANCE_FILE
+#define CHIP8_CONFORMANCE_FILE "roms/conformance.txt"
+#endif
+
+constexpr unsigned int CONFORMANCE_OPS_PER_SECOND = 700;
+constexpr unsigned int DEFAULT_REPEAT = 3;
+constexpr double DEFAULT_TOLERANCE = 10.0;
+
+struct KeyPress {
+  Byte key;
+  uint64_t first_frame;
+  uint64_t frame_count;
+};
+
+struct ConformanceCase {
+  std::string rom;
+  uint64_t cycles = 0;
+  std::string input;
+  std::vector<KeyPress> key_presses;
+  uint64_t expected_hash = 0;
+  Chip8::QuirkProfile quirk_profile = Chip8::QuirkProfile::Default;
+
+  // The ROM, with the profile unless it is the default one
+  std::string label;
+
+  // Where the case sits in the golden file, for --update
+  size_t line = 0;
+};
+
+struct ConformanceResult {
+  std::string engine;
+  uint64_t hash = 0;
+  double ops_per_second = 0.0;
+  bool passed = false;
+  bool stable = true;
+  bool slower = false;
+  double baseline_ops_per_second = 0.0;
+};
+
+// Holds the scripted keys, changing only on the emulated 60 Hz ticks like a
+// movie does
+class ScriptedInput : public Chip8::InputSource {
+public:
+  explicit ScriptedInput(const std::vector<KeyPress> &key_presses) : m_KeyPresses(key_presses) {}
+
+  bool IsKeyPressed(Byte key) const override { return (m_Keys >> (key & 0xF)) & 1; }
+
+  void LatchFrame() override {
+    m_Keys = 0;
+    for (const KeyPress &press : m_KeyPresses) {
+      if (m_Frame >= press.first_frame && m_Frame < press.first_frame + press.frame_count) {
+        m_Keys |= 1 << press.key;
+      }
+    }
+    m_Frame++;
+  }
+
+private:
+  const std::vector<KeyPress> &m_KeyPresses;
+  uint16_t m_Keys = 0;
+  uint64_t m_Frame = 0;
+};
+
+static void PrintUsage(const char *program_name) {
+  std::fprintf(stderr,
+               "Usage: %s [GOLDEN] [--engines LIST] [--repeat N] [--report FILE] "
+               "[--baseline FILE [--tolerance PERCENT]] [--update] [--dump] [--verbose]\n",
+               program_name);
+}
+
+static bool ParseEngine(const std::string &name, Chip8::ExecutionEngine &engine) {
+  if (name == "interpreter") {
+    engine = Chip8::ExecutionEngine::Interpreter;
+  } else if (name == "threaded") {
+    engine = Chip8::ExecutionEngine::Threaded;
+  } else if (name == "jit") {
+    engine = Chip8::ExecutionEngine::Jit;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static const char *GetEngineName(Chip8::ExecutionEngine engine) {
+  switch (engine) {
+    case Chip8::ExecutionEngine::Threaded: return "threaded";
+    case Chip8::ExecutionEngine::Jit: return "jit";
+    default: return "interpreter";
+  }
+}
+
+static bool ParseInput(const std::string &input, std::vector<KeyPress> &key_presses) {
+  if (input == "-") {
+    return true;
+  }
+
+  std::stringstream stream(input);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    unsigned int key;
+    unsigned long long first_frame, frame_count = 1;
+
+    if (std::sscanf(item.c_str(), "%x@%llu+%llu", &key, &first_frame, &frame_count) < 2 ||
+        key > 0xF || frame_count == 0) {
+      return false;
+    }
+
+    key_presses.push_back({static_cast<Byte>(key), first_frame, frame_count});
+  }
+
+  return true;
+}
+
+static bool ReadGoldenFile(const std::string &location, std::vector<std::string> &lines,
+                           std::vector<ConformanceCase> &cases) {
+  std::ifstream file(location);
+  if (!file) {
+    std::fprintf(stderr, "Could not open %s\n", location.c_str());
+    return false;
+  }
+
+  for (std::string line; std::getline(file, line);) {
+    lines.push_back(line);
+
+    std::stringstream stream(line);
+    ConformanceCase test;
+    std::string hash;
+    std::string quirk_profile;
+
+    if (!(stream >> test.rom) || test.rom[0] == '#') {
+      continue;
+    }
+
+    if (!(stream >> test.cycles >> test.input >> hash) ||
+        !ParseInput(test.input, test.key_presses) ||
+        ((stream >> quirk_profile) &&
+         !Chip8::ParseQuirkProfile(quirk_profile.c_str(), test.quirk_profile))) {
+      std::fprintf(stderr,
+                   "%s:%zu: expected <rom> <cycles> <input> <framebuffer hash> [quirk profile]\n",
+                   location.c_str(), lines.size());
+      return false;
+    }
+
+    test.expected_hash = std::strtoull(hash.c_str(), nullptr, 16);
+    test.label = test.rom;
+    if (test.quirk_profile != Chip8::QuirkProfile::Default) {
+      test.label += ':';
+      test.label += Chip8::GetQuirkProfileName(test.quirk_profile);
+    }
+    test.line = lines.size() - 1;
+    cases.push_back(std::move(test));
+  }
+
+  return true;
+}
+
+// Reads ops/s per "rom engine" from a report written by --report
+static std::map<std::string, double> ReadBaseline(const char *location) {
+  std::map<std::string, double> baseline;
+
+  std::ifstream file(location);
+  if (!file) {
+    std::fprintf(stderr, "Could not open baseline %s\n", location);
+    return baseline;
+  }
+
+  std::string line;
+  std::getline(file, line);
+
+  while (std::getline(file, line)) {
+    std::vector<std::string> fields;
+    std::stringstream stream(line);
+    for (std::string field; std::getline(stream, field, ',');) {
+      fields.push_back(field);
+    }
+
+    // rom,engine,result,framebuffer,expected,ops_per_second
+    if (fields.size() >= 6) {
+      baseline[fields[0] + " " + fields[1]] = std::strtod(fields[5].c_str(), nullptr);
+    }
+  }
+
+  return baseline;
+}
+
+static void DumpFrame(const Chip8::FrameBuffer &frame_buffer) {
+  for (Chip8::PixelPos y = 0; y < frame_buffer.GetHeight(); ++y) {
+    char row[Chip8::HIRES_WIDTH + 1] = {};
+    for (Chip8::PixelPos x = 0; x < frame_buffer.GetWidth(); ++x) {
+      // Pixels set only in the first plane are '#', other colours their index
+      const Byte color = frame_buffer.GetColor(x, y);
+      row[x] = color == 0 ? '.' : color == 1 ? '#' : "0123456789ABCDEF"[color];
+    }
+    std::printf("  %s\n", row);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  std::string golden_location = CHIP8_CONFORMANCE_FILE;
+  std::vector<Chip8::ExecutionEngine> engines = {Chip8::ExecutionEngine::Interpreter,
+                                                 Chip8::ExecutionEngine::Threaded,
+                                                 Chip8::ExecutionEngine::Jit};
+  unsigned int repeat = DEFAULT_REPEAT;
+  const char *report_location = nullptr;
+  const char *baseline_location = nullptr;
+  double tolerance = DEFAULT_TOLERANCE;
+  bool update = false;
+  bool dump = false;
+  bool verbose = false;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+
+    if (!std::strcmp(argv[i], "--engines") && has_value) {
+      engines.clear();
+
+      std::stringstream stream(argv[++i]);
+      for (std::string name; std::getline(stream, name, ',');) {
+        Chip8::ExecutionEngine engine;
+        if (!ParseEngine(name, engine)) {
+          PrintUsage(argv[0]);
+          return EXIT_FAILURE;
+        }
+        engines.push_back(engine);
+      }
+    } else if (!std::strcmp(argv[i], "--repeat") && has_value) {
+      repeat = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+    } else if (!std::strcmp(argv[i], "--report") && has_value) {
+      report_location = argv[++i];
+    } else if (!std::strcmp(argv[i], "--baseline") && has_value) {
+      baseline_location = argv[++i];
+    } else if (!std::strcmp(argv[i], "--tolerance") && has_value) {
+      tolerance = std::strtod(argv[++i], nullptr);
+    } else if (!std::strcmp(argv[i], "--update")) {
+      update = true;
+    } else if (!std::strcmp(argv[i], "--dump")) {
+      dump = true;
+    } else if (!std::strcmp(argv[i], "--verbose")) {
+      verbose = true;
+    } else if (argv[i][0] != '-') {
+      golden_location = argv[i];
+    } else {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (engines.empty()) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // The golden hashes are the interpreter's, the other engines must match it
+  if (update && std::find(engines.begin(), engines.end(),
+                          Chip8::ExecutionEngine::Interpreter) == engines.end()) {
+    std::fprintf(stderr, "--update needs the interpreter in --engines\n");
+    return EXIT_FAILURE;
+  }
+
+  Chip8::Logger::Init();
+  if (!verbose) {
+    Chip8::Logger::GetLogger()->set_level(spdlog::level::err);
+  }
+
+  std::vector<std::string> lines;
+  std::vector<ConformanceCase> cases;
+  if (!ReadGoldenFile(golden_location, lines, cases)) {
+    return EXIT_FAILURE;
+  }
+
+  std::map<std::string, double> baseline;
+  if (baseline_location != nullptr) {
+    baseline = ReadBaseline(baseline_location);
+  }
+
+  const std::filesystem::path rom_directory =
+      std::filesystem::path(golden_location).parent_path();
+
+  std::vector<std::vector<ConformanceResult>> results(cases.size());
+  int failures = 0;
+
+  std::printf("%-22s %-12s %-6s %-16s %14s\n", "rom", "engine", "result", "framebuffer",
+              "ops/s");
+
+  for (size_t index = 0; index < cases.size(); ++index) {
+    const ConformanceCase &test = cases[index];
+    const std::string rom_location = (rom_directory / test.rom).string();
+
+    if (!std::filesystem::is_regular_file(rom_location)) {
+      std::fprintf(stderr, "Missing ROM %s\n", rom_location.c_str());
+      return EXIT_FAILURE;
+    }
+
+    for (const Chip8::ExecutionEngine requested_engine : engines) {
+      ConformanceResult result;
+      Chip8::ExecutionEngine engine = requested_engine;
+      double best_seconds = 0.0;
+
+      for (unsigned int run = 0; run < repeat; ++run) {
+        auto interpreter = std::make_unique<Chip8::Interpreter>(rom_location.c_str());
+        interpreter->SetInstructionsPerSecond(CONFORMANCE_OPS_PER_SECOND);
+        interpreter->SetInputSource(std::make_shared<ScriptedInput>(test.key_presses));
+        interpreter->SetExecutionEngine(requested_engine);
+        interpreter->SetQuirkProfile(test.quirk_profile);
+        engine = interpreter->GetExecutionEngine();
+
+        const auto start = std::chrono::steady_clock::now();
+        for (uint64_t cycle = 0; cycle < test.cycles;) {
+          cycle += interpreter->Execute(std::min<uint64_t>(test.cycles - cycle, UINT32_MAX));
+        }
+        const double seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        const uint64_t hash = interpreter->GetFrameBuffer().Hash();
+        result.stable &= run == 0 || hash == result.hash;
+        result.hash = hash;
+
+        if (run == 0 || seconds < best_seconds) {
+          best_seconds = seconds;
+        }
+
+        if (dump && run == 0 && engine == engines.front()) {
+          std::printf("%s:\n", test.label.c_str());
+          DumpFrame(interpreter->GetFrameBuffer());
+        }
+      }
+
+      // A fallback from the JIT would just repeat the interpreter
+      if (engine != requested_engine) {
+        std::fprintf(stderr, "%s is not available, skipped\n", GetEngineName(requested_engine));
+        continue;
+      }
+
+      result.engine = GetEngineName(engine);
+      result.ops_per_second = best_seconds > 0.0 ? test.cycles / best_seconds : 0.0;
+      result.passed = result.stable && result.hash == test.expected_hash;
+
+      const auto previous = baseline.find(test.label + " " + result.engine);
+      if (previous != baseline.end()) {
+        result.baseline_ops_per_second = previous->second;
+        result.slower =
+            result.ops_per_second < previous->second * (1.0 - tolerance / 100.0);
+      }
+
+      const char *verdict = !result.passed ? "FAIL" : (result.slower ? "SLOW" : "ok");
+      std::printf("%-22s %-12s %-6s %016" PRIx64 " %14.0f", test.label.c_str(),
+                  result.engine.c_str(), verdict, result.hash, result.ops_per_second);
+      if (result.baseline_ops_per_second > 0.0) {
+        std::printf(" (%+.1f%%)",
+                    100.0 * (result.ops_per_second / result.baseline_ops_per_second - 1.0));
+      }
+      if (!result.stable) {
+        std::printf(" differs between runs");
+      }
+      std::printf("\n");
+
+      failures += !result.passed || result.slower;
+      results[index].push_back(result);
+    }
+  }
+
+  if (report_location != nullptr) {
+    std::FILE *file = std::fopen(report_location, "w");
+    if (file == nullptr) {
+      std::fprintf(stderr, "Could not open %s\n", report_location);
+      return EXIT_FAILURE;
+    }
+
+    std::fprintf(file, "rom,engine,result,framebuffer,expected,ops_per_second\n");
+    for (size_t index = 0; index < cases.size(); ++index) {
+      for (const ConformanceResult &result : results[index]) {
+        std::fprintf(file, "%s,%s,%s,%016" PRIx64 ",%016" PRIx64 ",%.0f\n",
+                     cases[index].label.c_str(), result.engine.c_str(),
+                     result.passed ? "pass" : "fail", result.hash, cases[index].expected_hash,
+                     result.ops_per_second);
+      }
+    }
+    std::fclose(file);
+  }
+
+  if (update) {
+    // A frame that changes from run to run is no golden hash, whichever
+    // engine it came from
+    for (size_t index = 0; index < cases.size(); ++index) {
+      for (const ConformanceResult &result : results[index]) {
+        if (!result.stable) {
+          std::fprintf(stderr, "Not updating %s: %s on %s differs between runs\n",
+                       golden_location.c_str(), cases[index].label.c_str(),
+                       result.engine.c_str());
+          return EXIT_FAILURE;
+        }
+      }
+    }
+
+    const std::string interpreter_name = GetEngineName(Chip8::ExecutionEngine::Interpreter);
+
+    for (size_t index = 0; index < cases.size(); ++index) {
+      const ConformanceCase &test = cases[index];
+      const auto interpreted =
+          std::find_if(results[index].begin(), results[index].end(),
+                       [&](const ConformanceResult &result) {
+                         return result.engine == interpreter_name;
+                       });
+
+      char hash[17];
+      std::snprintf(hash, sizeof(hash), "%016" PRIx64, interpreted->hash);
+
+      char line[256];
+      std::snprintf(line, sizeof(line), "%-20s %9" PRIu64 " %-20s %s", test.rom.c_str(),
+                    test.cycles, test.input.c_str(), hash);
+      lines[test.line] = line;
+
+      if (test.quirk_profile != Chip8::QuirkProfile::Default) {
+        lines[test.line] += ' ';
+        lines[test.line] += Chip8::GetQuirkProfileName(test.quirk_profile);
+      }
+    }
+
+    std::ofstream file(golden_location);
+    for (const std::string &line : lines) {
+      file << line << '\n';
+    }
+    std::printf("Updated %s\n", golden_location.c_str());
+  }
+
+  Chip8::Logger::Shutdown();
+
+  if (failures > 0 && !update) {
+    std::printf("%d of %zu runs failed\n", failures, cases.size() * engines.size());
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,470 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+
+#include "HeadlessPlatform.h"
+#include "InputMovie.h"
+#include "Interpreter.h"
+#include "LockstepEngine.h"
+#include "Logging.h"
+#include "Profiler.h"
+#include "RomCatalog.h"
+#include "SaveState.h"
+#include "TraceRecorder.h"
+
+// Runs a ROM without a window as fast as the host allows, then prints the
+// throughput and a hash of the final frame.
+//
+//   chip-headless <rom> [--cycles N | --frames N] [--ops-per-second N]
+//                [--engine interpreter|threaded|jit] [--display-wait]
+//                [--quirks default|vip|schip|xochip] [--check-allocations]
+//                [--trace FILE [--trace-ring BLOCKS]]
+//                [--load-state FILE] [--save-state FILE] [--seed N]
+//                [--play-movie FILE] [--record-movie FILE] [--lanes N]
+//                [--profile FILE] [--catalog DIRECTORY] [--verbose]
+//
+// --load-state starts from a saved machine instead of a fresh one, and
+// --save-state writes the machine after the last cycle. --cycles counts from
+// the loaded state.
+//
+// --play-movie replays recorded input with the seed, CPU rate and quirks
+// stored in the movie and runs until it ends unless --cycles/--frames say
+// otherwise. --record-movie writes the input the run saw, so playing a movie
+// while recording one must give back the same file.
+//
+// --quirks picks the platform the opcodes behave like, see Quirks.h. The
+// default is this interpreter's historical behaviour.
+//
+// --catalog applies the quirk profile and speed chip-catalog stored for the
+// ROM in that directory's index. --quirks and --ops-per-second still win,
+// and so do the settings of a played movie.
+//
+// --profile writes how often each instruction type and address ran, and the
+// cycles spent waiting on keys and the delay timer, as CSV. It needs a build
+// with CHIP8_ENABLE_PROFILER and always interprets.
+//
+// --lanes runs N instances in lockstep on the SIMD engine instead, lane i
+// seeded with seed + i. Throughput counts the instructions of all lanes and
+// the framebuffer is lane 0's, which must match a plain run with the same
+// seed.
+//
+// --check-allocations fails the run if the interpreter allocates anything
+// after the first 10% of the cycles. ctest runs it on every ROM in roms/
+// with each engine.
+
+constexpr uint64_t DEFAULT_CYCLES = 10'000'000;
+constexpr unsigned int DEFAULT_OPS_PER_SECOND = 700;
+constexpr unsigned int FRAMES_PER_SECOND = 60;
+
+// Every allocation in the process goes through here so --check-allocations
+// can tell whether the step loop allocates. All the replaceable forms are
+// covered, the aligned ones included: MachineState is alignas(64).
+static std::atomic<uint64_t> s_AllocationCount = 0;
+
+static void *Allocate(std::size_t size, std::size_t alignment) noexcept {
+  s_AllocationCount.fetch_add(1, std::memory_order_relaxed);
+
+  if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+    return std::malloc(size ? size : 1);
+  }
+
+  // aligned_alloc wants the size to be a multiple of the alignment
+  return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+static void *AllocateOrThrow(std::size_t size, std::size_t alignment) {
+  if (void *pointer = Allocate(size, alignment)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size) {
+  return AllocateOrThrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void *operator new[](std::size_t size) {
+  return AllocateOrThrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  return AllocateOrThrow(size, static_cast<std::size_t>(alignment));
+}
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+  return AllocateOrThrow(size, static_cast<std::size_t>(alignment));
+}
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  return Allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return Allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+  return Allocate(size, static_cast<std::size_t>(alignment));
+}
+void *operator new[](std::size_t size, std::align_val_t alignment,
+                     const std::nothrow_t &) noexcept {
+  return Allocate(size, static_cast<std::size_t>(alignment));
+}
+
+// malloc and aligned_alloc both give memory back through free
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+void operator delete[](void *pointer) noexcept { std::free(pointer); }
+void operator delete(void *pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete[](void *pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete(void *pointer, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete[](void *pointer, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete(void *pointer, std::size_t, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete[](void *pointer, std::size_t, std::align_val_t) noexcept {
+  std::free(pointer);
+}
+void operator delete(void *pointer, const std::nothrow_t &) noexcept { std::free(pointer); }
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept { std::free(pointer); }
+void operator delete(void *pointer, std::align_val_t, const std::nothrow_t &) noexcept {
+  std::free(pointer);
+}
+void operator delete[](void *pointer, std::align_val_t, const std::nothrow_t &) noexcept {
+  std::free(pointer);
+}
+
+static void PrintUsage(const char *program_name) {
+  std::fprintf(stderr,
+               "Usage: %s <rom> [--cycles N | --frames N] [--ops-per-second N] "
+               "[--engine interpreter|threaded|jit] [--display-wait] "
+               "[--quirks default|vip|schip|xochip] [--check-allocations] "
+               "[--trace FILE [--trace-ring BLOCKS]] [--load-state FILE] [--save-state FILE] "
+               "[--seed N] [--play-movie FILE] [--record-movie FILE] [--lanes N] [--profile FILE] "
+               "[--catalog DIRECTORY] [--verbose]\n",
+               program_name);
+}
+
+static int RunLockstep(const char *rom_location, uint32_t lane_count, uint64_t cycles,
+                       unsigned int ops_per_second, uint64_t random_seed,
+                       Chip8::QuirkProfile quirk_profile) {
+  Chip8::LockstepEngine engine(rom_location, lane_count);
+  if (!engine.HasRom()) {
+    std::fprintf(stderr, "Could not load %s\n", rom_location);
+    return EXIT_FAILURE;
+  }
+
+  engine.SetInstructionsPerSecond(ops_per_second);
+  engine.SetQuirkProfile(quirk_profile);
+
+  for (uint32_t lane = 0; lane < lane_count; ++lane) {
+    engine.SetRandomSeed(lane, random_seed + lane);
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+
+  for (uint64_t cycle = 0; cycle < cycles;) {
+    cycle += engine.Execute(std::min<uint64_t>(cycles - cycle, UINT32_MAX));
+  }
+
+  const auto end = std::chrono::steady_clock::now();
+  const double seconds = std::chrono::duration<double>(end - start).count();
+
+  const Chip8::LockstepCounters &counters = engine.GetCounters();
+  const uint64_t lane_instructions = counters.vector_instructions + counters.scalar_instructions;
+
+  std::printf("rom: %s\n", rom_location);
+  std::printf("lanes: %u (%s kernels)\n", lane_count, engine.IsUsingAvx2() ? "AVX2" : "portable");
+  std::printf("cycles: %llu\n", static_cast<unsigned long long>(cycles));
+  std::printf("time: %.3f s\n", seconds);
+  std::printf("throughput: %.0f ops/s\n", seconds > 0.0 ? lane_instructions / seconds : 0.0);
+  std::printf("vectorized: %.1f%%\n",
+              lane_instructions ? 100.0 * counters.vector_instructions / lane_instructions : 0.0);
+  std::printf("framebuffer: %016llx\n",
+              static_cast<unsigned long long>(engine.GetFrameBuffer(0).Hash()));
+
+  Chip8::Logger::Shutdown();
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const char *rom_location = argv[1];
+
+  uint64_t cycles = 0;
+  uint64_t frames = 0;
+  unsigned int ops_per_second = DEFAULT_OPS_PER_SECOND;
+  bool verbose = false;
+  bool display_wait = false;
+  Chip8::QuirkProfile quirk_profile = Chip8::QuirkProfile::Default;
+  bool check_allocations = false;
+  const char *trace_location = nullptr;
+  size_t trace_ring_blocks = 0;
+  const char *load_state_location = nullptr;
+  const char *save_state_location = nullptr;
+  const char *play_movie_location = nullptr;
+  const char *record_movie_location = nullptr;
+  const char *profile_location = nullptr;
+  const char *catalog_location = nullptr;
+  bool ops_per_second_set = false;
+  bool quirk_profile_set = false;
+  uint64_t random_seed = DEFAULT_RANDOM_SEED;
+  uint32_t lanes = 0;
+  Chip8::ExecutionEngine engine = Chip8::ExecutionEngine::Interpreter;
+
+  for (int i = 2; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+
+    if (!std::strcmp(argv[i], "--cycles") && has_value) {
+      cycles = std::strtoull(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--frames") && has_value) {
+      frames = std::strtoull(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--ops-per-second") && has_value) {
+      ops_per_second = std::strtoul(argv[++i], nullptr, 10);
+      ops_per_second_set = true;
+    } else if (!std::strcmp(argv[i], "--engine") && has_value) {
+      const char *name = argv[++i];
+
+      if (!std::strcmp(name, "interpreter")) {
+        engine = Chip8::ExecutionEngine::Interpreter;
+      } else if (!std::strcmp(name, "threaded")) {
+        engine = Chip8::ExecutionEngine::Threaded;
+      } else if (!std::strcmp(name, "jit")) {
+        engine = Chip8::ExecutionEngine::Jit;
+      } else {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (!std::strcmp(argv[i], "--display-wait")) {
+      display_wait = true;
+    } else if (!std::strcmp(argv[i], "--quirks") && has_value) {
+      if (!Chip8::ParseQuirkProfile(argv[++i], quirk_profile)) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      quirk_profile_set = true;
+    } else if (!std::strcmp(argv[i], "--check-allocations")) {
+      check_allocations = true;
+    } else if (!std::strcmp(argv[i], "--trace") && has_value) {
+      trace_location = argv[++i];
+    } else if (!std::strcmp(argv[i], "--trace-ring") && has_value) {
+      trace_ring_blocks = std::strtoull(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--load-state") && has_value) {
+      load_state_location = argv[++i];
+    } else if (!std::strcmp(argv[i], "--save-state") && has_value) {
+      save_state_location = argv[++i];
+    } else if (!std::strcmp(argv[i], "--seed") && has_value) {
+      random_seed = std::strtoull(argv[++i], nullptr, 0);
+    } else if (!std::strcmp(argv[i], "--play-movie") && has_value) {
+      play_movie_location = argv[++i];
+    } else if (!std::strcmp(argv[i], "--record-movie") && has_value) {
+      record_movie_location = argv[++i];
+    } else if (!std::strcmp(argv[i], "--profile") && has_value) {
+      profile_location = argv[++i];
+    } else if (!std::strcmp(argv[i], "--catalog") && has_value) {
+      catalog_location = argv[++i];
+    } else if (!std::strcmp(argv[i], "--lanes") && has_value) {
+      lanes = std::strtoul(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--verbose")) {
+      verbose = true;
+    } else {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  Chip8::Logger::Init();
+  if (!verbose) {
+    Chip8::Logger::GetLogger()->set_level(spdlog::level::err);
+  }
+
+  if (catalog_location != nullptr) {
+    Chip8::RomCatalog catalog;
+    Chip8::RomImage rom;
+
+    if (catalog.Open(catalog_location) && rom.Open(rom_location)) {
+      if (const Chip8::RomMetadata *metadata =
+              catalog.FindMetadata(Chip8::HashRom(rom.GetData()))) {
+        if (metadata->quirk_profile && !quirk_profile_set) {
+          quirk_profile = *metadata->quirk_profile;
+        }
+        if (metadata->ops_per_frame > 0 && !ops_per_second_set) {
+          ops_per_second = metadata->ops_per_frame * FRAMES_PER_SECOND;
+        }
+      }
+    }
+  }
+
+  std::shared_ptr<Chip8::InputSource> input = std::make_shared<Chip8::NullInputSource>();
+
+  std::shared_ptr<Chip8::MoviePlayer> movie_player;
+  if (play_movie_location != nullptr) {
+    movie_player = std::make_shared<Chip8::MoviePlayer>();
+    if (!movie_player->Open(play_movie_location)) {
+      return EXIT_FAILURE;
+    }
+
+    const Chip8::MovieSettings &settings = movie_player->GetSettings();
+    random_seed = settings.random_seed;
+    ops_per_second = settings.instructions_per_second;
+    display_wait = settings.display_wait_quirk;
+    quirk_profile = settings.quirk_profile;
+    input = movie_player;
+
+    // Up to the tick that latched the last recorded frame
+    if (cycles == 0 && frames == 0) {
+      frames = movie_player->GetFrameCount();
+    }
+  }
+
+  if (ops_per_second == 0) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (frames > 0) {
+    cycles = frames * ops_per_second / FRAMES_PER_SECOND;
+  } else if (cycles == 0) {
+    cycles = DEFAULT_CYCLES;
+  }
+
+  if (lanes > 0) {
+    if (display_wait || trace_location || load_state_location || save_state_location ||
+        movie_player || record_movie_location || profile_location) {
+      std::fprintf(stderr,
+                   "--lanes does not support display wait, traces, states, movies or profiles\n");
+      return EXIT_FAILURE;
+    }
+
+    return RunLockstep(rom_location, lanes, cycles, ops_per_second, random_seed, quirk_profile);
+  }
+
+  Chip8::Interpreter interpreter(rom_location);
+  if (!interpreter.HasRom()) {
+    std::fprintf(stderr, "Could not load %s\n", rom_location);
+    return EXIT_FAILURE;
+  }
+
+  interpreter.SetRandomSeed(random_seed);
+
+  if (movie_player && movie_player->GetSettings().rom_hash != interpreter.HashMemory()) {
+    std::fprintf(stderr, "Movie was recorded with a different ROM\n");
+  }
+
+  std::shared_ptr<Chip8::MovieRecorder> movie_recorder;
+  if (record_movie_location != nullptr) {
+    movie_recorder = std::make_shared<Chip8::MovieRecorder>(
+        input, Chip8::MovieSettings{random_seed, interpreter.HashMemory(), ops_per_second,
+                                    display_wait, quirk_profile});
+    input = movie_recorder;
+  }
+
+  interpreter.SetInputSource(input);
+
+  if (load_state_location != nullptr) {
+    auto state = std::make_unique<Chip8::MachineState>();
+    auto extended = std::make_unique<Chip8::ExtendedMemory>();
+    if (!Chip8::ReadStateFile(load_state_location, *state, *extended)) {
+      return EXIT_FAILURE;
+    }
+
+    interpreter.LoadState(*state, extended.get());
+  }
+
+  interpreter.SetInstructionsPerSecond(ops_per_second);
+  interpreter.SetExecutionEngine(engine);
+  interpreter.SetDisplayWaitQuirk(display_wait);
+  interpreter.SetQuirkProfile(quirk_profile);
+
+  if (interpreter.GetExecutionEngine() != engine) {
+    std::fprintf(stderr, "Requested engine is not available, falling back to the interpreter\n");
+  }
+
+  std::shared_ptr<Chip8::TraceRecorder> trace_recorder;
+  if (trace_location != nullptr) {
+    trace_recorder = std::make_shared<Chip8::TraceRecorder>();
+    if (!trace_recorder->Open(trace_location, trace_ring_blocks)) {
+      return EXIT_FAILURE;
+    }
+
+    interpreter.SetTraceRecorder(trace_recorder);
+  }
+
+  std::shared_ptr<Chip8::Profiler> profiler;
+  if (profile_location != nullptr) {
+#if CHIP8_PROFILER_ENABLED
+    profiler = std::make_shared<Chip8::Profiler>();
+    interpreter.SetProfiler(profiler);
+#else
+    std::fprintf(stderr, "--profile needs a build with -DCHIP8_ENABLE_PROFILER=ON\n");
+    return EXIT_FAILURE;
+#endif
+  }
+
+  // Timers follow the cycle count, so the run is the same at any host speed
+  uint64_t cycle = 0;
+
+  // Decoding, block compilation and the first draws may allocate, after
+  // that the step loop must not
+  const uint64_t warmup_cycles = cycles / 10;
+
+  const auto start = std::chrono::steady_clock::now();
+
+  while (cycle < warmup_cycles) {
+    cycle += interpreter.Execute(std::min<uint64_t>(warmup_cycles - cycle, UINT32_MAX));
+  }
+
+  const uint64_t warmup_allocations = s_AllocationCount.load();
+
+  while (cycle < cycles) {
+    cycle += interpreter.Execute(std::min<uint64_t>(cycles - cycle, UINT32_MAX));
+  }
+
+  const uint64_t allocations_after_warmup = s_AllocationCount.load() - warmup_allocations;
+
+  if (trace_recorder) {
+    trace_recorder->Close();
+  }
+
+  const auto end = std::chrono::steady_clock::now();
+  const double seconds = std::chrono::duration<double>(end - start).count();
+
+  if (movie_recorder && !movie_recorder->Save(record_movie_location)) {
+    return EXIT_FAILURE;
+  }
+
+  if (profiler && !Chip8::WriteProfileFile(profile_location, profiler->GetCounters())) {
+    return EXIT_FAILURE;
+  }
+
+  if (save_state_location != nullptr) {
+    auto state = std::make_unique<Chip8::MachineState>();
+    interpreter.SaveState(*state);
+
+    if (!Chip8::WriteStateFile(save_state_location, *state, interpreter.GetExtendedMemory())) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::printf("rom: %s\n", rom_location);
+  std::printf("cycles: %llu\n", static_cast<unsigned long long>(cycles));
+  std::printf("time: %.3f s\n", seconds);
+  std::printf("throughput: %.0f ops/s\n", seconds > 0.0 ? cycles / seconds : 0.0);
+  std::printf("framebuffer: %016llx\n",
+              static_cast<unsigned long long>(interpreter.GetFrameBuffer().Hash()));
+
+  Chip8::Logger::Shutdown();
+
+  if (check_allocations) {
+    std::printf("allocations after warmup: %llu\n",
+                static_cast<unsigned long long>(allocations_after_warmup));
+
+    if (allocations_after_warmup > 0) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,241 @@
+#include <cctype>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+
+#include "Logging.h"
+#include "TraceRecorder.h"
+
+// Reads execution traces written by chip-headless --trace (or the debug menu)
+//
+//   chip-trace dump <trace> [--pc START-END] [--opcode PATTERN] [--limit N]
+//   chip-trace diff <trace-a> <trace-b> [--context N]
+//   chip-trace stats <trace>
+//
+// PATTERN is four characters where hex digits must match and anything else
+// is a wildcard, e.g. DXYN, 8XY4 or 00EE.
+
+constexpr unsigned int DEFAULT_DIFF_CONTEXT = 8;
+
+struct TraceFilter {
+  MemoryAddress pc_start = 0;
+  MemoryAddress pc_end = 0xFFFF;
+
+  Opcode opcode_mask = 0;
+  Opcode opcode_value = 0;
+
+  bool Matches(const Chip8::TraceRecord &record) const {
+    return record.program_counter >= pc_start && record.program_counter <= pc_end &&
+           (record.opcode & opcode_mask) == opcode_value;
+  }
+};
+
+static void PrintUsage(const char *program_name) {
+  std::fprintf(stderr,
+               "Usage: %s dump <trace> [--pc START-END] [--opcode PATTERN] [--limit N]\n"
+               "       %s diff <trace-a> <trace-b> [--context N]\n"
+               "       %s stats <trace>\n",
+               program_name, program_name, program_name);
+}
+
+static bool ParseOpcodePattern(const char *pattern, TraceFilter &filter) {
+  if (std::strlen(pattern) != 4) {
+    return false;
+  }
+
+  for (int i = 0; i < 4; ++i) {
+    const int shift = (3 - i) * 4;
+    const char c = pattern[i];
+
+    if (std::isxdigit(static_cast<unsigned char>(c))) {
+      const char digit[2] = {c, '\0'};
+      filter.opcode_mask |= 0xF << shift;
+      filter.opcode_value |= std::strtoul(digit, nullptr, 16) << shift;
+    }
+  }
+
+  return true;
+}
+
+static void PrintRecord(const char *prefix, const Chip8::TraceRecord &record) {
+  std::printf("%s%10" PRIu64 "  %03X  %04X  I=%03X", prefix, record.cycle, record.program_counter,
+              record.opcode, record.index_register);
+
+  if (record.changed_register != Chip8::TRACE_NO_REGISTER) {
+    std::printf("  V%X=%02X", record.changed_register, record.value);
+  }
+
+  std::printf("\n");
+}
+
+static bool SameRecord(const Chip8::TraceRecord &a, const Chip8::TraceRecord &b) {
+  return std::memcmp(&a, &b, sizeof(Chip8::TraceRecord)) == 0;
+}
+
+static int Dump(const char *trace_location, const TraceFilter &filter, uint64_t limit) {
+  Chip8::TraceReader reader;
+  if (!reader.Open(trace_location)) {
+    return EXIT_FAILURE;
+  }
+
+  Chip8::TraceRecord record;
+  uint64_t printed = 0;
+
+  while (printed < limit && reader.Next(record)) {
+    if (filter.Matches(record)) {
+      PrintRecord("", record);
+      printed++;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+static int Diff(const char *trace_a, const char *trace_b, unsigned int context) {
+  Chip8::TraceReader reader_a, reader_b;
+  if (!reader_a.Open(trace_a) || !reader_b.Open(trace_b)) {
+    return EXIT_FAILURE;
+  }
+
+  // The last few matching records, printed before the first difference
+  std::deque<Chip8::TraceRecord> history;
+  Chip8::TraceRecord a, b;
+  uint64_t index = 0;
+
+  while (true) {
+    const bool has_a = reader_a.Next(a);
+    const bool has_b = reader_b.Next(b);
+
+    if (!has_a && !has_b) {
+      std::printf("Traces are identical (%" PRIu64 " records)\n", index);
+      return EXIT_SUCCESS;
+    }
+
+    if (has_a && has_b && SameRecord(a, b)) {
+      history.push_back(a);
+      if (history.size() > context) {
+        history.pop_front();
+      }
+
+      index++;
+      continue;
+    }
+
+    std::printf("Traces diverge at record %" PRIu64 "\n", index);
+    for (const auto &record : history) {
+      PrintRecord("  ", record);
+    }
+
+    if (has_a) {
+      PrintRecord("< ", a);
+    } else {
+      std::printf("< (end of %s)\n", trace_a);
+    }
+
+    if (has_b) {
+      PrintRecord("> ", b);
+    } else {
+      std::printf("> (end of %s)\n", trace_b);
+    }
+
+    return EXIT_FAILURE;
+  }
+}
+
+static int Stats(const char *trace_location) {
+  Chip8::TraceReader reader;
+  if (!reader.Open(trace_location)) {
+    return EXIT_FAILURE;
+  }
+
+  Chip8::TraceRecord record;
+  uint64_t records = 0;
+  uint64_t first_cycle = 0, last_cycle = 0;
+
+  while (reader.Next(record)) {
+    if (records == 0) {
+      first_cycle = record.cycle;
+    }
+    last_cycle = record.cycle;
+    records++;
+  }
+
+  const uint64_t compressed = reader.GetCompressedSize();
+
+  std::printf("records: %" PRIu64 "\n", records);
+  std::printf("cycles: %" PRIu64 " - %" PRIu64 "\n", first_cycle, last_cycle);
+  std::printf("blocks: %" PRIu64 "\n", reader.GetBlockCount());
+  std::printf("size: %" PRIu64 " bytes (%.2f bytes/record, %.1fx smaller)\n", compressed,
+              records ? static_cast<double>(compressed) / records : 0.0,
+              compressed ? static_cast<double>(records * sizeof(Chip8::TraceRecord)) / compressed
+                         : 0.0);
+
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Chip8::Logger::Init();
+
+  const char *command = argv[1];
+  int result = EXIT_FAILURE;
+
+  if (!std::strcmp(command, "dump")) {
+    TraceFilter filter;
+    uint64_t limit = UINT64_MAX;
+
+    for (int i = 3; i < argc; ++i) {
+      const bool has_value = i + 1 < argc;
+
+      if (!std::strcmp(argv[i], "--pc") && has_value) {
+        unsigned int start = 0, end = 0;
+        if (std::sscanf(argv[++i], "%x-%x", &start, &end) != 2) {
+          PrintUsage(argv[0]);
+          return EXIT_FAILURE;
+        }
+        filter.pc_start = start;
+        filter.pc_end = end;
+      } else if (!std::strcmp(argv[i], "--opcode") && has_value) {
+        if (!ParseOpcodePattern(argv[++i], filter)) {
+          PrintUsage(argv[0]);
+          return EXIT_FAILURE;
+        }
+      } else if (!std::strcmp(argv[i], "--limit") && has_value) {
+        limit = std::strtoull(argv[++i], nullptr, 10);
+      } else {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    }
+
+    result = Dump(argv[2], filter, limit);
+  } else if (!std::strcmp(command, "diff") && argc >= 4) {
+    unsigned int context = DEFAULT_DIFF_CONTEXT;
+
+    for (int i = 4; i < argc; ++i) {
+      if (!std::strcmp(argv[i], "--context") && i + 1 < argc) {
+        context = std::strtoul(argv[++i], nullptr, 10);
+      } else {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    }
+
+    result = Diff(argv[2], argv[3], context);
+  } else if (!std::strcmp(command, "stats")) {
+    result = Stats(argv[2]);
+  } else {
+    PrintUsage(argv[0]);
+  }
+
+  Chip8::Logger::Shutdown();
+
+  return result;
+}
@@ -0,0 +1,407 @@
+#include "TraceRecorder.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include "Logging.h"
+
+#define CHIP8_LOG_SUBSYSTEM CORE
+
+namespace Chip8 {
+
+// File layout, all integers little-endian:
+//
+//   header: "C8TRACE\0", u32 version, u32 record size, u32 records per block
+//   blocks: u32 record count, u32 payload size, payload
+//
+// The first record of a block is stored whole. Every following one is XORed
+// with a prediction from the previous record (next cycle, next instruction,
+// everything else unchanged), and stored as a 16-bit mask of the nonzero
+// bytes followed by those bytes. Straight-line code usually only differs in
+// the opcode, so a record takes 3-6 bytes instead of 16.
+constexpr char TRACE_MAGIC[8] = {'C', '8', 'T', 'R', 'A', 'C', 'E', '\0'};
+constexpr uint32_t TRACE_VERSION = 1;
+
+constexpr size_t TRACE_RECORD_SIZE = sizeof(TraceRecord);
+constexpr size_t TRACE_BLOCK_HEADER_SIZE = 2 * sizeof(uint32_t);
+constexpr size_t MAX_BLOCK_PAYLOAD_SIZE =
+    TRACE_RECORD_SIZE + (TRACE_RECORDS_PER_BLOCK - 1) * (sizeof(uint16_t) + TRACE_RECORD_SIZE);
+// Packing a word stores all 8 bytes and keeps the nonzero ones, so the last
+// one can spill past the payload
+constexpr size_t BLOCK_PACKING_SLACK = sizeof(uint64_t);
+
+// The bits of the cycle a TraceSample carries
+constexpr uint64_t TRACE_SAMPLE_CYCLE_MASK = (1ull << 48) - 1;
+
+static_assert(TRACE_RECORD_SIZE == 16, "the byte mask is 16 bits wide");
+static_assert(std::endian::native == std::endian::little, "traces are stored little-endian");
+
+namespace {
+
+void PutU32(Byte *out, uint32_t value) {
+  for (int i = 0; i < 4; ++i) {
+    out[i] = (value >> (i * 8)) & 0xFF;
+  }
+}
+
+uint32_t GetU32(const Byte *in) {
+  return in[0] | (in[1] << 8) | (in[2] << 16) | (static_cast<uint32_t>(in[3]) << 24);
+}
+
+struct BytePacking {
+  // Indices of the nonzero bytes, in order
+  std::array<Byte, 8> order;
+  Byte count;
+};
+
+// How to pack the nonzero bytes of a word, for every mask of them. Packing
+// through the table takes no branch, the number of bytes that changed is too
+// random to predict.
+constexpr std::array<BytePacking, 256> BYTE_PACKING = [] {
+  std::array<BytePacking, 256> packing{};
+  for (unsigned int mask = 0; mask < 256; ++mask) {
+    for (Byte byte = 0; byte < 8; ++byte) {
+      if (mask & (1 << byte)) {
+        packing[mask].order[packing[mask].count++] = byte;
+      }
+    }
+  }
+  return packing;
+}();
+
+// One bit per nonzero byte of word. The top bit of every byte is set if any
+// of its bits is, then the multiply gathers the eight top bits into the top
+// byte.
+unsigned int NonzeroBytes(uint64_t word) {
+  constexpr uint64_t LOW_BITS = 0x7F7F7F7F7F7F7F7Full;
+  const uint64_t top_bits = (((word & LOW_BITS) + LOW_BITS) | word) & ~LOW_BITS;
+  return (top_bits * 0x0002040810204081ull) >> 56;
+}
+
+// A record is two little-endian words, so it is stored as is and the
+// prediction error is found with two XORs
+void RecordToWords(const TraceRecord &record, uint64_t *words) {
+  std::memcpy(words, &record, TRACE_RECORD_SIZE);
+}
+
+// The next record is expected one cycle and one instruction later with
+// everything else unchanged. The cycle is the first word and the program
+// counter the low 16 bits of the second.
+void PredictWords(const uint64_t *previous, uint64_t *words) {
+  words[0] = previous[0] + 1;
+  words[1] = (previous[1] & ~0xFFFFull) | ((previous[1] + 2) & 0xFFFF);
+}
+
+}  // namespace
+
+TraceRecorder::~TraceRecorder() { this->Close(); }
+
+bool TraceRecorder::Open(const char *trace_location, size_t ring_blocks) {
+  this->Close();
+
+  m_File = std::fopen(trace_location, "wb");
+  if (m_File == nullptr) {
+    LOG_ERROR("Could not open trace file {}", trace_location);
+    return false;
+  }
+
+  Byte header[sizeof(TRACE_MAGIC) + 3 * sizeof(uint32_t)];
+  std::memcpy(header, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  PutU32(header + 8, TRACE_VERSION);
+  PutU32(header + 12, TRACE_RECORD_SIZE);
+  PutU32(header + 16, TRACE_RECORDS_PER_BLOCK);
+  std::fwrite(header, 1, sizeof(header), m_File);
+
+  // Everything is allocated here so recording itself never allocates
+  m_BlockPool.resize(TRACE_BLOCK_POOL_SIZE * TRACE_RECORDS_PER_BLOCK);
+  for (uint32_t i = 1; i < TRACE_BLOCK_POOL_SIZE; ++i) {
+    m_FreeBlocks.Push(i);
+  }
+
+  m_BlockIndex = 0;
+  m_Block = m_BlockPool.data();
+  m_BlockSize = 0;
+
+  m_LastCycle = 0;
+
+  m_Ring.resize(ring_blocks > 0 ? ring_blocks : 1);
+  for (auto &block : m_Ring) {
+    block.reserve(TRACE_BLOCK_HEADER_SIZE + MAX_BLOCK_PAYLOAD_SIZE + BLOCK_PACKING_SLACK);
+  }
+  m_RingNext = 0;
+  m_RingUsed = 0;
+
+  m_FilledCount.store(0);
+  m_Closing.store(false);
+  m_Writer = std::thread(&TraceRecorder::WriterMain, this);
+
+  LOG_INFO("Recording trace to {}", trace_location);
+
+  return true;
+}
+
+void TraceRecorder::Close() {
+  if (m_File == nullptr) {
+    return;
+  }
+
+  if (m_BlockSize > 0) {
+    this->SubmitBlock();
+  }
+
+  m_Closing.store(true);
+  m_FilledCount.fetch_add(1);
+  m_FilledCount.notify_one();
+  m_Writer.join();
+
+  // Ring mode writes the kept blocks oldest first
+  if (m_Ring.size() > 1) {
+    const size_t oldest = (m_RingNext + m_Ring.size() - m_RingUsed) % m_Ring.size();
+    for (size_t i = 0; i < m_RingUsed; ++i) {
+      const auto &block = m_Ring[(oldest + i) % m_Ring.size()];
+      std::fwrite(block.data(), 1, block.size(), m_File);
+    }
+  }
+
+  std::fclose(m_File);
+  m_File = nullptr;
+
+  // Leaves the queues empty for the next Open
+  uint32_t index;
+  while (m_FreeBlocks.Pop(index)) {
+  }
+}
+
+void TraceRecorder::SubmitBlock() {
+  m_BlockSizes[m_BlockIndex] = m_BlockSize;
+  m_FilledBlocks.Push(m_BlockIndex);
+  m_FilledCount.fetch_add(1, std::memory_order_release);
+  m_FilledCount.notify_one();
+
+  // Only waits when the writer is a whole pool of blocks behind
+  while (!m_FreeBlocks.Pop(m_BlockIndex)) {
+    std::this_thread::yield();
+  }
+
+  m_Block = m_BlockPool.data() + m_BlockIndex * TRACE_RECORDS_PER_BLOCK;
+  m_BlockSize = 0;
+}
+
+void TraceRecorder::WriterMain() {
+  while (true) {
+    m_FilledCount.wait(0, std::memory_order_acquire);
+
+    // Read before draining, so every block submitted before Close is seen
+    const bool closing = m_Closing.load();
+
+    uint32_t index;
+    while (m_FilledBlocks.Pop(index)) {
+      const TraceSample *samples = m_BlockPool.data() + index * TRACE_RECORDS_PER_BLOCK;
+      std::vector<Byte> &block = m_Ring[m_RingNext];
+      this->CompressBlock(samples, m_BlockSizes[index], block);
+
+      m_FreeBlocks.Push(index);
+      m_FilledCount.fetch_sub(1, std::memory_order_relaxed);
+
+      if (m_Ring.size() == 1) {
+        std::fwrite(block.data(), 1, block.size(), m_File);
+      } else {
+        m_RingNext = (m_RingNext + 1) % m_Ring.size();
+        m_RingUsed = std::min(m_RingUsed + 1, m_Ring.size());
+      }
+    }
+
+    if (closing) {
+      return;
+    }
+  }
+}
+
+TraceRecord TraceRecorder::DecodeSample(const TraceSample &sample) {
+  // The top 16 bits of the cycle come from the previous record, carried over
+  // when the low 48 wrap around
+  uint64_t cycle = (m_LastCycle & ~TRACE_SAMPLE_CYCLE_MASK) |
+                   static_cast<uint64_t>(sample.cycle_high) << 32 | sample.cycle_low;
+  if (cycle < m_LastCycle && m_LastCycle - cycle > TRACE_SAMPLE_CYCLE_MASK / 2) {
+    cycle += TRACE_SAMPLE_CYCLE_MASK + 1;
+  }
+  m_LastCycle = cycle;
+
+  // Comparing Vx and VF catches every single-register write, FX65 only
+  // reports Vx. Selects rather than branches, which one changes is close to
+  // random.
+  const Byte x = (sample.opcode >> 8) & 0xF;
+  const bool x_changed = sample.x_after != sample.x_before;
+  const bool flag_changed = sample.flag_after != sample.flag_before;
+
+  return {cycle,
+          sample.program_counter,
+          sample.opcode,
+          sample.index_register,
+          x_changed ? x : (flag_changed ? Byte(0xF) : TRACE_NO_REGISTER),
+          x_changed ? sample.x_after : sample.flag_after};
+}
+
+void TraceRecorder::CompressBlock(const TraceSample *samples, uint32_t sample_count,
+                                  std::vector<Byte> &block) {
+  block.resize(TRACE_BLOCK_HEADER_SIZE + MAX_BLOCK_PAYLOAD_SIZE + BLOCK_PACKING_SLACK);
+
+  Byte *out = block.data() + TRACE_BLOCK_HEADER_SIZE;
+
+  uint64_t previous[2];
+  RecordToWords(this->DecodeSample(samples[0]), previous);
+  std::memcpy(out, previous, TRACE_RECORD_SIZE);
+  out += TRACE_RECORD_SIZE;
+
+  for (uint32_t i = 1; i < sample_count; ++i) {
+    uint64_t actual[2], predicted[2];
+    RecordToWords(this->DecodeSample(samples[i]), actual);
+    PredictWords(previous, predicted);
+    previous[0] = actual[0];
+    previous[1] = actual[1];
+
+    Byte *mask = out;
+    out += sizeof(uint16_t);
+
+    uint16_t nonzero = 0;
+    for (int word = 0; word < 2; ++word) {
+      const uint64_t delta = actual[word] ^ predicted[word];
+      // Mostly the cycle, which is nearly always as predicted
+      if (delta == 0) {
+        continue;
+      }
+
+      Byte bytes[sizeof(uint64_t)];
+      std::memcpy(bytes, &delta, sizeof(bytes));
+
+      const unsigned int changed = NonzeroBytes(delta);
+      const BytePacking &packing = BYTE_PACKING[changed];
+      for (size_t byte = 0; byte < sizeof(bytes); ++byte) {
+        out[byte] = bytes[packing.order[byte]];
+      }
+      out += packing.count;
+      nonzero |= changed << (word * 8);
+    }
+    mask[0] = nonzero & 0xFF;
+    mask[1] = nonzero >> 8;
+  }
+
+  const size_t payload_size = out - (block.data() + TRACE_BLOCK_HEADER_SIZE);
+  PutU32(block.data(), sample_count);
+  PutU32(block.data() + 4, payload_size);
+  block.resize(TRACE_BLOCK_HEADER_SIZE + payload_size);
+}
+
+TraceReader::~TraceReader() {
+  if (m_File != nullptr) {
+    std::fclose(m_File);
+  }
+}
+
+bool TraceReader::Open(const char *trace_location) {
+  m_File = std::fopen(trace_location, "rb");
+  if (m_File == nullptr) {
+    LOG_ERROR("Could not open trace file {}", trace_location);
+    return false;
+  }
+
+  Byte header[sizeof(TRACE_MAGIC) + 3 * sizeof(uint32_t)];
+  if (std::fread(header, 1, sizeof(header), m_File) != sizeof(header) ||
+      std::memcmp(header, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+    LOG_ERROR("{} is not a trace file", trace_location);
+    return false;
+  }
+
+  if (GetU32(header + 8) != TRACE_VERSION || GetU32(header + 12) != TRACE_RECORD_SIZE ||
+      GetU32(header + 16) != TRACE_RECORDS_PER_BLOCK) {
+    LOG_ERROR("{} was written by an incompatible version (format {})", trace_location,
+              GetU32(header + 8));
+    return false;
+  }
+
+  m_Compressed.reserve(MAX_BLOCK_PAYLOAD_SIZE);
+  m_Block.resize(TRACE_RECORDS_PER_BLOCK);
+
+  return true;
+}
+
+bool TraceReader::Next(TraceRecord &record) {
+  if (m_BlockPosition == m_BlockSize && !this->ReadBlock()) {
+    return false;
+  }
+
+  record = m_Block[m_BlockPosition++];
+
+  return true;
+}
+
+bool TraceReader::ReadBlock() {
+  if (m_File == nullptr) {
+    return false;
+  }
+
+  Byte block_header[TRACE_BLOCK_HEADER_SIZE];
+  if (std::fread(block_header, 1, sizeof(block_header), m_File) != sizeof(block_header)) {
+    return false;
+  }
+
+  const uint32_t record_count = GetU32(block_header);
+  const uint32_t payload_size = GetU32(block_header + 4);
+  if (record_count == 0 || record_count > TRACE_RECORDS_PER_BLOCK ||
+      payload_size > MAX_BLOCK_PAYLOAD_SIZE || payload_size < TRACE_RECORD_SIZE) {
+    LOG_ERROR("Corrupt trace block {}", m_BlockCount);
+    return false;
+  }
+
+  m_Compressed.resize(payload_size);
+  if (std::fread(m_Compressed.data(), 1, payload_size, m_File) != payload_size) {
+    LOG_ERROR("Trace ends in the middle of block {}", m_BlockCount);
+    return false;
+  }
+
+  const Byte *in = m_Compressed.data();
+  const Byte *const end = in + payload_size;
+
+  std::memcpy(&m_Block[0], in, TRACE_RECORD_SIZE);
+  in += TRACE_RECORD_SIZE;
+
+  for (uint32_t i = 1; i < record_count; ++i) {
+    if (end - in < 2) {
+      LOG_ERROR("Corrupt trace block {}", m_BlockCount);
+      return false;
+    }
+
+    const uint16_t nonzero = in[0] | (in[1] << 8);
+    in += sizeof(uint16_t);
+
+    uint64_t previous[2], predicted[2];
+    RecordToWords(m_Block[i - 1], previous);
+    PredictWords(previous, predicted);
+
+    Byte bytes[TRACE_RECORD_SIZE];
+    std::memcpy(bytes, predicted, TRACE_RECORD_SIZE);
+
+    for (size_t byte = 0; byte < TRACE_RECORD_SIZE; ++byte) {
+      if (nonzero & (1 << byte)) {
+        if (in == end) {
+          LOG_ERROR("Corrupt trace block {}", m_BlockCount);
+          return false;
+        }
+        bytes[byte] ^= *in++;
+      }
+    }
+
+    std::memcpy(&m_Block[i], bytes, TRACE_RECORD_SIZE);
+  }
+
+  m_BlockSize = record_count;
+  m_BlockPosition = 0;
+
+  m_BlockCount++;
+  m_CompressedSize += TRACE_BLOCK_HEADER_SIZE + payload_size;
+
+  return true;
+}
+
+}  // namespace Chip8
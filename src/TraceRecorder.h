@@ -0,0 +1,146 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "SPSCQueue.h"
+
+using MemoryAddress = uint16_t;
+using Opcode = uint16_t;
+using Byte = uint8_t;
+
+namespace Chip8 {
+
+// Marks a record where no register changed
+constexpr Byte TRACE_NO_REGISTER = 0xFF;
+
+// One executed instruction. The on-disk format stores these little-endian,
+// field by field in this order.
+struct TraceRecord {
+  uint64_t cycle;
+  MemoryAddress program_counter;
+  Opcode opcode;
+  MemoryAddress index_register;
+  // The register the instruction changed (Vx, else VF) and its new value,
+  // value is meaningless when changed_register is TRACE_NO_REGISTER
+  Byte changed_register;
+  Byte value;
+};
+static_assert(sizeof(TraceRecord) == 16 && std::is_trivially_copyable_v<TraceRecord>);
+
+// What the recording thread appends for every executed instruction: the
+// machine state around it, taken as is. The writer thread works out which
+// register changed and turns it into a TraceRecord. x is the second nibble
+// of the opcode. Only the low 48 bits of the cycle are kept, the writer
+// carries the rest over from the previous record.
+struct TraceSample {
+  uint32_t cycle_low;
+  uint16_t cycle_high;
+  MemoryAddress program_counter;
+  Opcode opcode;
+  MemoryAddress index_register;
+  Byte x_before, x_after;
+  Byte flag_before, flag_after;
+};
+static_assert(sizeof(TraceSample) == 16 && std::is_trivially_copyable_v<TraceSample>);
+
+// Records are compressed in blocks, each block decodes on its own
+constexpr uint32_t TRACE_RECORDS_PER_BLOCK = 4096;
+
+// Raw blocks cycling between the recording thread and the writer thread
+constexpr uint32_t TRACE_BLOCK_POOL_SIZE = 16;
+
+// Writes executed instructions to a compact binary trace file, see
+// TraceRecorder.cpp for the format. Recording only appends a raw sample to a
+// block; full blocks are turned into records, compressed and written on a
+// background thread. In streaming mode every block goes to the file; in ring
+// mode only the last ring_blocks blocks are kept in memory and written on
+// Close, for capturing what led up to a bug without an ever-growing file.
+class TraceRecorder {
+public:
+  TraceRecorder() = default;
+  ~TraceRecorder();
+
+  bool Open(const char *trace_location, size_t ring_blocks = 0);
+  void Close();
+
+  bool IsOpen() const { return m_File != nullptr; }
+
+  void Record(const TraceSample &sample) {
+    m_Block[m_BlockSize] = sample;
+
+    if (++m_BlockSize == TRACE_RECORDS_PER_BLOCK) {
+      this->SubmitBlock();
+    }
+  }
+
+private:
+  // Recording thread: hands the current block to the writer, takes a free one
+  void SubmitBlock();
+
+  // Writer thread
+  void WriterMain();
+  TraceRecord DecodeSample(const TraceSample &sample);
+  void CompressBlock(const TraceSample *samples, uint32_t sample_count, std::vector<Byte> &out);
+
+private:
+  std::FILE *m_File = nullptr;
+
+  std::vector<TraceSample> m_BlockPool;
+  std::array<uint32_t, TRACE_BLOCK_POOL_SIZE> m_BlockSizes{};
+  SPSCQueue<uint32_t, TRACE_BLOCK_POOL_SIZE> m_FilledBlocks;
+  SPSCQueue<uint32_t, TRACE_BLOCK_POOL_SIZE> m_FreeBlocks;
+  std::atomic<uint32_t> m_FilledCount = 0;
+
+  TraceSample *m_Block = nullptr;
+  uint32_t m_BlockIndex = 0;
+  uint32_t m_BlockSize = 0;
+
+  std::atomic<bool> m_Closing = false;
+  std::thread m_Writer;
+
+  // Cycle of the last record written, owned by the writer
+  uint64_t m_LastCycle = 0;
+
+  // Compressed blocks, owned by the writer. Only the first one is used when
+  // streaming.
+  std::vector<std::vector<Byte>> m_Ring;
+  size_t m_RingNext = 0;
+  size_t m_RingUsed = 0;
+};
+
+// Reads a trace written by TraceRecorder one record at a time
+class TraceReader {
+public:
+  TraceReader() = default;
+  ~TraceReader();
+
+  bool Open(const char *trace_location);
+
+  // Returns false at the end of the trace or if it is corrupt
+  bool Next(TraceRecord &record);
+
+  uint64_t GetBlockCount() const { return m_BlockCount; }
+  uint64_t GetCompressedSize() const { return m_CompressedSize; }
+
+private:
+  bool ReadBlock();
+
+private:
+  std::FILE *m_File = nullptr;
+
+  std::vector<Byte> m_Compressed;
+  std::vector<TraceRecord> m_Block;
+  uint32_t m_BlockSize = 0;
+  uint32_t m_BlockPosition = 0;
+
+  uint64_t m_BlockCount = 0;
+  uint64_t m_CompressedSize = 0;
+};
+
+}  // namespace Chip8
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace Chip8 {
+
+// Lock-free handoff of the latest value from one writer thread to one reader
+// thread. Each side owns one of the three buffers and the third is swapped
+// through an atomic index, so neither side ever waits for the other. The
+// reader always sees the most recently published value; older ones that were
+// never read are overwritten.
+template <typename T>
+class TripleBuffer {
+public:
+  // Writer side
+  T &GetWriteBuffer() { return m_Buffers[m_WriteIndex]; }
+
+  void Publish() {
+    const uint8_t previous =
+        m_Shared.exchange(m_WriteIndex | FRESH_BIT, std::memory_order_acq_rel);
+    m_WriteIndex = previous & INDEX_MASK;
+  }
+
+  // Reader side, returns true if something new was published since the last
+  // call. GetReadBuffer stays valid until the next Acquire.
+  bool Acquire() {
+    if (!(m_Shared.load(std::memory_order_relaxed) & FRESH_BIT)) {
+      return false;
+    }
+
+    const uint8_t previous = m_Shared.exchange(m_ReadIndex, std::memory_order_acq_rel);
+    m_ReadIndex = previous & INDEX_MASK;
+
+    return true;
+  }
+
+  T &GetReadBuffer() { return m_Buffers[m_ReadIndex]; }
+
+private:
+  static constexpr uint8_t INDEX_MASK = 0x3;
+  static constexpr uint8_t FRESH_BIT = 0x4;
+
+  std::array<T, 3> m_Buffers{};
+
+  alignas(64) std::atomic<uint8_t> m_Shared{1};
+  alignas(64) uint8_t m_WriteIndex = 0;
+  alignas(64) uint8_t m_ReadIndex = 2;
+};
+
+}  // namespace Chip8
@@ -0,0 +1,101 @@
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "Logging.h"
+
+#define CHIP8_LOG_SUBSYSTEM CORE
+
+namespace Chip8 {
+
+static void PinCurrentThread(unsigned int worker) {
+#if defined(__linux__)
+  const unsigned int cpu_count = std::max(std::thread::hardware_concurrency(), 1u);
+
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(worker % cpu_count, &cpus);
+
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+    LOG_WARN("Could not pin worker {} to CPU {}", worker, worker % cpu_count);
+  }
+#else
+  LOG_WARN("Thread pinning is not supported on this platform");
+#endif
+}
+
+WorkStealingPool::WorkStealingPool(unsigned int thread_count, bool pin_threads)
+    : m_ThreadCount(thread_count ? thread_count
+                                 : std::max(std::thread::hardware_concurrency(), 1u)),
+      m_PinThreads(pin_threads),
+      m_Queues(new WorkerQueue[m_ThreadCount]) {}
+
+void WorkStealingPool::Run(size_t job_count,
+                           const std::function<void(size_t index, unsigned int worker)> &job) {
+  for (size_t index = 0; index < job_count; ++index) {
+    m_Queues[index % m_ThreadCount].jobs.push_back(index);
+  }
+
+  auto worker_main = [&](unsigned int worker) {
+    if (m_PinThreads) {
+      PinCurrentThread(worker);
+    }
+
+    // Nothing is added once running, so an empty sweep means all jobs are
+    // taken
+    size_t index;
+    while (this->PopOwn(worker, index) || this->Steal(worker, index)) {
+      job(index, worker);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(m_ThreadCount - 1);
+  for (unsigned int worker = 1; worker < m_ThreadCount; ++worker) {
+    threads.emplace_back(worker_main, worker);
+  }
+
+  // The calling thread is worker 0
+  worker_main(0);
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+bool WorkStealingPool::PopOwn(unsigned int worker, size_t &index) {
+  WorkerQueue &queue = m_Queues[worker];
+  std::lock_guard lock(queue.mutex);
+
+  if (queue.jobs.empty()) {
+    return false;
+  }
+
+  index = queue.jobs.front();
+  queue.jobs.pop_front();
+  return true;
+}
+
+bool WorkStealingPool::Steal(unsigned int worker, size_t &index) {
+  for (unsigned int offset = 1; offset < m_ThreadCount; ++offset) {
+    WorkerQueue &victim = m_Queues[(worker + offset) % m_ThreadCount];
+    std::lock_guard lock(victim.mutex);
+
+    if (!victim.jobs.empty()) {
+      index = victim.jobs.back();
+      victim.jobs.pop_back();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+}  // namespace Chip8
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace Chip8 {
+
+// Runs a fixed set of independent jobs on a pool of threads. Jobs are dealt
+// out round-robin up front; a worker takes from the front of its own queue
+// and, once that is empty, steals from the back of the others. Meant for
+// coarse jobs (whole emulator runs), so a mutex per queue is plenty.
+class WorkStealingPool {
+public:
+  // thread_count 0 uses every hardware thread. With pin_threads, worker i is
+  // bound to CPU i modulo the CPU count where the platform allows it.
+  explicit WorkStealingPool(unsigned int thread_count = 0, bool pin_threads = false);
+
+  unsigned int GetThreadCount() const { return m_ThreadCount; }
+
+  // Calls job(index, worker) for every index in [0, job_count) and returns
+  // once all of them finished
+  void Run(size_t job_count, const std::function<void(size_t index, unsigned int worker)> &job);
+
+private:
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<size_t> jobs;
+  };
+
+  bool PopOwn(unsigned int worker, size_t &index);
+  bool Steal(unsigned int worker, size_t &index);
+
+private:
+  unsigned int m_ThreadCount;
+  bool m_PinThreads;
+
+  std::unique_ptr<WorkerQueue[]> m_Queues;
+};
+
+}  // namespace Chip8
@@ -0,0 +1,103 @@
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+#include "Interpreter.h"
+#include "Logging.h"
+#include "SaveState.h"
+
+// Saves a state, breaks its timer schedule the way a hand-edited or corrupt
+// file could, loads it back through the file and checks the machine still
+// steps and ticks its timers at a sane rate. A schedule that never catches
+// up hangs instead, which ctest reports through the test's timeout.
+//
+//   load-state-test <rom> <scratch state file>
+
+constexpr unsigned int STEP_CYCLES = 100000;
+
+struct BrokenState {
+  const char *name;
+  void (*apply)(Chip8::MachineState &state);
+};
+
+static const BrokenState s_BrokenStates[] = {
+    {"zero rate", [](Chip8::MachineState &state) { state.instructions_per_second = 0; }},
+    {"rate out of range",
+     [](Chip8::MachineState &state) { state.instructions_per_second = UINT32_MAX; }},
+    {"next tick far behind the cycles",
+     [](Chip8::MachineState &state) {
+       state.cycles = 1ull << 40;
+       state.timer_base_cycle = 0;
+       state.timer_ticks = 0;
+       state.next_timer_cycle = 0;
+     }},
+    {"next tick far ahead of the cycles",
+     [](Chip8::MachineState &state) { state.next_timer_cycle = UINT64_MAX; }},
+    {"tick count that overflows the schedule",
+     [](Chip8::MachineState &state) { state.timer_ticks = UINT64_MAX / 2; }},
+};
+
+static bool CheckBrokenState(const char *rom_location, const char *state_location,
+                             const BrokenState &broken) {
+  auto interpreter = std::make_unique<Chip8::Interpreter>(rom_location);
+  interpreter->Execute(STEP_CYCLES);
+
+  auto state = std::make_unique<Chip8::MachineState>();
+  auto extended = std::make_unique<Chip8::ExtendedMemory>();
+  interpreter->SaveState(*state, extended.get());
+  broken.apply(*state);
+
+  if (!Chip8::WriteStateFile(state_location, *state, extended.get()) ||
+      !Chip8::ReadStateFile(state_location, *state, *extended)) {
+    std::fprintf(stderr, "%s: could not round-trip %s\n", broken.name, state_location);
+    return false;
+  }
+
+  interpreter->LoadState(*state, extended.get());
+
+  const unsigned int rate = interpreter->GetInstructionsPerSecond();
+  if (rate == 0 || rate > MAX_INSTRUCTIONS_PER_SECOND) {
+    std::fprintf(stderr, "%s: loaded a rate of %u op/s\n", broken.name, rate);
+    return false;
+  }
+
+  // The timers tick once every rate / 60 cycles, give or take the one in
+  // progress
+  interpreter->SaveState(*state);
+  const uint64_t ticks_before = state->timer_ticks;
+  interpreter->Execute(STEP_CYCLES);
+  interpreter->SaveState(*state);
+
+  const uint64_t ticks = state->timer_ticks - ticks_before;
+  const uint64_t expected = uint64_t(STEP_CYCLES) * TIMER_FREQUENCY / rate;
+  if (ticks > expected + 1 || ticks + 1 < expected) {
+    std::fprintf(stderr, "%s: %" PRIu64 " timer ticks in %u cycles, expected %" PRIu64 "\n",
+                 broken.name, ticks, STEP_CYCLES, expected);
+    return false;
+  }
+
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    std::fprintf(stderr, "Usage: %s <rom> <scratch state file>\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Chip8::Logger::Init();
+  Chip8::Logger::GetLogger()->set_level(spdlog::level::err);
+
+  bool passed = true;
+  for (const BrokenState &broken : s_BrokenStates) {
+    const bool state_passed = CheckBrokenState(argv[1], argv[2], broken);
+    std::printf("%-40s %s\n", broken.name, state_passed ? "ok" : "FAIL");
+    passed = passed && state_passed;
+  }
+
+  std::remove(argv[2]);
+  Chip8::Logger::Shutdown();
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}